@@ -0,0 +1,211 @@
+#include "fasttools2d.h"
+
+#include <string.h>
+
+namespace fasttools2d {
+
+//The sums only read their inputs, but take them as double*.
+static inline double* In(Input p){
+    return const_cast<double*>(p.data);
+}
+
+static void CheckKernel(int kernel){
+    if(kernel != SLP_KERNEL && kernel != DLP_KERNEL)
+        throw std::invalid_argument("kernel must be SLP_KERNEL or DLP_KERNEL.");
+}
+
+static void CheckPoints(int kernel, int Nsrc, Input f, Input n){
+    if(f.n != Nsrc)
+        throw std::invalid_argument("psrc and f must be the same size.");
+    if(kernel == DLP_KERNEL && n.n != Nsrc)
+        throw std::invalid_argument("psrc and n must be the same size.");
+}
+
+static void CheckGrid(int nside_x, int nside_y){
+    if(nside_x < 1 || nside_y < 1)
+        throw std::invalid_argument("The grid must have at least one box.");
+}
+
+//The quantity with an output, RS_NUM_QUANTITIES if there are several.
+static int OutputQuantity(double** output){
+    int single = RS_NUM_QUANTITIES, nq = 0;
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+        if(output[q] != NULL) {
+            single = q;
+            nq++;
+        }
+    return (nq == 1) ? single : RS_NUM_QUANTITIES;
+}
+
+void RealSpaceSum(int kernel, Points psrc, Points ptar, Input f, Input n,
+        const Box& box, const RealSpaceSettings& settings, double** output,
+        double** skipped, RealSpaceStats* stats){
+
+    CheckKernel(kernel);
+    CheckPoints(kernel, psrc.n, f, n);
+    CheckGrid(settings.nside_x, settings.nside_y);
+
+    RealSpaceOptions opt;
+    opt.precision = ChoosePrecision(settings.tol, kernel,
+            OutputQuantity(output));
+    opt.excl = settings.excl;
+    opt.skipped = skipped;
+    opt.max_memory = settings.max_memory;
+    opt.near_field = settings.near_field;
+
+    if(kernel == SLP_KERNEL)
+        StokesSLPRealSpaceEx(&psrc.p, &ptar.p, In(f), psrc.n, ptar.n,
+                settings.xi, settings.nside_x, settings.nside_y, box.Lx,
+                box.Ly, &opt, output, stats);
+    else
+        StokesDLPRealSpaceEx(&psrc.p, &ptar.p, In(f), In(n), psrc.n,
+                ptar.n, settings.xi, settings.nside_x, settings.nside_y,
+                box.Lx, box.Ly, &opt, output, stats);
+}
+
+void StokesletVelocity(Input psrc, Input ptar, Input f, const Box& box,
+        const RealSpaceSettings& settings, Output u, RealSpaceStats* stats){
+
+    if(u.n != ptar.n)
+        throw std::invalid_argument("ptar and u must be the same size.");
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u.data;
+    RealSpaceSum(SLP_KERNEL, psrc, ptar, f, Input(), box, settings, output,
+            NULL, stats);
+}
+
+void StressletVelocity(Input psrc, Input ptar, Input f, Input n,
+        const Box& box, const RealSpaceSettings& settings, Output u,
+        RealSpaceStats* stats){
+
+    if(u.n != ptar.n)
+        throw std::invalid_argument("ptar and u must be the same size.");
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u.data;
+    RealSpaceSum(DLP_KERNEL, psrc, ptar, f, n, box, settings, output, NULL,
+            stats);
+}
+
+RealSpacePlan::RealSpacePlan(int kernel, Input psrc, Input ptar, Input n,
+        const Box& box, const RealSpaceSettings& settings)
+    : kernel_(kernel), Nsrc_(psrc.n), Ntar_(ptar.n), box_(box),
+      xi_(settings.xi), nside_x_(settings.nside_x),
+      nside_y_(settings.nside_y),
+      precision_(ChoosePrecision(settings.tol, kernel, RS_VELOCITY)),
+      n_(NULL), rebuilds_(0) {
+
+    CheckKernel(kernel);
+    CheckPoints(kernel, psrc.n, psrc, n);
+    CheckGrid(nside_x_, nside_y_);
+
+    if(kernel == DLP_KERNEL) {
+        n_ = new double[2*Nsrc_+1];
+        memcpy(n_, n.data, 2*Nsrc_*sizeof(double));
+    }
+
+    Build(psrc.data, ptar.data);
+}
+
+RealSpacePlan::~RealSpacePlan(){
+    FreeNearField(&nf_);
+    delete[] n_;
+}
+
+//The density values are filled in by each evaluation, so the near field
+//is built with zeros and kept on the heap, as for an EwaldPlan.
+void RealSpacePlan::Build(const double* psrc, const double* ptar){
+
+    int ndens = (kernel_ == SLP_KERNEL) ? 2 : 4;
+    double* dens = new double[ndens*Nsrc_+1];
+    memset(dens, 0, ndens*Nsrc_*sizeof(double));
+
+    BuildNearField(const_cast<double*>(psrc), const_cast<double*>(ptar),
+            dens, ndens, Nsrc_, Ntar_, nside_x_, nside_y_, box_.Lx, box_.Ly,
+            1, &nf_);
+
+    delete[] dens;
+}
+
+void RealSpacePlan::Execute(Input f, Output u, RealSpaceStats* stats){
+
+    if(f.n != Nsrc_ || u.n != Ntar_)
+        throw std::invalid_argument("The density and the output do not match the plan.");
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u.data;
+    RealSpaceSumNearField(kernel_, &nf_, In(f), n_, Nsrc_, Ntar_, xi_,
+            precision_, output, stats);
+}
+
+bool RealSpacePlan::Move(Input psrc, Input ptar, Input n){
+
+    if(psrc.n != Nsrc_ || ptar.n != Ntar_ ||
+            (kernel_ == DLP_KERNEL && n.n != Nsrc_))
+        throw std::invalid_argument("The points do not match the plan.");
+
+    if(kernel_ == DLP_KERNEL)
+        memcpy(n_, n.data, 2*Nsrc_*sizeof(double));
+
+    if(MoveNearField(&nf_, psrc.data, ptar.data, Nsrc_, Ntar_, nside_x_,
+            nside_y_, box_.Lx, box_.Ly))
+        return true;
+
+    FreeNearField(&nf_);
+    Build(psrc.data, ptar.data);
+    rebuilds_++;
+    return false;
+}
+
+RealSpaceMatrix::RealSpaceMatrix(int kernel, Input psrc, Input ptar,
+        Input n, const Box& box, double xi, int nside_x, int nside_y,
+        double max_memory){
+
+    CheckKernel(kernel);
+    CheckPoints(kernel, psrc.n, psrc, n);
+    CheckGrid(nside_x, nside_y);
+
+    if(kernel == SLP_KERNEL)
+        StokesSLPRealSpaceOperator(In(psrc), In(ptar), psrc.n, ptar.n, xi,
+                nside_x, nside_y, box.Lx, box.Ly, max_memory, &op_);
+    else
+        StokesDLPRealSpaceOperator(In(psrc), In(ptar), In(n), psrc.n,
+                ptar.n, xi, nside_x, nside_y, box.Lx, box.Ly, max_memory,
+                &op_);
+}
+
+RealSpaceMatrix::~RealSpaceMatrix(){
+    FreeRealSpaceOperator(&op_);
+}
+
+void RealSpaceMatrix::Apply(Input f, Output u) const {
+
+    if(!assembled())
+        throw std::invalid_argument("The operator has not been assembled.");
+    if(f.n != op_.num_sources || u.n != op_.num_targets)
+        throw std::invalid_argument("The density and the output do not match the operator.");
+
+    ApplyRealSpaceOperator(&op_, f.data, u.data);
+}
+
+double DensityNorm(Input f){
+
+    double Q = 1;
+    for(int k = 0;k<2*f.n;k++)
+        Q += f.data[k]*f.data[k];
+    return Q;
+}
+
+EwaldParameters ChooseParameters(int kernel, int derivatives, Input f,
+        int Ntar, double Nb, int P, const Box& box, double tol){
+
+    CheckKernel(kernel);
+
+    EwaldParameters par;
+    ChooseEwaldParameters(kernel, derivatives, DensityNorm(f), f.n+Ntar,
+            Nb, P, box.Lx, box.Ly, tol, &par);
+    return par;
+}
+
+}
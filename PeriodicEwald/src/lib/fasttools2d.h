@@ -0,0 +1,180 @@
+#ifndef FASTTOOLS2D
+#define FASTTOOLS2D
+
+#include "real_space.h"
+#include "ewald_parameters.h"
+
+#include <stdexcept>
+
+/*------------------------------------------------------------------------
+ *C++ interface of the parts of the spectral Ewald sums that do not depend
+ *on Matlab, built as the library fasttools2d without it: the real-space
+ *sums of the Stokeslet and the stresslet, plans that keep the near field
+ *over many densities, the precomputed real-space operators and the
+ *parameters of the error estimates. The Fourier-space sums transform the
+ *grids with Matlab's fft2 and stay in the mex files, but the spreading and
+ *gathering of ewald_tools.h are part of the library too.
+ *
+ *Points, densities and normals are views of 2 x n arrays stored column by
+ *column (x1,y1,x2,y2,...), as Matlab stores them, so the mex files and a
+ *C++ solver pass their own memory without copying. The results are
+ *written to buffers owned by the caller. Invalid arguments are thrown as
+ *std::invalid_argument.
+ *------------------------------------------------------------------------
+ */
+namespace fasttools2d {
+
+//A view of n columns of two values.
+template <typename T>
+struct Columns {
+    T* data;
+    int n;
+
+    Columns() : data(NULL), n(0) {}
+    Columns(T* data, int n) : data(data), n(n) {}
+};
+
+typedef Columns<const double> Input;
+typedef Columns<double> Output;
+
+//A view of n points read in place, see PointSet: an Input of 2 x n values,
+//which converts to it, or separate x and y arrays such as the vectors of
+//a Matlab cell {x, y}.
+struct Points {
+    PointSet p;
+    int n;
+
+    Points(Input in) : p(InterleavedPoints(in.data)), n(in.n) {}
+    Points(const PointSet& p, int n) : p(p), n(n) {}
+};
+
+//The periodic box [-Lx/2,Lx/2) x [-Ly/2,Ly/2).
+struct Box {
+    double Lx;
+    double Ly;
+};
+
+/*------------------------------------------------------------------------
+ *Settings of a real-space sum. xi is the Ewald parameter and the cutoff is
+ *the box size of the nside_x x nside_y grid. The pairs of the stresslet
+ *velocity are evaluated in mixed precision if tol is at least
+ *RS_MIXED_PRECISION_TOL, see ChoosePrecision(). max_memory,
+ *if positive, bounds the working memory by summing the targets in
+ *chunks, excl, if not NULL, lists pairs to leave out, and near_field
+ *forces the structure of the near field, see RealSpaceOptions.
+ *------------------------------------------------------------------------
+ */
+struct RealSpaceSettings {
+    double xi;
+    int nside_x;
+    int nside_y;
+    double tol;
+    double max_memory;
+    const ExclusionList* excl;
+    int near_field;
+
+    RealSpaceSettings(double xi, int nside_x, int nside_y, double tol = 0)
+        : xi(xi), nside_x(nside_x), nside_y(nside_y), tol(tol),
+          max_memory(0), excl(NULL), near_field(NF_AUTO) {}
+};
+
+/*------------------------------------------------------------------------
+ *The real-space quantities of the Stokeslet (SLP_KERNEL, n is empty) or
+ *the stresslet (DLP_KERNEL). Quantity q is evaluated if output[q] is not
+ *NULL, in which case it must hold QuantityComponents(q) x ptar.n values.
+ *skipped, if not NULL, receives the excluded contributions in the same
+ *layout. stats may be NULL. The real-space mex files are built on it.
+ *------------------------------------------------------------------------
+ */
+void RealSpaceSum(int kernel, Points psrc, Points ptar, Input f, Input n,
+        const Box& box, const RealSpaceSettings& settings, double** output,
+        double** skipped = NULL, RealSpaceStats* stats = NULL);
+
+//The real-space velocity of the Stokeslet, u is 2 x ptar.n.
+void StokesletVelocity(Input psrc, Input ptar, Input f, const Box& box,
+        const RealSpaceSettings& settings, Output u,
+        RealSpaceStats* stats = NULL);
+
+//The real-space velocity of the stresslet, u is 2 x ptar.n.
+void StressletVelocity(Input psrc, Input ptar, Input f, Input n,
+        const Box& box, const RealSpaceSettings& settings, Output u,
+        RealSpaceStats* stats = NULL);
+
+/*------------------------------------------------------------------------
+ *A plan of the real-space velocity for fixed points and new densities,
+ *e.g. the iterations of a solver. The points are binned and the near
+ *field built once, and each Execute() only sums the pairs. Move() takes
+ *new positions, which keep the near field if every point stays in its
+ *box and rebuild it otherwise. The settings tol is used for the
+ *precision, while max_memory and excl are not.
+ *------------------------------------------------------------------------
+ */
+class RealSpacePlan {
+public:
+    RealSpacePlan(int kernel, Input psrc, Input ptar, Input n,
+            const Box& box, const RealSpaceSettings& settings);
+    ~RealSpacePlan();
+
+    void Execute(Input f, Output u, RealSpaceStats* stats = NULL);
+
+    //Returns true if the near field was kept.
+    bool Move(Input psrc, Input ptar, Input n = Input());
+
+    int rebuilds() const { return rebuilds_; }
+
+private:
+    RealSpacePlan(const RealSpacePlan&);
+    RealSpacePlan& operator=(const RealSpacePlan&);
+
+    void Build(const double* psrc, const double* ptar);
+
+    int kernel_;
+    int Nsrc_;
+    int Ntar_;
+    Box box_;
+    double xi_;
+    int nside_x_;
+    int nside_y_;
+    int precision_;
+    double* n_;
+    NearField nf_;
+    int rebuilds_;
+};
+
+/*------------------------------------------------------------------------
+ *The real-space velocity assembled as a block-sparse operator, see
+ *RealSpaceOperator. If it would take more than max_memory bytes it is not
+ *assembled, and assembled() is false.
+ *------------------------------------------------------------------------
+ */
+class RealSpaceMatrix {
+public:
+    RealSpaceMatrix(int kernel, Input psrc, Input ptar, Input n,
+            const Box& box, double xi, int nside_x, int nside_y,
+            double max_memory = RS_OPERATOR_MAX_MEMORY);
+    ~RealSpaceMatrix();
+
+    bool assembled() const { return op_.blocks != NULL; }
+    double memory() const { return op_.memory; }
+    const RealSpaceOperator& op() const { return op_; }
+
+    void Apply(Input f, Output u) const;
+
+private:
+    RealSpaceMatrix(const RealSpaceMatrix&);
+    RealSpaceMatrix& operator=(const RealSpaceMatrix&);
+
+    RealSpaceOperator op_;
+};
+
+//The sum of the squared densities plus one, the Q of the error estimates.
+double DensityNorm(Input f);
+
+//The parameters for ptar.n targets and the sources of f, as
+//ChooseEwaldParameters() chooses them.
+EwaldParameters ChooseParameters(int kernel, int derivatives, Input f,
+        int Ntar, double Nb, int P, const Box& box, double tol);
+
+}
+
+#endif
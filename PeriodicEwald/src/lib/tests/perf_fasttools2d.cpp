@@ -0,0 +1,124 @@
+#include "fasttools2d.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <random>
+#include <vector>
+
+/*------------------------------------------------------------------------
+ *Performance test of the library. For N sources and N targets (the
+ *argument, default 200000) in the unit box it times the real-space
+ *velocity of both kernels, evaluated anew in double (and in mixed
+ *precision for the stresslet, the only one that uses it), from a plan and
+ *from an assembled operator, and the choice of parameters. The grid has
+ *about 24*log2(2N) points per box, as in the Ewald sums, and xi is chosen for
+ *tol = 1e-10. The best of three runs is reported, with the rate of
+ *accepted pairs, and the time per pair of the stresslet velocity relative
+ *to the Stokeslet.
+ *------------------------------------------------------------------------
+ */
+
+using namespace fasttools2d;
+
+template <typename Function>
+static double BestTime(Function run){
+    double best = 1e300;
+    for(int it = 0;it<3;it++) {
+        double start = omp_get_wtime();
+        run();
+        best = fmin(best, omp_get_wtime() - start);
+    }
+    return best;
+}
+
+static void Report(const char* what, double time, double pairs){
+    if(pairs > 0)
+        printf("%-28s %10.4f s  %8.1f Mpairs/s\n", what, time, pairs/time/1e6);
+    else
+        printf("%-28s %10.4f s\n", what, time);
+}
+
+int main(int argc, char** argv){
+
+    int N = (argc > 1) ? atoi(argv[1]) : 200000;
+    double tol = 1e-10;
+    Box box = {1, 1};
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> U(-0.5, 0.5);
+    std::vector<double> psrc(2*N), ptar(2*N), f(2*N), n(2*N);
+    for(int i = 0;i<2*N;i++) {
+        psrc[i] = U(rng);
+        ptar[i] = U(rng);
+        f[i] = U(rng);
+    }
+    for(int i = 0;i<N;i++) {
+        double t = 2*M_PI*(U(rng)+0.5);
+        n[2*i] = cos(t);
+        n[2*i+1] = sin(t);
+    }
+    std::vector<double> u(2*N);
+
+    Input src(psrc.data(), N), tar(ptar.data(), N), dens(f.data(), N);
+    Input normals(n.data(), N);
+    Output out(u.data(), N);
+
+    EwaldParameters par;
+    double time = BestTime([&](){
+        par = ChooseParameters(SLP_KERNEL, 0, dens, N, 24*log2(2.0*N), 0,
+                box, tol);
+    });
+    printf("N = %d, %d threads, %d x %d boxes, xi = %.3f\n", N,
+            omp_get_max_threads(), par.nside_x, par.nside_y, par.xi);
+    Report("parameters", time, 0);
+
+    RealSpaceSettings settings(par.xi, par.nside_x, par.nside_y, tol);
+    double per_pair[2];
+    for(int kernel = SLP_KERNEL;kernel<=DLP_KERNEL;kernel++) {
+        const char* name = (kernel == SLP_KERNEL) ? "SLP" : "DLP";
+        Input nin = (kernel == DLP_KERNEL) ? normals : Input();
+        char what[64];
+
+        RealSpaceStats stats;
+        double* output[RS_NUM_QUANTITIES] = {NULL};
+        output[RS_VELOCITY] = u.data();
+        time = BestTime([&](){
+            RealSpaceSum(kernel, src, tar, dens, nin, box, settings, output,
+                    NULL, &stats);
+        });
+        snprintf(what, 64, "%s velocity", name);
+        Report(what, time, stats.accepted_pairs);
+        per_pair[kernel-SLP_KERNEL] = time/stats.accepted_pairs;
+
+        if(kernel == DLP_KERNEL) {
+            RealSpaceSettings mixed = settings;
+            mixed.tol = RS_MIXED_PRECISION_TOL;
+            double mixed_time = BestTime([&](){
+                RealSpaceSum(kernel, src, tar, dens, nin, box, mixed, output,
+                        NULL, &stats);
+            });
+            snprintf(what, 64, "%s velocity, mixed (%.2fx)", name,
+                    time/mixed_time);
+            Report(what, mixed_time, stats.accepted_pairs);
+        }
+
+        RealSpacePlan plan(kernel, src, tar, nin, box, settings);
+        time = BestTime([&](){ plan.Execute(dens, out); });
+        snprintf(what, 64, "%s velocity from a plan", name);
+        Report(what, time, stats.accepted_pairs);
+
+        RealSpaceMatrix matrix(kernel, src, tar, nin, box, par.xi,
+                par.nside_x, par.nside_y);
+        if(matrix.assembled()) {
+            time = BestTime([&](){ matrix.Apply(dens, out); });
+            snprintf(what, 64, "%s operator (%.0f MB)", name,
+                    matrix.memory()/1e6);
+            Report(what, time, stats.accepted_pairs);
+        }
+    }
+    printf("DLP/SLP velocity time per pair %.2f\n", per_pair[1]/per_pair[0]);
+
+    return 0;
+}
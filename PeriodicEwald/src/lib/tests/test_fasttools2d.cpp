@@ -0,0 +1,516 @@
+#include "fasttools2d.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+/*------------------------------------------------------------------------
+ *Unit tests of the library: the real-space Stokeslet velocity against a
+ *direct sum over the periodic images, for evenly spread and clustered
+ *points and at a loose tolerance, the uniform grid against the adaptive
+ *tree, the vectorised stresslet velocity against the pair loop, excluded
+ *near pairs in mixed precision, the plans, operators, chunked sums and
+ *exclusion lists of both kernels against the plain sums, and the reuse of
+ *the scratch memory.
+ *------------------------------------------------------------------------
+ */
+
+using namespace fasttools2d;
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what, double value){
+    printf("%-50s %10.3e  %s\n", what, value, ok ? "ok" : "FAILED");
+    if(!ok)
+        failures++;
+}
+
+static double RelativeError(const std::vector<double>& a,
+        const std::vector<double>& b){
+    double err = 0, scale = 0;
+    for(size_t i = 0;i<a.size();i++) {
+        err = fmax(err, fabs(a[i]-b[i]));
+        scale = fmax(scale, fabs(b[i]));
+    }
+    return err/scale;
+}
+
+//E1(x) from its series for small x and its continued fraction otherwise.
+static double ExpIntE1(double x){
+
+    if(x < 1) {
+        double sum = 0, term = 1;
+        for(int k = 1;k<40;k++) {
+            term *= -x/k;
+            sum -= term/k;
+        }
+        return -0.57721566490153286061 - log(x) + sum;
+    }
+
+    double cf = 0;
+    for(int k = 60;k>=1;k--)
+        cf = k/(1 + k/(x + cf));
+    return exp(-x)/(x + cf);
+}
+
+//The real-space Stokeslet velocity by summing every pair and image within
+//the cutoff, as the near field does.
+static std::vector<double> DirectStokeslet(const std::vector<double>& psrc,
+        const std::vector<double>& ptar, const std::vector<double>& f,
+        const Box& box, double xi, int nside_x, int nside_y){
+
+    int Nsrc = psrc.size()/2, Ntar = ptar.size()/2;
+    double cutoffsq = box.Lx*box.Ly/nside_x/nside_y;
+    std::vector<double> u(2*Ntar, 0.0);
+
+    for(int j = 0;j<Ntar;j++)
+        for(int k = 0;k<Nsrc;k++) {
+            for(int sx = -1;sx<=1;sx++)
+                for(int sy = -1;sy<=1;sy++) {
+                    double r1 = ptar[2*j] - psrc[2*k] + sx*box.Lx;
+                    double r2 = ptar[2*j+1] - psrc[2*k+1] + sy*box.Ly;
+                    double rSq = r1*r1 + r2*r2;
+                    if(rSq >= cutoffsq)
+                        continue;
+
+                    double e2 = exp(-xi*xi*rSq);
+                    double a = 0.5*ExpIntE1(xi*xi*rSq) - e2;
+                    double b = e2*(r1*f[2*k] + r2*f[2*k+1])/rSq;
+                    u[2*j] += (a*f[2*k] + b*r1)/(4*M_PI);
+                    u[2*j+1] += (a*f[2*k+1] + b*r2)/(4*M_PI);
+                }
+        }
+    return u;
+}
+
+static std::mt19937 rng(7);
+
+static std::vector<double> Uniform(int n, double lo, double hi){
+    std::uniform_real_distribution<double> U(lo, hi);
+    std::vector<double> v(n);
+    for(int i = 0;i<n;i++)
+        v[i] = U(rng);
+    return v;
+}
+
+static std::vector<double> Normals(int n){
+    std::vector<double> t = Uniform(n, 0, 2*M_PI), v(2*n);
+    for(int i = 0;i<n;i++) {
+        v[2*i] = cos(t[i]);
+        v[2*i+1] = sin(t[i]);
+    }
+    return v;
+}
+
+static Input In(const std::vector<double>& v){
+    return Input(v.data(), v.size()/2);
+}
+
+static Output Out(std::vector<double>& v){
+    return Output(v.data(), v.size()/2);
+}
+
+static void TestDirectSum(){
+
+    Box box = {1, 1.5};
+    int Nsrc = 800, Ntar = 700;
+    double xi = 12;
+    RealSpaceSettings settings(xi, 6, 9);
+
+    std::vector<double> psrc = Uniform(2*Nsrc, -0.5, 0.5);
+    std::vector<double> ptar = Uniform(2*Ntar, -0.5, 0.5);
+    for(int i = 0;i<Nsrc;i++)
+        psrc[2*i+1] *= box.Ly;
+    for(int i = 0;i<Ntar;i++)
+        ptar[2*i+1] *= box.Ly;
+    std::vector<double> f = Uniform(2*Nsrc, -1, 1);
+
+    std::vector<double> u(2*Ntar);
+    StokesletVelocity(In(psrc), In(ptar), In(f), box, settings, Out(u));
+    std::vector<double> ref = DirectStokeslet(psrc, ptar, f, box, xi, 6, 9);
+    double err = RelativeError(u, ref);
+    Check(err < 1e-12, "SLP velocity vs direct sum", err);
+
+    //The Stokeslet has no vectorised single-precision loop, so it stays in
+    //double at a loose tolerance.
+    settings.tol = 1e-4;
+    StokesletVelocity(In(psrc), In(ptar), In(f), box, settings, Out(u));
+    err = RelativeError(u, ref);
+    Check(err < 1e-12, "SLP velocity in double at a loose tolerance", err);
+
+    //Points clustered in a small circle, which refine the grid into the
+    //adaptive tree.
+    std::vector<double> r = Uniform(Nsrc+Ntar, 0, 0.01);
+    std::vector<double> t = Uniform(Nsrc+Ntar, 0, 2*M_PI);
+    for(int i = 0;i<Nsrc;i++) {
+        psrc[2*i] = 0.1 + r[i]*cos(t[i]);
+        psrc[2*i+1] = -0.2 + r[i]*sin(t[i]);
+    }
+    for(int i = 0;i<Ntar;i++) {
+        ptar[2*i] = 0.1 + r[Nsrc+i]*cos(t[Nsrc+i]);
+        ptar[2*i+1] = -0.2 + r[Nsrc+i]*sin(t[Nsrc+i]);
+    }
+
+    RealSpaceStats stats;
+    settings.tol = 0;
+    StokesletVelocity(In(psrc), In(ptar), In(f), box, settings, Out(u),
+            &stats);
+    ref = DirectStokeslet(psrc, ptar, f, box, xi, 6, 9);
+    err = RelativeError(u, ref);
+    Check(err < 1e-12 && stats.adaptive, "SLP velocity of clustered points", err);
+}
+
+//n points on a ring of radius 0.15 around (0.1,-0.2), spread over a few
+//boxes of a 6 x 6 grid, so that the grid has many more candidate pairs
+//than for evenly spread points.
+static std::vector<double> Ring(int n){
+    std::vector<double> r = Uniform(n, 0.14, 0.16);
+    std::vector<double> t = Uniform(n, 0, 2*M_PI), p(2*n);
+    for(int i = 0;i<n;i++) {
+        p[2*i] = 0.1 + r[i]*cos(t[i]);
+        p[2*i+1] = -0.2 + r[i]*sin(t[i]);
+    }
+    return p;
+}
+
+//The uniform grid and the adaptive tree sum the same pairs, also for
+//pairs in the same box that are further apart than the cutoff. xi is
+//small enough that those pairs matter.
+static void TestNearFieldModes(int kernel){
+
+    const char* name = (kernel == SLP_KERNEL) ? "SLP" : "DLP";
+    char what[64];
+
+    Box box = {1, 1};
+    int Nsrc = 1500, Ntar = 1200;
+    RealSpaceSettings settings(10, 6, 6);
+
+    std::vector<double> psrc = Ring(Nsrc), ptar = Ring(Ntar);
+    std::vector<double> f = Uniform(2*Nsrc, -1, 1);
+    std::vector<double> n = Normals(Nsrc);
+    Input nin = (kernel == DLP_KERNEL) ? In(n) : Input();
+
+    std::vector<double> u(2*Ntar), v(2*Ntar);
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    RealSpaceStats stats;
+    settings.near_field = NF_UNIFORM;
+    output[RS_VELOCITY] = u.data();
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, settings,
+            output, NULL, &stats);
+    bool uniform = !stats.adaptive;
+
+    settings.near_field = NF_ADAPTIVE;
+    output[RS_VELOCITY] = v.data();
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, settings,
+            output, NULL, &stats);
+    double err = RelativeError(v, u);
+    snprintf(what, 64, "%s adaptive vs uniform near field", name);
+    Check(uniform && stats.adaptive && err < 1e-13, what, err);
+
+    if(kernel == SLP_KERNEL) {
+        std::vector<double> ref = DirectStokeslet(psrc, ptar, f, box,
+                settings.xi, 6, 6);
+        err = RelativeError(u, ref);
+        Check(err < 1e-12, "SLP uniform near field vs direct sum", err);
+    }
+
+    //Targets in chunks, the first chunk evenly spread and the second on
+    //the ring. Every chunk takes the structure chosen for all targets, so
+    //the candidate pairs are those of the forced structure.
+    int Nmixed = 2*RS_MIN_TARGET_CHUNK;
+    std::vector<double> pmixed = Uniform(2*Nmixed, -0.5, 0.5);
+    std::vector<double> ring = Ring(RS_MIN_TARGET_CHUNK);
+    std::copy(ring.begin(), ring.end(),
+            pmixed.begin() + 2*RS_MIN_TARGET_CHUNK);
+    std::vector<double> w(2*Nmixed), z(2*Nmixed);
+
+    settings.near_field = NF_AUTO;
+    output[RS_VELOCITY] = w.data();
+    RealSpaceSum(kernel, In(psrc), In(pmixed), In(f), nin, box, settings,
+            output, NULL, &stats);
+    int whole = stats.adaptive ? NF_ADAPTIVE : NF_UNIFORM;
+
+    RealSpaceSettings chunked = settings;
+    chunked.max_memory = 1;
+    RealSpaceStats auto_stats, forced_stats;
+    output[RS_VELOCITY] = z.data();
+    RealSpaceSum(kernel, In(psrc), In(pmixed), In(f), nin, box, chunked,
+            output, NULL, &auto_stats);
+    err = RelativeError(z, w);
+
+    chunked.near_field = whole;
+    RealSpaceSum(kernel, In(psrc), In(pmixed), In(f), nin, box, chunked,
+            output, NULL, &forced_stats);
+    snprintf(what, 64, "%s chunked clustered vs sum (%d chunks)", name,
+            auto_stats.num_chunks);
+    Check(auto_stats.num_chunks == 2 && err < 1e-13 &&
+            auto_stats.candidate_pairs == forced_stats.candidate_pairs,
+            what, err);
+}
+
+//The stresslet velocity alone is summed in vectorised batches, and with
+//another quantity by the pair loop. Both must agree and count the same
+//pairs, also for targets on or very near a source, which mixed precision
+//evaluates in double, and for xi so large that the exponential underflows
+//within the cutoff. Only the batches are run in mixed precision at a loose
+//tolerance.
+static void TestVectorisedDLP(){
+
+    Box box = {1, 1};
+    int Nsrc = 1500, Ntar = 1200;
+    std::vector<double> psrc = Uniform(2*Nsrc, -0.5, 0.5);
+    std::vector<double> ptar = Uniform(2*Ntar, -0.5, 0.5);
+    for(int i = 0;i<Ntar;i+=4) {
+        ptar[2*i] = psrc[2*i];
+        ptar[2*i+1] = psrc[2*i+1];
+        ptar[2*i+2] = psrc[2*i+2] + 1e-5;
+        ptar[2*i+3] = psrc[2*i+3];
+    }
+    std::vector<double> f = Uniform(2*Nsrc, -1, 1);
+    std::vector<double> n = Normals(Nsrc);
+
+    const double xis[2] = {10, 200}, tols[2] = {0, 1e-4};
+    for(int a = 0;a<2;a++) {
+        for(int b = 0;b<2;b++) {
+            RealSpaceSettings settings(xis[a], 4, 4, tols[b]);
+            std::vector<double> u(2*Ntar), v(2*Ntar), p(Ntar);
+            double* output[RS_NUM_QUANTITIES] = {NULL};
+            RealSpaceStats batch, pairs;
+
+            output[RS_VELOCITY] = u.data();
+            RealSpaceSum(DLP_KERNEL, In(psrc), In(ptar), In(f), In(n), box,
+                    settings, output, NULL, &batch);
+            output[RS_VELOCITY] = v.data();
+            output[RS_PRESSURE] = p.data();
+            RealSpaceSum(DLP_KERNEL, In(psrc), In(ptar), In(f), In(n), box,
+                    settings, output, NULL, &pairs);
+
+            double err = RelativeError(u, v);
+            char what[64];
+            snprintf(what, 64, "DLP batches vs pairs, xi = %g, %s", xis[a],
+                    tols[b] > 0 ? "mixed" : "double");
+            int mixed = (tols[b] > 0) ? RS_MIXED : RS_DOUBLE;
+            Check(err < (tols[b] > 0 ? 1e-5 : 1e-13) &&
+                    batch.accepted_pairs == pairs.accepted_pairs &&
+                    batch.precision == mixed &&
+                    pairs.precision == RS_DOUBLE, what, err);
+        }
+    }
+}
+
+//Each target sits next to a strong source it excludes, just beyond the
+//pairs that mixed precision evaluates in double. The pairs loop skips the
+//excluded pairs, so the stresslet velocity in mixed precision keeps the
+//accuracy of the other pairs rather than the roundoff of the near ones.
+static void TestExcludedNearPairs(){
+
+    Box box = {1, 1};
+    int Nsrc = 1500, Ntar = 1000;
+    std::vector<double> psrc = Uniform(2*Nsrc, -0.5, 0.5);
+    std::vector<double> ptar(2*Ntar);
+    std::vector<int> offsets(Ntar+1), ranges(2*Ntar);
+    offsets[0] = 0;
+    for(int j = 0;j<Ntar;j++) {
+        ptar[2*j] = psrc[2*j] + 3e-4;
+        ptar[2*j+1] = psrc[2*j+1];
+        ranges[2*j] = j;
+        ranges[2*j+1] = j+1;
+        offsets[j+1] = j+1;
+    }
+    std::vector<double> f = Uniform(2*Nsrc, -1, 1);
+    for(int i = 0;i<2*Ntar;i++)
+        f[i] *= 100;
+    std::vector<double> n = Normals(Nsrc);
+    ExclusionList excl = {Ntar, Ntar, offsets.data(), ranges.data()};
+
+    std::vector<double> u(2*Ntar), v(2*Ntar);
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    RealSpaceSettings settings(10, 4, 4);
+    settings.excl = &excl;
+    output[RS_VELOCITY] = u.data();
+    RealSpaceSum(DLP_KERNEL, In(psrc), In(ptar), In(f), In(n), box,
+            settings, output);
+
+    settings.tol = 1e-4;
+    RealSpaceStats stats;
+    output[RS_VELOCITY] = v.data();
+    RealSpaceSum(DLP_KERNEL, In(psrc), In(ptar), In(f), In(n), box,
+            settings, output, NULL, &stats);
+    double err = RelativeError(v, u);
+    Check(stats.precision == RS_MIXED && err < 1e-6,
+            "DLP excluded near pairs, mixed", err);
+}
+
+static void TestPlansAndOperators(int kernel){
+
+    const char* name = (kernel == SLP_KERNEL) ? "SLP" : "DLP";
+    char what[64];
+
+    Box box = {1, 1};
+    int Nsrc = 3000, Ntar = 2500;
+    RealSpaceSettings settings(30, 10, 10);
+
+    std::vector<double> psrc = Uniform(2*Nsrc, -0.5, 0.5);
+    std::vector<double> ptar = Uniform(2*Ntar, -0.5, 0.5);
+    std::vector<double> f = Uniform(2*Nsrc, -1, 1);
+    std::vector<double> n = Normals(Nsrc);
+    Input nin = (kernel == DLP_KERNEL) ? In(n) : Input();
+
+    std::vector<double> u(2*Ntar), v(2*Ntar);
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u.data();
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, settings,
+            output);
+
+    RealSpacePlan plan(kernel, In(psrc), In(ptar), nin, box, settings);
+    plan.Execute(In(f), Out(v));
+    double err = RelativeError(v, u);
+    snprintf(what, 64, "%s plan vs sum", name);
+    Check(err < 1e-14, what, err);
+
+    RealSpaceMatrix matrix(kernel, In(psrc), In(ptar), nin, box,
+            settings.xi, settings.nside_x, settings.nside_y);
+    matrix.Apply(In(f), Out(v));
+    err = RelativeError(v, u);
+    snprintf(what, 64, "%s operator vs sum", name);
+    Check(matrix.assembled() && err < 1e-13, what, err);
+
+    //Targets summed in chunks.
+    RealSpaceSettings chunked = settings;
+    chunked.max_memory = 1;
+    RealSpaceStats stats;
+    output[RS_VELOCITY] = v.data();
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, chunked,
+            output, NULL, &stats);
+    err = RelativeError(v, u);
+    snprintf(what, 64, "%s chunked vs sum (%d chunks)", name,
+            stats.num_chunks);
+    Check(stats.num_chunks > 1 && err < 1e-14, what, err);
+
+    //Excluding up to eight sources of each target, the sum and the
+    //skipped part add up to the full sum.
+    std::vector<int> offsets(Ntar+1), ranges(2*Ntar);
+    offsets[0] = 0;
+    for(int j = 0;j<Ntar;j++) {
+        ranges[2*j] = (17*j) % (Nsrc-8);
+        ranges[2*j+1] = ranges[2*j] + 1 + j % 8;
+        offsets[j+1] = j+1;
+    }
+    ExclusionList excl = {Ntar, Ntar, offsets.data(), ranges.data()};
+    RealSpaceSettings excluded = settings;
+    excluded.excl = &excl;
+    std::vector<double> s(2*Ntar);
+    double* skipped[RS_NUM_QUANTITIES] = {NULL};
+    skipped[RS_VELOCITY] = s.data();
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, excluded,
+            output, skipped);
+    for(int i = 0;i<2*Ntar;i++)
+        v[i] += s[i];
+    err = RelativeError(v, u);
+    snprintf(what, 64, "%s sum + excluded vs sum", name);
+    Check(err < 1e-13, what, err);
+
+    //Moves towards the centre of the box keep the near field of the plan.
+    for(size_t i = 0;i<psrc.size();i++) {
+        double c = (floor((psrc[i]+0.5)*10)+0.5)/10 - 0.5;
+        psrc[i] = c + 0.9*(psrc[i]-c);
+    }
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, settings,
+            output);
+    bool kept = plan.Move(In(psrc), In(ptar), nin);
+    std::vector<double> w(2*Ntar);
+    plan.Execute(In(f), Out(w));
+    err = RelativeError(w, v);
+    snprintf(what, 64, "%s moved plan vs sum", name);
+    Check(kept && err < 1e-14, what, err);
+
+    //Large moves rebuild it.
+    for(size_t i = 0;i<ptar.size();i++)
+        ptar[i] = -ptar[i];
+    RealSpaceSum(kernel, In(psrc), In(ptar), In(f), nin, box, settings,
+            output);
+    kept = plan.Move(In(psrc), In(ptar), nin);
+    plan.Execute(In(f), Out(w));
+    err = RelativeError(w, v);
+    snprintf(what, 64, "%s rebuilt plan vs sum", name);
+    Check(!kept && plan.rebuilds() == 1 && err < 1e-14, what, err);
+}
+
+//A plan keeps its near field on the heap, so the scratch arena can still
+//grow for larger sums and then serves them without heap allocations.
+static void TestScratchArena(){
+
+    Box box = {1, 1};
+    int N = 40000;
+    RealSpaceSettings settings(20, 12, 12);
+
+    std::vector<double> p = Uniform(2*N, -0.5, 0.5), f = Uniform(2*N, -1, 1);
+    RealSpacePlan plan(SLP_KERNEL, Input(p.data(), 1000),
+            Input(p.data(), 1000), Input(), box, settings);
+
+    std::vector<double> u(2*N);
+    RealSpaceStats stats;
+    for(int k = 0;k<3;k++)
+        StokesletVelocity(In(p), In(p), In(f), box, settings, Out(u),
+                &stats);
+    Check(stats.allocations > 0 && stats.heap_allocations == 0,
+            "sums beside a plan draw on the arena", stats.heap_allocations);
+}
+
+static void TestErrors(){
+
+    Box box = {1, 1};
+    std::vector<double> p = Uniform(20, -0.5, 0.5), f = Uniform(18, -1, 1);
+    std::vector<double> u(20);
+    bool thrown = false;
+    try {
+        StokesletVelocity(In(p), In(p), In(f), box,
+                RealSpaceSettings(10, 4, 4), Out(u));
+    } catch(const std::invalid_argument&) {
+        thrown = true;
+    }
+    Check(thrown, "mismatched sizes throw", 0);
+}
+
+static void TestParameters(){
+
+    Box box = {1, 2};
+    std::vector<double> f = Uniform(2*10000, -1, 1);
+    double tol = 1e-10;
+    EwaldParameters par = ChooseParameters(DLP_KERNEL, 0, In(f), 10000, 100,
+            0, box, tol);
+
+    double xi = FindXi(DLP_KERNEL, 0, DensityNorm(In(f)), box.Lx, box.Ly,
+            par.rc, tol);
+    Check(par.xi == xi && par.Mx == 2*par.kinf && par.My == 2*par.Mx,
+            "parameters of the error estimates", par.xi);
+
+    //A budget of a quarter of the grids moves work to the real-space sum.
+    double grids = 7;
+    double max_memory = grids*par.Mx*par.My*sizeof(double)/4;
+    EwaldParameters fit = par;
+    int meets = FitEwaldParameters(DLP_KERNEL, 0, DensityNorm(In(f)),
+            box.Lx, box.Ly, tol, grids, max_memory, &fit);
+    Check(meets && fit.xi < par.xi && fit.nside_x < par.nside_x &&
+            grids*fit.Mx*fit.My*sizeof(double) <= max_memory,
+            "parameters within a memory budget", fit.xi);
+}
+
+int main(){
+
+    TestDirectSum();
+    TestNearFieldModes(SLP_KERNEL);
+    TestNearFieldModes(DLP_KERNEL);
+    TestVectorisedDLP();
+    TestExcludedNearPairs();
+    TestPlansAndOperators(SLP_KERNEL);
+    TestPlansAndOperators(DLP_KERNEL);
+    TestScratchArena();
+    TestErrors();
+    TestParameters();
+
+    printf("%d failures\n", failures);
+    return failures > 0;
+}
@@ -0,0 +1,78 @@
+classdef EwaldPlan < handle
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+% Persistent plan for repeated spectral Ewald evaluations of the velocity
+% of the doubly-periodic Stokeslet or stresslet with the same points.
+% The parameters, the binned points of the real-space sum and the
+% frequency-space filter are kept in memory by mex_stokes_ewald_plan, so
+% each evaluation only does the work that depends on the density. Plans
+% are normally made by StokesSLP_ewald_2p or StokesDLP_ewald_2p with the
+% option 'plan', true, and are freed when the object is deleted.
+%
+%   [ur, uk, stats] = execute(plan, f)
+%       real and Fourier components for the density f (2xN)
+%   rebuilt = move(plan, psrc, ptar, n)
+%       new positions (and normals for the stresslet). The plan is kept as
+%       long as every point stays in its box of the real-space grid,
+%       otherwise its real-space part is rebuilt and rebuilt is true
+%   s = info(plan)
+%       parameters, memory and counters of the plan, and the variant of
+%       the Fourier sum that it uses
+%
+% The optional last argument of the constructor, kspace_variant, is
+% 'estimate' (default), 'measure' to time the variants of the Fourier sum
+% in the first execution and keep the fastest, or the name of a variant,
+% see kspace_variants.h.
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    properties (SetAccess = private)
+        % 'slp' or 'dlp'
+        kernel
+        % id of the plan in mex_stokes_ewald_plan
+        id = []
+        num_sources
+        num_targets
+        Lx
+        Ly
+        xi
+    end
+
+    methods
+        function plan = EwaldPlan(kernel, psrc, ptar, n, xi, nside_x,...
+                    nside_y, eta, Mx, My, Lx, Ly, w, P, tol, kspace_variant)
+            if nargin < 16
+                kspace_variant = 'estimate';
+            end
+            plan.kernel = kernel;
+            plan.num_sources = size(psrc,2);
+            plan.num_targets = size(ptar,2);
+            plan.Lx = Lx;
+            plan.Ly = Ly;
+            plan.xi = xi;
+            plan.id = mex_stokes_ewald_plan('create',kernel,psrc,ptar,n,...
+                        xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,tol,...
+                        kspace_variant);
+        end
+
+        function [ur, uk, stats] = execute(plan, f)
+            [ur, uk, stats] = mex_stokes_ewald_plan('execute',plan.id,f);
+        end
+
+        function rebuilt = move(plan, psrc, ptar, n)
+            if nargin < 4
+                n = [];
+            end
+            rebuilt = mex_stokes_ewald_plan('move',plan.id,psrc,ptar,n) ~= 0;
+        end
+
+        function s = info(plan)
+            s = mex_stokes_ewald_plan('info',plan.id);
+        end
+
+        function delete(plan)
+            if ~isempty(plan.id)
+                mex_stokes_ewald_plan('destroy',plan.id);
+                plan.id = [];
+            end
+        end
+    end
+end
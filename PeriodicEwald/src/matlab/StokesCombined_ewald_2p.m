@@ -0,0 +1,173 @@
+function [u1, u2, ur, uk, xi] = StokesCombined_ewald_2p(xsrc, ysrc, xtar,...
+            ytar, f1, f2, g1, g2, n1, n2, alpha, beta, gamma, Lx, Ly, varargin)
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+% Spectral Ewald evaluation of alpha*SLP(f) + beta*DLP(g,n) + gamma*f for
+% the doubly-periodic Stokeslet and stresslet, e.g. the operator
+% 1/2*I + D + S of a second-kind integral equation. Both potentials share
+% one real-space pass and one spreading, FFT and gathering, instead of a
+% call to StokesSLP_ewald_2p and one to StokesDLP_ewald_2p.
+%
+% Input:
+%       xsrc, x component of source points
+%       ysrc, y component of source points 
+%       xtar, x component of target points
+%       ytar, y component of target points 
+%       f1, x component of density function of the Stokeslet
+%       f2, y component of density function of the Stokeslet
+%       g1, x component of density function of the stresslet
+%       g2, y component of density function of the stresslet
+%       n1, x component of normal vector
+%       n2, y component of normal vector
+%       alpha, weight of the Stokeslet
+%       beta, weight of the stresslet
+%       gamma, weight of the identity term gamma*f, which needs the
+%           targets to be the sources unless it is 0
+%       Lx, the length of the periodic box in the x direction
+%       Ly, the length of the periodic box in the y direction
+%         'P', integer giving support points in each direction (default from
+%             tol, at most 24)
+%         'Nb', average number of points per box (default 24*log2(#pts))
+%         'tol', error tolerance for truncation of sums (default 1e-16)
+%             real-space pairs are evaluated in single precision for tol >= 1e-5
+%         'verbose', flag to write out parameter information
+% Output:
+%       u1, x component of velocity
+%       u2, y component of velocity
+%       ur, real component of Ewald decomposition of the two potentials
+%           (as a 2xN matrix)
+%       uk, Fourier component of Ewald decomposition of the two
+%           potentials (as a 2xN matrix)
+%       xi, Ewald parameter
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+npts = length(xsrc)+length(xtar);
+
+%% set default parameter values 
+% support points in each direction, chosen from tol below unless given
+P = [];
+% average number of points per box for real space sum
+Nb = min(24*round(log2(npts)), npts/4);
+% tolerance, used to get parameters from estimates
+tol = 1e-16;  
+% print diagnostic information
+verbose = 0;
+
+%% read in optional input parameters
+if nargin > 15
+    % Go through all other input arguments and assign parameters
+    jv = 1;
+    while jv <= length(varargin)-1
+       switch varargin{jv}
+  
+           case 'P'
+               P = varargin{jv+1};
+               
+           case 'Nb'
+               Nb = varargin{jv+1};
+               
+           case 'tol'
+               tol = varargin{jv+1};
+               
+           case 'verbose'
+               verbose = varargin{jv+1};
+       end
+       jv = jv + 2;
+    end
+end
+
+% the smallest P whose window truncation error exp(-m^2/2), with
+% m = 0.95*sqrt(pi*P), meets tol
+if isempty(P)
+    P = min(max(ceil(-log(tol)/(0.95^2*pi/2)), 4), 24);
+end
+
+if verbose
+    fprintf("*********************************************************\n");
+    fprintf("SPECTRAL EWALD FOR THE COMBINED STOKES POTENTIALS\n\n")
+    fprintf("NUMBER OF SOURCES: %d\n", length(xsrc));
+    fprintf("NUMBER OF TARGETS: %d\n", length(xtar));
+    fprintf("WEIGHTS: %3.3g (SLP), %3.3g (DLP), %3.3g (identity)\n",...
+                alpha, beta, gamma);
+    fprintf("TOLERANCE: %3.3e\n", tol);
+    fprintf("P: %d\n", P);
+    fprintf("Points per box: %d\n", Nb);
+end
+
+%  Make sure the sources and targets are all inside the box.
+xsrc = mod(xsrc+Lx/2,Lx)-Lx/2;
+xtar = mod(xtar+Lx/2,Lx)-Lx/2;
+ysrc = mod(ysrc+Ly/2,Ly)-Ly/2;
+ytar = mod(ytar+Ly/2,Ly)-Ly/2;
+
+psrc = [xsrc';ysrc'];
+ptar = [xtar';ytar'];
+f = [f1';f2'];
+g = [g1';g2'];
+n = [n1';n2'];
+
+% compute parameters, rc, xi and kinf
+[A,B] = rat(Lx/Ly);
+
+% each potential with its weighted density, as in StokesSLP_ewald_2p and
+% StokesDLP_ewald_2p
+Q_slp = alpha^2*sum(sum(f.^2))+1;
+Q_dlp = beta^2*sum(sum(g.^2))+1;
+
+a = ceil(sqrt(npts/(Nb*A*B)));
+
+m = 0.95*sqrt(pi*P);
+nside_x = a*A;
+nside_y = a*B;
+rc = Lx/nside_x;
+
+% the grids are shared, so xi and kinf must meet tol for both potentials
+xi = max(mex_stokes_ewald_parameters('xi','slp',0,Q_slp,Lx,Ly,rc,tol),...
+            mex_stokes_ewald_parameters('xi','dlp',0,Q_dlp,Lx,Ly,rc,tol));
+kinfx = max(mex_stokes_ewald_parameters('kinf','slp',0,Q_slp,Lx,Lx,xi,tol),...
+            mex_stokes_ewald_parameters('kinf','dlp',0,Q_dlp,Lx,Lx,xi,tol));
+
+Mx = min(2*kinfx,10000);
+
+My = B * Mx;
+Mx = A * Mx;
+
+w = P*Lx/Mx/2;
+eta = (2*xi*w/m)^2;
+
+if verbose
+    fprintf("\nPARAMETER INFORMATION:\n")
+    fprintf("\txi: %3.3f\n", xi);
+    fprintf("\trc: %3.3f\n", rc);
+    fprintf("\tkinf: %d\n", kinfx);
+    fprintf("\tMx: %d\n", Mx);
+    fprintf("\tMy: %d\n", My);
+    fprintf("\tw: %3.3f\n", w);
+    fprintf("\teta: %3.3f\n", eta);
+    fprintf("*********************************************************\n");
+    tic
+end
+
+[u, ur, uk, rstats] = mex_stokes_combined_ewald(psrc,ptar,f,g,n,alpha,...
+            beta,gamma,xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,tol);
+
+if verbose
+    fprintf("TIME FOR REAL AND FOURIER SUMS: %3.3g s\n", toc);
+    fprintf("\tREAL SUM: %3.3g s (%d threads)\n",...
+                rstats.real_time, rstats.real_threads);
+    fprintf("\tFOURIER SUM: %3.3g s (%d threads)\n",...
+                rstats.kspace_time, rstats.kspace_threads);
+    fprintf("\tREAL PHASES: assign %3.3g s, pairs %3.3g s, copy out %3.3g s\n",...
+                rstats.assign_time, rstats.pairs_time, rstats.copy_out_time);
+    fprintf("\tFOURIER PHASES: spread %3.3g s, fft %3.3g s, filter %3.3g s, ifft %3.3g s, gather %3.3g s\n",...
+                rstats.spread_time, rstats.fft_time, rstats.filter_time,...
+                rstats.ifft_time, rstats.gather_time);
+    fprintf("\tPAIRS: %d candidate, %d accepted; PEAK MEMORY: %3.3g MB\n",...
+                rstats.candidate_pairs, rstats.accepted_pairs,...
+                rstats.peak_memory/2^20);
+    fprintf("*********************************************************\n\n");
+end
+
+u1 = u(1,:)';
+u2 = u(2,:)';
+
+end
@@ -1,4 +1,4 @@
-function [u1, u2, ur, uk, xi] = StokesDLP_ewald_2p(xsrc, ysrc,...
+function [u1, u2, ur, uk, xi, rop, ur_skip, plan] = StokesDLP_ewald_2p(xsrc, ysrc,...
                     xtar, ytar, n1, n2, f1, f2, Lx, Ly, varargin)
 % - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 % Spectral Ewald evaluation of the doubly-periodic  double-layer potential.
@@ -15,27 +15,80 @@ function [u1, u2, ur, uk, xi] = StokesDLP_ewald_2p(xsrc, ysrc,...
 %       Lx, the length of the periodic box in the x direction
 %       Ly, the length of the periodic box in the y direction
 %       vargargin can contain any or all of the following:
-%         'P', integer giving support points in each direction (default 24)
-%         'Nb', average number of points per box (default P*log2(#pts))
+%         'P', integer giving support points in each direction (default from
+%             tol, at most 24)
+%         'Nb', average number of points per box (default 24*log2(#pts))
 %         'tol', error tolerance for truncation of sums (default 1e-16)
+%             real-space pairs are evaluated in single precision for tol >= 1e-5
 %         'verbose', flag to write out parameter information
+%         'real_op', true to assemble the real-space sum as a sparse
+%             operator and return it as rop, or an operator returned by an
+%             earlier call with the same points and normals, whose xi and
+%             grid are then reused. Useful when the geometry is fixed, e.g.
+%             in an iterative solver
+%         'max_memory', largest footprint in bytes of the real-space
+%             operator (default 1 GiB), the real sum is evaluated on the
+%             fly if it would be larger. It also bounds the working memory
+%             of the real sum on the fly, which then processes the targets
+%             in chunks, and the Fourier grids, for which a coarser grid of
+%             boxes and a smaller xi are chosen if needed
+%         'exclude', {excl_ptr, excl_src}, source-target pairs to leave
+%             out of the real sum, e.g. near panels that are treated with
+%             special quadrature. The sources excl_src(1,e):excl_src(2,e)
+%             are excluded for target j for excl_ptr(j) <= e < excl_ptr(j+1)
+%         'concurrent', flag to evaluate the real and Fourier sums at the
+%             same time on a split of the threads (default true), unless
+%             a precomputed real-space operator is applied
+%         'autotune', flag to choose Nb and P from a cost model of this
+%             machine (see ewald_cost_model), for the shortest predicted
+%             time at the tolerance (default false). Overrides 'Nb' and 'P'
+%         'plan', true to keep the parameters, the binned points and the
+%             Fourier filter of this call in an EwaldPlan, returned as
+%             plan, or a plan returned by an earlier call, which is then
+%             moved to the points of this call and executed for the new
+%             density. Its xi and grids are reused
+%         'kspace_variant', variant of the Fourier sum of a new plan:
+%             'estimate' (default), 'measure' to time each variant in the
+%             first evaluation and keep the fastest, or the name of a
+%             variant (see kspace_variants.h)
 % Output:
 %       u1, x component of velocity
 %       u2, y component of velocity
-%
+%       ur, real component of Ewald decomposition (as a 2xN matrix)
+%       uk, Fourier component of Ewald decomposition (as a 2xN matrix)
+%       xi, Ewald parameter
+%       rop, real-space operator (empty unless 'real_op' is given)
+%       ur_skip, real-space contribution of the excluded pairs (as a 2xN
+%           matrix), which has been left out of ur and u
+%       plan, EwaldPlan for repeated evaluations (empty unless 'plan' is
+%           given)
 % - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 npts = length(xsrc)+length(xtar);
 
 %% set default parameter values 
-% support points in each direction
-P = 24;                    
+% support points in each direction, chosen from tol below unless given
+P = [];
 % average number of points per box for real space sum
-Nb = min(P*round(log2(npts)), npts/4);
+Nb = min(24*round(log2(npts)), npts/4);
 % tolerance, used to get parameters from estimates
 tol = 1e-16;
 % print diagnostic information
 verbose = 0;
+% precomputed real-space operator
+real_op = false;
+% memory limit for the real-space operator, in bytes
+max_memory = 2^30;
+% source-target pairs left out of the real sum
+exclude = {};
+% evaluate the real and Fourier sums at the same time
+concurrent = true;
+% persistent plan for repeated evaluations
+plan = false;
+% variant of the Fourier sum of a new plan
+kspace_variant = 'estimate';
+% choose Nb and P from the cost model of the machine
+autotune = false;
 
 %% read in optional input parameters
 if nargin > 8
@@ -55,11 +108,38 @@ if nargin > 8
                
            case 'verbose'
                verbose = varargin{jv+1};
+               
+           case 'real_op'
+               real_op = varargin{jv+1};
+               
+           case 'max_memory'
+               max_memory = varargin{jv+1};
+               
+           case 'exclude'
+               exclude = varargin{jv+1};
+               
+           case 'concurrent'
+               concurrent = varargin{jv+1};
+               
+           case 'plan'
+               plan = varargin{jv+1};
+               
+           case 'kspace_variant'
+               kspace_variant = varargin{jv+1};
+               
+           case 'autotune'
+               autotune = varargin{jv+1};
        end
        jv = jv + 2;
     end
 end
 
+% the smallest P whose window truncation error exp(-m^2/2), with
+% m = 0.95*sqrt(pi*P), meets tol
+if isempty(P)
+    P = min(max(ceil(-log(tol)/(0.95^2*pi/2)), 4), 24);
+end
+
 % TO DO: ADD CHECKS ON INPUT DATA HERE
 
 %% Fix for matlab 2018/2019, not sure why this is necessary, but it seems 
@@ -106,7 +186,28 @@ n = [n1';n2'];
 
 npts = length(psrc)+length(ptar);
 Q = sum(sum(f.^2))+1;
+
+if autotune
+    cfg = ewald_autotune('dlp',length(xsrc),length(xtar),Lx,Ly,tol,...
+                @(rc) find_xi(Q,Lx,Ly,rc,tol),...
+                @(xi) find_kinfb(Q,Lx,Lx,xi,tol), max_memory);
+    Nb = cfg.Nb;
+    P = cfg.P;
+    
+    if verbose
+        fprintf("\nAUTOTUNED PARAMETERS:\n");
+        fprintf("\tPoints per box: %3.3g\n", Nb);
+        fprintf("\tP: %d\n", P);
+        fprintf("\tPREDICTED TIME: %3.3g s (real %3.3g s, Fourier %3.3g s)\n",...
+                    cfg.total_time, cfg.real_time, cfg.kspace_time);
+    end
+end
+
 a = ceil(sqrt(npts/(Nb*A*B)));
+if autotune
+    % the grid the tuner chose, without rounding Nb back to it
+    a = cfg.nside_x/A;
+end
 
 m = 0.95*sqrt(pi*P);
 nside_x = a*A;
@@ -114,15 +215,83 @@ nside_y = a*B;
 rc = Lx/nside_x;
 
 xi = find_xi(Q,Lx,Ly,rc,tol);
-kinfx = find_kinfb(Q,Lx,Lx,xi,tol);
 
-Mx = min(2*kinfx,10000);
+% a precomputed real-space operator fixes xi and the grid, since Q and
+% hence xi change with the density
+if isstruct(real_op)
+    if ~strcmp(real_op.kernel,'dlp') || ...
+            real_op.num_sources ~= length(xsrc) || ...
+            real_op.num_targets ~= length(xtar) || ...
+            real_op.Lx ~= Lx || real_op.Ly ~= Ly
+        error('The real-space operator does not match the input.');
+    end
+    xi = real_op.xi;
+    nside_x = real_op.nside_x;
+    nside_y = real_op.nside_y;
+    rc = Lx/nside_x;
+end
+
+% so does a plan, which also holds the Fourier grid
+if isa(plan, 'EwaldPlan')
+    if ~strcmp(plan.kernel,'dlp') || ...
+            plan.num_sources ~= length(xsrc) || ...
+            plan.num_targets ~= length(xtar) || ...
+            plan.Lx ~= Lx || plan.Ly ~= Ly
+        error('The Ewald plan does not match the input.');
+    end
+    xi = plan.xi;
+    pinfo = info(plan);
+    nside_x = pinfo.nside_x;
+    nside_y = pinfo.nside_y;
+    rc = Lx/nside_x;
+end
 
-My = B * Mx;
-Mx = A * Mx;
+% a plan evaluates all pairs
+if ~isequal(plan, false) && ~isempty(exclude)
+    error('Exclusions cannot be used with an Ewald plan.');
+end
+
+if isstruct(real_op) || isa(plan, 'EwaldPlan')
+    kinfx = find_kinfb(Q,Lx,Lx,xi,tol);
+
+    Mx = min(2*kinfx,10000);
+
+    My = B * Mx;
+    Mx = A * Mx;
+
+    w = P*Lx/Mx/2;
+    eta = (2*xi*w/m)^2;
+else
+    % a coarser grid takes a smaller xi and fewer Fourier modes, which
+    % moves work to the real sum when the Fourier grids would not fit
+    % max_memory
+    par = mex_stokes_ewald_parameters('budget','dlp',0,Q,nside_x,nside_y,...
+                P,Lx,Ly,tol,max_memory);
+    if verbose && par.nside_x ~= nside_x
+        fprintf("Grid coarsened from %d x %d to %d x %d boxes to fit max_memory\n",...
+                    nside_x, nside_y, par.nside_x, par.nside_y);
+    end
+    if ~par.meets_tol
+        warning('The Fourier grids cannot meet tol within max_memory.');
+    end
+    nside_x = par.nside_x;
+    nside_y = par.nside_y;
+    rc = par.rc;
+    xi = par.xi;
+    kinfx = par.kinf;
+    Mx = par.Mx;
+    My = par.My;
+    w = par.w;
+    eta = par.eta;
+end
 
-w = P*Lx/Mx/2;
-eta = (2*xi*w/m)^2;
+if isa(plan, 'EwaldPlan')
+    Mx = pinfo.Mx;
+    My = pinfo.My;
+    w = pinfo.w;
+    eta = pinfo.eta;
+    P = pinfo.P;
+end
 
 if verbose
     fprintf("\nPARAMETER INFORMATION:\n")
@@ -137,21 +306,120 @@ if verbose
     tic
 end
 
-ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+if isequal(real_op, true)
+    real_op = mex_stokes_dlp_real_operator(psrc,ptar,n,xi,nside_x,nside_y,...
+                Lx,Ly,max_memory);
+    
+    if verbose
+        fprintf("TIME TO ASSEMBLE REAL-SPACE OPERATOR: %3.3g s\n", toc);
+        fprintf("MEMORY FOR REAL-SPACE OPERATOR: %3.3g MB (assembled: %d)\n",...
+                    real_op.memory/2^20, real_op.assembled);
+        tic
+    end
+end
 
-if verbose
-    fprintf("TIME FOR REAL SUM: %3.3g s\n", toc);
-    tic
+if isequal(plan, true)
+    plan = EwaldPlan('dlp',psrc,ptar,n,xi,nside_x,nside_y,eta,Mx,My,...
+                Lx,Ly,w,P,tol,kspace_variant);
+    
+    if verbose
+        fprintf("TIME TO MAKE EWALD PLAN: %3.3g s\n", toc);
+        tic
+    end
+elseif isa(plan, 'EwaldPlan')
+    rebuilt = move(plan, psrc, ptar, n);
+    
+    if verbose
+        fprintf("TIME TO MOVE EWALD PLAN: %3.3g s (rebuilt: %d)\n", toc, rebuilt);
+        tic
+    end
+end
+
+% the operator holds all pairs, so exclusions need the sum on the fly
+ur_skip = [];
+uk = [];
+if isa(plan, 'EwaldPlan')
+    [ur, uk, rstats] = execute(plan, f);
+    
+    if verbose
+        fprintf("TIME FOR REAL AND FOURIER SUMS (EWALD PLAN): %3.3g s\n", toc);
+        tic
+    end
+elseif isstruct(real_op) && real_op.assembled && isempty(exclude)
+    ur = mex_stokes_real_operator_apply(real_op, f);
+    
+    if verbose
+        fprintf("TIME FOR REAL SUM (PRECOMPUTED OPERATOR): %3.3g s\n", toc);
+        tic
+    end
+elseif concurrent
+    if isempty(exclude)
+        [ur, uk, rstats] = mex_stokes_dlp_ewald(psrc,ptar,f,n,xi,nside_x,...
+                    nside_y,eta,Mx,My,Lx,Ly,w,P,tol,[],[],max_memory);
+    else
+        [ur, uk, rstats, ur_skip] = mex_stokes_dlp_ewald(psrc,ptar,f,n,xi,nside_x,...
+                    nside_y,eta,Mx,My,Lx,Ly,w,P,tol,exclude{1},exclude{2},...
+                    max_memory);
+    end
+
+    if verbose
+        fprintf("TIME FOR REAL AND FOURIER SUMS: %3.3g s\n", toc);
+        fprintf("\tREAL SUM: %3.3g s (%d threads)\n",...
+                    rstats.real_time, rstats.real_threads);
+        fprintf("\tFOURIER SUM: %3.3g s (%d threads)\n",...
+                    rstats.kspace_time, rstats.kspace_threads);
+        fprintf("\tREAL PHASES: assign %3.3g s, pairs %3.3g s, copy out %3.3g s\n",...
+                    rstats.assign_time, rstats.pairs_time, rstats.copy_out_time);
+        fprintf("\tFOURIER PHASES: spread %3.3g s, fft %3.3g s, filter %3.3g s, ifft %3.3g s, gather %3.3g s\n",...
+                    rstats.spread_time, rstats.fft_time, rstats.filter_time,...
+                    rstats.ifft_time, rstats.gather_time);
+        fprintf("\tPAIRS: %d candidate, %d accepted; PEAK MEMORY: %3.3g MB\n",...
+                    rstats.candidate_pairs, rstats.accepted_pairs,...
+                    rstats.peak_memory/2^20);
+        tic
+    end
+else
+    if isempty(exclude)
+        [ur, rstats] = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly,tol,...
+                    [],[],max_memory);
+    else
+        [ur, rstats, ur_skip] = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly,tol,...
+                    exclude{1},exclude{2},max_memory);
+    end
+
+    if verbose
+        fprintf("TIME FOR REAL SUM: %3.3g s\n", toc);
+        fprintf("LOAD IMBALANCE IN REAL SUM: %3.3f (%d threads)\n",...
+                    rstats.imbalance, rstats.num_threads);
+        fprintf("MIXED PRECISION IN REAL SUM: %d\n", rstats.mixed_precision);
+        fprintf("TARGET CHUNKS IN REAL SUM: %d\n", rstats.num_chunks);
+        tic
+    end
+end
+
+rop = [];
+if isstruct(real_op)
+    rop = real_op;
+end
+if ~isa(plan, 'EwaldPlan')
+    plan = [];
 end
 
-uk = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,My,Lx,Ly,w,P);
+% the concurrent evaluation has done the Fourier sum already
+separate_kspace = isempty(uk);
+if separate_kspace
+    uk = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,My,Lx,Ly,w,P,...
+                'estimate',max_memory);
+end
 
 % Add on zero mode
 uk(1,:) = uk(1,:) + sum((f1.*n1 + f2.*n2).*xsrc) / (Lx*Ly);
 uk(2,:) = uk(2,:) + sum((f1.*n1 + f2.*n2).*ysrc) / (Lx*Ly);
 
 if verbose
-    fprintf("TIME FOR FOURIER SUM: %3.3g s\n", toc);
+    if separate_kspace
+        fprintf("TIME FOR FOURIER SUM: %3.3g s\n", toc);
+    end
     fprintf("*********************************************************\n\n");
 end
 
@@ -164,35 +432,15 @@ end
 
 %% Computing error estimates. Estimates come from Pålsson and Tornberg 2019 
 % https://arxiv.org/pdf/1909.12581.pdf
+% The estimates are solved by mex_stokes_ewald_parameters, see
+% ewald_parameters.h.
 
 % -------------------------------------------------------------------------
 % Given xi and tol, finds kinfbar according to estimate
 % -------------------------------------------------------------------------
 function k = find_kinfb(Q,Lx,Ly,xi,tol)
 
-% Find k using a Newton iteration (OBS kinf)
-k = round(5*xi);       % Initial guess
-maxit = 1e2; it = 0;
-
-f = @(k) sqrt(k*8*pi*Q*max(Lx,Ly)/Lx^3*Ly^3)*exp(-k^2/(4*xi^2)) - tol;
-fp = @(k) sqrt(8*pi*Q*max(Lx,Ly)/Lx^3*Ly^3)*exp(-k^2/(4*xi^2))*...
-            (0.5*k^(-1/2) - 2*k^(3/2)/(4*xi^2));
-
-%kdiff = 1;
-while abs(f(k)) > tol
-    if it > maxit
-        warning('SEStresslet:find_kinfb','Max nbr of iterations reached');
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    kdiff = min(f(k)/fp(k), 0.9*k);
-    k = k - kdiff;
-    
-    it = it + 1;
-end
-
-k = round(Lx*k/(2*pi));
+k = mex_stokes_ewald_parameters('kinf','dlp',0,Q,Lx,Ly,xi,tol);
 
 end
 
@@ -201,25 +449,6 @@ end
 % -------------------------------------------------------------------------
 function x = find_xi(Q,Lx,Ly,rc,tol)
 
-% Find xi using a Newton iteration
-x = 1/rc;       % Initial guess
-maxit = 1e2; it = 0;
-%xdiff = 1;
-
-f = @(a) exp(-a^2*rc^2)*a*rc*sqrt(2*pi*Q/(Lx*Ly)) - tol;
-fp = @(a) (1 - 2*a^2*rc^2)*exp(-a^2*rc^2)*sqrt(2*pi*Q/(Lx*Ly))*rc;
+x = mex_stokes_ewald_parameters('xi','dlp',0,Q,Lx,Ly,rc,tol);
 
-while abs(f(x)) > tol
-    if it > maxit
-        warning('SEStresslet:find_xi','Max nbr of iterations reached');
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    xdiff = min(f(x)/fp(x), 0.9*x); 
-    x = x - xdiff;
-    
-    it = it + 1;
 end
-
-end
\ No newline at end of file
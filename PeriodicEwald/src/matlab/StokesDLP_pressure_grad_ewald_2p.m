@@ -16,9 +16,11 @@ function [p,  pr, pk, xi] = StokesDLP_pressure_grad_ewald_2p(xsrc, ysrc,...
 %       Lx, the length of the periodic box in the x direction
 %       Ly, the length of the periodic box in the y direction
 %       vargargin can contain any or all of the following:
-%         'P', integer giving support points in each direction (default 24)
-%         'Nb', average number of points per box (default P*log2(#pts))
+%         'P', integer giving support points in each direction (default from
+%             tol, at most 24)
+%         'Nb', average number of points per box (default 24*log2(#pts))
 %         'tol', error tolerance for truncation of sums (default 1e-16)
+%             real-space pairs are evaluated in single precision for tol >= 1e-5
 %         'verbose', flag to write out parameter information
 % Output:
 %       p, pressure
@@ -28,10 +30,10 @@ function [p,  pr, pk, xi] = StokesDLP_pressure_grad_ewald_2p(xsrc, ysrc,...
 npts = length(xsrc)+length(xtar);
 
 %% set default parameter values 
-% support points in each direction
-P = 24;                    
+% support points in each direction, chosen from tol below unless given
+P = [];
 % average number of points per box for real space sum
-Nb = min(P*round(log2(npts)), npts/4);
+Nb = min(24*round(log2(npts)), npts/4);
 % tolerance, used to get parameters from estimates
 tol = 1e-16;  
 % print diagnostic information
@@ -60,6 +62,12 @@ if nargin > 8
     end
 end
 
+% the smallest P whose window truncation error exp(-m^2/2), with
+% m = 0.95*sqrt(pi*P), meets tol
+if isempty(P)
+    P = min(max(ceil(-log(tol)/(0.95^2*pi/2)), 4), 24);
+end
+
 % TO DO: ADD CHECKS ON INPUT DATA HERE
 
 %% Fix for matlab 2018/2019, not sure why this is necessary, but it seems 
@@ -137,10 +145,13 @@ if verbose
     tic
 end
 
-pr = mex_stokes_dlp_pressure_grad_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+[pr, rstats] = mex_stokes_dlp_pressure_grad_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly,tol);
 
 if verbose
     fprintf("TIME FOR REAL SUM: %3.3g s\n", toc);
+    fprintf("LOAD IMBALANCE IN REAL SUM: %3.3f (%d threads)\n",...
+                rstats.imbalance, rstats.num_threads);
+    fprintf("MIXED PRECISION IN REAL SUM: %d\n", rstats.mixed_precision);
     tic
 end
 
@@ -157,35 +168,16 @@ end
 
 %% Computing error estimates. Estimates come from Pålsson and Tornberg 2019 
 % https://arxiv.org/pdf/1909.12581.pdf
+% The estimates are for the pressure gradient, two derivatives of the
+% velocity. They are solved by mex_stokes_ewald_parameters, see
+% ewald_parameters.h.
 
 % -------------------------------------------------------------------------
 % Given xi and tol, finds kinfbar according to estimate
 % -------------------------------------------------------------------------
 function k = find_kinfb(Q,Lx,Ly,xi,tol)
 
-% Find k using a Newton iteration (OBS kinf)
-k = round(5*xi);       % Initial guess
-maxit = 1e2; it = 0;
-
-f = @(k) sqrt(k*8*pi*Q*max(Lx,Ly)/Lx^3*Ly^3)*exp(-k^2/(4*xi^2)) - tol;
-fp = @(k) sqrt(8*pi*Q*max(Lx,Ly)/Lx^3*Ly^3)*exp(-k^2/(4*xi^2))*...
-            (0.5*k^(-1/2) - 2*k^(3/2)/(4*xi^2));
-
-%kdiff = 1;
-while abs(f(k)) > tol
-    if it > maxit
-        warning('SEStresslet:find_kinfb','Max nbr of iterations reached');
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    kdiff = min(f(k)/fp(k), 0.9*k);
-    k = k - kdiff;
-    
-    it = it + 1;
-end
-
-k = round(Lx*k/(2*pi));
+k = mex_stokes_ewald_parameters('kinf','dlp',2,Q,Lx,Ly,xi,tol);
 
 end
 
@@ -194,25 +186,6 @@ end
 % -------------------------------------------------------------------------
 function x = find_xi(Q,Lx,Ly,rc,tol)
 
-% Find xi using a Newton iteration
-x = 1/rc;       % Initial guess
-maxit = 1e2; it = 0;
-%xdiff = 1;
+x = mex_stokes_ewald_parameters('xi','dlp',2,Q,Lx,Ly,rc,tol);
 
-f = @(a) exp(-a^2*rc^2)*a*rc*sqrt(2*pi*Q/(Lx*Ly)) - tol;
-fp = @(a) (1 - 2*a^2*rc^2)*exp(-a^2*rc^2)*sqrt(2*pi*Q/(Lx*Ly))*rc;
-
-while abs(f(x)) > tol
-    if it > maxit
-        warning('SEStresslet:find_xi','Max nbr of iterations reached');
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    xdiff = min(f(x)/fp(x), 0.9*x); 
-    x = x - xdiff;
-    
-    it = it + 1;
 end
-
-end
\ No newline at end of file
@@ -14,10 +14,16 @@ function [u1, u2, ur, uk, xi] = StokesSLP_gradient_ewald_2p(xsrc, ysrc,...
 %       b2, y component of target_direction vector
 %       Lx, the length of the periodic box in the x direction
 %       Ly, the length of the periodic box in the y direction
-%         'P', integer giving support points in each direction (default 24)
-%         'Nb', average number of points per box (default P*log2(#pts))
+%         'P', integer giving support points in each direction (default from
+%             tol, at most 24)
+%         'Nb', average number of points per box (default 24*log2(#pts))
 %         'tol', error tolerance for truncation of sums (default 1e-16)
+%             real-space pairs are evaluated in single precision for tol >= 1e-5
 %         'verbose', flag to write out parameter information
+%         'kspace_variant', variant of the Fourier sum: 'estimate'
+%             (default), 'measure' to time each variant and keep the
+%             fastest for calls of the same size, or the name of a
+%             variant (see kspace_variants.h)
 % Output:
 %       u1, x component of velocity
 %       u2, y component of velocity
@@ -29,14 +35,16 @@ function [u1, u2, ur, uk, xi] = StokesSLP_gradient_ewald_2p(xsrc, ysrc,...
 npts = length(xsrc)+length(xtar);
 
 %% set default parameter values 
-% support points in each direction
-P = 24;                    
+% support points in each direction, chosen from tol below unless given
+P = [];
 % average number of points per box for real space sum
-Nb = min(P*round(log2(npts)), npts/4);
+Nb = min(24*round(log2(npts)), npts/4);
 % tolerance, used to get parameters from estimates
 tol = 1e-16;  
 % print diagnostic information
 verbose = 0;
+% variant of the Fourier sum
+kspace_variant = 'estimate';
 
 %% read in optional input parameters
 if nargin > 8
@@ -56,11 +64,20 @@ if nargin > 8
                
            case 'verbose'
                verbose = varargin{jv+1};
+               
+           case 'kspace_variant'
+               kspace_variant = varargin{jv+1};
        end
        jv = jv + 2;
     end
 end
 
+% the smallest P whose window truncation error exp(-m^2/2), with
+% m = 0.95*sqrt(pi*P), meets tol
+if isempty(P)
+    P = min(max(ceil(-log(tol)/(0.95^2*pi/2)), 4), 24);
+end
+
 % TO DO: ADD CHECKS ON INPUT DATA HERE
 %% Fix for matlab 2018/2019, not sure why this is necessary, but it seems 
 % to work. 
@@ -128,7 +145,7 @@ if verbose
     tic
 end
 
-ur_tmp = mex_stokes_slp_gradient_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+[ur_tmp, rstats] = mex_stokes_slp_gradient_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly,tol);
 
 ur = zeros(2,length(xtar));
 ur(1,:) = ur_tmp(1,:).*b1' + ur_tmp(3,:).*b2';
@@ -136,14 +153,14 @@ ur(2,:) = ur_tmp(2,:).*b1' + ur_tmp(4,:).*b2';
 
 if verbose
     fprintf("TIME FOR REAL SUM: %3.3g s\n", toc);
+    fprintf("LOAD IMBALANCE IN REAL SUM: %3.3f (%d threads)\n",...
+                rstats.imbalance, rstats.num_threads);
+    fprintf("MIXED PRECISION IN REAL SUM: %d\n", rstats.mixed_precision);
     tic
 end
 
-% old mex that does not work
-% uk_tmp = mex_stokes_slp_gradient_kspace_old(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P)
-
-% new mex that works
-uk_tmp = mex_stokes_slp_gradient_kspace(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P);
+[uk_tmp, used_variant] = mex_stokes_slp_gradient_kspace(psrc,ptar,xi,eta,...
+            f,Mx,My,Lx,Ly,w,P,kspace_variant);
 
 uk = zeros(2,length(xtar));
 uk(1,:) = uk_tmp(1,:).*b1' + uk_tmp(3,:).*b2';
@@ -151,6 +168,7 @@ uk(2,:) = uk_tmp(2,:).*b1' + uk_tmp(4,:).*b2';
 
 if verbose
     fprintf("TIME FOR FOURIER SUM: %3.3g s\n", toc);
+    fprintf("FOURIER SUM VARIANT: %s\n", used_variant);
     fprintf("*********************************************************\n\n");
 end
 
@@ -164,35 +182,16 @@ end
 
 %% Computing error estimates. Estimates come from Pålsson and Tornberg 2019 
 % https://arxiv.org/pdf/1909.12581.pdf
+% The estimates are for the gradient, one derivative of the
+% velocity. They are solved by mex_stokes_ewald_parameters, see
+% ewald_parameters.h.
 
 % -------------------------------------------------------------------------
 % Given xi and tol, finds kinfbar according to estimate
 % -------------------------------------------------------------------------
 function k = find_kinfb(Q,Lx,Ly,xi,tol)
 
-% Find k using a Newton iteration (OBS kinf)
-k = round(5*xi);       % Initial guess
-maxit = 1e2; it = 0;
-
-f = @(k) sqrt(4*Q*pi*max(Lx,Ly)/(Lx^3*Ly^3*k))*exp(-k^2/(4*xi^2)) - tol;
-fp = @(k) -sqrt(4*Q*pi*max(Lx,Ly)/(Lx^3*Ly^3))*exp(-k^2/(4*xi^2))*...
-                (0.5*k^(-1.5) + sqrt(1/k)*2*k/(4*xi^2));
-
-%kdiff = 1;
-while abs(f(k)) > tol
-    if it > maxit
-        disp("Couldn't find suitable k! Break")
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    kdiff = min(f(k)/fp(k), 0.9*k);
-    k = k - kdiff;
-    
-    it = it + 1;
-end
-
-k = round(Lx*k/(2*pi));
+k = mex_stokes_ewald_parameters('kinf','slp',1,Q,Lx,Ly,xi,tol);
 
 end
 
@@ -201,27 +200,6 @@ end
 % -------------------------------------------------------------------------
 function x = find_xi(Q,Lx,Ly,rc,tol)
 
-% Find xi using a Newton iteration
-x = 4/rc;       % Initial guess
-maxit = 1e2; it = 0;
+x = mex_stokes_ewald_parameters('xi','slp',1,Q,Lx,Ly,rc,tol);
 
-% estimates from paper
-f = @(x) sqrt(Q * pi/(4*Lx*Ly*x))*exp(-x^2*rc^2) - tol;
-fp = @(x) -sqrt(Q*pi/(4*Lx*Ly))*exp(-x^2*rc^2)*(0.5*x^(-1.5)+...
-                2*rc^2*x*sqrt(1/x));
-
-%xdiff = 1;
-while abs(f(x)) > tol
-    if it > maxit
-        disp("Couldn't find suitable xi! Break")
-        break;
-    end
-    
-    % limit the step size in the negative direction
-    xdiff = min(f(x)/fp(x), 0.9*x); 
-    x = x - xdiff;
-    
-    it = it + 1;
 end
-
-end
\ No newline at end of file
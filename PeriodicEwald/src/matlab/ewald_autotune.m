@@ -0,0 +1,91 @@
+function cfg = ewald_autotune(kernel, Nsrc, Ntar, Lx, Ly, tol, find_xi, find_kinf, max_memory)
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+% Chooses the parameters of a spectral Ewald velocity evaluation that give
+% the shortest predicted time for the tolerance, from the cost model of
+% ewald_cost_model.
+%
+% Input:
+%       kernel, 'slp' or 'dlp'
+%       Nsrc, Ntar, number of sources and targets
+%       Lx, Ly, the size of the periodic box
+%       tol, error tolerance
+%       find_xi, @(rc) the xi that meets tol for the cutoff rc
+%       find_kinf, @(xi) the number of Fourier modes kinf that meets tol
+%           for xi, in the x direction
+%       max_memory, optional budget in bytes for the Fourier grids
+%           (default 0, no budget)
+% Output:
+%       cfg, struct with the chosen Nb, nside_x, nside_y, xi, P, Mx, My,
+%           w and eta, the predicted real_time, kspace_time and
+%           total_time in seconds and the kspace_memory of the Fourier
+%           grids in bytes
+%
+% The grid of the real-space sum is the only free choice: a finer grid
+% gives a shorter cutoff and fewer pairs, but a larger xi and hence a
+% larger Fourier grid. All grids with at least one point per box are
+% tried. P is chosen from tol as in the Ewald sums, as the smallest number
+% of support points whose window error exp(-m^2/2), with
+% m = 0.95*sqrt(pi*P), meets tol. Grids whose Fourier sum needs more than
+% 10000 modes per period or more memory than max_memory are only chosen
+% if no grid fits.
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+if nargin < 9
+    max_memory = 0;
+end
+
+model = ewald_cost_model(kernel);
+kspace_grids = mex_stokes_ewald_parameters('grids', kernel, 0);
+
+if strcmp(kernel, 'slp')
+    ngrids = 2;
+else
+    ngrids = 4;
+end
+if tol >= 1e-5
+    pair_time = model.pair_time_mixed;
+else
+    pair_time = model.pair_time;
+end
+
+P = ceil(-log(tol)/(0.95^2*pi/2));
+P = min(max(P, 4), 24);
+m = 0.95*sqrt(pi*P);
+
+[A,B] = rat(Lx/Ly);
+npts = Nsrc + Ntar;
+amax = max(1, floor(sqrt(npts/(A*B))));
+
+cfg = [];
+for a = 1:amax
+    nside_x = a*A;
+    nside_y = a*B;
+    rc = Lx/nside_x;
+
+    xi = find_xi(rc);
+    kinfx = find_kinf(xi);
+    Mx = min(2*kinfx,10000);
+    My = B * Mx;
+    Mx = A * Mx;
+
+    M = Mx*My;
+    kspace_memory = kspace_grids*M*8;
+    fits = 2*kinfx <= 10000 && (max_memory == 0 || kspace_memory <= max_memory);
+    real_time = pair_time*9*Nsrc*Ntar/(nside_x*nside_y);
+    kspace_time = model.spread_time*(Nsrc*ngrids + 2*Ntar)*P^2 + ...
+                model.fft_time*2*ngrids*M*log2(max(M,2));
+
+    if isempty(cfg) || (fits && ~cfg_fits) || ...
+            (fits == cfg_fits && real_time + kspace_time < cfg.total_time)
+        cfg_fits = fits;
+        w = P*Lx/Mx/2;
+        cfg = struct('Nb', npts/(nside_x*nside_y), 'nside_x', nside_x,...
+                    'nside_y', nside_y, 'xi', xi, 'P', P, 'Mx', Mx,...
+                    'My', My, 'w', w, 'eta', (2*xi*w/m)^2,...
+                    'real_time', real_time, 'kspace_time', kspace_time,...
+                    'total_time', real_time + kspace_time,...
+                    'kspace_memory', kspace_memory);
+    end
+end
+
+end
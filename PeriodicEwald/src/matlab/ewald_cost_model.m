@@ -0,0 +1,137 @@
+function model = ewald_cost_model(kernel, refresh)
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+% Cost model of the spectral Ewald velocity evaluation on this machine,
+% measured by timing small real-space and Fourier-space sums.
+%
+% Input:
+%       kernel, 'slp' or 'dlp'
+%       refresh, flag to measure again instead of using the stored model
+%           (default false)
+% Output:
+%       model, struct with the time in seconds of
+%           pair_time, one real-space pair in double precision
+%           pair_time_mixed, one real-space pair at a tolerance that
+%               allows mixed precision, which only the dlp uses
+%           spread_time, one support point of a source or a target when
+%               spreading and gathering
+%           fft_time, one grid point of an FFT, per log2 of the grid size
+%       and num_threads, the number of threads it was measured with.
+%
+% The real-space time is pair_time times the 9*Nsrc*Ntar/(nside_x*nside_y)
+% candidate pairs, and the Fourier-space time spread_time times
+% (Nsrc*ngrids + 2*Ntar)*P^2 plus fft_time times 2*ngrids*M*log2(M), with
+% ngrids = 2 (slp) or 4 (dlp) and M = Mx*My, as in ewald_driver.h. The
+% model is kept for the session and stored in prefdir, and is measured
+% again if the number of threads has changed.
+% - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+persistent models
+
+if nargin < 2
+    refresh = false;
+end
+
+file = fullfile(prefdir, 'ewald_cost_model.mat');
+if isempty(models)
+    models = struct();
+    if exist(file, 'file')
+        stored = load(file);
+        models = stored.models;
+    end
+end
+
+nthreads = maxNumCompThreads;
+if ~refresh && isfield(models, kernel) && ...
+        models.(kernel).num_threads == nthreads
+    model = models.(kernel);
+    return
+end
+
+rng_state = rng;
+rng(1);
+
+Lx = 1;
+Ly = 1;
+xi = 20;
+m = 0.95*sqrt(pi*16);
+
+%% real-space pairs, in double and in mixed precision
+N = 4000;
+nside = 8;
+psrc = rand(2,N) - 0.5;
+ptar = rand(2,N) - 0.5;
+f = rand(2,N);
+t = 2*pi*rand(1,N);
+n = [cos(t); sin(t)];
+
+pair_time = zeros(1,2);
+tols = [0 1e-5];
+for j = 1:2
+    best = inf;
+    for rep = 1:3
+        tic
+        if strcmp(kernel, 'slp')
+            [~, stats] = mex_stokes_slp_real(psrc,ptar,f,xi,nside,nside,...
+                        Lx,Ly,tols(j));
+        else
+            [~, stats] = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside,nside,...
+                        Lx,Ly,tols(j));
+        end
+        best = min(best, toc);
+    end
+    pair_time(j) = best/stats.candidate_pairs;
+end
+
+%% Fourier space, once dominated by spreading and once by the FFTs
+if strcmp(kernel, 'slp')
+    ngrids = 2;
+else
+    ngrids = 4;
+end
+P = 16;
+sizes = [40000 64; 500 512];
+times = zeros(2,1);
+work = zeros(2,2);
+for j = 1:2
+    N = sizes(j,1);
+    M = sizes(j,2);
+    psrc = rand(2,N) - 0.5;
+    f = rand(2,N);
+    t = 2*pi*rand(1,N);
+    n = [cos(t); sin(t)];
+    w = P*Lx/M/2;
+    eta = (2*xi*w/m)^2;
+
+    best = inf;
+    for rep = 1:3
+        tic
+        if strcmp(kernel, 'slp')
+            mex_stokes_slp_kspace(psrc,psrc,xi,eta,f,M,M,Lx,Ly,w,P);
+        else
+            mex_stokes_dlp_kspace(psrc,psrc,xi,eta,f,n,M,M,Lx,Ly,w,P);
+        end
+        best = min(best, toc);
+    end
+    times(j) = best;
+    work(j,:) = [(N*ngrids + 2*N)*P^2, 2*ngrids*M^2*log2(M^2)];
+end
+
+% the two rates from the two timings, each at least its share of the
+% timing it dominates
+rates = work\times;
+rates(1) = max(rates(1), 0.1*times(1)/work(1,1));
+rates(2) = max(rates(2), 0.1*times(2)/work(2,2));
+
+rng(rng_state);
+
+model = struct('pair_time', pair_time(1), 'pair_time_mixed', pair_time(2),...
+            'spread_time', rates(1), 'fft_time', rates(2),...
+            'num_threads', nthreads);
+models.(kernel) = model;
+try
+    save(file, 'models');
+catch
+    % the model is still kept for the session
+end
+
+end
@@ -0,0 +1,199 @@
+#include "mex.h"
+#include "ewald_driver.h"
+#include "kspace.h"
+#include "kspace_variants.h"
+#include "real_space.h"
+
+#include <string.h>
+
+//The arguments of the two parts of the evaluation.
+typedef struct {
+    double* psrc;
+    double* ptar;
+    double* f;
+    double* n;
+    int Nsrc;
+    int Ntar;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    const RealSpaceOptions* opt;
+    double** output;
+    RealSpaceStats* stats;
+    KSpaceStats* kstats;
+    double max_memory;
+    double* uk;
+} EwaldData;
+
+static void RealPart(void* data){
+
+    EwaldData* d = (EwaldData*) data;
+    PointSet psrc = InterleavedPoints(d->psrc);
+    PointSet ptar = InterleavedPoints(d->ptar);
+    StokesDLPRealSpaceEx(&psrc, &ptar, d->f, d->n, d->Nsrc, d->Ntar,
+            d->xi, d->nside_x, d->nside_y, d->Lx, d->Ly, d->opt, d->output,
+            d->stats);
+}
+
+static void KSpacePart(void* data){
+
+    EwaldData* d = (EwaldData*) data;
+    KSpaceArgs args;
+    args.psrc = d->psrc;
+    args.ptar = d->ptar;
+    args.f = d->f;
+    args.n = d->n;
+    args.Nsrc = d->Nsrc;
+    args.Ntar = d->Ntar;
+    args.xi = d->xi;
+    args.eta = d->eta;
+    args.Mx = d->Mx;
+    args.My = d->My;
+    args.Lx = d->Lx;
+    args.Ly = d->Ly;
+    args.w = d->w;
+    args.P = d->P;
+    args.filter = NULL;
+    args.stats = d->kstats;
+    args.max_memory = d->max_memory;
+
+    //The grids are streamed if they would exceed the budget otherwise.
+    RunKSpaceVariant(KS_DLP_VELOCITY, KS_ESTIMATE, &args, d->uk, NULL);
+}
+
+/*------------------------------------------------------------------------
+ *Real-space and Fourier-space parts of the Ewald sum for the velocity of
+ *the stresslet, evaluated at the same time by RunConcurrently(), e.g.
+ *
+ *  [ur, uk, stats] = mex_stokes_dlp_ewald(psrc,ptar,f,n,xi,...
+ *                  nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,tol);
+ *
+ *ur and uk are identical to the outputs of mex_stokes_dlp_real and
+ *mex_stokes_dlp_kspace. The optional third output holds the real-space
+ *and k-space statistics, with the times of their phases, together with
+ *the thread split, the time of each part and the peak memory.
+ *The tolerance and the trailing (excl_ptr, excl_src, max_memory) inputs
+ *are optional and as for mex_stokes_dlp_real, whose skipped pairs are
+ *returned in a fourth output. max_memory also bounds the grids of the
+ *Fourier sum, which are streamed if they would exceed it. As for mex_stokes_dlp_kspace the zero mode
+ *is not included in uk.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 14 && nrhs != 15 && nrhs != 17 && nrhs != 18)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    if(mxGetM(prhs[2]) != 2)
+        mexErrMsgTxt("f must be a 2xn matrix.");
+    if(mxGetM(prhs[3]) != 2)
+        mexErrMsgTxt("n must be a 2xn matrix.");
+    if(mxGetN(prhs[2]) != mxGetN(prhs[0]))
+        mexErrMsgTxt("psrc and f must be the same size.");
+    if(mxGetN(prhs[3]) != mxGetN(prhs[0]))
+        mexErrMsgTxt("psrc and n must be the same size.");
+    
+    EwaldData d;
+    
+    //Source and target points.
+    d.psrc = mxGetPr(prhs[0]);
+    d.ptar = mxGetPr(prhs[1]);
+    d.Nsrc = mxGetN(prhs[0]);
+    d.Ntar = mxGetN(prhs[1]);
+    
+    //Density and normal vectors
+    d.f = mxGetPr(prhs[2]);
+    d.n = mxGetPr(prhs[3]);
+    
+    //Ewald parameter xi
+    d.xi = mxGetScalar(prhs[4]);
+    
+    //Number of bins per side
+    d.nside_x = static_cast<int>(mxGetScalar(prhs[5]));
+    d.nside_y = static_cast<int>(mxGetScalar(prhs[6]));
+    
+    //Splitting parameter eta
+    d.eta = mxGetScalar(prhs[7]);
+    
+    //Number of grid intervals in each direction
+    d.Mx = static_cast<int>(mxGetScalar(prhs[8]));
+    d.My = static_cast<int>(mxGetScalar(prhs[9]));
+    
+    //Size of the domain
+    d.Lx = mxGetScalar(prhs[10]);
+    d.Ly = mxGetScalar(prhs[11]);
+    
+    //Width of the Gaussian bell curves
+    d.w = mxGetScalar(prhs[12]);
+    
+    //Number of support nodes
+    d.P = static_cast<int>(mxGetScalar(prhs[13]));
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 14) ? mxGetScalar(prhs[14]) : 0;
+    
+    //Source-target pairs to leave out, none if excl_ptr is empty
+    int exclude = (nrhs > 15 && !mxIsEmpty(prhs[15]));
+    ExclusionList excl;
+    
+    //Bound on the working memory of the real sum and of the grids of the
+    //Fourier sum in bytes, none if 0
+    double max_memory = (nrhs > 17) ? mxGetScalar(prhs[17]) : 0;
+    d.max_memory = max_memory;
+    
+    if(exclude)
+        ParseExclusions(prhs[15], prhs[16], d.Ntar, d.Nsrc, &excl);
+    if(nlhs > 3 && !exclude)
+        mexErrMsgTxt("The skipped pairs can only be returned with an exclusion list.");
+    
+    //All Matlab arrays are created here, on the Matlab thread.
+    plhs[0] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    plhs[1] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = mxGetPr(plhs[0]);
+    
+    double* skipped[RS_NUM_QUANTITIES] = {NULL};
+    if(exclude && nlhs > 3) {
+        plhs[3] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+        skipped[RS_VELOCITY] = mxGetPr(plhs[3]);
+    }
+    
+    RealSpaceOptions opt;
+    opt.precision = ChoosePrecision(tol, DLP_KERNEL, RS_VELOCITY);
+    opt.excl = exclude ? &excl : NULL;
+    opt.skipped = skipped;
+    opt.max_memory = max_memory;
+    opt.near_field = NF_AUTO;
+    
+    RealSpaceStats stats;
+    KSpaceStats kstats;
+    ConcurrentStats cstats;
+    d.opt = &opt;
+    d.output = output;
+    d.stats = &stats;
+    memset(&kstats, 0, sizeof(KSpaceStats));
+    d.kstats = &kstats;
+    d.uk = mxGetPr(plhs[1]);
+    
+    RunConcurrently(RealPart, KSpacePart, &d,
+            RealSpaceWork(d.Nsrc, d.Ntar, d.nside_x, d.nside_y),
+            KSpaceWork(d.Nsrc, d.Ntar, d.Mx, d.My, d.P, 4), &cstats);
+    if(exclude)
+        FreeExclusionList(&excl);
+    
+    if(nlhs > 2) {
+        plhs[2] = EwaldStatsToStruct(&stats, &kstats, &cstats);
+    }
+}
@@ -0,0 +1,83 @@
+#include "mex.h"
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Updates the real-space part of the Ewald sum for the velocity of the
+ *stresslet, ur from an earlier call to mex_stokes_dlp_real, after some
+ *of the sources and targets changed, see StokesDLPRealSpaceUpdate in
+ *real_space.h. src_idx lists the changed sources (1-based), psrc_old,
+ *f_old and n_old (2 x length(src_idx)) their old positions, densities
+ *and normals, and tar_idx the targets that moved. psrc, ptar, f and n
+ *hold the new values. An optional last input gives the error tolerance,
+ *see ChoosePrecision().
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 15 && nrhs != 16)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    if(mxGetM(prhs[2]) != 2)
+        mexErrMsgTxt("f must be a 2xn matrix.");
+    if(mxGetM(prhs[3]) != 2)
+        mexErrMsgTxt("n must be a 2xn matrix.");
+    if(mxGetN(prhs[2]) != mxGetN(prhs[0]) || mxGetN(prhs[3]) != mxGetN(prhs[0]))
+        mexErrMsgTxt("psrc, f and n must be the same size.");
+    if(mxGetM(prhs[4]) != 2 || mxGetN(prhs[4]) != mxGetN(prhs[1]))
+        mexErrMsgTxt("ur must be a 2xn matrix, with one column per target.");
+    
+    //Source and target points.
+    double* psrc = mxGetPr(prhs[0]);
+    double* ptar = mxGetPr(prhs[1]);
+    int Nsrc = mxGetN(prhs[0]);
+    int Ntar = mxGetN(prhs[1]);
+    
+    //Strength and normal vectors
+    double *f = mxGetPr(prhs[2]);
+    double *n = mxGetPr(prhs[3]);
+    
+    //Changed sources, with their old positions, strengths and normals
+    int* src_idx;
+    int nchanged_src = ParseIndices(prhs[5], Nsrc, &src_idx);
+    for(int k = 6;k<9;k++)
+        if(mxGetM(prhs[k]) != 2 || static_cast<int>(mxGetN(prhs[k])) != nchanged_src)
+            mexErrMsgTxt("psrc_old, f_old and n_old must be 2xn matrices, with one column per changed source.");
+    double* psrc_old = mxGetPr(prhs[6]);
+    double* f_old = mxGetPr(prhs[7]);
+    double* n_old = mxGetPr(prhs[8]);
+    
+    //Changed targets
+    int* tar_idx;
+    int nchanged_tar = ParseIndices(prhs[9], Ntar, &tar_idx);
+    
+    //Ewald parameter xi
+    double xi = mxGetScalar(prhs[10]);
+    
+    //Number of bins per side
+    int nside_x = static_cast<int>(mxGetScalar(prhs[11]));
+    int nside_y = static_cast<int>(mxGetScalar(prhs[12]));
+    
+    //Size of reference cell
+    double Lx = mxGetScalar(prhs[13]);
+    double Ly = mxGetScalar(prhs[14]);
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 15) ? mxGetScalar(prhs[15]) : 0;
+    
+    plhs[0] = mxDuplicateArray(prhs[4]);
+    
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = mxGetPr(plhs[0]);
+    
+    StokesDLPRealSpaceUpdate(psrc, ptar, f, n, Nsrc, Ntar, src_idx,
+            nchanged_src, psrc_old, f_old, n_old, tar_idx, nchanged_tar, xi,
+            nside_x, nside_y, Lx, Ly,
+            ChoosePrecision(tol, DLP_KERNEL, RS_VELOCITY), output);
+    
+    mxFree(src_idx);
+    mxFree(tar_idx);
+}
@@ -1,4 +1,6 @@
 #include "ewald_tools.h"
+#include "mx_complex.h"
+#include "scratch_arena.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
@@ -66,14 +68,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     fft2rhs[2] = mxCreateDoubleMatrix(My, Mx, mxREAL);
     fft2rhs[3] = mxCreateDoubleMatrix(My, Mx, mxREAL);
     
-    double* H1 = mxGetPr(fft2rhs[0]);    
-    double* H2 = mxGetPr(fft2rhs[1]);    
-    double* H3 = mxGetPr(fft2rhs[2]);    
-    double* H4 = mxGetPr(fft2rhs[3]);
+    double* H1 = RealData(fft2rhs[0]);    
+    double* H2 = RealData(fft2rhs[1]);    
+    double* H3 = RealData(fft2rhs[2]);    
+    double* H4 = RealData(fft2rhs[3]);
     
     //Have to multiply components of f and n before speading
-    double* v1 = new double[2*Nsrc];
-    double* v2 = new double[2*Nsrc];
+    ScratchBuffer<double> v1(2*Nsrc);
+    ScratchBuffer<double> v2(2*Nsrc);
     for (int i = 0; i < Nsrc; i++)
     {
         v1[2*i] = f[2*i]*n[2*i];          //f1 * n1
@@ -83,9 +85,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     }
     
     //This is the precomputable part of the fast Gaussian gridding.
-    double* e1 = new double[P+1];
+    ScratchBuffer<double> e1(P+1);
     Spread(H1, H2, e1, psrc, v1, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
     Spread(H3, H4, e1, psrc, v2, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
+    v1.Free();
+    v2.Free();
     
     //---------------------------------------------------------------------
     //Step 2 : Frequency space filter
@@ -96,48 +100,24 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     //Call Matlab's routines to compute the 2D FFT. Other choices,
     //such as fftw could possibly be better, mainly because of the poor
     //complex data structure Matlab uses which we now have to deal with.
-    mexCallMATLAB(1,&fft2lhs[0],1,&fft2rhs[0],"fft2");
-    mexCallMATLAB(1,&fft2lhs[1],1,&fft2rhs[1],"fft2");
-    mexCallMATLAB(1,&fft2lhs[2],1,&fft2rhs[2],"fft2");
-    mexCallMATLAB(1,&fft2lhs[3],1,&fft2rhs[3],"fft2");
+    MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+    MatlabTransform(&fft2lhs[1], fft2rhs[1], "fft2");
+    MatlabTransform(&fft2lhs[2], fft2rhs[2], "fft2");
+    MatlabTransform(&fft2lhs[3], fft2rhs[3], "fft2");
     
-    //The output of the FFT is complex. Get pointers to the real and
-    //imaginary parts of the Hhats.
-    double* Hhat1_re = mxGetPr(fft2lhs[0]);
-    double* Hhat1_im = mxGetPi(fft2lhs[0]);
+    //The output of the FFT is complex. Get views of the real and
+    //imaginary parts of the Hhats, see mx_complex.h.
+    ComplexPart Hhat1_re = RealPart(fft2lhs[0]);
+    ComplexPart Hhat1_im = ImagPart(fft2lhs[0]);
     
-    double* Hhat2_re = mxGetPr(fft2lhs[1]);
-    double* Hhat2_im = mxGetPi(fft2lhs[1]);
+    ComplexPart Hhat2_re = RealPart(fft2lhs[1]);
+    ComplexPart Hhat2_im = ImagPart(fft2lhs[1]);
     
-    double* Hhat3_re = mxGetPr(fft2lhs[2]);
-    double* Hhat3_im = mxGetPi(fft2lhs[2]);
+    ComplexPart Hhat3_re = RealPart(fft2lhs[2]);
+    ComplexPart Hhat3_im = ImagPart(fft2lhs[2]);
     
-    double* Hhat4_re = mxGetPr(fft2lhs[3]);
-    double* Hhat4_im = mxGetPi(fft2lhs[3]);
-    
-    //We cannot assume that the imaginary parts of the
-    //Fourier transforms are non-zero. Let Matlab take care of the
-    //memory management.
-    mwSize cs = Mx*My;
-    
-    if(Hhat1_im == NULL) {
-        Hhat1_im = (double*) mxCalloc(cs,sizeof(double));
-        mxSetPi(fft2lhs[0],Hhat1_im);
-    }
-    if(Hhat2_im == NULL) {
-        Hhat2_im = (double*) mxCalloc(cs,sizeof(double));
-        mxSetPi(fft2lhs[1],Hhat2_im);
-    }
-    
-    if(Hhat3_im == NULL) {
-        Hhat3_im = new double[Mx*My];
-        mxSetPi(fft2lhs[2],Hhat3_im);
-    }
-    
-    if(Hhat4_im == NULL) {
-        Hhat4_im = new double[Mx*My];
-        mxSetPi(fft2lhs[3],Hhat4_im);
-    }
+    ComplexPart Hhat4_re = RealPart(fft2lhs[3]);
+    ComplexPart Hhat4_im = ImagPart(fft2lhs[3]);
     
     //Apply filter in the frequency domain. This is a completely
     //parallel operation. The FFT gives the frequency components in
@@ -277,16 +257,16 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     mxDestroyArray(fft2rhs[3]);
     
     //Do the inverse 2D FFTs. We use Matlab's inbuilt functions again.
-    mexCallMATLAB(1,&fft2rhs[0],1,&fft2lhs[0],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[1],1,&fft2lhs[1],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[2],1,&fft2lhs[2],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[3],1,&fft2lhs[3],"ifft2");
+    MatlabTransform(&fft2rhs[0], fft2lhs[0], "ifft2");
+    MatlabTransform(&fft2rhs[1], fft2lhs[1], "ifft2");
+    MatlabTransform(&fft2rhs[2], fft2lhs[2], "ifft2");
+    MatlabTransform(&fft2rhs[3], fft2lhs[3], "ifft2");
     
     //The pointer to the real part. We don't need the imaginary part.
-    double* Ht1 = mxGetPr(fft2rhs[0]);
-    double* Ht2 = mxGetPr(fft2rhs[1]);
-    double* Ht3 = mxGetPr(fft2rhs[2]);
-    double* Ht4 = mxGetPr(fft2rhs[3]);
+    double* Ht1 = RealGrid(fft2rhs[0]);
+    double* Ht2 = RealGrid(fft2rhs[1]);
+    double* Ht3 = RealGrid(fft2rhs[2]);
+    double* Ht4 = RealGrid(fft2rhs[3]);
     
     //In case the inverse FFTs are purely imaginary. Not likely to happen, 
     //but the program would crash without guarding for this.
@@ -335,6 +315,4 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     mxDestroyArray(fft2rhs[1]);
     mxDestroyArray(fft2rhs[2]);
     mxDestroyArray(fft2rhs[3]);
-    
-    delete e1;
 }
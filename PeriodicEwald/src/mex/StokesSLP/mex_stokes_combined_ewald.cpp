@@ -0,0 +1,172 @@
+#include "mex.h"
+#include "ewald_driver.h"
+#include "kspace.h"
+#include "real_space.h"
+
+#include <string.h>
+
+//The arguments of the two parts of the evaluation.
+typedef struct {
+    double* psrc;
+    double* ptar;
+    double* f;
+    double* g;
+    double* n;
+    double alpha;
+    double beta;
+    int Nsrc;
+    int Ntar;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    const RealSpaceOptions* opt;
+    RealSpaceStats* stats;
+    KSpaceStats* kstats;
+    double* ur;
+    double* uk;
+} CombinedData;
+
+static void RealPart(void* data){
+
+    CombinedData* d = (CombinedData*) data;
+    StokesCombinedRealSpace(d->psrc, d->ptar, d->f, d->g, d->n, d->alpha,
+            d->beta, d->Nsrc, d->Ntar, d->xi, d->nside_x, d->nside_y,
+            d->Lx, d->Ly, d->opt, d->ur, d->stats);
+}
+
+static void KSpacePart(void* data){
+
+    CombinedData* d = (CombinedData*) data;
+    StokesCombinedKSpace(d->psrc, d->ptar, d->f, d->g, d->n, d->alpha,
+            d->beta, d->Nsrc, d->Ntar, d->xi, d->eta, d->Mx, d->My, d->Lx,
+            d->Ly, d->w, d->P, NULL, NULL, d->uk, d->kstats);
+}
+
+/*------------------------------------------------------------------------
+ *The velocity of alpha*SLP(f) + beta*DLP(g,n) + gamma*f, e.g. the
+ *operator 1/2*I + D + S of a second-kind integral equation, with one
+ *real-space pass and one spread/FFT/gather for both potentials, see
+ *StokesCombinedRealSpace() and StokesCombinedKSpace():
+ *
+ *  [u, ur, uk, stats] = mex_stokes_combined_ewald(psrc,ptar,f,g,n,...
+ *                  alpha,beta,gamma,xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,...
+ *                  w,P,tol);
+ *
+ *The two potentials share xi and the grids. ur and uk are the real-space
+ *and Fourier-space parts of the two potentials, and u = ur + uk +
+ *gamma*f. The identity term needs the targets to be the sources, unless
+ *gamma is 0. The two parts run at the same time as in mex_stokes_slp_ewald
+ *and the optional fourth output holds the same statistics. The tolerance
+ *is optional.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 18 && nrhs != 19)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    for(int i = 0;i<5;i++)
+        if(mxGetM(prhs[i]) != 2)
+            mexErrMsgTxt("psrc, ptar, f, g and n must be 2xn matrices.");
+    for(int i = 2;i<5;i++)
+        if(mxGetN(prhs[i]) != mxGetN(prhs[0]))
+            mexErrMsgTxt("psrc, f, g and n must be the same size.");
+    
+    CombinedData d;
+    
+    //Source and target points.
+    d.psrc = mxGetPr(prhs[0]);
+    d.ptar = mxGetPr(prhs[1]);
+    d.Nsrc = mxGetN(prhs[0]);
+    d.Ntar = mxGetN(prhs[1]);
+    
+    //The density of the Stokeslet, and the density and normals of the
+    //stresslet
+    d.f = mxGetPr(prhs[2]);
+    d.g = mxGetPr(prhs[3]);
+    d.n = mxGetPr(prhs[4]);
+    
+    //Weights of the two potentials and of the identity
+    d.alpha = mxGetScalar(prhs[5]);
+    d.beta = mxGetScalar(prhs[6]);
+    double gamma = mxGetScalar(prhs[7]);
+    if(gamma != 0 && d.Ntar != d.Nsrc)
+        mexErrMsgTxt("The identity term needs the targets to be the sources.");
+    
+    //Ewald parameter xi
+    d.xi = mxGetScalar(prhs[8]);
+    
+    //Number of bins per side
+    d.nside_x = static_cast<int>(mxGetScalar(prhs[9]));
+    d.nside_y = static_cast<int>(mxGetScalar(prhs[10]));
+    
+    //Splitting parameter eta
+    d.eta = mxGetScalar(prhs[11]);
+    
+    //Number of grid intervals in each direction
+    d.Mx = static_cast<int>(mxGetScalar(prhs[12]));
+    d.My = static_cast<int>(mxGetScalar(prhs[13]));
+    
+    //Size of the domain
+    d.Lx = mxGetScalar(prhs[14]);
+    d.Ly = mxGetScalar(prhs[15]);
+    
+    //Width of the Gaussian bell curves
+    d.w = mxGetScalar(prhs[16]);
+    
+    //Number of support nodes
+    d.P = static_cast<int>(mxGetScalar(prhs[17]));
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 18) ? mxGetScalar(prhs[18]) : 0;
+    
+    //All Matlab arrays are created here, on the Matlab thread.
+    plhs[0] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    mxArray* ur = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    mxArray* uk = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    
+    RealSpaceOptions opt;
+    opt.precision = ChoosePrecision(tol, COMBINED_KERNEL,
+            RS_VELOCITY);
+    opt.excl = NULL;
+    opt.skipped = NULL;
+    opt.max_memory = 0;
+    opt.near_field = NF_AUTO;
+    
+    RealSpaceStats stats;
+    KSpaceStats kstats;
+    ConcurrentStats cstats;
+    d.opt = &opt;
+    d.stats = &stats;
+    memset(&kstats, 0, sizeof(KSpaceStats));
+    d.kstats = &kstats;
+    d.ur = mxGetPr(ur);
+    d.uk = mxGetPr(uk);
+    
+    RunConcurrently(RealPart, KSpacePart, &d,
+            RealSpaceWork(d.Nsrc, d.Ntar, d.nside_x, d.nside_y),
+            KSpaceWork(d.Nsrc, d.Ntar, d.Mx, d.My, d.P, 6), &cstats);
+    
+    double* u = mxGetPr(plhs[0]);
+    for(int j = 0;j<2*d.Ntar;j++)
+        u[j] = d.ur[j] + d.uk[j] + (gamma != 0 ? gamma*d.f[j] : 0);
+    
+    if(nlhs > 1)
+        plhs[1] = ur;
+    else
+        mxDestroyArray(ur);
+    if(nlhs > 2)
+        plhs[2] = uk;
+    else
+        mxDestroyArray(uk);
+    if(nlhs > 3) {
+        plhs[3] = EwaldStatsToStruct(&stats, &kstats, &cstats);
+    }
+}
@@ -0,0 +1,117 @@
+#include "mex.h"
+#include "ewald_parameters.h"
+
+#include <string.h>
+
+static int ReadKernel(const mxArray* arg){
+
+    char* name = mxArrayToString(arg);
+    int kernel = -1;
+    if(name != NULL && !strcmp(name, "slp"))
+        kernel = SLP_KERNEL;
+    else if(name != NULL && !strcmp(name, "dlp"))
+        kernel = DLP_KERNEL;
+    mxFree(name);
+    if(kernel < 0)
+        mexErrMsgTxt("The kernel must be 'slp' or 'dlp'.");
+    return kernel;
+}
+
+/*------------------------------------------------------------------------
+ *Parameters of the spectral Ewald sums from the error estimates, see
+ *ewald_parameters.h. The first input is a command:
+ *
+ *  xi = mex_stokes_ewald_parameters('xi',kernel,derivatives,Q,Lx,Ly,rc,tol);
+ *  kinf = mex_stokes_ewald_parameters('kinf',kernel,derivatives,Q,Lx,Ly,...
+ *                  xi,tol);
+ *  par = mex_stokes_ewald_parameters('parameters',kernel,derivatives,Q,...
+ *                  npts,Nb,P,Lx,Ly,tol);
+ *  par = mex_stokes_ewald_parameters('budget',kernel,derivatives,Q,...
+ *                  nside_x,nside_y,P,Lx,Ly,tol,max_memory);
+ *  grids = mex_stokes_ewald_parameters('grids',kernel,derivatives);
+ *
+ *kernel is 'slp' or 'dlp' and derivatives the number of derivatives of
+ *the velocity in the quantity. 'parameters' chooses all parameters as the
+ *wrappers do, P from tol if it is 0, and gives them as a struct with the
+ *fields nside_x, nside_y, rc, xi, kinf, Mx, My, P, w and eta. 'budget'
+ *starts from the box grid nside_x x nside_y and makes it coarser until
+ *the Fourier grids fit max_memory bytes, see FitEwaldParameters(). Its
+ *struct also has the fields kspace_memory, the least memory of the
+ *Fourier grids, and meets_tol, false if the budget is too small for tol.
+ *'grids' is the fewest real Mx x My grids the Fourier sum holds at one
+ *time.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+
+    if(nrhs < 1 || !mxIsChar(prhs[0]))
+        mexErrMsgTxt("Usage: mex_stokes_ewald_parameters(command, ...)");
+
+    char* cmd = mxArrayToString(prhs[0]);
+    int xi = !strcmp(cmd, "xi");
+    int kinf = !strcmp(cmd, "kinf");
+    int parameters = !strcmp(cmd, "parameters");
+    int budget = !strcmp(cmd, "budget");
+    int grids = !strcmp(cmd, "grids");
+    mxFree(cmd);
+
+    if(xi || kinf) {
+        if(nrhs != 8)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        int kernel = ReadKernel(prhs[1]);
+        int derivatives = static_cast<int>(mxGetScalar(prhs[2]));
+        double Q = mxGetScalar(prhs[3]);
+        double Lx = mxGetScalar(prhs[4]);
+        double Ly = mxGetScalar(prhs[5]);
+        double tol = mxGetScalar(prhs[7]);
+
+        if(xi)
+            plhs[0] = mxCreateDoubleScalar(FindXi(kernel, derivatives, Q,
+                    Lx, Ly, mxGetScalar(prhs[6]), tol));
+        else
+            plhs[0] = mxCreateDoubleScalar(FindKinf(kernel, derivatives, Q,
+                    Lx, Ly, mxGetScalar(prhs[6]), tol));
+    } else if(parameters) {
+        if(nrhs != 10)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        EwaldParameters par;
+        ChooseEwaldParameters(ReadKernel(prhs[1]),
+                static_cast<int>(mxGetScalar(prhs[2])), mxGetScalar(prhs[3]),
+                static_cast<int>(mxGetScalar(prhs[4])), mxGetScalar(prhs[5]),
+                static_cast<int>(mxGetScalar(prhs[6])), mxGetScalar(prhs[7]),
+                mxGetScalar(prhs[8]), mxGetScalar(prhs[9]), &par);
+        plhs[0] = EwaldParametersToStruct(&par);
+    } else if(budget) {
+        if(nrhs != 11)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        int kernel = ReadKernel(prhs[1]);
+        int derivatives = static_cast<int>(mxGetScalar(prhs[2]));
+        double kspace_grids = FewestKSpaceGrids(kernel, derivatives);
+
+        EwaldParameters par;
+        par.nside_x = static_cast<int>(mxGetScalar(prhs[4]));
+        par.nside_y = static_cast<int>(mxGetScalar(prhs[5]));
+        par.P = static_cast<int>(mxGetScalar(prhs[6]));
+        int meets_tol = FitEwaldParameters(kernel, derivatives,
+                mxGetScalar(prhs[3]), mxGetScalar(prhs[7]),
+                mxGetScalar(prhs[8]), mxGetScalar(prhs[9]), kspace_grids,
+                mxGetScalar(prhs[10]), &par);
+
+        plhs[0] = EwaldParametersToStruct(&par);
+        mxAddField(plhs[0], "kspace_memory");
+        mxSetField(plhs[0], 0, "kspace_memory", mxCreateDoubleScalar(
+                kspace_grids*par.Mx*par.My*sizeof(double)));
+        mxAddField(plhs[0], "meets_tol");
+        mxSetField(plhs[0], 0, "meets_tol", mxCreateLogicalScalar(meets_tol));
+    } else if(grids) {
+        if(nrhs != 3)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        plhs[0] = mxCreateDoubleScalar(FewestKSpaceGrids(ReadKernel(prhs[1]),
+                static_cast<int>(mxGetScalar(prhs[2]))));
+    } else
+        mexErrMsgTxt("Unknown command, use 'xi', 'kinf', 'parameters', 'budget' or 'grids'.");
+}
@@ -0,0 +1,164 @@
+#include "mex.h"
+#include "ewald_plan.h"
+#include "kspace_variants.h"
+
+#include <map>
+#include <string.h>
+
+//The plans that are alive, by the id handed out to Matlab.
+static std::map<int, EwaldPlan*> plans;
+static int next_id = 1;
+
+static void FreeAllPlans(void){
+
+    for(std::map<int, EwaldPlan*>::iterator it = plans.begin();
+            it != plans.end();++it) {
+        FreeEwaldPlan(it->second);
+        delete it->second;
+    }
+    plans.clear();
+}
+
+static EwaldPlan* FindPlan(const mxArray* id){
+
+    std::map<int, EwaldPlan*>::iterator it =
+            plans.find(static_cast<int>(mxGetScalar(id)));
+    if(it == plans.end())
+        mexErrMsgTxt("No Ewald plan with this id, it may have been destroyed.");
+    return it->second;
+}
+
+static void CheckPoints(const mxArray* p, int n, const char* msg){
+
+    if(mxGetM(p) != 2 || static_cast<int>(mxGetN(p)) != n)
+        mexErrMsgTxt(msg);
+}
+
+/*------------------------------------------------------------------------
+ *Ewald plans for the velocity of the Stokeslet and the stresslet, kept in
+ *this mex file between calls, see ewald_plan.h. The first input is a
+ *command:
+ *
+ *  id = mex_stokes_ewald_plan('create',kernel,psrc,ptar,n,xi,nside_x,...
+ *                  nside_y,eta,Mx,My,Lx,Ly,w,P,tol,kspace_variant);
+ *  [ur, uk, stats] = mex_stokes_ewald_plan('execute',id,f);
+ *  rebuilt = mex_stokes_ewald_plan('move',id,psrc,ptar,n);
+ *  info = mex_stokes_ewald_plan('info',id);
+ *  mex_stokes_ewald_plan('destroy',id);
+ *
+ *kernel is 'slp' or 'dlp', and n is empty for the Stokeslet. The other
+ *parameters are as for mex_stokes_slp_ewald, whose outputs 'execute' also
+ *gives. kspace_variant is optional and is the name of a variant of the
+ *k-space sum, 'estimate' (the default) or 'measure', see
+ *kspace_variants.h. The file stays locked in memory while there are
+ *plans, which are normally owned by EwaldPlan objects that destroy them
+ *when deleted.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+
+    static int registered = 0;
+    if(!registered) {
+        mexAtExit(FreeAllPlans);
+        registered = 1;
+    }
+
+    if(nrhs < 2 || !mxIsChar(prhs[0]))
+        mexErrMsgTxt("Usage: mex_stokes_ewald_plan(command, ...)");
+
+    char* cmd = mxArrayToString(prhs[0]);
+    int create = !strcmp(cmd, "create");
+    int execute = !strcmp(cmd, "execute");
+    int move = !strcmp(cmd, "move");
+    int info = !strcmp(cmd, "info");
+    int destroy = !strcmp(cmd, "destroy");
+    mxFree(cmd);
+
+    if(create) {
+        if(nrhs != 16 && nrhs != 17)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        char* name = mxArrayToString(prhs[1]);
+        int kernel = -1;
+        if(name != NULL && !strcmp(name, "slp"))
+            kernel = SLP_KERNEL;
+        else if(name != NULL && !strcmp(name, "dlp"))
+            kernel = DLP_KERNEL;
+        mxFree(name);
+        if(kernel < 0)
+            mexErrMsgTxt("The kernel must be 'slp' or 'dlp'.");
+
+        if(mxGetM(prhs[2]) != 2)
+            mexErrMsgTxt("psrc must be a 2xn matrix.");
+        if(mxGetM(prhs[3]) != 2)
+            mexErrMsgTxt("ptar must be a 2xn matrix.");
+        int Nsrc = mxGetN(prhs[2]);
+        int Ntar = mxGetN(prhs[3]);
+        if(kernel == DLP_KERNEL)
+            CheckPoints(prhs[4], Nsrc, "psrc and n must be the same size.");
+
+        int family = (kernel == SLP_KERNEL) ? KS_SLP_VELOCITY
+                : KS_DLP_VELOCITY;
+        int variant = (nrhs > 16) ? ReadKSpaceVariant(family, prhs[16])
+                : KS_ESTIMATE;
+
+        EwaldPlan* plan = new EwaldPlan;
+        CreateEwaldPlan(kernel, mxGetPr(prhs[2]), mxGetPr(prhs[3]),
+                kernel == DLP_KERNEL ? mxGetPr(prhs[4]) : NULL, Nsrc, Ntar,
+                mxGetScalar(prhs[5]), static_cast<int>(mxGetScalar(prhs[6])),
+                static_cast<int>(mxGetScalar(prhs[7])), mxGetScalar(prhs[8]),
+                static_cast<int>(mxGetScalar(prhs[9])),
+                static_cast<int>(mxGetScalar(prhs[10])), mxGetScalar(prhs[11]),
+                mxGetScalar(prhs[12]), mxGetScalar(prhs[13]),
+                static_cast<int>(mxGetScalar(prhs[14])),
+                ChoosePrecision(mxGetScalar(prhs[15]), kernel, RS_VELOCITY),
+                variant, plan);
+
+        if(plans.empty())
+            mexLock();
+        plans[next_id] = plan;
+        plhs[0] = mxCreateDoubleScalar(next_id++);
+    } else if(execute) {
+        if(nrhs != 3)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        EwaldPlan* plan = FindPlan(prhs[1]);
+        CheckPoints(prhs[2], plan->Nsrc, "f must be a 2xn matrix, with one column per source.");
+
+        plhs[0] = mxCreateDoubleMatrix(2, plan->Ntar, mxREAL);
+        plhs[1] = mxCreateDoubleMatrix(2, plan->Ntar, mxREAL);
+
+        RealSpaceStats stats;
+        KSpaceStats kstats;
+        ConcurrentStats cstats;
+        ExecuteEwaldPlan(plan, mxGetPr(prhs[2]), mxGetPr(plhs[0]),
+                mxGetPr(plhs[1]), &stats, &kstats, &cstats);
+
+        if(nlhs > 2) {
+            plhs[2] = EwaldStatsToStruct(&stats, &kstats, &cstats);
+        }
+    } else if(move) {
+        if(nrhs != 5)
+            mexErrMsgTxt("Incorrect number of input parameters");
+
+        EwaldPlan* plan = FindPlan(prhs[1]);
+        CheckPoints(prhs[2], plan->Nsrc, "psrc must be a 2xn matrix, with the sources of the plan.");
+        CheckPoints(prhs[3], plan->Ntar, "ptar must be a 2xn matrix, with the targets of the plan.");
+        if(plan->kernel == DLP_KERNEL)
+            CheckPoints(prhs[4], plan->Nsrc, "psrc and n must be the same size.");
+
+        int rebuilt = MoveEwaldPlan(plan, mxGetPr(prhs[2]), mxGetPr(prhs[3]),
+                plan->kernel == DLP_KERNEL ? mxGetPr(prhs[4]) : NULL);
+        plhs[0] = mxCreateDoubleScalar(rebuilt);
+    } else if(info) {
+        plhs[0] = EwaldPlanToStruct(FindPlan(prhs[1]));
+    } else if(destroy) {
+        EwaldPlan* plan = FindPlan(prhs[1]);
+        plans.erase(static_cast<int>(mxGetScalar(prhs[1])));
+        FreeEwaldPlan(plan);
+        delete plan;
+        if(plans.empty())
+            mexUnlock();
+    } else
+        mexErrMsgTxt("Unknown command, use 'create', 'execute', 'move', 'info' or 'destroy'.");
+}
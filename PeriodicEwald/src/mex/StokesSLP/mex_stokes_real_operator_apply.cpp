@@ -0,0 +1,28 @@
+#include "mex.h"
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Applies a real-space operator assembled by mex_stokes_slp_real_operator
+ *or mex_stokes_dlp_real_operator to the density f (2xn). The result is
+ *the same as from mex_stokes_slp_real or mex_stokes_dlp_real, up to
+ *roundoff, for the points (and normals) the operator was assembled for.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 2)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    RealSpaceOperator op;
+    RealSpaceOperatorFromStruct(prhs[0], &op);
+    
+    if(mxGetM(prhs[1]) != 2 || static_cast<int>(mxGetN(prhs[1])) != op.num_sources)
+        mexErrMsgTxt("f must be a 2xn matrix, with one column per source.");
+    
+    //Strength vector
+    double *f = mxGetPr(prhs[1]);
+    
+    plhs[0] = mxCreateDoubleMatrix(2, op.num_targets, mxREAL);
+    
+    ApplyRealSpaceOperator(&op, f, mxGetPr(plhs[0]));
+}
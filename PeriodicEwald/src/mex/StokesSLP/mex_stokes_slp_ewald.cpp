@@ -0,0 +1,168 @@
+#include "mex.h"
+#include "ewald_driver.h"
+#include "kspace.h"
+#include "real_space.h"
+
+#include <string.h>
+
+//The arguments of the two parts of the evaluation.
+typedef struct {
+    double* psrc;
+    double* ptar;
+    double* f;
+    int Nsrc;
+    int Ntar;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    const RealSpaceOptions* opt;
+    double** output;
+    RealSpaceStats* stats;
+    KSpaceStats* kstats;
+    double* uk;
+} EwaldData;
+
+static void RealPart(void* data){
+
+    EwaldData* d = (EwaldData*) data;
+    PointSet psrc = InterleavedPoints(d->psrc);
+    PointSet ptar = InterleavedPoints(d->ptar);
+    StokesSLPRealSpaceEx(&psrc, &ptar, d->f, d->Nsrc, d->Ntar, d->xi,
+            d->nside_x, d->nside_y, d->Lx, d->Ly, d->opt, d->output,
+            d->stats);
+}
+
+static void KSpacePart(void* data){
+
+    EwaldData* d = (EwaldData*) data;
+    StokesSLPKSpace(d->psrc, d->ptar, d->f, d->Nsrc, d->Ntar, d->xi, d->eta,
+            d->Mx, d->My, d->Lx, d->Ly, d->w, d->P, NULL, d->uk, d->kstats);
+}
+
+/*------------------------------------------------------------------------
+ *Real-space and Fourier-space parts of the Ewald sum for the velocity of
+ *the Stokeslet, evaluated at the same time by RunConcurrently(), e.g.
+ *
+ *  [ur, uk, stats] = mex_stokes_slp_ewald(psrc,ptar,f,xi,nside_x,...
+ *                  nside_y,eta,Mx,My,Lx,Ly,w,P,tol);
+ *
+ *ur and uk are identical to the outputs of mex_stokes_slp_real and
+ *mex_stokes_slp_kspace. The optional third output holds the real-space
+ *and k-space statistics, with the times of their phases, together with
+ *the thread split, the time of each part and the peak memory.
+ *The tolerance and the trailing (excl_ptr, excl_src, max_memory) inputs
+ *are optional and as for mex_stokes_slp_real, whose skipped pairs are
+ *returned in a fourth output.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 13 && nrhs != 14 && nrhs != 16 && nrhs != 17)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    if(mxGetM(prhs[2]) != 2)
+        mexErrMsgTxt("f must be a 2xn matrix.");
+    if(mxGetN(prhs[2]) != mxGetN(prhs[0]))
+        mexErrMsgTxt("psrc and f must be the same size.");
+    
+    EwaldData d;
+    
+    //Source and target points.
+    d.psrc = mxGetPr(prhs[0]);
+    d.ptar = mxGetPr(prhs[1]);
+    d.Nsrc = mxGetN(prhs[0]);
+    d.Ntar = mxGetN(prhs[1]);
+    
+    //Strength vector
+    d.f = mxGetPr(prhs[2]);
+    
+    //Ewald parameter xi
+    d.xi = mxGetScalar(prhs[3]);
+    
+    //Number of bins per side
+    d.nside_x = static_cast<int>(mxGetScalar(prhs[4]));
+    d.nside_y = static_cast<int>(mxGetScalar(prhs[5]));
+    
+    //Splitting parameter eta
+    d.eta = mxGetScalar(prhs[6]);
+    
+    //Number of grid intervals in each direction
+    d.Mx = static_cast<int>(mxGetScalar(prhs[7]));
+    d.My = static_cast<int>(mxGetScalar(prhs[8]));
+    
+    //Size of the domain
+    d.Lx = mxGetScalar(prhs[9]);
+    d.Ly = mxGetScalar(prhs[10]);
+    
+    //Width of the Gaussian bell curves
+    d.w = mxGetScalar(prhs[11]);
+    
+    //Number of support nodes
+    d.P = static_cast<int>(mxGetScalar(prhs[12]));
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 13) ? mxGetScalar(prhs[13]) : 0;
+    
+    //Source-target pairs to leave out, none if excl_ptr is empty
+    int exclude = (nrhs > 14 && !mxIsEmpty(prhs[14]));
+    ExclusionList excl;
+    
+    //Bound on the working memory of the real sum in bytes, none if 0
+    double max_memory = (nrhs > 16) ? mxGetScalar(prhs[16]) : 0;
+    
+    if(exclude)
+        ParseExclusions(prhs[14], prhs[15], d.Ntar, d.Nsrc, &excl);
+    if(nlhs > 3 && !exclude)
+        mexErrMsgTxt("The skipped pairs can only be returned with an exclusion list.");
+    
+    //All Matlab arrays are created here, on the Matlab thread.
+    plhs[0] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    plhs[1] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+    
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = mxGetPr(plhs[0]);
+    
+    double* skipped[RS_NUM_QUANTITIES] = {NULL};
+    if(exclude && nlhs > 3) {
+        plhs[3] = mxCreateDoubleMatrix(2, d.Ntar, mxREAL);
+        skipped[RS_VELOCITY] = mxGetPr(plhs[3]);
+    }
+    
+    RealSpaceOptions opt;
+    opt.precision = ChoosePrecision(tol, SLP_KERNEL, RS_VELOCITY);
+    opt.excl = exclude ? &excl : NULL;
+    opt.skipped = skipped;
+    opt.max_memory = max_memory;
+    opt.near_field = NF_AUTO;
+    
+    RealSpaceStats stats;
+    KSpaceStats kstats;
+    ConcurrentStats cstats;
+    d.opt = &opt;
+    d.output = output;
+    d.stats = &stats;
+    memset(&kstats, 0, sizeof(KSpaceStats));
+    d.kstats = &kstats;
+    d.uk = mxGetPr(plhs[1]);
+    
+    RunConcurrently(RealPart, KSpacePart, &d,
+            RealSpaceWork(d.Nsrc, d.Ntar, d.nside_x, d.nside_y),
+            KSpaceWork(d.Nsrc, d.Ntar, d.Mx, d.My, d.P, 2), &cstats);
+    if(exclude)
+        FreeExclusionList(&excl);
+    
+    if(nlhs > 2) {
+        plhs[2] = EwaldStatsToStruct(&stats, &kstats, &cstats);
+    }
+}
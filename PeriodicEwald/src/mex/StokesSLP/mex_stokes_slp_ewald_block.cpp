@@ -0,0 +1,141 @@
+#include "mex.h"
+#include "ewald_driver.h"
+#include "kspace.h"
+#include "real_space.h"
+
+#include <string.h>
+
+//The arguments of the two parts of the evaluation.
+typedef struct {
+    double* psrc;
+    double* ptar;
+    double* f;
+    int Nsrc;
+    int Ntar;
+    int nrhs;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    int precision;
+    RealSpaceStats* stats;
+    KSpaceStats* kstats;
+    double* ur;
+    double* uk;
+} EwaldBlockData;
+
+static void RealPart(void* data){
+
+    EwaldBlockData* d = (EwaldBlockData*) data;
+    StokesSLPRealSpaceBlock(d->psrc, d->ptar, d->f, d->Nsrc, d->Ntar,
+            d->nrhs, d->xi, d->nside_x, d->nside_y, d->Lx, d->Ly,
+            d->precision, d->ur, d->stats);
+}
+
+static void KSpacePart(void* data){
+
+    EwaldBlockData* d = (EwaldBlockData*) data;
+    StokesSLPKSpaceBlock(d->psrc, d->ptar, d->f, d->Nsrc, d->Ntar, d->nrhs,
+            d->xi, d->eta, d->Mx, d->My, d->Lx, d->Ly, d->w, d->P, NULL,
+            d->uk, d->kstats);
+}
+
+/*------------------------------------------------------------------------
+ *The velocity of the Stokeslet for k densities on the same points, e.g.
+ *
+ *  [ur, uk, stats] = mex_stokes_slp_ewald_block(psrc,ptar,f,xi,nside_x,...
+ *                  nside_y,eta,Mx,My,Lx,Ly,w,P,tol);
+ *
+ *f is 2 x Nsrc x k, and ur and uk are 2 x Ntar x k with page r equal to
+ *the outputs of mex_stokes_slp_ewald for f(:,:,r). The points are binned
+ *and spread once for all densities and each real-space pair is evaluated
+ *once, see StokesSLPRealSpaceBlock() and StokesSLPKSpaceBlock(). The two
+ *parts run at the same time as in mex_stokes_slp_ewald, and the optional
+ *third output holds the same statistics. The tolerance is optional.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 13 && nrhs != 14)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    
+    EwaldBlockData d;
+    
+    //Source and target points.
+    d.psrc = mxGetPr(prhs[0]);
+    d.ptar = mxGetPr(prhs[1]);
+    d.Nsrc = mxGetN(prhs[0]);
+    d.Ntar = mxGetN(prhs[1]);
+    
+    //Strength vectors, one 2 x Nsrc page per right-hand side
+    if(mxGetM(prhs[2]) != 2 || mxGetNumberOfElements(prhs[2]) % 2 != 0)
+        mexErrMsgTxt("f must be a 2xnxk array.");
+    d.f = mxGetPr(prhs[2]);
+    d.nrhs = (d.Nsrc > 0) ? mxGetNumberOfElements(prhs[2])/(2*d.Nsrc) : 0;
+    if(2*d.Nsrc*d.nrhs != static_cast<int>(mxGetNumberOfElements(prhs[2])))
+        mexErrMsgTxt("psrc and the pages of f must be the same size.");
+    
+    //Ewald parameter xi
+    d.xi = mxGetScalar(prhs[3]);
+    
+    //Number of bins per side
+    d.nside_x = static_cast<int>(mxGetScalar(prhs[4]));
+    d.nside_y = static_cast<int>(mxGetScalar(prhs[5]));
+    
+    //Splitting parameter eta
+    d.eta = mxGetScalar(prhs[6]);
+    
+    //Number of grid intervals in each direction
+    d.Mx = static_cast<int>(mxGetScalar(prhs[7]));
+    d.My = static_cast<int>(mxGetScalar(prhs[8]));
+    
+    //Size of the domain
+    d.Lx = mxGetScalar(prhs[9]);
+    d.Ly = mxGetScalar(prhs[10]);
+    
+    //Width of the Gaussian bell curves
+    d.w = mxGetScalar(prhs[11]);
+    
+    //Number of support nodes
+    d.P = static_cast<int>(mxGetScalar(prhs[12]));
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    d.precision = ChoosePrecision((nrhs > 13) ? mxGetScalar(prhs[13]) : 0,
+            SLP_KERNEL, RS_VELOCITY);
+    
+    //All Matlab arrays are created here, on the Matlab thread.
+    mwSize dims[3] = {2, static_cast<mwSize>(d.Ntar),
+            static_cast<mwSize>(d.nrhs)};
+    plhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+    plhs[1] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+    if(d.nrhs == 0)
+        return;
+    
+    RealSpaceStats stats;
+    KSpaceStats kstats;
+    ConcurrentStats cstats;
+    d.stats = &stats;
+    memset(&kstats, 0, sizeof(KSpaceStats));
+    d.kstats = &kstats;
+    d.ur = mxGetPr(plhs[0]);
+    d.uk = mxGetPr(plhs[1]);
+    
+    RunConcurrently(RealPart, KSpacePart, &d,
+            RealSpaceWork(d.Nsrc, d.Ntar, d.nside_x, d.nside_y),
+            KSpaceWork(d.Nsrc, d.Ntar, d.Mx, d.My, d.P, 2*d.nrhs), &cstats);
+    
+    if(nlhs > 2) {
+        plhs[2] = EwaldStatsToStruct(&stats, &kstats, &cstats);
+    }
+}
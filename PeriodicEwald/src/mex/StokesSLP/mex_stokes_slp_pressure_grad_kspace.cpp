@@ -2,6 +2,8 @@
 #include <omp.h>
 #include <string.h>
 #include "ewald_tools.h"
+#include "mx_complex.h"
+#include "scratch_arena.h"
 #define pi 3.1415926535897932385
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
@@ -55,12 +57,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     fft2rhs[0] = mxCreateDoubleMatrix(My, Mx, mxREAL);    
     fft2rhs[1] = mxCreateDoubleMatrix(My, Mx, mxREAL);    
     
-    double* H1 = mxGetPr(fft2rhs[0]);
-    double* H2 = mxGetPr(fft2rhs[1]);
+    double* H1 = RealData(fft2rhs[0]);
+    double* H2 = RealData(fft2rhs[1]);
     
     //e1 contains some Gaussian gridding information that will be used in 
     //the gathering step later
-    double* e1 = new double[P+1];    
+    ScratchBuffer<double> e1(P+1);    
     Spread(H1, H2, e1, psrc, f, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
     
     //---------------------------------------------------------------------
@@ -72,30 +74,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     //Call Matlab's routines to compute the 2D FFT. Other choices,
     //such as fftw could possibly be better, mainly because of the poor
     //complex data structure Matlab uses which we now have to deal with.
-    mexCallMATLAB(1,&fft2lhs[0],1,&fft2rhs[0],"fft2");
-    mexCallMATLAB(1,&fft2lhs[1],1,&fft2rhs[1],"fft2");     
+    MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+    MatlabTransform(&fft2lhs[1], fft2rhs[1], "fft2");     
 
-    //The output of the FFT is complex. Get pointers to the real and
-    //imaginary parts of Hhat1 and Hhat2.
-    double* Hhat1_re = mxGetPr(fft2lhs[0]);
-    double* Hhat1_im = mxGetPi(fft2lhs[0]);
+    //The output of the FFT is complex. Get views of the real and
+    //imaginary parts of Hhat1 and Hhat2, see mx_complex.h.
+    ComplexPart Hhat1_re = RealPart(fft2lhs[0]);
+    ComplexPart Hhat1_im = ImagPart(fft2lhs[0]);
     
-    double* Hhat2_re = mxGetPr(fft2lhs[1]);
-    double* Hhat2_im = mxGetPi(fft2lhs[1]);
+    ComplexPart Hhat2_re = RealPart(fft2lhs[1]);
+    ComplexPart Hhat2_im = ImagPart(fft2lhs[1]);
     
-    mwSize cs = Mx*My;
-    
-    //We cannot assume that both the real and imaginary part of the
-    //Fourier transforms are non-zero.
-    if(Hhat1_im == NULL) {
-        Hhat1_im = (double*) mxCalloc(cs,sizeof(double));        
-        mxSetPi(fft2lhs[0],Hhat1_im);
-    }
-    if(Hhat2_im == NULL) {        
-        Hhat2_im = (double*) mxCalloc(cs,sizeof(double));        
-        mxSetPi(fft2lhs[1],Hhat2_im);
-    }
-       
     //Apply filter in the frequency domain. This is a completely
     //parallel operation. The FFT gives the frequency components in
     //non-sequential order, so we have to split the loops. One could
@@ -156,12 +145,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     mxDestroyArray(fft2rhs[1]);
     
     //Do the inverse 2D FFT. We use Matlab's inbuilt functions again.
-    mexCallMATLAB(1,&fft2rhs[0],1,&fft2lhs[0],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[1],1,&fft2lhs[1],"ifft2");
+    MatlabTransform(&fft2rhs[0], fft2lhs[0], "ifft2");
+    MatlabTransform(&fft2rhs[1], fft2lhs[1], "ifft2");
     
     //The pointer to the real part. We don't need the imaginary part.
-    double* Ht1 = mxGetPr(fft2rhs[0]);
-    double* Ht2 = mxGetPr(fft2rhs[1]);
+    double* Ht1 = RealGrid(fft2rhs[0]);
+    double* Ht2 = RealGrid(fft2rhs[1]);
     
     if(Ht1 == NULL)
         Ht1 = new double[Mx*My];    
@@ -192,5 +181,4 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     //Clean up
     mxDestroyArray(fft2rhs[0]);
     mxDestroyArray(fft2rhs[1]);
-    delete e1;
 }
\ No newline at end of file
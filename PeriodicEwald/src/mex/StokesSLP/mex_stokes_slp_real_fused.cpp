@@ -0,0 +1,104 @@
+#include "mex.h"
+#include "real_space.h"
+#include "fasttools2d.h"
+
+/*------------------------------------------------------------------------
+ *Fused real-space part of the Ewald sum for the Stokeslet. Evaluates any
+ *subset of the velocity, pressure, velocity gradient, stress, vorticity
+ *and pressure gradient in a single traversal of the boxes, e.g.
+ *
+ *  [ur, pr] = mex_stokes_slp_real_fused(psrc,ptar,f,xi,nside_x,nside_y,...
+ *                  Lx,Ly,{'velocity','pressure'});
+ *
+ *The outputs are returned in the order requested and are identical to
+ *those of the corresponding mex_stokes_slp_*_real functions. One extra
+ *output can be requested for the load-balance statistics, and the error
+ *tolerance can be given after the quantities, see ChoosePrecision().
+ *
+ *After the tolerance an exclusion list (excl_ptr, excl_src) can be given,
+ *see ParseExclusions(). Its pairs are left out of all quantities, and
+ *their contributions are returned after the statistics, one output per
+ *quantity in the order requested. An empty excl_ptr excludes nothing. A
+ *last optional input bounds the working memory in bytes, see
+ *RealSpaceOptions.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 9 && nrhs != 10 && nrhs != 12 && nrhs != 13)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    //Source and target points, 2xn matrices or cells {x, y}
+    PointSet psrc, ptar;
+    int Nsrc = ParsePoints(prhs[0], "psrc", &psrc);
+    int Ntar = ParsePoints(prhs[1], "ptar", &ptar);
+    
+    if(mxGetM(prhs[2]) != 2)
+        mexErrMsgTxt("f must be a 2xn matrix.");
+    if(static_cast<int>(mxGetN(prhs[2])) != Nsrc)
+        mexErrMsgTxt("psrc and f must be the same size.");
+    
+    //Strength vector
+    double *f = mxGetPr(prhs[2]);
+    
+    //Ewald parameter xi
+    double xi = mxGetScalar(prhs[3]);
+    
+    //Number of bins per side
+    int nside_x = static_cast<int>(mxGetScalar(prhs[4]));
+    int nside_y = static_cast<int>(mxGetScalar(prhs[5]));
+    
+    //Size of reference cell
+    double Lx = mxGetScalar(prhs[6]);
+    double Ly = mxGetScalar(prhs[7]);
+    
+    //The requested quantities, in output order
+    int quantities[RS_NUM_QUANTITIES];
+    int nq = ParseQuantities(prhs[8], quantities);
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 9) ? mxGetScalar(prhs[9]) : 0;
+    
+    //Source-target pairs to leave out, none if excl_ptr is empty
+    int exclude = (nrhs > 10 && !mxIsEmpty(prhs[10]));
+    ExclusionList excl;
+    
+    //Bound on the working memory of the sum in bytes, none if 0
+    double max_memory = (nrhs > 12) ? mxGetScalar(prhs[12]) : 0;
+    
+    if(nlhs > (exclude ? 2*nq+1 : nq+1))
+        mexErrMsgTxt("Too many output arguments for the requested quantities.");
+    if(exclude)
+        ParseExclusions(prhs[10], prhs[11], Ntar, Nsrc, &excl);
+    
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    RealSpaceStats stats;
+    for(int j = 0;j<nq;j++) {
+        plhs[j] = mxCreateDoubleMatrix(QuantityComponents(quantities[j]), 
+                Ntar, mxREAL);
+        output[quantities[j]] = mxGetPr(plhs[j]);
+    }
+    
+    double* skipped[RS_NUM_QUANTITIES] = {NULL};
+    if(exclude) {
+        for(int j = 0;j<nq && nq+1+j<nlhs;j++) {
+            plhs[nq+1+j] = mxCreateDoubleMatrix(
+                    QuantityComponents(quantities[j]), Ntar, mxREAL);
+            skipped[quantities[j]] = mxGetPr(plhs[nq+1+j]);
+        }
+    }
+    
+    fasttools2d::Box box = {Lx, Ly};
+    fasttools2d::RealSpaceSettings settings(xi, nside_x, nside_y, tol);
+    settings.excl = exclude ? &excl : NULL;
+    settings.max_memory = max_memory;
+    
+    fasttools2d::RealSpaceSum(SLP_KERNEL, fasttools2d::Points(psrc, Nsrc),
+            fasttools2d::Points(ptar, Ntar), fasttools2d::Input(f, Nsrc),
+            fasttools2d::Input(), box, settings, output, skipped, &stats);
+    if(exclude)
+        FreeExclusionList(&excl);
+    
+    if(nlhs > nq)
+        plhs[nq] = RealSpaceStatsToStruct(&stats);
+}
@@ -0,0 +1,49 @@
+#include "mex.h"
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Assembles the real-space part of the Ewald sum for the velocity of the
+ *Stokeslet as a sparse operator, see RealSpaceOperator in real_space.h,
+ *which is applied by mex_stokes_real_operator_apply. The optional last
+ *input limits the memory footprint in bytes. A larger operator is not
+ *assembled, which the assembled field of the output shows, and the real
+ *sum must then be evaluated on the fly by mex_stokes_slp_real.
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 7 && nrhs != 8)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    
+    //Source and target points.
+    double* psrc = mxGetPr(prhs[0]);
+    double* ptar = mxGetPr(prhs[1]);
+    int Nsrc = mxGetN(prhs[0]);
+    int Ntar = mxGetN(prhs[1]);
+    
+    //Ewald parameter xi
+    double xi = mxGetScalar(prhs[2]);
+    
+    //Number of bins per side
+    int nside_x = static_cast<int>(mxGetScalar(prhs[3]));
+    int nside_y = static_cast<int>(mxGetScalar(prhs[4]));
+    
+    //Size of reference cell
+    double Lx = mxGetScalar(prhs[5]);
+    double Ly = mxGetScalar(prhs[6]);
+    
+    //Memory limit in bytes
+    double max_memory = (nrhs > 7) ? mxGetScalar(prhs[7])
+            : RS_OPERATOR_MAX_MEMORY;
+    
+    RealSpaceOperator op;
+    StokesSLPRealSpaceOperator(psrc, ptar, Nsrc, Ntar, xi, nside_x, nside_y,
+            Lx, Ly, max_memory, &op);
+    
+    plhs[0] = RealSpaceOperatorToStruct(&op);
+}
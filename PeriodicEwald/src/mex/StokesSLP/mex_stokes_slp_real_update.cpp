@@ -0,0 +1,79 @@
+#include "mex.h"
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Updates the real-space part of the Ewald sum for the velocity of the
+ *Stokeslet, ur from an earlier call to mex_stokes_slp_real, after some
+ *of the sources and targets changed, see StokesSLPRealSpaceUpdate in
+ *real_space.h. src_idx lists the changed sources (1-based), psrc_old and
+ *f_old (2 x length(src_idx)) their old positions and densities, and
+ *tar_idx the targets that moved. psrc, ptar and f hold the new values.
+ *An optional last input gives the error tolerance, see ChoosePrecision().
+ *------------------------------------------------------------------------
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    if(nrhs != 13 && nrhs != 14)
+        mexErrMsgTxt("Incorrect number of input parameters");
+    
+    if(mxGetM(prhs[0]) != 2)
+        mexErrMsgTxt("psrc must be a 2xn matrix.");
+    if(mxGetM(prhs[1]) != 2)
+        mexErrMsgTxt("ptar must be a 2xn matrix.");
+    if(mxGetM(prhs[2]) != 2)
+        mexErrMsgTxt("f must be a 2xn matrix.");
+    if(mxGetN(prhs[2]) != mxGetN(prhs[0]))
+        mexErrMsgTxt("psrc and f must be the same size.");
+    if(mxGetM(prhs[3]) != 2 || mxGetN(prhs[3]) != mxGetN(prhs[1]))
+        mexErrMsgTxt("ur must be a 2xn matrix, with one column per target.");
+    
+    //Source and target points.
+    double* psrc = mxGetPr(prhs[0]);
+    double* ptar = mxGetPr(prhs[1]);
+    int Nsrc = mxGetN(prhs[0]);
+    int Ntar = mxGetN(prhs[1]);
+    
+    //Strength vector
+    double *f = mxGetPr(prhs[2]);
+    
+    //Changed sources, with their old positions and strengths
+    int* src_idx;
+    int nchanged_src = ParseIndices(prhs[4], Nsrc, &src_idx);
+    if(mxGetM(prhs[5]) != 2 || static_cast<int>(mxGetN(prhs[5])) != nchanged_src)
+        mexErrMsgTxt("psrc_old must be a 2xn matrix, with one column per changed source.");
+    if(mxGetM(prhs[6]) != 2 || static_cast<int>(mxGetN(prhs[6])) != nchanged_src)
+        mexErrMsgTxt("f_old must be a 2xn matrix, with one column per changed source.");
+    double* psrc_old = mxGetPr(prhs[5]);
+    double* f_old = mxGetPr(prhs[6]);
+    
+    //Changed targets
+    int* tar_idx;
+    int nchanged_tar = ParseIndices(prhs[7], Ntar, &tar_idx);
+    
+    //Ewald parameter xi
+    double xi = mxGetScalar(prhs[8]);
+    
+    //Number of bins per side
+    int nside_x = static_cast<int>(mxGetScalar(prhs[9]));
+    int nside_y = static_cast<int>(mxGetScalar(prhs[10]));
+    
+    //Size of reference cell
+    double Lx = mxGetScalar(prhs[11]);
+    double Ly = mxGetScalar(prhs[12]);
+    
+    //Error tolerance, which decides the precision of the pair evaluation
+    double tol = (nrhs > 13) ? mxGetScalar(prhs[13]) : 0;
+    
+    plhs[0] = mxDuplicateArray(prhs[3]);
+    
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = mxGetPr(plhs[0]);
+    
+    StokesSLPRealSpaceUpdate(psrc, ptar, f, Nsrc, Ntar, src_idx,
+            nchanged_src, psrc_old, f_old, tar_idx, nchanged_tar, xi,
+            nside_x, nside_y, Lx, Ly,
+            ChoosePrecision(tol, SLP_KERNEL, RS_VELOCITY), output);
+    
+    mxFree(src_idx);
+    mxFree(tar_idx);
+}
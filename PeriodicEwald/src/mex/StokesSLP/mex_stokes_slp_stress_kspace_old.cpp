@@ -1,8 +1,5 @@
-#include <math.h>
-#include <omp.h>
-#include <string.h>
-#include "ewald_tools.h"
-#define pi 3.1415926535897932385
+#include "mex.h"
+#include "kspace.h"
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
@@ -23,7 +20,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
     //Ewald parameter xi
     double xi = mxGetScalar(prhs[2]);
-    double xi2 = xi*xi;
     
     //Splitting parameter eta
     double eta = mxGetScalar(prhs[3]);
@@ -45,241 +41,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     //Number of support nodes
     int P = static_cast<int>(mxGetScalar(prhs[10]));
     
-    //Grid spacing, assuming hx = hy = h
-    double h = Lx/Mx;
-    
-    //---------------------------------------------------------------------
-    //Step 1 : Spreading to the grid
-    //---------------------------------------------------------------------
-    //We begin by spreading the sources onto the grid. This basically means
-    //that we superposition properly scaled Gaussian bells, one for
-    //each source. We use fast Gaussian gridding to reduce the number of
-    //exps we need to evaluate.
-    
-    //The function H on the grid. We need to have these as Matlab arrays
-    //since we call Matlab's in-built fft2 to compute the 2D FFT.
-    mxArray *fft2rhs[4],*fft2lhs[4];
-    fft2rhs[0] = mxCreateDoubleMatrix(My, Mx, mxREAL);
-    fft2rhs[1] = mxCreateDoubleMatrix(My, Mx, mxREAL);
-    //fft2rhs[2] = mxCreateDoubleMatrix(My, Mx, mxREAL);
-    //fft2rhs[3] = mxCreateDoubleMatrix(My, Mx, mxREAL);
-    
-    double* H1 = mxGetPr(fft2rhs[0]);
-    double* H2 = mxGetPr(fft2rhs[1]);
-    
-    //This is the precomputable part of the fast Gaussian gridding.
-    double* e1 = new double[P+1];
-    Spread(H1, H2, e1, psrc, f, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
-    
-    //---------------------------------------------------------------------
-    //Step 2 : Frequency space filter
-    //---------------------------------------------------------------------
-    //We apply the appropriate k-space filter associated with the
-    //Stokeslet. This involves Fast Fourier Transforms.
-    
-    //Call Matlab's routines to compute the 2D FFT. Other choices,
-    //such as fftw could possibly be better, mainly because of the poor
-    //complex data structure Matlab uses which we now have to deal with.
-    mexCallMATLAB(1,&fft2lhs[0],1,&fft2rhs[0],"fft2");
-    mexCallMATLAB(1,&fft2lhs[1],1,&fft2rhs[1],"fft2");
-
-    //The output of the FFT is complex. Get pointers to the real and
-    //imaginary parts of Hhat1 and Hhat2.
-    
-    mwSize cs = Mx*My;
-    
-    double* Hhat1_re = mxGetPr(fft2lhs[0]);
-    double* Hhat1_im = mxGetPi(fft2lhs[0]);    
-    double* Hhat2_re = mxGetPr(fft2lhs[1]);
-    double* Hhat2_im = mxGetPi(fft2lhs[1]);
-    
-    //We cannot assume that both the real and imaginary part of the
-    //Fourier transforms are non-zero.
-    if(Hhat1_im == NULL) {
-
-        Hhat1_im = (double*) mxCalloc(cs,sizeof(double));
-        
-        mxSetPi(fft2lhs[0],Hhat1_im);
-    }
-    if(Hhat2_im == NULL) {
-
-        Hhat2_im = (double*) mxCalloc(cs,sizeof(double));
-        
-        mxSetPi(fft2lhs[1],Hhat2_im);
-    }
-    
-    // allocate remaining arrays
-    
-    fft2lhs[2] = mxCreateDoubleMatrix(My, Mx, mxREAL);
-    fft2lhs[3] = mxCreateDoubleMatrix(My, Mx, mxREAL);    
-    
-    double* Hhat3_re = (double*) mxCalloc(cs,sizeof(double));
-    double* Hhat3_im = (double*) mxCalloc(cs,sizeof(double));    
-    double* Hhat4_re = (double*) mxCalloc(cs,sizeof(double));
-    double* Hhat4_im = (double*) mxCalloc(cs,sizeof(double));
-
-    mxSetPr(fft2lhs[2],Hhat3_re);
-    mxSetPi(fft2lhs[2],Hhat3_im);
-    mxSetPr(fft2lhs[3],Hhat4_re);
-    mxSetPi(fft2lhs[3],Hhat4_im);
-   
-    //Apply filter in the frequency domain. This is a completely
-    //parallel operation. The FFT gives the frequency components in
-    //non-sequential order, so we have to split the loops. One could
-    //possibly use fast gaussian gridding here too, to get rid of the
-    //exponentials, but as this loop accounts for a few percent of the
-    //total runtime, this hardly seems worth the extra work.
-#pragma omp parallel for
-    for(int j = 0;j<Mx;j++) {
-        int ptr = j*My;
-        
-        double k1;
-        if(j <= Mx/2)
-            k1 = 2.0*pi/Lx*j;
-        else
-            k1 = 2.0*pi/Lx*(j-Mx);
-        for(int k = 0;k<=My/2;k++,ptr++) {
-            
-            //Hhat1 contains density component 1 convolved with Gaussians
-            //Hhat2 contains density component 2 convolved with Gaussians
-            double q1_re = Hhat1_re[ptr];
-            double q1_im = Hhat1_im[ptr];
-            double q2_re = Hhat2_re[ptr];
-            double q2_im = Hhat2_im[ptr];
-            
-            double k2 = 2.0*pi/Ly*k;
-            double Ksq = k1*k1+k2*k2;
-            double e = exp(-0.25*(1-eta)/xi2*Ksq)*(1.0+Ksq/(4*xi2))/Ksq;
-            
-            double kdotq_re = k1 * q1_re + k2 * q2_re;
-            double kdotq_im = k1 * q1_im + k2 * q2_im;
-
-            // multiply everything by 1i
-            //j = 1, l = 1
-            Hhat1_re[ptr] = -(kdotq_im + q1_im*k1 + q1_im*k1 - 2*(k1*k1*kdotq_im)/Ksq)*e;
-            Hhat1_im[ptr] = (kdotq_re + q1_re*k1 + q1_re*k1 - 2*(k1*k1*kdotq_re)/Ksq)*e;
-            
-            //j = 2, l = 1
-            Hhat2_re[ptr] = -(q2_im*k1 + q1_im*k2 - 2*(k2*k1*kdotq_im)/Ksq)*e;
-            Hhat2_im[ptr] = (q2_re*k1 + q1_re*k2 - 2*(k2*k1*kdotq_re)/Ksq)*e;
-            
-            //j = 1, l = 2
-            Hhat3_re[ptr] = -(q1_im*k2 + q2_im*k1 - 2*(k1*k2*kdotq_im)/Ksq)*e;
-            Hhat3_im[ptr] = (q1_re*k2 + q2_re*k1 - 2*(k1*k2*kdotq_re)/Ksq)*e;
-            
-            //j = 2, l = 2
-            Hhat4_re[ptr] = -(kdotq_im + q2_im*k2 + q2_im*k2 - 2*(k2*k2*kdotq_im)/Ksq)*e;
-            Hhat4_im[ptr] = (kdotq_re + q2_re*k2 + q2_re*k2 - 2*(k2*k2*kdotq_re)/Ksq)*e;
-            
-        }
-        for(int k = 0;k<My/2-1;k++,ptr++) {
-            
-            //Hhat1 contains density component 1 convolved with Gaussians
-            //Hhat2 contains density component 2 convolved with Gaussians
-            double q1_re = Hhat1_re[ptr];
-            double q1_im = Hhat1_im[ptr];
-            double q2_re = Hhat2_re[ptr];
-            double q2_im = Hhat2_im[ptr];
-            
-            double k2 = 2.0*pi/Ly*(k-My/2+1);
-            double Ksq = k1*k1+k2*k2;
-            double e = exp(-0.25*(1-eta)/xi2*Ksq)*(1.0+Ksq/(4*xi2))/Ksq;
-            
-            double kdotq_re = k1 * q1_re + k2 * q2_re;
-            double kdotq_im = k1 * q1_im + k2 * q2_im;
-
-            // multiply everything by 1i
-            //j = 1, l = 1
-            Hhat1_re[ptr] = -(kdotq_im + q1_im*k1 + q1_im*k1 - 2*(k1*k1*kdotq_im)/Ksq)*e;
-            Hhat1_im[ptr] = (kdotq_re + q1_re*k1 + q1_re*k1 - 2*(k1*k1*kdotq_re)/Ksq)*e;
-            
-            //j = 2, l = 1
-            Hhat2_re[ptr] = -(q2_im*k1 + q1_im*k2 - 2*(k2*k1*kdotq_im)/Ksq)*e;
-            Hhat2_im[ptr] = (q2_re*k1 + q1_re*k2 - 2*(k2*k1*kdotq_re)/Ksq)*e;
-            
-            //j = 1, l = 2
-            Hhat3_re[ptr] = -(q1_im*k2 + q2_im*k1 - 2*(k1*k2*kdotq_im)/Ksq)*e;
-            Hhat3_im[ptr] = (q1_re*k2 + q2_re*k1 - 2*(k1*k2*kdotq_re)/Ksq)*e;
-            
-            //j = 2, l = 2
-            Hhat4_re[ptr] = -(kdotq_im + q2_im*k2 + q2_im*k2 - 2*(k2*k2*kdotq_im)/Ksq)*e;
-            Hhat4_im[ptr] = (kdotq_re + q2_re*k2 + q2_re*k2 - 2*(k2*k2*kdotq_re)/Ksq)*e;
-            
-        }
-    }
-    
-    //Remove the zero frequency term.
-    Hhat1_re[0] = 0;
-    Hhat2_re[0] = 0;
-    Hhat3_re[0] = 0;
-    Hhat4_re[0] = 0;
-    Hhat1_im[0] = 0;
-    Hhat2_im[0] = 0;
-    Hhat3_im[0] = 0;
-    Hhat4_im[0] = 0;
-    
-    //Get rid of the old H1 and H2 arrays. They are no longer needed.
-    mxDestroyArray(fft2rhs[0]);
-    mxDestroyArray(fft2rhs[1]);
-    
-    //Do the inverse 2D FFTs. We use Matlab's inbuilt functions again.
-    //Note that we could eliminate one of these IFFTs by noting that 
-    //trace(grad u) = 0, but we'll keep it here for a consistency check
-    mexCallMATLAB(1,&fft2rhs[0],1,&fft2lhs[0],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[1],1,&fft2lhs[1],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[2],1,&fft2lhs[2],"ifft2");
-    mexCallMATLAB(1,&fft2rhs[3],1,&fft2lhs[3],"ifft2");
-    
-    //The pointer to the real part. We don't need the imaginary part.
-    double* Ht1 = mxGetPr(fft2rhs[0]);
-    double* Ht2 = mxGetPr(fft2rhs[1]);
-    double* Ht3 = mxGetPr(fft2rhs[2]);
-    double* Ht4 = mxGetPr(fft2rhs[3]);
-    
-    if(Ht1 == NULL) {
-        Ht1 = new double[Mx*My];
-        memset(Ht1,0,Mx*My*sizeof(double));
-    }
-    if(Ht2 == NULL) {
-        Ht2 = new double[Mx*My];
-        memset(Ht2,0,Mx*My*sizeof(double));
-    }
-    if(Ht3 == NULL) {
-        Ht3 = new double[Mx*My];
-        memset(Ht3,0,Mx*My*sizeof(double));
-    }
-    if(Ht4 == NULL) {
-        Ht4 = new double[Mx*My];
-        memset(Ht4,0,Mx*My*sizeof(double));
-    }
-    
-    //Get rid of the Hhat arrays. They are no longer needed.
-    mxDestroyArray(fft2lhs[0]);
-    mxDestroyArray(fft2lhs[1]);
-    mxDestroyArray(fft2lhs[2]);
-    mxDestroyArray(fft2lhs[3]);
-    
-    //---------------------------------------------------------------------
-    //Step 3 : Evaluating the velocity
-    //---------------------------------------------------------------------
-    //Here we compute the output velocity as a convolution of the Ht1
-    //and Ht2 functions with a properly scaled gaussian. This is basically
-    //gaussian blur, and we again use fast gaussian gridding. This
-    //procedure is fully parallel.
-    
     //Create the output matrix.
     plhs[0] = mxCreateDoubleMatrix(4, Ntar, mxREAL);
-    double* sigmak = mxGetPr(plhs[0]);
     
-    Gather(Ht1, 4, 1, e1, ptar, sigmak, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h);
-    Gather(Ht2, 4, 2, e1, ptar, sigmak, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h); 
-    Gather(Ht3, 4, 3, e1, ptar, sigmak, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h); 
-    Gather(Ht4, 4, 4, e1, ptar, sigmak, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h); 
-        
-    //Clean up
-    mxDestroyArray(fft2rhs[0]);
-    mxDestroyArray(fft2rhs[1]);
-    mxDestroyArray(fft2rhs[2]);
-    mxDestroyArray(fft2rhs[3]);
-    delete e1;
+    //The first layout of this k-space sum, with one spread and two FFTs,
+    //which is the 'one_spread' variant of mex_stokes_slp_stress_kspace.
+    StokesSLPStressKSpace(psrc, ptar, f, Nsrc, Ntar, xi, eta, Mx, My, Lx, Ly, w, P,
+            KS_ONE_SPREAD, mxGetPr(plhs[0]), NULL);
 }
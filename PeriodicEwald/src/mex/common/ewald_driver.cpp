@@ -0,0 +1,148 @@
+#include "ewald_driver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+//Initial time per unit of work of the two parts, relative to each other.
+//A real-space pair costs a few times more than a grid point update.
+#define ED_REAL_COST 4.0
+#define ED_KSPACE_COST 1.0
+
+//Time per unit of work on one thread, measured by the last call.
+static double real_cost = ED_REAL_COST;
+static double kspace_cost = ED_KSPACE_COST;
+
+double RealSpaceWork(int Nsrc, int Ntar, int nside_x, int nside_y){
+
+    return 9.0*Nsrc*Ntar/(static_cast<double>(nside_x)*nside_y);
+}
+
+double KSpaceWork(int Nsrc, int Ntar, int Mx, int My, int P, int ngrids){
+
+    double grid = static_cast<double>(Mx)*My;
+    return (static_cast<double>(Nsrc)*ngrids + 2.0*Ntar)*P*P
+            + 2*ngrids*grid*log2(std::max(grid, 2.0));
+}
+
+//Calls phase with nthreads threads for its parallel regions and returns
+//the time it took. An exception cannot leave the parallel region the
+//phase may run in, so its message is kept in error (the first one if both
+//parts fail) and it is thrown again by RunConcurrently().
+static double TimePhase(EwaldPhase phase, void* data, int nthreads,
+        std::string* error){
+
+    omp_set_num_threads(nthreads);
+    double start = omp_get_wtime();
+    const char* message = NULL;
+    try {
+        phase(data);
+    } catch(const std::exception& e) {
+        message = e.what();
+    } catch(...) {
+        message = "Unknown error in the Ewald sum.";
+    }
+    if(message != NULL) {
+#pragma omp critical(ewald_phase_error)
+        if(error->empty())
+            *error = (*message != 0) ? message : "Error in the Ewald sum.";
+    }
+    return omp_get_wtime() - start;
+}
+
+void RunConcurrently(EwaldPhase real, EwaldPhase kspace, void* data,
+        double real_work, double kspace_work, ConcurrentStats* stats){
+
+    int nthreads = omp_get_max_threads();
+    int old_levels = omp_get_max_active_levels();
+    double start = omp_get_wtime();
+
+    //Split the threads in proportion to the estimated time of each part.
+    double real_est = real_work*real_cost;
+    double kspace_est = kspace_work*kspace_cost;
+    int nreal = static_cast<int>(floor(nthreads*real_est/
+            std::max(real_est + kspace_est, 1e-300) + 0.5));
+    nreal = std::min(std::max(nreal, 1), nthreads-1);
+
+    int concurrent = 0;
+    if(nthreads > 1) {
+        omp_set_max_active_levels(std::max(old_levels, 2));
+        concurrent = (omp_get_max_active_levels() >= 2);
+    }
+
+    double real_time = 0, kspace_time = 0;
+    std::string error;
+    if(concurrent) {
+#pragma omp parallel num_threads(2)
+        {
+            //Fewer threads than asked for, run the parts in turn.
+            int alone = (omp_get_num_threads() < 2);
+            if(omp_get_thread_num() == 0) {
+                kspace_time = TimePhase(kspace, data,
+                        alone ? nthreads : nthreads-nreal, &error);
+                if(alone)
+                    real_time = TimePhase(real, data, nthreads, &error);
+            } else
+                real_time = TimePhase(real, data, nreal, &error);
+
+#pragma omp single
+            concurrent = !alone;
+        }
+        omp_set_max_active_levels(old_levels);
+    } else {
+        kspace_time = TimePhase(kspace, data, nthreads, &error);
+        if(error.empty())
+            real_time = TimePhase(real, data, nthreads, &error);
+    }
+    omp_set_num_threads(nthreads);
+
+    //Both parts have stopped and released their scratch memory.
+    if(!error.empty())
+        throw std::runtime_error(error);
+
+    int real_threads = concurrent ? nreal : nthreads;
+    int kspace_threads = concurrent ? nthreads-nreal : nthreads;
+    if(real_work > 0 && real_time > 0)
+        real_cost = real_time*real_threads/real_work;
+    if(kspace_work > 0 && kspace_time > 0)
+        kspace_cost = kspace_time*kspace_threads/kspace_work;
+
+    if(stats != NULL) {
+        stats->concurrent = concurrent;
+        stats->real_threads = real_threads;
+        stats->kspace_threads = kspace_threads;
+        stats->real_time = real_time;
+        stats->kspace_time = kspace_time;
+        stats->wall_time = omp_get_wtime() - start;
+    }
+}
+
+void AddConcurrentStats(mxArray* s, const ConcurrentStats* stats){
+
+    static const char* fields[6] = {"concurrent", "real_threads",
+            "kspace_threads", "real_time", "kspace_time", "wall_time"};
+    double values[6] = {static_cast<double>(stats->concurrent),
+            static_cast<double>(stats->real_threads),
+            static_cast<double>(stats->kspace_threads), stats->real_time,
+            stats->kspace_time, stats->wall_time};
+
+    for(int i = 0;i<6;i++) {
+        mxAddField(s, fields[i]);
+        mxSetField(s, 0, fields[i], mxCreateDoubleScalar(values[i]));
+    }
+}
+
+mxArray* EwaldStatsToStruct(const RealSpaceStats* real,
+        const KSpaceStats* kspace, const ConcurrentStats* cstats){
+
+    mxArray* s = RealSpaceStatsToStruct(real);
+    AddKSpaceStats(s, kspace);
+    AddConcurrentStats(s, cstats);
+
+    double peak = cstats->concurrent ? real->memory + kspace->memory
+            : std::max(real->memory, kspace->memory);
+    mxAddField(s, "peak_memory");
+    mxSetField(s, 0, "peak_memory", mxCreateDoubleScalar(peak));
+    return s;
+}
@@ -0,0 +1,74 @@
+#ifndef EWALD_DRIVER
+#define EWALD_DRIVER
+
+#include <omp.h>
+#include "mex.h"
+#include "kspace.h"
+#include "real_space.h"
+
+//One of the two parts of an Ewald evaluation, called with its data.
+typedef void (*EwaldPhase)(void* data);
+
+/*------------------------------------------------------------------------
+ *How the two parts of an Ewald evaluation were run. concurrent is 0 if
+ *they ran one after the other, each with all threads. The times are wall
+ *times in seconds.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int concurrent;
+    int real_threads;
+    int kspace_threads;
+    double real_time;
+    double kspace_time;
+    double wall_time;
+} ConcurrentStats;
+
+/*------------------------------------------------------------------------
+ *Runs the real-space and the k-space part of an Ewald evaluation at the
+ *same time, as two nested teams that split the threads between them. The
+ *real-space sum is compute-bound while the spreading, FFTs and gathering
+ *are mostly memory-bound, so together they use a machine better than
+ *either does alone.
+ *
+ *kspace runs on the calling thread, which must be the Matlab thread since
+ *the FFTs go through mexCallMATLAB. real runs on another thread and must
+ *not call the Matlab API (memory included). The threads are split in
+ *proportion to real_work and kspace_work, estimates of the work in each
+ *part, weighted by the time per unit of work that was measured in the
+ *previous call. The split thus adapts to the machine over a sequence of
+ *calls. With a single thread, or without nested parallelism, the parts
+ *run one after the other.
+ *
+ *An error in either part (a failed allocation or FFT) is caught on its
+ *thread, and once both parts have stopped it is thrown again from the
+ *calling thread as a std::runtime_error, so that their scratch memory has
+ *been released and the error reaches Matlab.
+ *------------------------------------------------------------------------
+ */
+void RunConcurrently(EwaldPhase real, EwaldPhase kspace, void* data,
+        double real_work, double kspace_work, ConcurrentStats* stats);
+
+//Estimated work of the real-space sum: the pairs in the 3x3 neighbourhood
+//of each target box on an nside_x x nside_y grid.
+double RealSpaceWork(int Nsrc, int Ntar, int nside_x, int nside_y);
+
+//Estimated work of the k-space sum with ngrids grids of Mx x My: the grid
+//points touched when spreading and gathering, and the FFTs.
+double KSpaceWork(int Nsrc, int Ntar, int Mx, int My, int P, int ngrids);
+
+//Adds the fields of stats to the Matlab struct s.
+void AddConcurrentStats(mxArray* s, const ConcurrentStats* stats);
+
+/*------------------------------------------------------------------------
+ *The statistics of an Ewald evaluation as one Matlab struct: the fields
+ *of the real-space statistics, those of the k-space statistics (see
+ *AddKSpaceStats()) and those of cstats, and peak_memory, the most memory
+ *in bytes the two parts held at one time. That is their sum if they ran
+ *concurrently, and the larger of the two otherwise.
+ *------------------------------------------------------------------------
+ */
+mxArray* EwaldStatsToStruct(const RealSpaceStats* real,
+        const KSpaceStats* kspace, const ConcurrentStats* cstats);
+
+#endif
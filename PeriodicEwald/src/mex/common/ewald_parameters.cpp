@@ -0,0 +1,235 @@
+#include "ewald_parameters.h"
+#include "ewald_tools.h"
+
+#include <math.h>
+
+//The logarithm of C*x^a*exp(-b*x^2)/tol.
+static inline double LogEstimate(double x, double logC, double a, double b,
+        double logtol){
+    return logC + a*log(x) - b*x*x - logtol;
+}
+
+/*------------------------------------------------------------------------
+ *Solves C*x^a*exp(-b*x^2) = tol for the x beyond the maximum of the
+ *estimate (x > 0 if a <= 0), where the estimate decreases. If even the
+ *maximum meets tol, the maximum is returned. The root is bracketed first
+ *and then found by Newton steps on the logarithm, with a bisection step
+ *whenever Newton would leave the bracket.
+ *------------------------------------------------------------------------
+ */
+static double SolveEstimate(double C, double a, double b, double tol){
+
+    double logC = log(C);
+    double logtol = log(tol);
+    double scale = 1/sqrt(b);
+
+    double lo;
+    if(a > 0) {
+        lo = sqrt(a/(2*b));
+        if(LogEstimate(lo, logC, a, b, logtol) <= 0)
+            return lo;
+    } else {
+        lo = scale;
+        for(int it = 0;it<200 && LogEstimate(lo, logC, a, b, logtol) <= 0;it++)
+            lo *= 0.5;
+        if(LogEstimate(lo, logC, a, b, logtol) <= 0)
+            return lo;
+    }
+
+    double hi = 2*(lo > scale ? lo : scale);
+    while(LogEstimate(hi, logC, a, b, logtol) > 0)
+        hi *= 2;
+
+    double x = 0.5*(lo+hi);
+    for(int it = 0;it<100;it++) {
+        double g = LogEstimate(x, logC, a, b, logtol);
+        if(fabs(g) < 1e-12)
+            break;
+        if(g > 0)
+            lo = x;
+        else
+            hi = x;
+        if(hi-lo < 1e-14*hi)
+            break;
+
+        double x_new = x - g/(a/x - 2*b*x);
+        if(!(x_new > lo && x_new < hi))
+            x_new = 0.5*(lo+hi);
+        x = x_new;
+    }
+
+    return x;
+}
+
+double FindXi(int kernel, int derivatives, double Q, double Lx, double Ly,
+        double rc, double tol){
+
+    double C, a;
+    if(kernel == SLP_KERNEL) {
+        C = sqrt(Q*pi/(4*Lx*Ly));
+        a = -0.5;
+    } else {
+        C = rc*sqrt(2*pi*Q/(Lx*Ly));
+        a = 1;
+    }
+    C *= pow(2*rc, derivatives);
+    a += 2*derivatives;
+
+    return SolveEstimate(C, a, rc*rc, tol);
+}
+
+int FindKinf(int kernel, int derivatives, double Q, double Lx, double Ly,
+        double xi, double tol){
+
+    double L3 = Lx*Lx*Lx*Ly*Ly*Ly;
+    double C, a;
+    if(kernel == SLP_KERNEL) {
+        C = sqrt(4*Q*pi*fmax(Lx,Ly)/L3);
+        a = -0.5;
+    } else {
+        C = sqrt(8*Q*pi*fmax(Lx,Ly)/L3);
+        a = 0.5;
+    }
+    a += derivatives;
+
+    double k = SolveEstimate(C, a, 1/(4*xi*xi), tol);
+    return static_cast<int>(floor(Lx*k/(2*pi) + 0.5));
+}
+
+int FindSupport(double tol){
+
+    int P = static_cast<int>(ceil(-log(tol)/(0.95*0.95*pi/2)));
+    if(P < 4)
+        return 4;
+    return (P > 24) ? 24 : P;
+}
+
+//Rational approximation A/B of x > 0 to the relative tolerance 1e-6 of
+//Matlab's rat, by continued fractions.
+static void RationalApproximation(double x, int* A, int* B){
+
+    double n = floor(x+0.5), d = 1;
+    double last_n = 1, last_d = 0;
+    double frac = x - n;
+    while(fabs(x - n/d) >= 1e-6*fabs(x) && frac != 0) {
+        double flip = 1/frac;
+        double step = floor(flip+0.5);
+        frac = flip - step;
+
+        double tmp = n;
+        n = n*step + last_n;
+        last_n = tmp;
+        tmp = d;
+        d = d*step + last_d;
+        last_d = tmp;
+    }
+    if(d < 0) {
+        n = -n;
+        d = -d;
+    }
+    *A = static_cast<int>(n);
+    *B = static_cast<int>(d);
+}
+
+//The box grid a*A x a*B of par, with xi and kinf for tol.
+static void SetBoxGrid(int kernel, int derivatives, double Q, double Lx,
+        double Ly, double tol, int a, int A, int B, EwaldParameters* par){
+
+    par->nside_x = a*A;
+    par->nside_y = a*B;
+    par->rc = Lx/par->nside_x;
+
+    par->xi = FindXi(kernel, derivatives, Q, Lx, Ly, par->rc, tol);
+    par->kinf = FindKinf(kernel, derivatives, Q, Lx, Lx, par->xi, tol);
+}
+
+//The Fourier grid of M modes per period of A/B, with w and eta.
+static void SetFourierGrid(double Lx, int M, int A, int B,
+        EwaldParameters* par){
+
+    par->Mx = A*M;
+    par->My = B*M;
+
+    double m = 0.95*sqrt(pi*par->P);
+    par->w = par->P*Lx/par->Mx/2;
+    par->eta = (2*par->xi*par->w/m)*(2*par->xi*par->w/m);
+}
+
+void ChooseEwaldParameters(int kernel, int derivatives, double Q, int npts,
+        double Nb, int P, double Lx, double Ly, double tol,
+        EwaldParameters* par){
+
+    int A, B;
+    RationalApproximation(Lx/Ly, &A, &B);
+
+    int a = static_cast<int>(ceil(sqrt(npts/(Nb*A*B))));
+    SetBoxGrid(kernel, derivatives, Q, Lx, Ly, tol, a, A, B, par);
+
+    par->P = (P > 0) ? P : FindSupport(tol);
+    SetFourierGrid(Lx, (2*par->kinf < 10000) ? 2*par->kinf : 10000, A, B,
+            par);
+}
+
+#ifdef MATLAB_MEX_FILE
+//The grid counts are those of the leanest variants in kspace_variants.cpp
+//and have to follow them.
+double FewestKSpaceGrids(int kernel, int derivatives){
+
+    if(derivatives == 0)
+        return (kernel == SLP_KERNEL) ? 8 : 7;
+    if(kernel == SLP_KERNEL)
+        return 8;
+
+    //The derivatives of the stresslet transform four grids and keep the
+    //transforms while they are transformed back.
+    return 16;
+}
+#endif
+
+int FitEwaldParameters(int kernel, int derivatives, double Q, double Lx,
+        double Ly, double tol, double kspace_grids, double max_memory,
+        EwaldParameters* par){
+
+    int A, B;
+    RationalApproximation(Lx/Ly, &A, &B);
+
+    //The most modes per period within the budget.
+    double bytes = kspace_grids*A*B*sizeof(double);
+    double fit = (max_memory > 0) ? floor(sqrt(max_memory/bytes)) : 10000;
+    int max_modes = static_cast<int>(fit < 10000 ? fit : 10000);
+
+    int a_max = (par->nside_x/A > 1) ? par->nside_x/A : 1;
+    for(int a = a_max;a>=1;a--) {
+        SetBoxGrid(kernel, derivatives, Q, Lx, Ly, tol, a, A, B, par);
+        if(2*par->kinf <= max_modes) {
+            SetFourierGrid(Lx, 2*par->kinf, A, B, par);
+            return 1;
+        }
+    }
+
+    //Even one box per period of A/B needs too many modes.
+    SetFourierGrid(Lx, max_modes > 1 ? max_modes : 1, A, B, par);
+    return 0;
+}
+
+#ifdef MATLAB_MEX_FILE
+mxArray* EwaldParametersToStruct(const EwaldParameters* par){
+
+    static const char* fields[10] = {"nside_x", "nside_y", "rc", "xi",
+            "kinf", "Mx", "My", "P", "w", "eta"};
+    mxArray* s = mxCreateStructMatrix(1, 1, 10, fields);
+
+    mxSetField(s, 0, "nside_x", mxCreateDoubleScalar(par->nside_x));
+    mxSetField(s, 0, "nside_y", mxCreateDoubleScalar(par->nside_y));
+    mxSetField(s, 0, "rc", mxCreateDoubleScalar(par->rc));
+    mxSetField(s, 0, "xi", mxCreateDoubleScalar(par->xi));
+    mxSetField(s, 0, "kinf", mxCreateDoubleScalar(par->kinf));
+    mxSetField(s, 0, "Mx", mxCreateDoubleScalar(par->Mx));
+    mxSetField(s, 0, "My", mxCreateDoubleScalar(par->My));
+    mxSetField(s, 0, "P", mxCreateDoubleScalar(par->P));
+    mxSetField(s, 0, "w", mxCreateDoubleScalar(par->w));
+    mxSetField(s, 0, "eta", mxCreateDoubleScalar(par->eta));
+
+    return s;
+}
+#endif
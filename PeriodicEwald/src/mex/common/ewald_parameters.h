@@ -0,0 +1,92 @@
+#ifndef EWALD_PARAMETERS
+#define EWALD_PARAMETERS
+
+#ifdef MATLAB_MEX_FILE
+#include "mex.h"
+#endif
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Error estimates of the spectral Ewald sums, from Palsson and Tornberg
+ *2019 (https://arxiv.org/pdf/1909.12581.pdf), and the parameters they
+ *give for a tolerance. kernel is SLP_KERNEL or DLP_KERNEL, and derivatives
+ *is the number of derivatives of the velocity in the evaluated quantity:
+ *0 for the velocity, 1 for the gradient, pressure, stress and vorticity
+ *and 2 for the pressure gradient. Each derivative multiplies the
+ *real-space error by 2*xi^2*rc and the Fourier-space error by k. Q is the
+ *sum of the squared densities plus one.
+ *
+ *All estimates have the form C*x^a*exp(-b*x^2), which decreases to zero
+ *beyond its maximum. They are solved for the tolerance by a bracketed
+ *Newton iteration on the logarithm, which always converges.
+ *------------------------------------------------------------------------
+ */
+
+//The smallest xi for which the real-space truncation error at the cutoff
+//rc meets tol.
+double FindXi(int kernel, int derivatives, double Q, double Lx, double Ly,
+        double rc, double tol);
+
+//The number of Fourier modes kinf for which the Fourier-space truncation
+//error meets tol, as a number of modes in a box of length Lx.
+int FindKinf(int kernel, int derivatives, double Q, double Lx, double Ly,
+        double xi, double tol);
+
+//The smallest number of support points P, at least 4 and at most 24,
+//whose window truncation error exp(-m^2/2), with m = 0.95*sqrt(pi*P),
+//meets tol.
+int FindSupport(double tol);
+
+/*------------------------------------------------------------------------
+ *All parameters of an evaluation, chosen as the Matlab wrappers do: the
+ *grid of the real-space sum holds about Nb points per box, xi meets tol
+ *at its cutoff and the Fourier grid has 2*kinf (at most 10000) modes per
+ *period of the rational approximation A/B of Lx/Ly.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int nside_x;
+    int nside_y;
+    double rc;
+    double xi;
+    int kinf;
+    int Mx;
+    int My;
+    int P;
+    double w;
+    double eta;
+} EwaldParameters;
+
+//Chooses the parameters for npts sources and targets. P is used as given
+//if it is positive and chosen from tol otherwise.
+void ChooseEwaldParameters(int kernel, int derivatives, double Q, int npts,
+        double Nb, int P, double Lx, double Ly, double tol,
+        EwaldParameters* par);
+
+#ifdef MATLAB_MEX_FILE
+mxArray* EwaldParametersToStruct(const EwaldParameters* par);
+
+//The fewest real Mx x My grids (a complex grid counts twice) the Fourier
+//sum of a quantity holds at one time, with the leanest variant of
+//kspace_variants.h where there is a choice. The counts are kept here, so
+//that the parameters do not depend on the variants.
+double FewestKSpaceGrids(int kernel, int derivatives);
+#endif
+
+/*------------------------------------------------------------------------
+ *Fits the parameters par, chosen for the box grid par->nside_x x
+ *par->nside_y and par->P, to a memory budget. As long as kspace_grids
+ *Fourier grids would take more than max_memory bytes, or more than 10000
+ *modes per period are needed, the box grid is made coarser. Its longer
+ *cutoff needs a smaller xi and fewer modes for tol, so work moves from
+ *the Fourier sum to the real-space sum and tol is still met. A budget of
+ *0 is no budget. Returns 1 if tol is met, and otherwise 0 with the
+ *coarsest box grid and the largest Fourier grid that fits, which cannot
+ *meet tol.
+ *------------------------------------------------------------------------
+ */
+int FitEwaldParameters(int kernel, int derivatives, double Q, double Lx,
+        double Ly, double tol, double kspace_grids, double max_memory,
+        EwaldParameters* par);
+
+#endif
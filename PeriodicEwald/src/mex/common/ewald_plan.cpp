@@ -0,0 +1,234 @@
+#include "ewald_plan.h"
+#include "kspace.h"
+#include "kspace_variants.h"
+
+#include <string.h>
+
+//Copies n points (2 x n) into a new array.
+static double* CopyPoints(const double* p, int n){
+
+    double* copy = new double[2*n+1];
+    memcpy(copy, p, 2*n*sizeof(double));
+    return copy;
+}
+
+//Builds the near field of the points of the plan. The density values are
+//filled in by each evaluation, so the near field is built with zeros. It
+//is kept until the plan is destroyed, so it is persistent.
+static void BuildPlanNearField(EwaldPlan* plan){
+
+    int ndens = (plan->kernel == SLP_KERNEL) ? 2 : 4;
+    double* dens = new double[ndens*plan->Nsrc+1];
+    memset(dens, 0, ndens*plan->Nsrc*sizeof(double));
+
+    BuildNearField(plan->psrc, plan->ptar, dens, ndens, plan->Nsrc,
+            plan->Ntar, plan->nside_x, plan->nside_y, plan->Lx, plan->Ly, 1,
+            &plan->nf);
+
+    delete[] dens;
+}
+
+void CreateEwaldPlan(int kernel, const double* psrc, const double* ptar,
+        const double* n, int Nsrc, int Ntar, double xi, int nside_x,
+        int nside_y, double eta, int Mx, int My, double Lx, double Ly,
+        double w, int P, int precision, int kspace_variant,
+        EwaldPlan* plan){
+
+    plan->kernel = kernel;
+    plan->Nsrc = Nsrc;
+    plan->Ntar = Ntar;
+    plan->xi = xi;
+    plan->nside_x = nside_x;
+    plan->nside_y = nside_y;
+    plan->eta = eta;
+    plan->Mx = Mx;
+    plan->My = My;
+    plan->Lx = Lx;
+    plan->Ly = Ly;
+    plan->w = w;
+    plan->P = P;
+    plan->precision = precision;
+    plan->kspace_variant = kspace_variant;
+    for(int j = 0;j<KS_MAX_VARIANTS;j++)
+        plan->kspace_times[j] = -1;
+    plan->executions = 0;
+    plan->refreshes = 0;
+    plan->rebuilds = 0;
+
+    plan->psrc = CopyPoints(psrc, Nsrc);
+    plan->ptar = CopyPoints(ptar, Ntar);
+    plan->n = (kernel == DLP_KERNEL) ? CopyPoints(n, Nsrc) : NULL;
+
+    BuildPlanNearField(plan);
+
+    plan->filter = new double[Mx*My];
+    if(kernel == SLP_KERNEL)
+        StokesSLPKSpaceFilter(Mx, My, Lx, Ly, xi, eta, plan->filter);
+    else
+        StokesDLPKSpaceFilter(Mx, My, Lx, Ly, xi, eta, plan->filter);
+}
+
+int MoveEwaldPlan(EwaldPlan* plan, const double* psrc, const double* ptar,
+        const double* n){
+
+    memcpy(plan->psrc, psrc, 2*plan->Nsrc*sizeof(double));
+    memcpy(plan->ptar, ptar, 2*plan->Ntar*sizeof(double));
+    if(plan->kernel == DLP_KERNEL)
+        memcpy(plan->n, n, 2*plan->Nsrc*sizeof(double));
+
+    if(MoveNearField(&plan->nf, psrc, ptar, plan->Nsrc, plan->Ntar,
+            plan->nside_x, plan->nside_y, plan->Lx, plan->Ly)) {
+        plan->refreshes++;
+        return 0;
+    }
+
+    FreeNearField(&plan->nf);
+    BuildPlanNearField(plan);
+    plan->rebuilds++;
+    return 1;
+}
+
+//The arguments of the two parts of an evaluation.
+typedef struct {
+    EwaldPlan* plan;
+    double* f;
+    double* ur;
+    double* uk;
+    RealSpaceStats* stats;
+    KSpaceStats* kstats;
+} PlanData;
+
+static void PlanRealPart(void* data){
+
+    PlanData* d = (PlanData*) data;
+    EwaldPlan* plan = d->plan;
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = d->ur;
+    RealSpaceSumNearField(plan->kernel, &plan->nf, d->f, plan->n,
+            plan->Nsrc, plan->Ntar, plan->xi, plan->precision, output,
+            d->stats);
+}
+
+static void PlanKSpacePart(void* data){
+
+    PlanData* d = (PlanData*) data;
+    EwaldPlan* plan = d->plan;
+
+    KSpaceArgs args;
+    args.psrc = plan->psrc;
+    args.ptar = plan->ptar;
+    args.f = d->f;
+    args.n = plan->n;
+    args.Nsrc = plan->Nsrc;
+    args.Ntar = plan->Ntar;
+    args.xi = plan->xi;
+    args.eta = plan->eta;
+    args.Mx = plan->Mx;
+    args.My = plan->My;
+    args.Lx = plan->Lx;
+    args.Ly = plan->Ly;
+    args.w = plan->w;
+    args.P = plan->P;
+    args.filter = plan->filter;
+    args.stats = d->kstats;
+    args.max_memory = 0;
+    if(d->kstats != NULL)
+        memset(d->kstats, 0, sizeof(KSpaceStats));
+
+    //Once measured, or if the variant was found in what was learnt
+    //earlier, the plan keeps the variant.
+    int family = (plan->kernel == SLP_KERNEL) ? KS_SLP_VELOCITY
+            : KS_DLP_VELOCITY;
+    double times[KS_MAX_VARIANTS];
+    plan->kspace_variant = RunKSpaceVariant(family, plan->kspace_variant,
+            &args, d->uk, times);
+    for(int j = 0;j<NumKSpaceVariants(family);j++)
+        if(times[j] >= 0)
+            plan->kspace_times[j] = times[j];
+}
+
+void ExecuteEwaldPlan(EwaldPlan* plan, double* f, double* ur, double* uk,
+        RealSpaceStats* stats, KSpaceStats* kstats, ConcurrentStats* cstats){
+
+    PlanData d;
+    d.plan = plan;
+    d.f = f;
+    d.ur = ur;
+    d.uk = uk;
+    d.stats = stats;
+    d.kstats = kstats;
+
+    int ngrids = (plan->kernel == SLP_KERNEL) ? 2 : 4;
+    RunConcurrently(PlanRealPart, PlanKSpacePart, &d,
+            RealSpaceWork(plan->Nsrc, plan->Ntar, plan->nside_x,
+            plan->nside_y), KSpaceWork(plan->Nsrc, plan->Ntar, plan->Mx,
+            plan->My, plan->P, ngrids), cstats);
+    plan->executions++;
+}
+
+double EwaldPlanMemory(const EwaldPlan* plan){
+
+    int ndens = (plan->kernel == SLP_KERNEL) ? 2 : 4;
+    double points = (2.0 + (plan->n != NULL ? 2 : 0))*plan->Nsrc
+            + 2.0*plan->Ntar;
+
+    return NearFieldMemory(&plan->nf, plan->Nsrc, plan->Ntar, ndens)
+            + points*sizeof(double)
+            + static_cast<double>(plan->Mx)*plan->My*sizeof(double);
+}
+
+void FreeEwaldPlan(EwaldPlan* plan){
+
+    FreeNearField(&plan->nf);
+    delete[] plan->psrc;
+    delete[] plan->ptar;
+    delete[] plan->n;
+    delete[] plan->filter;
+}
+
+mxArray* EwaldPlanToStruct(const EwaldPlan* plan){
+
+    static const char* fields[20] = {"kernel", "num_sources", "num_targets",
+            "xi", "nside_x", "nside_y", "eta", "Mx", "My", "Lx", "Ly", "w",
+            "P", "adaptive", "kspace_variant", "kspace_times", "memory",
+            "executions", "refreshes", "rebuilds"};
+    mxArray* s = mxCreateStructMatrix(1, 1, 20, fields);
+
+    mxSetField(s, 0, "kernel",
+            mxCreateString(plan->kernel == SLP_KERNEL ? "slp" : "dlp"));
+    mxSetField(s, 0, "num_sources", mxCreateDoubleScalar(plan->Nsrc));
+    mxSetField(s, 0, "num_targets", mxCreateDoubleScalar(plan->Ntar));
+    mxSetField(s, 0, "xi", mxCreateDoubleScalar(plan->xi));
+    mxSetField(s, 0, "nside_x", mxCreateDoubleScalar(plan->nside_x));
+    mxSetField(s, 0, "nside_y", mxCreateDoubleScalar(plan->nside_y));
+    mxSetField(s, 0, "eta", mxCreateDoubleScalar(plan->eta));
+    mxSetField(s, 0, "Mx", mxCreateDoubleScalar(plan->Mx));
+    mxSetField(s, 0, "My", mxCreateDoubleScalar(plan->My));
+    mxSetField(s, 0, "Lx", mxCreateDoubleScalar(plan->Lx));
+    mxSetField(s, 0, "Ly", mxCreateDoubleScalar(plan->Ly));
+    mxSetField(s, 0, "w", mxCreateDoubleScalar(plan->w));
+    mxSetField(s, 0, "P", mxCreateDoubleScalar(plan->P));
+    mxSetField(s, 0, "adaptive", mxCreateDoubleScalar(plan->nf.adaptive));
+
+    //The variant is not known before a measuring plan has been executed.
+    int family = (plan->kernel == SLP_KERNEL) ? KS_SLP_VELOCITY
+            : KS_DLP_VELOCITY;
+    int variant = plan->kspace_variant;
+    if(variant == KS_ESTIMATE)
+        variant = 0;
+    mxSetField(s, 0, "kspace_variant", mxCreateString(variant >= 0 ?
+            GetKSpaceVariant(family, variant)->name : "measure"));
+    mxArray* times = mxCreateDoubleMatrix(1, NumKSpaceVariants(family),
+            mxREAL);
+    memcpy(mxGetPr(times), plan->kspace_times,
+            NumKSpaceVariants(family)*sizeof(double));
+    mxSetField(s, 0, "kspace_times", times);
+
+    mxSetField(s, 0, "memory", mxCreateDoubleScalar(EwaldPlanMemory(plan)));
+    mxSetField(s, 0, "executions", mxCreateDoubleScalar(plan->executions));
+    mxSetField(s, 0, "refreshes", mxCreateDoubleScalar(plan->refreshes));
+    mxSetField(s, 0, "rebuilds", mxCreateDoubleScalar(plan->rebuilds));
+
+    return s;
+}
@@ -0,0 +1,91 @@
+#ifndef EWALD_PLAN
+#define EWALD_PLAN
+
+#include "mex.h"
+#include "ewald_driver.h"
+#include "kspace_variants.h"
+#include "near_field.h"
+#include "real_space.h"
+
+/*------------------------------------------------------------------------
+ *Everything about an Ewald evaluation of the velocity that does not
+ *depend on the density, kept between calls so that a sequence of
+ *evaluations for the same points (e.g. the iterations of a solver, or the
+ *time steps of a slowly moving suspension) only does the work that
+ *depends on f. The plan holds the parameters, copies of the points (and
+ *for the stresslet the normals), the near field of the real-space sum and
+ *the table of the frequency-space filter. kernel is SLP_KERNEL or
+ *DLP_KERNEL and precision is as for RealSpaceOptions.
+ *
+ *kspace_variant is the variant of the k-space sum, see kspace_variants.h.
+ *A plan made with KS_MEASURE times the variants in its first execution,
+ *which gives the result as usual, and keeps the fastest in kspace_variant.
+ *kspace_times holds the measured times, -1 where none was measured.
+ *
+ *executions counts the evaluations, refreshes the moves that kept the
+ *near field and rebuilds the moves that had to build it anew, see
+ *MoveEwaldPlan().
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int kernel;
+    int Nsrc;
+    int Ntar;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    int precision;
+    double* psrc;
+    double* ptar;
+    double* n;
+    NearField nf;
+    double* filter;
+    int kspace_variant;
+    double kspace_times[KS_MAX_VARIANTS];
+    int executions;
+    int refreshes;
+    int rebuilds;
+} EwaldPlan;
+
+//Makes a plan for the given points and parameters. n is only used, and
+//must only be given, for the stresslet. The points are copied.
+void CreateEwaldPlan(int kernel, const double* psrc, const double* ptar,
+        const double* n, int Nsrc, int Ntar, double xi, int nside_x,
+        int nside_y, double eta, int Mx, int My, double Lx, double Ly,
+        double w, int P, int precision, int kspace_variant,
+        EwaldPlan* plan);
+
+/*------------------------------------------------------------------------
+ *Moves the points of the plan (same numbers as before) and, for the
+ *stresslet, replaces the normals. The sorted points of the near field are
+ *updated in place as long as every point stays in its box of the uniform
+ *grid, which is the case for small displacements. Otherwise the near
+ *field is built anew, and 1 is returned.
+ *------------------------------------------------------------------------
+ */
+int MoveEwaldPlan(EwaldPlan* plan, const double* psrc, const double* ptar,
+        const double* n);
+
+//Evaluates the real-space and k-space velocity of the density f (2 x Nsrc)
+//into ur and uk (2 x Ntar), at the same time by RunConcurrently(). Must be
+//called from the Matlab thread. The statistics may be NULL.
+void ExecuteEwaldPlan(EwaldPlan* plan, double* f, double* ur, double* uk,
+        RealSpaceStats* stats, KSpaceStats* kstats, ConcurrentStats* cstats);
+
+//The memory held by the plan in bytes.
+double EwaldPlanMemory(const EwaldPlan* plan);
+
+void FreeEwaldPlan(EwaldPlan* plan);
+
+//Converts the parameters, the memory and the counters of the plan to a
+//Matlab struct.
+mxArray* EwaldPlanToStruct(const EwaldPlan* plan);
+
+#endif
@@ -1,82 +1,193 @@
 #include "ewald_tools.h"
+#include "scratch_arena.h"
 
 /*------------------------------------------------------------------------
- *This function assigns particles to boxes on the current grid.
+ *Counting sort of n points into the boxes of the grid. Each thread counts
+ *the points of its part of the input in its own histogram, the histograms
+ *are turned into write positions by a prefix sum over the threads and the
+ *boxes, and each thread then scatters its points. Points keep their input
+ *order within a box. in_box (n) and hist (boxes x threads) are scratch.
+ *If p_sorted (vals_sorted) is not NULL the coordinates (the nvals values
+ *per point in vals) are also written in box order. The boxes are
+ *numbered by box_rank, or row-major if it is NULL.
+ *------------------------------------------------------------------------
+ */
+static void BinPoints(const PointSet* p, const double* vals, int nvals, int n,
+        double Lx, double Ly, int nside_x, int nside_y, const int* box_rank,
+        int* in_box, int* hist, int* particle_offsets, int* box_offsets,
+        int* nparticles_in_box, double* p_sorted, double* vals_sorted){
+
+    int number_of_boxes = nside_x*nside_y;
+    int max_threads = omp_get_max_threads();
+    ScratchBuffer<int> block_sum(max_threads+1);
+    const double* x = p->x;
+    const double* y = p->y;
+    int stride = p->stride;
+
+#pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        int* h = hist + t*number_of_boxes;
+
+        for(int b = 0;b<number_of_boxes;b++)
+            h[b] = 0;
+
+        //Assign the points to boxes. Truncation only differs from floor
+        //for negative values, which are clamped to box 0 anyway.
+#pragma omp for schedule(static)
+        for(int j = 0;j<n;j++) {
+            int box_x = static_cast<int>(nside_x*(x[stride*j]/Lx+0.5));
+            int box_y = static_cast<int>(nside_y*(y[stride*j]/Ly+0.5));
+            if(box_x < 0) box_x = 0;
+            if(box_x >= nside_x) box_x = nside_x-1;
+            if(box_y < 0) box_y = 0;
+            if(box_y >= nside_y) box_y = nside_y-1;
+            in_box[j] = box_y*nside_x + box_x;
+            if(box_rank != NULL)
+                in_box[j] = box_rank[in_box[j]];
+            h[in_box[j]]++;
+        }
+
+        //Offsets of each thread within the boxes, and the box sizes.
+#pragma omp for schedule(static)
+        for(int b = 0;b<number_of_boxes;b++) {
+            int sum = 0;
+            for(int tt = 0;tt<nt;tt++) {
+                int c = hist[tt*number_of_boxes+b];
+                hist[tt*number_of_boxes+b] = sum;
+                sum += c;
+            }
+            nparticles_in_box[b] = sum;
+        }
+
+        //Prefix sum over the boxes, by blocks of boxes per thread.
+        int bfirst = (t*number_of_boxes)/nt;
+        int blast = ((t+1)*number_of_boxes)/nt;
+        int sum = 0;
+        for(int b = bfirst;b<blast;b++)
+            sum += nparticles_in_box[b];
+        block_sum[t+1] = sum;
+
+#pragma omp barrier
+#pragma omp single
+        {
+            block_sum[0] = 0;
+            for(int tt = 1;tt<=nt;tt++)
+                block_sum[tt] += block_sum[tt-1];
+            box_offsets[number_of_boxes] = n;
+        }
+
+        sum = block_sum[t];
+        for(int b = bfirst;b<blast;b++) {
+            box_offsets[b] = sum;
+            sum += nparticles_in_box[b];
+        }
+
+#pragma omp barrier
+#pragma omp for schedule(static)
+        for(int b = 0;b<number_of_boxes;b++)
+            for(int tt = 0;tt<nt;tt++)
+                hist[tt*number_of_boxes+b] += box_offsets[b];
+
+        //Scatter the points, with the same static partition as when
+        //counting so that every thread finds its own write positions.
+#pragma omp for schedule(static)
+        for(int j = 0;j<n;j++) {
+            int pos = h[in_box[j]]++;
+            particle_offsets[pos] = j;
+            if(p_sorted != NULL) {
+                p_sorted[2*pos] = x[stride*j];
+                p_sorted[2*pos+1] = y[stride*j];
+            }
+            if(vals_sorted != NULL)
+                for(int c = 0;c<nvals;c++)
+                    vals_sorted[nvals*pos+c] = vals[nvals*j+c];
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ *This function assigns particles to boxes on the current grid. The
+ *particle offsets give the input index of each particle in box order. The
+ *sorted outputs psrc_sorted, ptar_sorted and dens_sorted (ndens values per
+ *source) are optional and can be NULL. box_rank gives the number of each
+ *box, indexed row-major by box_y*nside_x+box_x, and the boxes are numbered
+ *row-major if it is NULL.
  *------------------------------------------------------------------------
  */
 void Assign(double* psrc, double* ptar, double Lx, double Ly, int nsrc,
         int ntar, int nside_x, int nside_y, int* particle_offsets_src,
         int* box_offsets_src,int* nsources_in_box, int* particle_offsets_tar,
-        int* box_offsets_tar,int* ntargets_in_box){
-    
-    //The total number of boxes.
+        int* box_offsets_tar,int* ntargets_in_box, double* dens, int ndens,
+        double* psrc_sorted, double* ptar_sorted, double* dens_sorted,
+        const int* box_rank){
+
+    //The scratch arrays are shared by the sources and the targets.
     int number_of_boxes = nside_x*nside_y;
-    int j;
-    int* in_box_src = new int[nsrc];
-    int* in_box_tar = new int[ntar];
-    int* particlenum_in_box_src = new int[number_of_boxes+1];
-    int* particlenum_in_box_tar = new int[number_of_boxes+1];
-    
-    //Clear the nparticles_in_box arrays.
-    for(j = 0;j<number_of_boxes;j++){
-        nsources_in_box[j] = 0;
-        ntargets_in_box[j] = 0;
-    }
-    
-    //Assign the sources to boxes.
-    for(j = 0;j<nsrc;j++) {
-        int box_x = (int)floor(nside_x*(psrc[2*j]/Lx+0.5));
-        int box_y = (int)floor(nside_y*(psrc[2*j+1]/Ly+0.5));
-        if(box_x < 0) box_x = 0;
-        if(box_x >= nside_x) box_x = nside_x-1;
-        if(box_y < 0) box_y = 0;
-        if(box_y >= nside_y) box_y = nside_y-1;
-        in_box_src[j] =  box_y*nside_x + box_x;
-        nsources_in_box[in_box_src[j]]++;
-    }
-    
-    //Assign the targets to boxes.
-    for(j = 0;j<ntar;j++) {
-        int box_x = (int)floor(nside_x*(ptar[2*j]/Lx+0.5));
-        int box_y = (int)floor(nside_y*(ptar[2*j+1]/Ly+0.5));
-        if(box_x < 0) box_x = 0;
-        if(box_x >= nside_x) box_x = nside_x-1;
-        if(box_y < 0) box_y = 0;
-        if(box_y >= nside_y) box_y = nside_y-1;
-        in_box_tar[j] =  box_y*nside_x + box_x;
-        ntargets_in_box[in_box_tar[j]]++;
-    }
-    
-    //box_offsets is the offsets of the boxes in particle_offsets to be
-    //computed below. particlenum_in_box is a temporary array.
-    box_offsets_src[0] = particlenum_in_box_src[0] = 0;
-    box_offsets_tar[0] = particlenum_in_box_tar[0] = 0;
-    int isrc = 0;
-    int itar = 0;
-    
-    for(j=1;j<number_of_boxes+1;j++) {
-        isrc += nsources_in_box[j-1];
-        
-        particlenum_in_box_src[j] = isrc;
-        
-        box_offsets_src[j] = isrc;
-        
-        itar += ntargets_in_box[j-1];
-        particlenum_in_box_tar[j] = itar;
-        
-        box_offsets_tar[j] = itar;
+    ScratchBuffer<int> in_box((nsrc > ntar ? nsrc : ntar)+1);
+    ScratchBuffer<int> hist(omp_get_max_threads()*number_of_boxes);
+
+    PointSet src = InterleavedPoints(psrc);
+    PointSet tar = InterleavedPoints(ptar);
+    BinPoints(&src, dens, ndens, nsrc, Lx, Ly, nside_x, nside_y, box_rank,
+            in_box, hist, particle_offsets_src, box_offsets_src, nsources_in_box,
+            psrc_sorted, dens_sorted);
+    BinPoints(&tar, NULL, 0, ntar, Lx, Ly, nside_x, nside_y, box_rank,
+            in_box, hist, particle_offsets_tar, box_offsets_tar, ntargets_in_box,
+            ptar_sorted, NULL);
+}
+
+void AssignPoints(const PointSet* p, double Lx, double Ly, int n,
+        int nside_x, int nside_y, int* particle_offsets, int* box_offsets,
+        int* nparticles_in_box, double* vals, int nvals, double* p_sorted,
+        double* vals_sorted, const int* box_rank){
+
+    ScratchBuffer<int> in_box(n+1);
+    ScratchBuffer<int> hist(omp_get_max_threads()*nside_x*nside_y);
+
+    BinPoints(p, vals, nvals, n, Lx, Ly, nside_x, nside_y, box_rank, in_box,
+            hist, particle_offsets, box_offsets, nparticles_in_box, p_sorted,
+            vals_sorted);
+}
+
+/*------------------------------------------------------------------------
+ *Numbers the boxes of the nside_x x nside_y grid along a Hilbert curve,
+ *so that boxes close in number are close in space. The curve is traced on
+ *the smallest power-of-two grid that covers the boxes, skipping the cells
+ *outside. box_rank[box_y*nside_x+box_x] is the number of the box.
+ *------------------------------------------------------------------------
+ */
+void HilbertBoxOrder(int nside_x, int nside_y, int* box_rank){
+
+    int side = 1;
+    while(side < nside_x || side < nside_y)
+        side *= 2;
+
+    int rank = 0;
+    for(long d = 0;d<static_cast<long>(side)*side;d++) {
+        //Cell number d along the curve, see e.g. Hacker's Delight 16-2.
+        int x = 0, y = 0;
+        long k = d;
+        for(int s = 1;s<side;s *= 2) {
+            int rx = 1 & static_cast<int>(k/2);
+            int ry = 1 & static_cast<int>(k ^ rx);
+            if(ry == 0) {
+                if(rx == 1) {
+                    x = s-1-x;
+                    y = s-1-y;
+                }
+                int tmp = x;
+                x = y;
+                y = tmp;
+            }
+            x += s*rx;
+            y += s*ry;
+            k /= 4;
+        }
+        if(x < nside_x && y < nside_y)
+            box_rank[y*nside_x + x] = rank++;
     }
-    
-    //The offsets of the particles in each box in the z and q arrays.
-    for(j=0;j<nsrc;j++)
-        particle_offsets_src[particlenum_in_box_src[in_box_src[j]]++] = j;
-    for(j=0;j<ntar;j++)
-        particle_offsets_tar[particlenum_in_box_tar[in_box_tar[j]]++] = j;
-    
-    delete in_box_src;
-    delete particlenum_in_box_src;
-    delete in_box_tar;
-    delete particlenum_in_box_tar;
 }
 
 /*------------------------------------------------------------------------
@@ -130,7 +241,7 @@ void Spread(double* H1, double* H2, double* e1, double* psrc, double* f,
     //operation. We use the simple approach of locking the column of the
     //matrix we are working on currently. This might not be optimal but it
     //is simple to implement.
-    omp_lock_t* locks = new omp_lock_t[Mx];
+    ScratchBuffer<omp_lock_t> locks(Mx);
     for(int j = 0;j<Mx;j++)
         omp_init_lock(&locks[j]);
     
@@ -194,8 +305,61 @@ void Spread(double* H1, double* H2, double* e1, double* psrc, double* f,
     //get rid of them.
     for(int j = 0;j<Mx;j++)
         omp_destroy_lock(&locks[j]);
-    
-    delete locks;
+}
+
+/*------------------------------------------------------------------------
+ *Spreads ngrids values per source (vals, ngrids x Nsrc) to ngrids grids
+ *at once, e.g. the densities of several right-hand sides. Grid g is
+ *H[g*Mx*My] to H[(g+1)*Mx*My-1]. The Gaussian weights of a source are
+ *computed once and applied to all its values, otherwise as Spread().
+ *------------------------------------------------------------------------
+ */
+void SpreadBlock(double* H, int ngrids, double* e1, double* psrc,
+        const double* vals, int Nsrc, double Lx, double Ly, double xi,
+        double w, double eta, int P, int Mx, int My, double h){
+
+    double tmp = -2*xi*xi/eta*h*h;
+    for(int j = -P/2;j<=P/2;j++)
+        e1[j+P/2] = exp(tmp*j*j);
+
+    int grid = Mx*My;
+    ScratchBuffer<omp_lock_t> locks(Mx);
+    for(int j = 0;j<Mx;j++)
+        omp_init_lock(&locks[j]);
+
+#pragma omp parallel for
+    for(int k = 0;k<Nsrc;k++) {
+        int mx, my;
+        double px, py;
+        FindClosestNode(psrc[2*k], psrc[2*k+1], Lx, Ly, h, P, &mx, &my,
+                &px, &py);
+
+        double tmp = -2*xi*xi/eta;
+        double ex = exp(tmp*(px*px+py*py + 2*w*px));
+        double e4y = exp(2*tmp*w*py);
+        double e3x = exp(-2*tmp*h*px);
+        double e3y = exp(-2*tmp*h*py);
+        const double* vk = vals + ngrids*k;
+
+        for(int x = 0;x<P+1;x++) {
+            double ey = ex*e4y*e1[x];
+            int xidx = ((x+mx+Mx)%Mx)*My;
+
+            omp_set_lock(&locks[(x+mx+Mx)%Mx]);
+            for(int y = 0;y<P+1;y++) {
+                double tmp = ey*e1[y];
+                int idx = ((y+my+My)%My)+xidx;
+                for(int g = 0;g<ngrids;g++)
+                    H[g*grid+idx] += tmp*vk[g];
+                ey *= e3y;
+            }
+            omp_unset_lock(&locks[(x+mx+Mx)%Mx]);
+            ex *= e3x;
+        }
+    }
+
+    for(int j = 0;j<Mx;j++)
+        omp_destroy_lock(&locks[j]);
 }
 
 /*------------------------------------------------------------------------
@@ -271,32 +435,51 @@ void Gather(double* H, int total_components, int component_number,
 }
 
 /*------------------------------------------------------------------------
- *This function extracts the real and imaginary parts of an FFT
+ *Gathers ngrids grids (laid out as for SpreadBlock()) at the targets,
+ *giving ngrids values per target in output (ngrids x Ntar), which is
+ *overwritten. The weights of a target are computed once for all grids,
+ *otherwise as Gather(). e1 must have been filled in by the spreading.
  *------------------------------------------------------------------------
  */
-void ExtractRealIm(mxArray *fftvector, double *Hhat_re, double *Hhat_im,
-        int Mx, int My)
-{
-    
-    mexPrintf("1\n");
-    
-    //The output of the FFT is complex. Get pointers to the real and
-    //imaginary parts of Hhat1 and Hhat2.
-    Hhat_re = mxGetPr(fftvector);
-    Hhat_im = mxGetPi(fftvector);
-    
-    mwSize cs = Mx*My;
-    
-    mexPrintf("2\n");
-    
-    //We cannot assume that both the real and imaginary part of the
-    //Fourier transforms are non-zero.
-    if(Hhat_im == NULL) {
-        Hhat_im = (double*) mxCalloc(cs,sizeof(double));
-        mxSetPi(fftvector,Hhat_im);
-    }
-    if(Hhat_re == NULL) {
-        Hhat_re = (double*) mxCalloc(cs,sizeof(double));
-        mxSetPr(fftvector,Hhat_re);
+void GatherBlock(const double* H, int ngrids, const double* e1,
+        double* ptar, double* output, int Ntar, double Lx, double Ly,
+        double xi, double w, double eta, int P, int Mx, int My, double h){
+
+    int grid = Mx*My;
+    double scale = 4*xi*xi/eta;
+    scale = scale*scale*h*h/pi/(4*pi);
+
+#pragma omp parallel for
+    for(int k = 0;k<Ntar;k++) {
+        int mx, my;
+        double px, py;
+        FindClosestNode(ptar[2*k], ptar[2*k+1], Lx, Ly, h, P, &mx, &my,
+                &px, &py);
+
+        double tmp = -2*xi*xi/eta;
+        double ex = exp(tmp*(px*px+py*py + 2*w*px));
+        double e4y = exp(2*tmp*w*py);
+        double e3x = exp(-2*tmp*h*px);
+        double e3y = exp(-2*tmp*h*py);
+
+        double* out = output + ngrids*k;
+        for(int g = 0;g<ngrids;g++)
+            out[g] = 0;
+
+        for(int x = 0;x<P+1;x++) {
+            double ey = ex*e4y*e1[x];
+            int xidx = ((x+mx+Mx)%Mx)*My;
+            for(int y = 0;y<P+1;y++) {
+                double tmp = ey*e1[y];
+                int idx = ((y+my+My)%My)+xidx;
+                for(int g = 0;g<ngrids;g++)
+                    out[g] += tmp*H[g*grid+idx];
+                ey *= e3y;
+            }
+            ex *= e3x;
+        }
+
+        for(int g = 0;g<ngrids;g++)
+            out[g] *= scale;
     }
 }
@@ -2,16 +2,60 @@
 #define EWALD_TOOLS
 
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 #include <omp.h>
+#ifdef MATLAB_MEX_FILE
 #include "mex.h"
+#endif
 
 #define pi 3.1415926535897932385
 
+/*------------------------------------------------------------------------
+ *The coordinates of a set of points, point j being (x[stride*j],
+ *y[stride*j]). A 2 x n Matlab matrix p is read in place with x = p,
+ *y = p+1 and stride 2, see InterleavedPoints(), and separate x and y
+ *vectors, as the Matlab wrappers hold them, with stride 1.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    const double* x;
+    const double* y;
+    int stride;
+} PointSet;
+
+static inline PointSet InterleavedPoints(const double* p){
+    PointSet points;
+    points.x = p;
+    points.y = p+1;
+    points.stride = 2;
+    return points;
+}
+
+//The points of p from first on.
+static inline PointSet OffsetPoints(const PointSet* p, int first){
+    PointSet points = *p;
+    points.x += static_cast<ptrdiff_t>(p->stride)*first;
+    points.y += static_cast<ptrdiff_t>(p->stride)*first;
+    return points;
+}
+
 void Assign(double *psrc, double *ptar, double len_x, double len_y, int nsrc, 
         int ntar, int nside_x, int nside_y, int* particle_offsets_src,
         int* box_offsets_src,int* nsources_in_box, int* particle_offsets_tar,
-        int* box_offsets_tar,int* ntargets_in_box);
+        int* box_offsets_tar,int* ntargets_in_box, double* dens, int ndens,
+        double* psrc_sorted, double* ptar_sorted, double* dens_sorted,
+        const int* box_rank);
+
+//Assigns a single set of n points to boxes as Assign() does, e.g. the
+//targets alone when the sources are kept binned. vals (nvals values per
+//point) and the sorted outputs can be NULL.
+void AssignPoints(const PointSet* p, double Lx, double Ly, int n,
+        int nside_x, int nside_y, int* particle_offsets, int* box_offsets,
+        int* nparticles_in_box, double* vals, int nvals, double* p_sorted,
+        double* vals_sorted, const int* box_rank);
+
+void HilbertBoxOrder(int nside_x, int nside_y, int* box_rank);
 
 void FindClosestNode(double x, double y, double Lx, double Ly, double h, int P, 
 			int* mx, int* my, double* px, double* py);
@@ -24,7 +68,22 @@ void Gather(double* H, int total_components, int component_number,
         double* e1, double* ptar, double* output,
         int Ntar, double Lx, double Ly, double xi, double w,
         double eta, int P, int Mx, int My, double h);
-        
-void ExtractRealIm(mxArray *fftvector, double *Hhat_re, double *Hhat_im, 
-        int Mx, int My);
+
+//Spread() and Gather() for ngrids grids at once, stored one after the
+//other in H, with ngrids values per point.
+void SpreadBlock(double* H, int ngrids, double* e1, double* psrc,
+        const double* vals, int Nsrc, double Lx, double Ly, double xi,
+        double w, double eta, int P, int Mx, int My, double h);
+
+void GatherBlock(const double* H, int ngrids, const double* e1,
+        double* ptar, double* output, int Ntar, double Lx, double Ly,
+        double xi, double w, double eta, int P, int Mx, int My, double h);
+
+//Adds the wall time since *clock to *phase_time and restarts the clock,
+//for the per-phase times of the real-space and k-space statistics.
+static inline void LapTime(double* phase_time, double* clock){
+    double now = omp_get_wtime();
+    *phase_time += now - *clock;
+    *clock = now;
+}
 #endif
@@ -0,0 +1,1136 @@
+#include "kspace.h"
+#include "ewald_tools.h"
+#include "mx_complex.h"
+#include "scratch_arena.h"
+
+#include <math.h>
+#include <omp.h>
+#include <string.h>
+
+//The scalar multipliers of the Stokeslet and stresslet filters at the
+//squared wavenumber Ksq.
+static inline double SLPMultiplier(double Ksq, double xi, double eta){
+    return (1.0/(Ksq*Ksq)+0.25/(Ksq*xi*xi))*exp(-0.25*(1-eta)/(xi*xi)*Ksq);
+}
+
+static inline double DLPMultiplier(double Ksq, double xi, double eta){
+    return exp(-Ksq*(1-eta)/(4*xi*xi))*(1 + Ksq/(4*xi*xi))/Ksq;
+}
+
+//Tabulates multiplier(Ksq) over the grid in the order of the FFT output.
+template <double (*Multiplier)(double, double, double)>
+static void Tabulate(int Mx, int My, double Lx, double Ly, double xi,
+        double eta, double* filter){
+
+#pragma omp parallel for
+    for(int j = 0;j<Mx;j++) {
+        int ptr = j*My;
+        double k1;
+        if(j <= Mx/2)
+            k1 = 2.0*pi/Lx*j;
+        else
+            k1 = 2.0*pi/Lx*(j-Mx);
+
+        for(int k = 0;k<=My/2;k++,ptr++) {
+            double k2 = 2.0*pi/Ly*k;
+            filter[ptr] = Multiplier(k1*k1+k2*k2, xi, eta);
+        }
+        for(int k = 0;k<My/2-1;k++,ptr++) {
+            double k2 = 2.0*pi/Ly*(k-My/2+1);
+            filter[ptr] = Multiplier(k1*k1+k2*k2, xi, eta);
+        }
+    }
+}
+
+void StokesSLPKSpaceFilter(int Mx, int My, double Lx, double Ly, double xi,
+        double eta, double* filter){
+    Tabulate<SLPMultiplier>(Mx, My, Lx, Ly, xi, eta, filter);
+}
+
+void StokesDLPKSpaceFilter(int Mx, int My, double Lx, double Ly, double xi,
+        double eta, double* filter){
+    Tabulate<DLPMultiplier>(Mx, My, Lx, Ly, xi, eta, filter);
+}
+
+mxArray* KSpaceStatsToStruct(const KSpaceStats* stats){
+
+    mxArray* s = mxCreateStructMatrix(1, 1, 0, NULL);
+    AddKSpaceStats(s, stats);
+    return s;
+}
+
+void AddKSpaceStats(mxArray* s, const KSpaceStats* stats){
+
+    static const char* fields[12] = {"spread_time", "fft_time",
+            "filter_time", "ifft_time", "gather_time", "Mx", "My",
+            "num_grids", "kspace_memory", "kspace_allocations",
+            "kspace_heap_allocations", "kspace_page_faults"};
+    double values[12] = {stats->spread_time, stats->fft_time,
+            stats->filter_time, stats->ifft_time, stats->gather_time,
+            static_cast<double>(stats->Mx), static_cast<double>(stats->My),
+            static_cast<double>(stats->num_grids), stats->memory,
+            stats->allocations, stats->heap_allocations, stats->page_faults};
+
+    for(int i = 0;i<12;i++) {
+        mxAddField(s, fields[i]);
+        mxSetField(s, 0, fields[i], mxCreateDoubleScalar(values[i]));
+    }
+}
+
+/*------------------------------------------------------------------------
+ *The statistics a k-space sum adds to: stats, or scratch if it is NULL.
+ *Sets the grid, num_grids spread grids and the memory of peak_grids real
+ *Mx x My grids (a complex grid counts twice), the most the sum holds at
+ *one time, and starts the clock of the phases. The scratch-memory
+ *counters are subtracted here and added back by FinishKSpaceStats(), so
+ *that stats gets the change over the sum.
+ *------------------------------------------------------------------------
+ */
+static KSpaceStats* StartKSpaceStats(KSpaceStats* stats,
+        KSpaceStats* scratch, int Mx, int My, int num_grids,
+        double peak_grids, double* clock){
+
+    if(stats == NULL) {
+        memset(scratch, 0, sizeof(KSpaceStats));
+        stats = scratch;
+    }
+    stats->Mx = Mx;
+    stats->My = My;
+    stats->num_grids = num_grids;
+    double memory = peak_grids*Mx*My*sizeof(double);
+    if(memory > stats->memory)
+        stats->memory = memory;
+
+    ScratchCounters counters;
+    ReadScratchCounters(&counters);
+    stats->allocations -= counters.allocations;
+    stats->heap_allocations -= counters.heap_allocations;
+    stats->page_faults -= counters.page_faults;
+
+    *clock = omp_get_wtime();
+    return stats;
+}
+
+static void FinishKSpaceStats(KSpaceStats* stats){
+
+    ScratchCounters counters;
+    ReadScratchCounters(&counters);
+    stats->allocations += counters.allocations;
+    stats->heap_allocations += counters.heap_allocations;
+    stats->page_faults += counters.page_faults;
+}
+
+void StokesSLPKSpace(double* psrc, double* ptar, double* f, int Nsrc,
+        int Ntar, double xi, double eta, int Mx, int My, double Lx,
+        double Ly, double w, int P, const double* filter, double* uk,
+        KSpaceStats* stats){
+    
+    //The grid spacing, assuming hx = hy = h
+    double h = Lx/Mx;
+    
+    //Two grids, whose transforms and inverse transforms are complex.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My, 2, 8, &clock);
+    
+    //---------------------------------------------------------------------
+    //Step 1 : Spreading to the grid
+    //---------------------------------------------------------------------
+    //We begin by spreading the sources onto the grid. This basically means
+    //that we superposition properly scaled Gaussian bells, one for
+    //each source. We use fast Gaussian gridding to reduce the number of
+    //exps we need to evaluate.
+    
+    //The function H on the grid. We need to have these as Matlab arrays
+    //since we call Matlab's in-built fft2 to compute the 2D FFT.
+    mxArray *fft2rhs[2],*fft2lhs[2];
+    fft2rhs[0] = mxCreateDoubleMatrix(My, Mx, mxREAL);    
+    fft2rhs[1] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+    
+    double* H1 = RealData(fft2rhs[0]);
+    double* H2 = RealData(fft2rhs[1]);
+    
+    //This is the precomputable part of the fast Gaussian gridding.
+    ScratchBuffer<double> e1(P+1);
+    Spread(H1, H2, e1, psrc, f, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
+    LapTime(&stats->spread_time, &clock);
+    
+    //---------------------------------------------------------------------
+    //Step 2 : Frequency space filter
+    //---------------------------------------------------------------------
+    //We apply the appropriate k-space filter associated with the
+    //Stokeslet. This involves Fast Fourier Transforms.
+    
+    //Call Matlab's routines to compute the 2D FFT. Other choices,
+    //such as fftw could possibly be better, mainly because of the poor
+    //complex data structure Matlab uses which we now have to deal with.
+    MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+    MatlabTransform(&fft2lhs[1], fft2rhs[1], "fft2");
+    LapTime(&stats->fft_time, &clock);
+    
+    //The output of the FFT is complex. Get views of the real and
+    //imaginary parts of Hhat1 and Hhat2, in whichever layout the complex
+    //API gives them. A transform that came out real is made complex.
+    ComplexPart Hhat1_re = RealPart(fft2lhs[0]);
+    ComplexPart Hhat1_im = ImagPart(fft2lhs[0]);
+    
+    ComplexPart Hhat2_re = RealPart(fft2lhs[1]);
+    ComplexPart Hhat2_im = ImagPart(fft2lhs[1]);
+    
+    //Apply filter in the frequency domain. This is a completely
+    //parallel operation. The FFT gives the frequency components in
+    //non-sequential order, so we have to split the loops. One could
+    //possibly use fast gaussian gridding here too, to get rid of the
+    //exponentials, but as this loop accounts for a few percent of the
+    //total runtime, this hardly seems worth the extra work.
+#pragma omp parallel for
+    for(int j = 0;j<Mx;j++) {
+        int ptr = j*My;
+        
+        double k1;
+        if(j <= Mx/2)
+            k1 = 2.0*pi/Lx*j;
+        else
+            k1 = 2.0*pi/Lx*(j-Mx);
+        for(int k = 0;k<=My/2;k++,ptr++) {
+            
+            //Hhat1 contains density component 1 convolved with Gaussians
+            //Hhat2 contains density component 2 convolved with Gaussians
+            double q1_re = Hhat1_re[ptr];
+            double q1_im = Hhat1_im[ptr];
+            double q2_re = Hhat2_re[ptr];
+            double q2_im = Hhat2_im[ptr];
+            
+            double k2 = 2.0*pi/Ly*k;
+            double Ksq = k1*k1+k2*k2;
+            double e = filter ? filter[ptr] : SLPMultiplier(Ksq, xi, eta);
+            
+            double kdotq_re = k1 * q1_re + k2 * q2_re;
+            double kdotq_im = k1 * q1_im + k2 * q2_im;
+            
+            Hhat1_re[ptr] = (Ksq*q1_re - k1 * kdotq_re)*e;
+            Hhat1_im[ptr] = (Ksq*q1_im - k1 * kdotq_im)*e;
+            
+            Hhat2_re[ptr] = (Ksq*q2_re - k2 * kdotq_re)*e;
+            Hhat2_im[ptr] = (Ksq*q2_im - k2 * kdotq_im)*e;
+        }
+        for(int k = 0;k<My/2-1;k++,ptr++) {
+            
+            //Hhat1 contains density component 1 convolved with Gaussians
+            //Hhat2 contains density component 2 convolved with Gaussians
+            double q1_re = Hhat1_re[ptr];
+            double q1_im = Hhat1_im[ptr];
+            double q2_re = Hhat2_re[ptr];
+            double q2_im = Hhat2_im[ptr];
+            
+            double k2 = 2.0*pi/Ly*(k-My/2+1);
+            double Ksq = k1*k1+k2*k2;
+            double e = filter ? filter[ptr] : SLPMultiplier(Ksq, xi, eta);
+            
+            double kdotq_re = k1 * q1_re + k2 * q2_re;
+            double kdotq_im = k1 * q1_im + k2 * q2_im;
+            
+            Hhat1_re[ptr] = (Ksq*q1_re - k1 * kdotq_re)*e;
+            Hhat1_im[ptr] = (Ksq*q1_im - k1 * kdotq_im)*e;
+            
+            Hhat2_re[ptr] = (Ksq*q2_re - k2 * kdotq_re)*e;
+            Hhat2_im[ptr] = (Ksq*q2_im - k2 * kdotq_im)*e;
+        }
+    }
+    
+    //Remove the zero frequency term.
+    Hhat1_re[0] = 0;
+    Hhat2_re[0] = 0;
+    Hhat1_im[0] = 0;
+    Hhat2_im[0] = 0;
+    LapTime(&stats->filter_time, &clock);
+    
+    //Get rid of the old H1 and H2 arrays. They are no longer needed.
+    mxDestroyArray(fft2rhs[0]);
+    mxDestroyArray(fft2rhs[1]);
+    
+    //Do the inverse 2D FFTs. We use Matlab's inbuilt functions again.
+    MatlabTransform(&fft2rhs[0], fft2lhs[0], "ifft2");
+    MatlabTransform(&fft2rhs[1], fft2lhs[1], "ifft2");
+    LapTime(&stats->ifft_time, &clock);
+    
+    //The pointer to the real part. We don't need the imaginary part.
+    double* Ht1 = RealGrid(fft2rhs[0]);
+    double* Ht2 = RealGrid(fft2rhs[1]);
+    
+    if(Ht1 == NULL) {
+        Ht1 = new double[Mx*My];
+        memset(Ht1,0,Mx*My*sizeof(double));
+    }
+    if(Ht2 == NULL) {
+        Ht2 = new double[Mx*My];
+        memset(Ht2,0,Mx*My*sizeof(double));
+    }
+    
+    //Get rid of the Hhat1 and Hhat2 arrays. They are no longer needed.
+    mxDestroyArray(fft2lhs[0]);
+    mxDestroyArray(fft2lhs[1]);
+    
+    //---------------------------------------------------------------------
+    //Step 3 : Evaluating the velocity
+    //---------------------------------------------------------------------
+    //Here we compute the output velocity as a convolution of the Ht1
+    //and Ht2 functions with a properly scaled gaussian. This is basically
+    //gaussian blur, and we again use fast gaussian gridding. This
+    //procedure is fully parallel.
+    
+    Gather(Ht1, 2, 1, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h);
+    Gather(Ht2, 2, 2, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h); 
+    
+    //Clean up
+    mxDestroyArray(fft2rhs[0]);
+    mxDestroyArray(fft2rhs[1]);
+    LapTime(&stats->gather_time, &clock);
+    FinishKSpaceStats(stats);
+}
+
+void StokesDLPKSpace(double* psrc, double* ptar, double* f, double* n,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats){
+    
+    //The grid spacing
+    double h = Lx/Mx;
+    
+    //Four grids, whose complex transforms are kept until the inverse
+    //transforms of the first two are done.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My, 4, 12, &clock);
+    
+    //---------------------------------------------------------------------
+    //Step 1 : Spreading to the grid
+    //---------------------------------------------------------------------
+    //We begin by spreading the sources onto the grid. This basically means
+    //that we superposition properly scaled Gaussian bells, one for
+    //each source. We use fast Gaussian gridding to reduce the number of
+    //exps we need to evaluate.
+    
+    //The function H on the grid. We need to have these as Matlab arrays
+    //since we call Matlab's in-built fft2 to compute the 2D FFT.
+    mxArray *fft2rhs[4],*fft2lhs[4];
+    fft2rhs[0] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+    double* H1 = RealData(fft2rhs[0]);
+    fft2rhs[1] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+    double* H2 = RealData(fft2rhs[1]);
+    fft2rhs[2] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+    double* H3 = RealData(fft2rhs[2]);
+    fft2rhs[3] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+    double* H4 = RealData(fft2rhs[3]);
+    
+    //Have to multiply components of f and n before speading
+    ScratchBuffer<double> v1(2*Nsrc);
+    ScratchBuffer<double> v2(2*Nsrc);
+    for (int i = 0; i < Nsrc; i++)
+    {
+        v1[2*i] = f[2*i]*n[2*i];          //f1 * n1
+        v1[2*i + 1] = f[2*i+1]*n[2*i];    //f2 * n1
+        v2[2*i] = f[2*i]*n[2*i+1];        //f1 * n2
+        v2[2*i + 1] = f[2*i+1]*n[2*i+1];  //n2 * n2
+    }
+    
+    //This is the precomputable part of the fast Gaussian gridding.
+    ScratchBuffer<double> e1(P+1);
+    Spread(H1, H2, e1, psrc, v1, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
+    Spread(H3, H4, e1, psrc, v2, Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
+    v1.Free();
+    v2.Free();
+    LapTime(&stats->spread_time, &clock);
+    
+    //---------------------------------------------------------------------
+    //Step 2 : Frequency space filter
+    //---------------------------------------------------------------------
+    //We apply the appropriate k-space filter associated with the
+    //Stresslet. This involves Fast Fourier Transforms.
+    
+    //Call Matlab's routines to compute the 2D FFT. Other choices,
+    //such as fftw could possibly be better, mainly because of the poor
+    //complex data structure Matlab uses which we now have to deal with.
+    MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+    MatlabTransform(&fft2lhs[1], fft2rhs[1], "fft2");
+    MatlabTransform(&fft2lhs[2], fft2rhs[2], "fft2");
+    MatlabTransform(&fft2lhs[3], fft2rhs[3], "fft2");
+    LapTime(&stats->fft_time, &clock);
+    
+    //The output of the FFT is complex. Get views of the real and
+    //imaginary parts of the Hhats, see mx_complex.h.
+    ComplexPart Hhat1_re = RealPart(fft2lhs[0]);
+    ComplexPart Hhat1_im = ImagPart(fft2lhs[0]);
+    
+    ComplexPart Hhat2_re = RealPart(fft2lhs[1]);
+    ComplexPart Hhat2_im = ImagPart(fft2lhs[1]);
+    
+    ComplexPart Hhat3_re = RealPart(fft2lhs[2]);
+    ComplexPart Hhat3_im = ImagPart(fft2lhs[2]);
+    
+    ComplexPart Hhat4_re = RealPart(fft2lhs[3]);
+    ComplexPart Hhat4_im = ImagPart(fft2lhs[3]);
+    
+    //Apply filter in the frequency domain. This is a completely
+    //parallel operation. The FFT gives the frequency components in
+    //non-sequential order, so we have to split the loops. One could
+    //possibly use fast gaussian gridding here too, to get rid of the
+    //exponentials, but as this loop accounts for a few percent of the
+    //total runtime, this hardly seems worth the extra work.
+#pragma omp parallel for
+    for(int j = 0;j<Mx;j++) {
+        int ptr = j*My;
+        double k1;
+        if(j <= Mx/2)
+            k1 = 2.0*pi/Lx*j;
+        else
+            k1 = 2.0*pi/Lx*(j-Mx);
+        
+        for(int k = 0;k<=My/2;k++,ptr++) {
+            double k2 = 2.0*pi/Ly*k;
+            double Ksq = k1*k1+k2*k2;
+            
+            double e = filter ? filter[ptr] : DLPMultiplier(Ksq, xi, eta);
+            
+            double f1n1_re = Hhat1_re[ptr];
+            double f1n1_im = Hhat1_im[ptr];
+            double f1n2_re = Hhat2_re[ptr];
+            double f1n2_im = Hhat2_im[ptr];
+            double f2n1_re = Hhat3_re[ptr];
+            double f2n1_im = Hhat3_im[ptr];
+            double f2n2_re = Hhat4_re[ptr];
+            double f2n2_im = Hhat4_im[ptr];
+            
+            Hhat1_re[ptr] = -(2*f1n1_im*k1 + k2*(f1n2_im + f2n1_im) 
+                                + k1*(f1n1_im + f2n2_im) 
+                                - 2*k1*(k1*k1*f1n1_im + k1*k2*(f1n2_im + f2n1_im) 
+                                + k2*k2*f2n2_im)/Ksq)*e;
+            Hhat1_im[ptr] = (2*f1n1_re*k1 + k2*(f1n2_re + f2n1_re) 
+                                + k1*(f1n1_re + f2n2_re) 
+                                - 2*k1*(k1*k1*f1n1_re + k1*k2*(f1n2_re + f2n1_re) 
+                                + k2*k2*f2n2_re)/Ksq)*e;
+            
+            Hhat2_re[ptr] = -(2*f2n2_im*k2 + k1*(f1n2_im + f2n1_im) 
+                                + k2*(f1n1_im + f2n2_im) 
+                                - 2*k2*(k1*k1*f1n1_im + k1*k2*(f1n2_im + f2n1_im) 
+                                + k2*k2*f2n2_im)/Ksq)*e;
+            Hhat2_im[ptr] = (2*f2n2_re*k2 + k1*(f1n2_re + f2n1_re) 
+                                + k2*(f1n1_re + f2n2_re) 
+                                - 2*k2*(k1*k1*f1n1_re + k1*k2*(f1n2_re + f2n1_re) 
+                                + k2*k2*f2n2_re)/Ksq)*e;            
+        }
+        for(int k = 0;k<My/2-1;k++,ptr++) {
+            double k2 = 2.0*pi/Ly*(k-My/2+1);
+            double Ksq = k1*k1+k2*k2;
+            
+            double e = filter ? filter[ptr] : DLPMultiplier(Ksq, xi, eta);
+            
+            double f1n1_re = Hhat1_re[ptr];
+            double f1n1_im = Hhat1_im[ptr];
+            double f1n2_re = Hhat2_re[ptr];
+            double f1n2_im = Hhat2_im[ptr];
+            double f2n1_re = Hhat3_re[ptr];
+            double f2n1_im = Hhat3_im[ptr];
+            double f2n2_re = Hhat4_re[ptr];
+            double f2n2_im = Hhat4_im[ptr];
+            
+            Hhat1_re[ptr] = -(2*f1n1_im*k1 + k2*(f1n2_im + f2n1_im) 
+                                + k1*(f1n1_im + f2n2_im) 
+                                - 2*k1*(k1*k1*f1n1_im + k1*k2*(f1n2_im + f2n1_im) 
+                                + k2*k2*f2n2_im)/Ksq)*e;
+            Hhat1_im[ptr] = (2*f1n1_re*k1 + k2*(f1n2_re + f2n1_re) 
+                                + k1*(f1n1_re + f2n2_re) 
+                                - 2*k1*(k1*k1*f1n1_re + k1*k2*(f1n2_re + f2n1_re) 
+                                + k2*k2*f2n2_re)/Ksq)*e;
+            
+            Hhat2_re[ptr] = -(2*f2n2_im*k2 + k1*(f1n2_im + f2n1_im) 
+                                + k2*(f1n1_im + f2n2_im) 
+                                - 2*k2*(k1*k1*f1n1_im + k1*k2*(f1n2_im + f2n1_im) 
+                                + k2*k2*f2n2_im)/Ksq)*e;
+            Hhat2_im[ptr] = (2*f2n2_re*k2 + k1*(f1n2_re + f2n1_re) 
+                                + k2*(f1n1_re + f2n2_re) 
+                                - 2*k2*(k1*k1*f1n1_re + k1*k2*(f1n2_re + f2n1_re) 
+                                + k2*k2*f2n2_re)/Ksq)*e;
+        }
+    }
+    
+    //Remove the zero frequency term.
+    Hhat1_re[0] = 0;
+    Hhat2_re[0] = 0;
+    Hhat1_im[0] = 0;
+    Hhat2_im[0] = 0;
+    LapTime(&stats->filter_time, &clock);
+    
+    //Get rid of the old H arrays. They are no longer needed.
+    mxDestroyArray(fft2rhs[0]);
+    mxDestroyArray(fft2rhs[1]);
+    mxDestroyArray(fft2rhs[2]);
+    mxDestroyArray(fft2rhs[3]);
+    
+    //Do the inverse 2D FFTs. We use Matlab's inbuilt functions again.
+    MatlabTransform(&fft2rhs[0], fft2lhs[0], "ifft2");
+    MatlabTransform(&fft2rhs[1], fft2lhs[1], "ifft2");
+    LapTime(&stats->ifft_time, &clock);
+    
+    //The pointer to the real part. We don't need the imaginary part.
+    double* Ht1 = RealGrid(fft2rhs[0]);
+    double* Ht2 = RealGrid(fft2rhs[1]);
+    
+    //In case the inverse FFTs are purely imaginary. Not likely to happen, 
+    //but the program would crash without guarding for this.
+    if(Ht1 == NULL) {
+        Ht1 = new double[Mx*My];
+        memset(Ht1,0,Mx*My*sizeof(double));
+    }
+    if(Ht2 == NULL) {
+        Ht2 = new double[Mx*My];
+        memset(Ht2,0,Mx*My*sizeof(double));
+    }
+    
+    //Get rid of the Hhat arrays. They are no longer needed.
+    mxDestroyArray(fft2lhs[0]);
+    mxDestroyArray(fft2lhs[1]);
+    
+    //---------------------------------------------------------------------
+    //Step 3 : Evaluating the velocity
+    //---------------------------------------------------------------------
+    //Here we compute the output velocity as a convolution of the Ht1
+    //and Ht2 functions with a properly scaled gaussian. This is basically
+    //gaussian blur, and we again use fast gaussian gridding. This
+    //procedure is fully parallel.
+    
+    Gather(Ht1, 2, 1, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h);
+    Gather(Ht2, 2, 2, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P, Mx,My, h);
+    
+    //Clean up
+    mxDestroyArray(fft2rhs[0]);
+    mxDestroyArray(fft2rhs[1]);
+    LapTime(&stats->gather_time, &clock);
+    FinishKSpaceStats(stats);
+}
+
+void StokesDLPKSpaceStreamed(double* psrc, double* ptar, double* f,
+        double* n, int Nsrc, int Ntar, double xi, double eta, int Mx,
+        int My, double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats){
+
+    double h = Lx/Mx;
+
+    //The transforms of the two velocity components, and one spread grid
+    //and its transform.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My, 3, 7, &clock);
+
+    mxArray* vel[2];
+    vel[0] = mxCreateDoubleMatrix(My, Mx, mxCOMPLEX);
+    vel[1] = mxCreateDoubleMatrix(My, Mx, mxCOMPLEX);
+    ComplexPart u1_re = RealPart(vel[0]);
+    ComplexPart u1_im = ImagPart(vel[0]);
+    ComplexPart u2_re = RealPart(vel[1]);
+    ComplexPart u2_im = ImagPart(vel[1]);
+
+    ScratchBuffer<double> vals(Nsrc+1);
+    ScratchBuffer<double> e1(P+1);
+    for(int c = 0;c<3;c++) {
+        //The components f1*n1, f1*n2 + f2*n1 and f2*n2 of the density.
+#pragma omp parallel for schedule(static)
+        for(int k = 0;k<Nsrc;k++)
+            vals[k] = (c == 0) ? f[2*k]*n[2*k] : (c == 1) ?
+                    f[2*k]*n[2*k+1] + f[2*k+1]*n[2*k] : f[2*k+1]*n[2*k+1];
+
+        mxArray *fft2rhs, *fft2lhs;
+        fft2rhs = mxCreateDoubleMatrix(My, Mx, mxREAL);
+        SpreadBlock(RealData(fft2rhs), 1, e1, psrc, vals, Nsrc, Lx, Ly, xi,
+                w, eta, P, Mx, My, h);
+        LapTime(&stats->spread_time, &clock);
+
+        MatlabTransform(&fft2lhs, fft2rhs, "fft2");
+        mxDestroyArray(fft2rhs);
+        LapTime(&stats->fft_time, &clock);
+
+        ComplexPart q_re = RealPart(fft2lhs);
+        ComplexPart q_im = ImagPart(fft2lhs);
+
+        //The filter of StokesDLPKSpace is linear in the transformed
+        //components, so the part of this one is added to each velocity.
+#pragma omp parallel for
+        for(int j = 0;j<Mx;j++) {
+            double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+
+            for(int k = 0;k<My;k++) {
+                int ptr = j*My+k;
+                double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+                double Ksq = k1*k1+k2*k2;
+                double e = filter ? filter[ptr] : DLPMultiplier(Ksq, xi, eta);
+
+                //The coefficients of the component in the two velocities,
+                //without the factor i.
+                double kk, b1, b2;
+                if(c == 0) {
+                    kk = k1*k1;
+                    b1 = 3*k1;
+                    b2 = k2;
+                } else if(c == 1) {
+                    kk = k1*k2;
+                    b1 = k2;
+                    b2 = k1;
+                } else {
+                    kk = k2*k2;
+                    b1 = k1;
+                    b2 = 3*k2;
+                }
+                double a1 = (b1 - 2*k1*kk/Ksq)*e;
+                double a2 = (b2 - 2*k2*kk/Ksq)*e;
+
+                u1_re[ptr] -= a1*q_im[ptr];
+                u1_im[ptr] += a1*q_re[ptr];
+                u2_re[ptr] -= a2*q_im[ptr];
+                u2_im[ptr] += a2*q_re[ptr];
+            }
+        }
+        mxDestroyArray(fft2lhs);
+        LapTime(&stats->filter_time, &clock);
+    }
+    vals.Free();
+
+    //Remove the zero frequency term.
+    u1_re[0] = 0;
+    u1_im[0] = 0;
+    u2_re[0] = 0;
+    u2_im[0] = 0;
+
+    //Each velocity component is transformed back and gathered before the
+    //next.
+    for(int v = 0;v<2;v++) {
+        mxArray* back;
+        MatlabTransform(&back, vel[v], "ifft2");
+        mxDestroyArray(vel[v]);
+        LapTime(&stats->ifft_time, &clock);
+
+        double* Ht = RealGrid(back);
+        if(Ht != NULL)
+            Gather(Ht, 2, v+1, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P,
+                    Mx, My, h);
+        else
+            for(int j = 0;j<Ntar;j++)
+                uk[2*j+v] = 0;
+        mxDestroyArray(back);
+        LapTime(&stats->gather_time, &clock);
+    }
+
+    FinishKSpaceStats(stats);
+}
+
+void StokesSLPKSpaceBlock(double* psrc, double* ptar, double* f, int Nsrc,
+        int Ntar, int nrhs, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats){
+
+    double h = Lx/Mx;
+    int ngrids = 2*nrhs;
+    mwSize grid = Mx*My;
+
+    //The complex transforms of the grids and their inverse transforms.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My, ngrids, 4.0*ngrids,
+            &clock);
+
+    //Interleave the densities, so that each source carries the values of
+    //all right-hand sides and is spread once.
+    ScratchBuffer<double> vals(ngrids*Nsrc+1);
+#pragma omp parallel for schedule(static)
+    for(int k = 0;k<Nsrc;k++)
+        for(int r = 0;r<nrhs;r++) {
+            vals[ngrids*k+2*r] = f[2*Nsrc*r+2*k];
+            vals[ngrids*k+2*r+1] = f[2*Nsrc*r+2*k+1];
+        }
+
+    //All grids in one My x Mx x ngrids array, whose pages are transformed
+    //by a single call to fft2.
+    mwSize dims[3] = {static_cast<mwSize>(My), static_cast<mwSize>(Mx),
+            static_cast<mwSize>(ngrids)};
+    mxArray *fft2rhs, *fft2lhs;
+    fft2rhs = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+
+    ScratchBuffer<double> e1(P+1);
+    SpreadBlock(RealData(fft2rhs), ngrids, e1, psrc, vals, Nsrc, Lx, Ly, xi,
+            w, eta, P, Mx, My, h);
+    vals.Free();
+    LapTime(&stats->spread_time, &clock);
+
+    MatlabTransform(&fft2lhs, fft2rhs, "fft2");
+    mxDestroyArray(fft2rhs);
+    LapTime(&stats->fft_time, &clock);
+
+    ComplexPart Hhat_re = RealPart(fft2lhs);
+    ComplexPart Hhat_im = ImagPart(fft2lhs);
+
+    //The same filter as StokesSLPKSpace, for each pair of grids, with the
+    //multiplier evaluated once per frequency.
+#pragma omp parallel for
+    for(int j = 0;j<Mx;j++) {
+        double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+
+        for(int k = 0;k<My;k++) {
+            int ptr = j*My+k;
+            double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+            double Ksq = k1*k1+k2*k2;
+            double e = filter ? filter[ptr] : SLPMultiplier(Ksq, xi, eta);
+
+            for(int r = 0;r<nrhs;r++) {
+                ComplexPart q1_re = Hhat_re + 2*r*grid + ptr;
+                ComplexPart q1_im = Hhat_im + 2*r*grid + ptr;
+                ComplexPart q2_re = q1_re + grid;
+                ComplexPart q2_im = q1_im + grid;
+
+                double kdotq_re = k1 * *q1_re + k2 * *q2_re;
+                double kdotq_im = k1 * *q1_im + k2 * *q2_im;
+
+                *q1_re = (Ksq * *q1_re - k1 * kdotq_re)*e;
+                *q1_im = (Ksq * *q1_im - k1 * kdotq_im)*e;
+                *q2_re = (Ksq * *q2_re - k2 * kdotq_re)*e;
+                *q2_im = (Ksq * *q2_im - k2 * kdotq_im)*e;
+            }
+        }
+    }
+
+    //Remove the zero frequency terms.
+    for(int g = 0;g<ngrids;g++) {
+        Hhat_re[g*grid] = 0;
+        Hhat_im[g*grid] = 0;
+    }
+    LapTime(&stats->filter_time, &clock);
+
+    MatlabTransform(&fft2rhs, fft2lhs, "ifft2");
+    mxDestroyArray(fft2lhs);
+    LapTime(&stats->ifft_time, &clock);
+
+    double* Ht = RealGrid(fft2rhs);
+    ScratchBuffer<double> acc(ngrids*Ntar+1);
+    if(Ht != NULL)
+        GatherBlock(Ht, ngrids, e1, ptar, acc, Ntar, Lx, Ly, xi, w, eta, P,
+                Mx, My, h);
+    else
+        memset(acc, 0, ngrids*Ntar*sizeof(double));
+    mxDestroyArray(fft2rhs);
+
+    //Back to one 2 x Ntar page per right-hand side.
+#pragma omp parallel for schedule(static)
+    for(int k = 0;k<Ntar;k++)
+        for(int r = 0;r<nrhs;r++) {
+            uk[2*Ntar*r+2*k] = acc[ngrids*k+2*r];
+            uk[2*Ntar*r+2*k+1] = acc[ngrids*k+2*r+1];
+        }
+
+    LapTime(&stats->gather_time, &clock);
+    FinishKSpaceStats(stats);
+}
+
+void StokesCombinedKSpace(double* psrc, double* ptar, double* f, double* g,
+        double* n, double alpha, double beta, int Nsrc, int Ntar,
+        double xi, double eta, int Mx, int My, double Lx, double Ly,
+        double w, int P, const double* slp_filter, const double* dlp_filter,
+        double* uk, KSpaceStats* stats){
+
+    double h = Lx/Mx;
+    mwSize grid = Mx*My;
+
+    //Six grids and their complex transforms, while fft2 runs.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My, 6, 18, &clock);
+
+    //The two grids of the Stokeslet and the four of the stresslet, as in
+    //StokesSLPKSpace and StokesDLPKSpace, with the weights applied to the
+    //densities.
+    ScratchBuffer<double> vals(6*Nsrc+1);
+#pragma omp parallel for schedule(static)
+    for(int k = 0;k<Nsrc;k++) {
+        vals[6*k] = alpha*f[2*k];
+        vals[6*k+1] = alpha*f[2*k+1];
+        vals[6*k+2] = beta*g[2*k]*n[2*k];
+        vals[6*k+3] = beta*g[2*k+1]*n[2*k];
+        vals[6*k+4] = beta*g[2*k]*n[2*k+1];
+        vals[6*k+5] = beta*g[2*k+1]*n[2*k+1];
+    }
+
+    mwSize dims[3] = {static_cast<mwSize>(My), static_cast<mwSize>(Mx), 6};
+    mxArray *fft2rhs, *fft2lhs;
+    fft2rhs = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+
+    ScratchBuffer<double> e1(P+1);
+    SpreadBlock(RealData(fft2rhs), 6, e1, psrc, vals, Nsrc, Lx, Ly, xi, w,
+            eta, P, Mx, My, h);
+    vals.Free();
+    LapTime(&stats->spread_time, &clock);
+
+    MatlabTransform(&fft2lhs, fft2rhs, "fft2");
+    mxDestroyArray(fft2rhs);
+    LapTime(&stats->fft_time, &clock);
+
+    ComplexPart Hhat_re = RealPart(fft2lhs);
+    ComplexPart Hhat_im = ImagPart(fft2lhs);
+
+    //Both filters, summed into the first two grids.
+#pragma omp parallel for
+    for(int j = 0;j<Mx;j++) {
+        double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+
+        for(int k = 0;k<My;k++) {
+            int ptr = j*My+k;
+            double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+            double Ksq = k1*k1+k2*k2;
+            double es = slp_filter ? slp_filter[ptr] : SLPMultiplier(Ksq, xi, eta);
+            double ed = dlp_filter ? dlp_filter[ptr] : DLPMultiplier(Ksq, xi, eta);
+
+            double q1_re = Hhat_re[ptr], q1_im = Hhat_im[ptr];
+            double q2_re = Hhat_re[grid+ptr], q2_im = Hhat_im[grid+ptr];
+            double f1n1_re = Hhat_re[2*grid+ptr], f1n1_im = Hhat_im[2*grid+ptr];
+            double f2n1_re = Hhat_re[3*grid+ptr], f2n1_im = Hhat_im[3*grid+ptr];
+            double f1n2_re = Hhat_re[4*grid+ptr], f1n2_im = Hhat_im[4*grid+ptr];
+            double f2n2_re = Hhat_re[5*grid+ptr], f2n2_im = Hhat_im[5*grid+ptr];
+
+            double kdotq_re = k1*q1_re + k2*q2_re;
+            double kdotq_im = k1*q1_im + k2*q2_im;
+
+            //k.S.k/|k|^2 and the trace of S, for the stresslet filter.
+            double kSk_re = (k1*k1*f1n1_re + k1*k2*(f1n2_re + f2n1_re)
+                    + k2*k2*f2n2_re)/Ksq;
+            double kSk_im = (k1*k1*f1n1_im + k1*k2*(f1n2_im + f2n1_im)
+                    + k2*k2*f2n2_im)/Ksq;
+            double tr_re = f1n1_re + f2n2_re;
+            double tr_im = f1n1_im + f2n2_im;
+            double off_re = f1n2_re + f2n1_re;
+            double off_im = f1n2_im + f2n1_im;
+
+            Hhat_re[ptr] = (Ksq*q1_re - k1*kdotq_re)*es
+                    - (2*f1n1_im*k1 + k2*off_im + k1*tr_im - 2*k1*kSk_im)*ed;
+            Hhat_im[ptr] = (Ksq*q1_im - k1*kdotq_im)*es
+                    + (2*f1n1_re*k1 + k2*off_re + k1*tr_re - 2*k1*kSk_re)*ed;
+            Hhat_re[grid+ptr] = (Ksq*q2_re - k2*kdotq_re)*es
+                    - (2*f2n2_im*k2 + k1*off_im + k2*tr_im - 2*k2*kSk_im)*ed;
+            Hhat_im[grid+ptr] = (Ksq*q2_im - k2*kdotq_im)*es
+                    + (2*f2n2_re*k2 + k1*off_re + k2*tr_re - 2*k2*kSk_re)*ed;
+        }
+    }
+
+    //Remove the zero frequency terms.
+    Hhat_re[0] = 0;
+    Hhat_im[0] = 0;
+    Hhat_re[grid] = 0;
+    Hhat_im[grid] = 0;
+    LapTime(&stats->filter_time, &clock);
+
+    //Only the two filtered grids are transformed back.
+    dims[2] = 2;
+    mxSetDimensions(fft2lhs, dims, 3);
+    MatlabTransform(&fft2rhs, fft2lhs, "ifft2");
+    mxDestroyArray(fft2lhs);
+    LapTime(&stats->ifft_time, &clock);
+
+    double* Ht = RealGrid(fft2rhs);
+    if(Ht != NULL)
+        GatherBlock(Ht, 2, e1, ptar, uk, Ntar, Lx, Ly, xi, w, eta, P, Mx,
+                My, h);
+    else
+        memset(uk, 0, 2*Ntar*sizeof(double));
+    mxDestroyArray(fft2rhs);
+
+    LapTime(&stats->gather_time, &clock);
+    FinishKSpaceStats(stats);
+}
+
+//The four filtered grids of the gradient of the Stokeslet velocity, i*k_p
+//times the velocity filter, from the transformed density (q1, q2).
+static inline void SLPGradientFilter(double k1, double k2, double Ksq,
+        double xi, double eta, double q1_re, double q1_im, double q2_re,
+        double q2_im, double* g_re, double* g_im){
+
+    double e = SLPMultiplier(Ksq, xi, eta);
+    double kdotq_re = k1 * q1_re + k2 * q2_re;
+    double kdotq_im = k1 * q1_im + k2 * q2_im;
+
+    //j = 1, p = 1
+    g_im[0] = k1*(Ksq*q1_re - k1 * kdotq_re)*e;
+    g_re[0] = -k1*(Ksq*q1_im - k1 * kdotq_im)*e;
+
+    //j = 2, p = 1
+    g_im[1] = k1*(Ksq*q2_re - k2 * kdotq_re)*e;
+    g_re[1] = -k1*(Ksq*q2_im - k2 * kdotq_im)*e;
+
+    //j = 1, p = 2
+    g_im[2] = k2*(Ksq*q1_re - k1 * kdotq_re)*e;
+    g_re[2] = -k2*(Ksq*q1_im - k1 * kdotq_im)*e;
+
+    //j = 2, p = 2
+    g_im[3] = k2*(Ksq*q2_re - k2 * kdotq_re)*e;
+    g_re[3] = -k2*(Ksq*q2_im - k2 * kdotq_im)*e;
+}
+
+//The four filtered grids of the stress of the Stokeslet.
+static inline void SLPStressFilter(double k1, double k2, double Ksq,
+        double xi, double eta, double q1_re, double q1_im, double q2_re,
+        double q2_im, double* g_re, double* g_im){
+
+    double e = DLPMultiplier(Ksq, xi, eta);
+    double kdotq_re = k1 * q1_re + k2 * q2_re;
+    double kdotq_im = k1 * q1_im + k2 * q2_im;
+
+    //j = 1, l = 1
+    g_re[0] = -(kdotq_im + q1_im*k1 + q1_im*k1 - 2*(k1*k1*kdotq_im)/Ksq)*e;
+    g_im[0] = (kdotq_re + q1_re*k1 + q1_re*k1 - 2*(k1*k1*kdotq_re)/Ksq)*e;
+
+    //j = 2, l = 1
+    g_re[1] = -(q2_im*k1 + q1_im*k2 - 2*(k2*k1*kdotq_im)/Ksq)*e;
+    g_im[1] = (q2_re*k1 + q1_re*k2 - 2*(k2*k1*kdotq_re)/Ksq)*e;
+
+    //j = 1, l = 2
+    g_re[2] = -(q1_im*k2 + q2_im*k1 - 2*(k1*k2*kdotq_im)/Ksq)*e;
+    g_im[2] = (q1_re*k2 + q2_re*k1 - 2*(k1*k2*kdotq_re)/Ksq)*e;
+
+    //j = 2, l = 2
+    g_re[3] = -(kdotq_im + q2_im*k2 + q2_im*k2 - 2*(k2*k2*kdotq_im)/Ksq)*e;
+    g_im[3] = (kdotq_re + q2_re*k2 + q2_re*k2 - 2*(k2*k2*kdotq_re)/Ksq)*e;
+}
+
+/*------------------------------------------------------------------------
+ *The k-space sum of a quantity with four components that are filtered
+ *from the two components of the Stokeslet density, in one of the layouts
+ *of kspace.h. The filtered grids are written in place of the transformed
+ *ones (grids 3 and 4 are new arrays for KS_ONE_SPREAD), and grid g gives
+ *component g of the 4 x Ntar output.
+ *------------------------------------------------------------------------
+ */
+template <void (*Filter)(double, double, double, double, double, double,
+        double, double, double, double*, double*)>
+static void SLPFourComponentKSpace(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, int layout, double* out,
+        KSpaceStats* stats){
+
+    double h = Lx/Mx;
+    mwSize grid = Mx*My;
+    ScratchBuffer<double> e1(P+1);
+    ComplexPart Hhat_re[4];
+    ComplexPart Hhat_im[4];
+    mxArray *fft2rhs[4], *fft2lhs[4];
+    int ngrids = (layout == KS_BATCHED) ? 1 : 4;
+
+    //The most grids held at one time: the filtered grids and their inverse
+    //transforms when batched, the two transforms and one filtered grid and
+    //its inverse transform when streamed, and otherwise the spread grids
+    //and their transforms.
+    KSpaceStats scratch;
+    double clock;
+    stats = StartKSpaceStats(stats, &scratch, Mx, My,
+            (layout == KS_TWO_SPREADS) ? 4 : 2,
+            (layout == KS_BATCHED) ? 16 : (layout == KS_ONE_SPREAD) ? 10 :
+            (layout == KS_STREAMED) ? 8 : 12, &clock);
+
+    if(layout == KS_STREAMED) {
+        for(int g = 0;g<2;g++)
+            fft2rhs[g] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+        Spread(RealData(fft2rhs[0]), RealData(fft2rhs[1]), e1, psrc, f, Nsrc,
+                Lx, Ly, xi, w, eta, P, Mx, My, h);
+        LapTime(&stats->spread_time, &clock);
+        for(int g = 0;g<2;g++) {
+            MatlabTransform(&fft2lhs[g], fft2rhs[g], "fft2");
+            mxDestroyArray(fft2rhs[g]);
+            Hhat_re[g] = RealPart(fft2lhs[g]);
+            Hhat_im[g] = ImagPart(fft2lhs[g]);
+        }
+        LapTime(&stats->fft_time, &clock);
+
+        //Each component is filtered into a new grid, which is transformed
+        //back and gathered before the next one is made.
+        for(int c = 0;c<4;c++) {
+            mxArray* filtered = mxCreateDoubleMatrix(My, Mx, mxCOMPLEX);
+            ComplexPart out_re = RealPart(filtered);
+            ComplexPart out_im = ImagPart(filtered);
+
+#pragma omp parallel for
+            for(int j = 0;j<Mx;j++) {
+                double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+                for(int k = 0;k<My;k++) {
+                    int ptr = j*My+k;
+                    double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+                    double g_re[4], g_im[4];
+                    Filter(k1, k2, k1*k1+k2*k2, xi, eta, Hhat_re[0][ptr],
+                            Hhat_im[0][ptr], Hhat_re[1][ptr],
+                            Hhat_im[1][ptr], g_re, g_im);
+                    out_re[ptr] = g_re[c];
+                    out_im[ptr] = g_im[c];
+                }
+            }
+
+            //Remove the zero frequency term.
+            out_re[0] = 0;
+            out_im[0] = 0;
+            LapTime(&stats->filter_time, &clock);
+
+            mxArray* back;
+            MatlabTransform(&back, filtered, "ifft2");
+            mxDestroyArray(filtered);
+            LapTime(&stats->ifft_time, &clock);
+
+            double* Ht = RealGrid(back);
+            if(Ht != NULL)
+                Gather(Ht, 4, c+1, e1, ptar, out, Ntar, Lx, Ly, xi, w, eta,
+                        P, Mx, My, h);
+            else
+                for(int j = 0;j<Ntar;j++)
+                    out[4*j+c] = 0;
+            mxDestroyArray(back);
+            LapTime(&stats->gather_time, &clock);
+        }
+
+        mxDestroyArray(fft2lhs[0]);
+        mxDestroyArray(fft2lhs[1]);
+        FinishKSpaceStats(stats);
+        return;
+    }
+
+    if(layout == KS_BATCHED) {
+        //Both components in one array, transformed by one call.
+        mwSize dims[3] = {static_cast<mwSize>(My), static_cast<mwSize>(Mx), 2};
+        fft2rhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+        SpreadBlock(RealData(fft2rhs[0]), 2, e1, psrc, f, Nsrc, Lx, Ly, xi,
+                w, eta, P, Mx, My, h);
+        LapTime(&stats->spread_time, &clock);
+        MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+        mxDestroyArray(fft2rhs[0]);
+        LapTime(&stats->fft_time, &clock);
+
+        //The four filtered grids go to a new array, transformed back by
+        //one call as well.
+        dims[2] = 4;
+        fft2rhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxCOMPLEX);
+        ComplexPart in_re = RealPart(fft2lhs[0]);
+        ComplexPart in_im = ImagPart(fft2lhs[0]);
+        for(int g = 0;g<4;g++) {
+            Hhat_re[g] = RealPart(fft2rhs[0]) + g*grid;
+            Hhat_im[g] = ImagPart(fft2rhs[0]) + g*grid;
+        }
+
+#pragma omp parallel for
+        for(int j = 0;j<Mx;j++) {
+            double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+            for(int k = 0;k<My;k++) {
+                int ptr = j*My+k;
+                double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+                double g_re[4], g_im[4];
+                Filter(k1, k2, k1*k1+k2*k2, xi, eta, in_re[ptr], in_im[ptr],
+                        in_re[grid+ptr], in_im[grid+ptr], g_re, g_im);
+                for(int g = 0;g<4;g++) {
+                    Hhat_re[g][ptr] = g_re[g];
+                    Hhat_im[g][ptr] = g_im[g];
+                }
+            }
+        }
+        mxDestroyArray(fft2lhs[0]);
+        fft2lhs[0] = fft2rhs[0];
+    } else {
+        int nspread = (layout == KS_TWO_SPREADS) ? 4 : 2;
+        for(int g = 0;g<nspread;g++)
+            fft2rhs[g] = mxCreateDoubleMatrix(My, Mx, mxREAL);
+
+        Spread(RealData(fft2rhs[0]), RealData(fft2rhs[1]), e1, psrc, f, Nsrc,
+                Lx, Ly, xi, w, eta, P, Mx, My, h);
+        LapTime(&stats->spread_time, &clock);
+        MatlabTransform(&fft2lhs[0], fft2rhs[0], "fft2");
+        MatlabTransform(&fft2lhs[1], fft2rhs[1], "fft2");
+        LapTime(&stats->fft_time, &clock);
+
+        //KS_TWO_SPREADS spreads and transforms the density a second time
+        //for grids 3 and 4, KS_ONE_SPREAD only allocates them.
+        if(layout == KS_TWO_SPREADS) {
+            Spread(RealData(fft2rhs[2]), RealData(fft2rhs[3]), e1, psrc, f,
+                    Nsrc, Lx, Ly, xi, w, eta, P, Mx, My, h);
+            LapTime(&stats->spread_time, &clock);
+            MatlabTransform(&fft2lhs[2], fft2rhs[2], "fft2");
+            MatlabTransform(&fft2lhs[3], fft2rhs[3], "fft2");
+            LapTime(&stats->fft_time, &clock);
+        } else {
+            fft2lhs[2] = mxCreateDoubleMatrix(My, Mx, mxCOMPLEX);
+            fft2lhs[3] = mxCreateDoubleMatrix(My, Mx, mxCOMPLEX);
+        }
+        for(int g = 0;g<nspread;g++)
+            mxDestroyArray(fft2rhs[g]);
+        for(int g = 0;g<4;g++) {
+            Hhat_re[g] = RealPart(fft2lhs[g]);
+            Hhat_im[g] = ImagPart(fft2lhs[g]);
+        }
+
+#pragma omp parallel for
+        for(int j = 0;j<Mx;j++) {
+            double k1 = (j <= Mx/2) ? 2.0*pi/Lx*j : 2.0*pi/Lx*(j-Mx);
+            for(int k = 0;k<My;k++) {
+                int ptr = j*My+k;
+                double k2 = (k <= My/2) ? 2.0*pi/Ly*k : 2.0*pi/Ly*(k-My);
+                double g_re[4], g_im[4];
+                Filter(k1, k2, k1*k1+k2*k2, xi, eta, Hhat_re[0][ptr],
+                        Hhat_im[0][ptr], Hhat_re[1][ptr], Hhat_im[1][ptr],
+                        g_re, g_im);
+                for(int g = 0;g<4;g++) {
+                    Hhat_re[g][ptr] = g_re[g];
+                    Hhat_im[g][ptr] = g_im[g];
+                }
+            }
+        }
+    }
+
+    //Remove the zero frequency terms.
+    for(int g = 0;g<4;g++) {
+        Hhat_re[g][0] = 0;
+        Hhat_im[g][0] = 0;
+    }
+    LapTime(&stats->filter_time, &clock);
+
+    for(int g = 0;g<ngrids;g++) {
+        MatlabTransform(&fft2rhs[g], fft2lhs[g], "ifft2");
+        mxDestroyArray(fft2lhs[g]);
+    }
+    LapTime(&stats->ifft_time, &clock);
+
+    if(layout == KS_BATCHED) {
+        double* Ht = RealGrid(fft2rhs[0]);
+        if(Ht != NULL)
+            GatherBlock(Ht, 4, e1, ptar, out, Ntar, Lx, Ly, xi, w, eta, P,
+                    Mx, My, h);
+        else
+            memset(out, 0, 4*Ntar*sizeof(double));
+    } else {
+        for(int g = 0;g<4;g++) {
+            double* Ht = RealGrid(fft2rhs[g]);
+            if(Ht != NULL)
+                Gather(Ht, 4, g+1, e1, ptar, out, Ntar, Lx, Ly, xi, w, eta,
+                        P, Mx, My, h);
+            else
+                for(int j = 0;j<Ntar;j++)
+                    out[4*j+g] = 0;
+        }
+    }
+
+    for(int g = 0;g<ngrids;g++)
+        mxDestroyArray(fft2rhs[g]);
+    LapTime(&stats->gather_time, &clock);
+    FinishKSpaceStats(stats);
+}
+
+void StokesSLPGradientKSpace(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, int layout, double* uk,
+        KSpaceStats* stats){
+    SLPFourComponentKSpace<SLPGradientFilter>(psrc, ptar, f, Nsrc, Ntar,
+            xi, eta, Mx, My, Lx, Ly, w, P, layout, uk, stats);
+}
+
+void StokesSLPStressKSpace(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, int layout, double* sigmak,
+        KSpaceStats* stats){
+    SLPFourComponentKSpace<SLPStressFilter>(psrc, ptar, f, Nsrc, Ntar, xi,
+            eta, Mx, My, Lx, Ly, w, P, layout, sigmak, stats);
+}
@@ -0,0 +1,148 @@
+#ifndef KSPACE
+#define KSPACE
+
+#include "mex.h"
+
+/*------------------------------------------------------------------------
+ *Statistics of one k-space sum: the wall times in seconds of spreading the
+ *densities to the grids (with the weighted densities made first), the
+ *forward FFTs, the filter, the inverse FFTs and gathering at the targets
+ *(with the copy to the output), the Mx x My grid and the number of grids
+ *spread, and the largest memory in bytes the grids took at one time. The
+ *times are added to, so that a sum of several parts can be timed as one,
+ *and so are the scratch allocations, those of them that went to the heap
+ *and the page faults of the process, see scratch_arena.h.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    double spread_time;
+    double fft_time;
+    double filter_time;
+    double ifft_time;
+    double gather_time;
+    int Mx;
+    int My;
+    int num_grids;
+    double memory;
+    double allocations;
+    double heap_allocations;
+    double page_faults;
+} KSpaceStats;
+
+//Converts the statistics to a Matlab struct.
+mxArray* KSpaceStatsToStruct(const KSpaceStats* stats);
+
+//Adds the fields of stats to the Matlab struct s, as those of the Ewald
+//sums in which the real-space statistics come first. The memory and the
+//scratch counters get the prefix kspace_, e.g. kspace_page_faults.
+void AddKSpaceStats(mxArray* s, const KSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *Fourier-space part of the Ewald sum for the velocity of the Stokeslet
+ *(SLP) and the stresslet (DLP), by spectral Ewald: the densities are
+ *spread to an Mx x My grid with Gaussians of P support points, filtered
+ *in frequency space and gathered at the targets. eta and w are the
+ *splitting parameter and the width of the Gaussians. The 2 x Ntar result
+ *is written to uk, without the zero mode of the stresslet. The FFTs are
+ *done by Matlab's fft2 through mexCallMATLAB, so these functions must be
+ *called from the Matlab thread. filter is a table made by
+ *StokesSLPKSpaceFilter() or StokesDLPKSpaceFilter() for the same
+ *parameters, or NULL to evaluate the filter on the fly. If stats is not
+ *NULL, the times of the phases are added to it and the grid is set.
+ *------------------------------------------------------------------------
+ */
+void StokesSLPKSpace(double* psrc, double* ptar, double* f, int Nsrc,
+        int Ntar, double xi, double eta, int Mx, int My, double Lx,
+        double Ly, double w, int P, const double* filter, double* uk,
+        KSpaceStats* stats);
+
+void StokesDLPKSpace(double* psrc, double* ptar, double* f, double* n,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *StokesDLPKSpace with less memory, for grids too large for a budget. The
+ *filter only depends on f1*n2 and f2*n1 through their sum, so three grids
+ *are spread, one at a time, and the filtered transform of each is added
+ *to the transforms of the two velocity components, which are transformed
+ *back and gathered one at a time. At most seven real Mx x My grids are
+ *held (a complex grid counts twice), against twelve for StokesDLPKSpace,
+ *at the cost of spreading without sharing the Gaussian weights between
+ *the grids.
+ *------------------------------------------------------------------------
+ */
+void StokesDLPKSpaceStreamed(double* psrc, double* ptar, double* f,
+        double* n, int Nsrc, int Ntar, double xi, double eta, int Mx,
+        int My, double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *StokesSLPKSpace for nrhs densities on the same points, e.g. the block
+ *vectors of block GMRES. f and uk hold one 2 x Nsrc (2 x Ntar) page per
+ *right-hand side. The Gaussian weights of each point are computed once
+ *for all densities, and the 2*nrhs grids are transformed by one call to
+ *fft2 and one to ifft2.
+ *------------------------------------------------------------------------
+ */
+void StokesSLPKSpaceBlock(double* psrc, double* ptar, double* f, int Nsrc,
+        int Ntar, int nrhs, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, const double* filter,
+        double* uk, KSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *The k-space velocity of alpha*SLP(f) + beta*DLP(g,n) on a common grid.
+ *The six grids of the two potentials are spread in one pass and
+ *transformed by one call to fft2, both filters are summed into two grids,
+ *and only those are transformed back and gathered. slp_filter and
+ *dlp_filter are tabulated filters as for StokesSLPKSpace, or NULL.
+ *------------------------------------------------------------------------
+ */
+void StokesCombinedKSpace(double* psrc, double* ptar, double* f, double* g,
+        double* n, double alpha, double beta, int Nsrc, int Ntar,
+        double xi, double eta, int Mx, int My, double Lx, double Ly,
+        double w, int P, const double* slp_filter, const double* dlp_filter,
+        double* uk, KSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *Layouts of the k-space sums of the gradient and the stress of the
+ *Stokeslet, which give the same result with different numbers of
+ *spreads and FFTs. KS_TWO_SPREADS spreads the density twice, to four
+ *grids, and transforms all four. KS_ONE_SPREAD spreads and transforms
+ *two grids and filters them into four. KS_BATCHED does the same with one
+ *call to fft2 for the two grids and one to ifft2 for the four. Which is
+ *fastest depends on the number of points, the grid and the threads, see
+ *kspace_variants.h. KS_STREAMED transforms two grids as KS_ONE_SPREAD but
+ *filters, transforms back and gathers one component at a time, which
+ *holds eight real grids at most, against ten to sixteen for the others.
+ *------------------------------------------------------------------------
+ */
+#define KS_TWO_SPREADS 0
+#define KS_ONE_SPREAD 1
+#define KS_BATCHED 2
+#define KS_STREAMED 3
+
+//The 4 x Ntar k-space gradient of the Stokeslet velocity, as given by
+//mex_stokes_slp_gradient_kspace.
+void StokesSLPGradientKSpace(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, int layout, double* uk,
+        KSpaceStats* stats);
+
+//The 4 x Ntar k-space stress of the Stokeslet, as given by
+//mex_stokes_slp_stress_kspace.
+void StokesSLPStressKSpace(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, double xi, double eta, int Mx, int My,
+        double Lx, double Ly, double w, int P, int layout, double* sigmak,
+        KSpaceStats* stats);
+
+//Tabulates the scalar part of the frequency-space filter, which only
+//depends on the parameters, for the Mx x My grid in the order of the FFT
+//output. filter holds Mx*My values.
+void StokesSLPKSpaceFilter(int Mx, int My, double Lx, double Ly, double xi,
+        double eta, double* filter);
+
+void StokesDLPKSpaceFilter(int Mx, int My, double Lx, double Ly, double xi,
+        double eta, double* filter);
+
+#endif
@@ -0,0 +1,205 @@
+#include "kspace_variants.h"
+#include "kspace.h"
+
+#include <map>
+#include <omp.h>
+#include <string.h>
+
+static void SLPVelocitySeparate(const KSpaceArgs* a, double* out){
+    StokesSLPKSpace(a->psrc, a->ptar, a->f, a->Nsrc, a->Ntar, a->xi,
+            a->eta, a->Mx, a->My, a->Lx, a->Ly, a->w, a->P, a->filter, out,
+            a->stats);
+}
+
+static void SLPVelocityBatched(const KSpaceArgs* a, double* out){
+    StokesSLPKSpaceBlock(a->psrc, a->ptar, a->f, a->Nsrc, a->Ntar, 1,
+            a->xi, a->eta, a->Mx, a->My, a->Lx, a->Ly, a->w, a->P,
+            a->filter, out, a->stats);
+}
+
+static void DLPVelocitySeparate(const KSpaceArgs* a, double* out){
+    StokesDLPKSpace(a->psrc, a->ptar, a->f, a->n, a->Nsrc, a->Ntar, a->xi,
+            a->eta, a->Mx, a->My, a->Lx, a->Ly, a->w, a->P, a->filter, out,
+            a->stats);
+}
+
+static void DLPVelocityStreamed(const KSpaceArgs* a, double* out){
+    StokesDLPKSpaceStreamed(a->psrc, a->ptar, a->f, a->n, a->Nsrc, a->Ntar,
+            a->xi, a->eta, a->Mx, a->My, a->Lx, a->Ly, a->w, a->P,
+            a->filter, out, a->stats);
+}
+
+//The stresslet part of the combined operator, whose four grids are
+//transformed by one call to fft2. The Stokeslet grids are spread with a
+//zero weight.
+static void DLPVelocityBatched(const KSpaceArgs* a, double* out){
+    StokesCombinedKSpace(a->psrc, a->ptar, a->f, a->f, a->n, 0, 1, a->Nsrc,
+            a->Ntar, a->xi, a->eta, a->Mx, a->My, a->Lx, a->Ly, a->w, a->P,
+            NULL, a->filter, out, a->stats);
+}
+
+#define SLP_FOUR_COMPONENT_VARIANT(name, function, layout) \
+    static void name(const KSpaceArgs* a, double* out){ \
+        function(a->psrc, a->ptar, a->f, a->Nsrc, a->Ntar, a->xi, a->eta, \
+                a->Mx, a->My, a->Lx, a->Ly, a->w, a->P, layout, out, \
+                a->stats); \
+    }
+
+SLP_FOUR_COMPONENT_VARIANT(SLPGradientTwoSpreads, StokesSLPGradientKSpace, KS_TWO_SPREADS)
+SLP_FOUR_COMPONENT_VARIANT(SLPGradientOneSpread, StokesSLPGradientKSpace, KS_ONE_SPREAD)
+SLP_FOUR_COMPONENT_VARIANT(SLPGradientBatched, StokesSLPGradientKSpace, KS_BATCHED)
+SLP_FOUR_COMPONENT_VARIANT(SLPGradientStreamed, StokesSLPGradientKSpace, KS_STREAMED)
+SLP_FOUR_COMPONENT_VARIANT(SLPStressTwoSpreads, StokesSLPStressKSpace, KS_TWO_SPREADS)
+SLP_FOUR_COMPONENT_VARIANT(SLPStressOneSpread, StokesSLPStressKSpace, KS_ONE_SPREAD)
+SLP_FOUR_COMPONENT_VARIANT(SLPStressBatched, StokesSLPStressKSpace, KS_BATCHED)
+SLP_FOUR_COMPONENT_VARIANT(SLPStressStreamed, StokesSLPStressKSpace, KS_STREAMED)
+
+//The variants of each family, the default first, with the most real
+//Mx x My grids each holds at one time (see the statistics of kspace.h).
+static const KSpaceVariant slp_velocity[] = {
+    {"separate", SLPVelocitySeparate, 8},
+    {"batched", SLPVelocityBatched, 8}};
+static const KSpaceVariant dlp_velocity[] = {
+    {"separate", DLPVelocitySeparate, 12},
+    {"batched", DLPVelocityBatched, 18},
+    {"streamed", DLPVelocityStreamed, 7}};
+static const KSpaceVariant slp_gradient[] = {
+    {"two_spreads", SLPGradientTwoSpreads, 12},
+    {"one_spread", SLPGradientOneSpread, 10},
+    {"batched", SLPGradientBatched, 16},
+    {"streamed", SLPGradientStreamed, 8}};
+static const KSpaceVariant slp_stress[] = {
+    {"two_spreads", SLPStressTwoSpreads, 12},
+    {"one_spread", SLPStressOneSpread, 10},
+    {"batched", SLPStressBatched, 16},
+    {"streamed", SLPStressStreamed, 8}};
+
+static const KSpaceVariant* families[KS_NUM_FAMILIES] = {slp_velocity,
+        dlp_velocity, slp_gradient, slp_stress};
+static const int num_variants[KS_NUM_FAMILIES] = {2, 3, 4, 4};
+
+//The number of components per target of the output of each family.
+static const int num_components[KS_NUM_FAMILIES] = {2, 2, 4, 4};
+
+//The shape of a call, which decides the fastest variant, and the
+//variants that fit its memory budget.
+typedef struct {
+    int v[8];
+} KSpaceShape;
+
+static bool operator<(const KSpaceShape& a, const KSpaceShape& b){
+    return memcmp(a.v, b.v, sizeof(a.v)) < 0;
+}
+
+//The fastest variant of each shape that has been measured.
+static std::map<KSpaceShape, int> wisdom;
+
+int NumKSpaceVariants(int family){
+    return num_variants[family];
+}
+
+double KSpaceVariantMemory(int family, int variant, int Mx, int My){
+    return families[family][variant].peak_grids*Mx*My*sizeof(double);
+}
+
+//The variants whose grids fit the budget of args, as a bit mask. If none
+//does, the one with the fewest grids.
+static int VariantsInBudget(int family, const KSpaceArgs* args){
+
+    int mask = 0, leanest = 0;
+    for(int j = 0;j<num_variants[family];j++) {
+        if(args->max_memory <= 0 || KSpaceVariantMemory(family, j, args->Mx,
+                args->My) <= args->max_memory)
+            mask |= 1 << j;
+        if(families[family][j].peak_grids < families[family][leanest].peak_grids)
+            leanest = j;
+    }
+    return (mask != 0) ? mask : 1 << leanest;
+}
+
+const KSpaceVariant* GetKSpaceVariant(int family, int variant){
+    return &families[family][variant];
+}
+
+int FindKSpaceVariant(int family, const char* name){
+
+    if(!strcmp(name, "estimate"))
+        return KS_ESTIMATE;
+    if(!strcmp(name, "measure"))
+        return KS_MEASURE;
+    for(int j = 0;j<num_variants[family];j++)
+        if(!strcmp(name, families[family][j].name))
+            return j;
+    return KS_UNKNOWN;
+}
+
+int ReadKSpaceVariant(int family, const mxArray* name){
+
+    char* str = mxArrayToString(name);
+    int variant = (str != NULL) ? FindKSpaceVariant(family, str) : KS_UNKNOWN;
+    mxFree(str);
+    if(variant == KS_UNKNOWN)
+        mexErrMsgTxt("Unknown k-space variant, use the name of a variant, 'estimate' or 'measure'.");
+    return variant;
+}
+
+int RunKSpaceVariant(int family, int variant, const KSpaceArgs* args,
+        double* out, double* times){
+
+    if(times != NULL)
+        for(int j = 0;j<num_variants[family];j++)
+            times[j] = -1;
+
+    int allowed = VariantsInBudget(family, args);
+    if(variant == KS_ESTIMATE)
+        for(variant = 0;!(allowed & (1 << variant));variant++);
+
+    if(variant == KS_MEASURE) {
+        KSpaceShape shape;
+        memset(&shape, 0, sizeof(shape));
+        shape.v[0] = family;
+        shape.v[1] = args->Nsrc;
+        shape.v[2] = args->Ntar;
+        shape.v[3] = args->Mx;
+        shape.v[4] = args->My;
+        shape.v[5] = args->P;
+        shape.v[6] = omp_get_max_threads();
+        shape.v[7] = allowed;
+
+        std::map<KSpaceShape, int>::iterator it = wisdom.find(shape);
+        if(it != wisdom.end())
+            variant = it->second;
+        else {
+            //Each run overwrites out with the same result, from zero since
+            //gathering adds to it. The statistics are those of the fastest
+            //run.
+            KSpaceArgs run_args = *args;
+            KSpaceStats run_stats, best_stats;
+            run_args.stats = &run_stats;
+            double best = -1;
+            for(int j = 0;j<num_variants[family];j++) {
+                if(!(allowed & (1 << j)))
+                    continue;
+                memset(&run_stats, 0, sizeof(KSpaceStats));
+                memset(out, 0, num_components[family]*args->Ntar*sizeof(double));
+                double start = omp_get_wtime();
+                families[family][j].run(&run_args, out);
+                double t = omp_get_wtime() - start;
+                if(times != NULL)
+                    times[j] = t;
+                if(best < 0 || t < best) {
+                    best = t;
+                    variant = j;
+                    best_stats = run_stats;
+                }
+            }
+            if(args->stats != NULL)
+                *args->stats = best_stats;
+            wisdom[shape] = variant;
+            return variant;
+        }
+    }
+
+    families[family][variant].run(args, out);
+    return variant;
+}
@@ -0,0 +1,102 @@
+#ifndef KSPACE_VARIANTS
+#define KSPACE_VARIANTS
+
+#include "mex.h"
+#include "kspace.h"
+
+/*------------------------------------------------------------------------
+ *Run-time choice between the algorithms of a k-space sum, in the manner
+ *of FFTW's planner. Each family of k-space sums (a quantity of a kernel)
+ *registers variants that give the same result with different layouts of
+ *the spreading and the FFTs, see kspace.h. Which one is fastest depends
+ *on the numbers of points, the grid, P and the threads, and cannot be
+ *told reliably in advance.
+ *
+ *KS_ESTIMATE runs the first variant of the family, the one the code used
+ *before there was a choice. KS_MEASURE times each variant once and
+ *remembers the fastest for the shape of the call (the family, Nsrc, Ntar,
+ *Mx, My, P and the number of threads), so later calls with the same shape
+ *run it directly. Every timed run computes the full result, so measuring
+ *costs one evaluation per variant and the output is valid. What was
+ *learnt is kept for as long as the mex file is loaded.
+ *
+ *The variants also differ in how many grids they hold at one time. Given
+ *a memory budget, KS_ESTIMATE runs the first variant whose grids fit it
+ *and KS_MEASURE only times those, and if none fits the one with the
+ *fewest grids is run. A variant chosen by name is run regardless.
+ *------------------------------------------------------------------------
+ */
+#define KS_SLP_VELOCITY 0
+#define KS_DLP_VELOCITY 1
+#define KS_SLP_GRADIENT 2
+#define KS_SLP_STRESS 3
+#define KS_NUM_FAMILIES 4
+#define KS_MAX_VARIANTS 4
+
+#define KS_ESTIMATE -1
+#define KS_MEASURE -2
+#define KS_UNKNOWN -3
+
+//The arguments of a k-space sum, as for the functions of kspace.h. n is
+//only used by the stresslet and filter only by the velocities, where it
+//may be NULL. stats may be NULL. max_memory is the budget in bytes for
+//the grids, or 0 for none.
+typedef struct {
+    double* psrc;
+    double* ptar;
+    double* f;
+    double* n;
+    int Nsrc;
+    int Ntar;
+    double xi;
+    double eta;
+    int Mx;
+    int My;
+    double Lx;
+    double Ly;
+    double w;
+    int P;
+    const double* filter;
+    KSpaceStats* stats;
+    double max_memory;
+} KSpaceArgs;
+
+typedef void (*KSpaceFunction)(const KSpaceArgs* args, double* out);
+
+//A variant, which holds at most peak_grids real Mx x My grids at one time
+//(a complex grid counts twice).
+typedef struct {
+    const char* name;
+    KSpaceFunction run;
+    double peak_grids;
+} KSpaceVariant;
+
+int NumKSpaceVariants(int family);
+
+//The memory in bytes the grids of a variant take at most.
+double KSpaceVariantMemory(int family, int variant, int Mx, int My);
+
+const KSpaceVariant* GetKSpaceVariant(int family, int variant);
+
+//The variant of the family with the given name, KS_ESTIMATE or
+//KS_MEASURE for "estimate" and "measure", and KS_UNKNOWN otherwise.
+int FindKSpaceVariant(int family, const char* name);
+
+//FindKSpaceVariant() for a Matlab string, with an error if the name is
+//unknown.
+int ReadKSpaceVariant(int family, const mxArray* name);
+
+/*------------------------------------------------------------------------
+ *Evaluates the k-space sum of the family into out with variant, which is
+ *a variant of the family, KS_ESTIMATE or KS_MEASURE, and returns the
+ *variant that gave the result. If times is not NULL, it gets the time in
+ *seconds of each variant (NumKSpaceVariants() values) that was measured
+ *by this call, and -1 for the others. If args->stats is not NULL it gets
+ *the statistics of the run that gave the result. Must be called from the
+ *Matlab thread.
+ *------------------------------------------------------------------------
+ */
+int RunKSpaceVariant(int family, int variant, const KSpaceArgs* args,
+        double* out, double* times);
+
+#endif
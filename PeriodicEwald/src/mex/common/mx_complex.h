@@ -0,0 +1,135 @@
+#ifndef MX_COMPLEX
+#define MX_COMPLEX
+
+#include "mex.h"
+#include <stddef.h>
+#include <stdexcept>
+#include <string>
+
+/*------------------------------------------------------------------------
+ *Access to the grids of Matlab's fft2 and ifft2 under both complex APIs.
+ *With the interleaved API (mex -R2018a, which defines
+ *MX_HAS_INTERLEAVED_COMPLEX) the real and imaginary parts of element i are
+ *stored next to each other, at 2*i and 2*i+1, and the separate API
+ *(-R2017b) keeps them in two arrays. A ComplexPart indexes either layout
+ *as a plain array with a stride known at compile time, so the filters
+ *work on the FFT output in place, and Matlab converts nothing.
+ *------------------------------------------------------------------------
+ */
+#if MX_HAS_INTERLEAVED_COMPLEX
+#define MX_COMPLEX_STRIDE 2
+#else
+#define MX_COMPLEX_STRIDE 1
+#endif
+
+class ComplexPart {
+public:
+    ComplexPart() : p_(NULL) {}
+    explicit ComplexPart(double* p) : p_(p) {}
+
+    double& operator*() const {
+        return *p_;
+    }
+    double& operator[](ptrdiff_t i) const {
+        return p_[MX_COMPLEX_STRIDE*i];
+    }
+    ComplexPart operator+(ptrdiff_t i) const {
+        return ComplexPart(p_ + MX_COMPLEX_STRIDE*i);
+    }
+
+private:
+    double* p_;
+};
+
+//The values of a real double array.
+inline double* RealData(const mxArray* a){
+#if MX_HAS_INTERLEAVED_COMPLEX
+    return mxGetDoubles(a);
+#else
+    return mxGetPr(a);
+#endif
+}
+
+//Makes a double array complex, with a zero imaginary part, if it is not
+//already, e.g. the transform of a grid that fft2 found to be real.
+inline void MakeComplex(mxArray* a){
+#if MX_HAS_INTERLEAVED_COMPLEX
+    if(!mxIsComplex(a))
+        mxMakeArrayComplex(a);
+#else
+    if(mxGetPi(a) == NULL)
+        mxSetPi(a, (double*) mxCalloc(mxGetNumberOfElements(a),
+                sizeof(double)));
+#endif
+}
+
+//The real and imaginary parts of a double array, made complex first.
+inline ComplexPart RealPart(mxArray* a){
+    MakeComplex(a);
+#if MX_HAS_INTERLEAVED_COMPLEX
+    return ComplexPart(reinterpret_cast<double*>(mxGetComplexDoubles(a)));
+#else
+    return ComplexPart(mxGetPr(a));
+#endif
+}
+
+inline ComplexPart ImagPart(mxArray* a){
+    MakeComplex(a);
+#if MX_HAS_INTERLEAVED_COMPLEX
+    return ComplexPart(reinterpret_cast<double*>(mxGetComplexDoubles(a))+1);
+#else
+    return ComplexPart(mxGetPi(a));
+#endif
+}
+
+/*------------------------------------------------------------------------
+ *The real part of the result of ifft2 as a contiguous grid, for the
+ *gathering. With the interleaved API a complex result is compacted in
+ *place, which overwrites its imaginary part, and a is not complex data
+ *after. With the separate API it is just the real array.
+ *------------------------------------------------------------------------
+ */
+inline double* RealGrid(mxArray* a){
+#if MX_HAS_INTERLEAVED_COMPLEX
+    if(!mxIsComplex(a))
+        return mxGetDoubles(a);
+
+    double* data = reinterpret_cast<double*>(mxGetComplexDoubles(a));
+    mwSize n = mxGetNumberOfElements(a);
+    for(mwSize i = 1;i<n;i++)
+        data[i] = data[2*i];
+    return data;
+#else
+    return mxGetPr(a);
+#endif
+}
+
+/*------------------------------------------------------------------------
+ *Calls Matlab's fft2 or ifft2 (name) on in, as mexCallMATLAB. A failure,
+ *e.g. running out of memory, is thrown as a std::runtime_error with
+ *Matlab's message instead of leaving the mex file at once, so that the
+ *scratch memory of the sum is freed on the way out (see ScratchBuffer)
+ *and RunConcurrently() can stop the real-space sum before reporting it.
+ *------------------------------------------------------------------------
+ */
+inline void MatlabTransform(mxArray** out, mxArray* in, const char* name){
+
+    mxArray* exception = mexCallMATLABWithTrap(1, out, 1, &in, name);
+    if(exception == NULL)
+        return;
+
+    std::string msg = std::string(name) + " failed.";
+    mxArray* text = mxGetProperty(exception, 0, "message");
+    if(text != NULL) {
+        char* str = mxArrayToString(text);
+        if(str != NULL) {
+            msg = str;
+            mxFree(str);
+        }
+        mxDestroyArray(text);
+    }
+    mxDestroyArray(exception);
+    throw std::runtime_error(msg);
+}
+
+#endif
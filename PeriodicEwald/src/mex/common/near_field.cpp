@@ -0,0 +1,661 @@
+#include "near_field.h"
+#include "ewald_tools.h"
+#include "scratch_arena.h"
+
+#include <mm_malloc.h>
+#include <new>
+#include <vector>
+
+/*------------------------------------------------------------------------
+ *The arrays of a near field. Those of a persistent near field, which a
+ *plan keeps between calls, come from the heap, since they would pin the
+ *scratch arena, and the others from the arena.
+ *------------------------------------------------------------------------
+ */
+template <typename T>
+static T* NearFieldArray(size_t n, int persistent){
+
+    if(!persistent)
+        return ScratchArray<T>(n);
+
+    T* p = static_cast<T*>(_mm_malloc(n*sizeof(T), SA_ALIGNMENT));
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void FreeNearFieldArray(void* p, int persistent){
+
+    if(persistent)
+        _mm_free(p);
+    else
+        ScratchFree(p);
+}
+
+//List used for translating sources. FF
+static const int ilist_x[8] = {-1,-1,-1,0,0,1,1,1};
+static const int ilist_y[8] = {-1,0,1,-1,1,-1,0,1};
+
+/*------------------------------------------------------------------------
+ *The uniform box grid, with the boxes numbered along a Hilbert curve (see
+ *HilbertBoxOrder). rank[box_y*nside_x+box_x] is the number of a box and
+ *at[b] the row-major index of box b.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int nside_x;
+    int nside_y;
+    double Lx;
+    double Ly;
+    int* rank;
+    int* at;
+} BoxGrid;
+
+/*------------------------------------------------------------------------
+ *Returns the j:th of the eight neighbours of box b, and the z-offset of
+ *the neighbour corrected for periodicity in (shift_x,shift_y).
+ *------------------------------------------------------------------------
+ */
+static int Neighbour(const BoxGrid* grid, int b, int j, double* shift_x,
+        double* shift_y){
+
+    int per_source_x = grid->at[b]%grid->nside_x+ilist_x[j];
+    int per_source_y = grid->at[b]/grid->nside_x+ilist_y[j];
+
+    int t_x = (per_source_x+grid->nside_x)%grid->nside_x;
+    int t_y = (per_source_y+grid->nside_y)%grid->nside_y;
+
+    *shift_x = (grid->Lx*(per_source_x-t_x))/grid->nside_x;
+    *shift_y = (grid->Ly*(per_source_y-t_y))/grid->nside_y;
+
+    return grid->rank[t_y*grid->nside_x + t_x];
+}
+
+/*------------------------------------------------------------------------
+ *A node of the adaptive tree. The cell is the part of the box the node
+ *was made from, while the bounding boxes (xmin,ymin,xmax,ymax) are those
+ *of the points actually in it, which is what the distance tests use.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    double x0, y0, x1, y1;
+    double sbox[4];
+    double tbox[4];
+    int src_first;
+    int src_last;
+    int tar_first;
+    int tar_last;
+    int child;
+} TreeNode;
+
+static void BoundingBox(const PointSet* p, const int* order, int first,
+        int last, double* box){
+
+    box[0] = box[1] = INFINITY;
+    box[2] = box[3] = -INFINITY;
+    for(int j = first;j<last;j++) {
+        double x = p->x[p->stride*order[j]];
+        double y = p->y[p->stride*order[j]];
+        if(x < box[0]) box[0] = x;
+        if(y < box[1]) box[1] = y;
+        if(x > box[2]) box[2] = x;
+        if(y > box[3]) box[3] = y;
+    }
+}
+
+/*------------------------------------------------------------------------
+ *Sorts order[first..last-1] by the quadrant (0..3) of the point relative
+ *to (mx,my), and writes the start of each quadrant to split[0..4].
+ *------------------------------------------------------------------------
+ */
+static void SplitQuadrants(const PointSet* p, int* order, int* tmp,
+        int first, int last, double mx, double my, int* split){
+
+    int count[4] = {0, 0, 0, 0};
+    for(int j = first;j<last;j++) {
+        int q = (p->x[p->stride*order[j]] >= mx)
+                + 2*(p->y[p->stride*order[j]] >= my);
+        count[q]++;
+    }
+
+    split[0] = first;
+    for(int q = 0;q<4;q++)
+        split[q+1] = split[q] + count[q];
+
+    int pos[4] = {split[0], split[1], split[2], split[3]};
+    for(int j = first;j<last;j++) {
+        int q = (p->x[p->stride*order[j]] >= mx)
+                + 2*(p->y[p->stride*order[j]] >= my);
+        tmp[pos[q]++] = order[j];
+    }
+    memcpy(order + first, tmp + first, (last-first)*sizeof(int));
+}
+
+/*------------------------------------------------------------------------
+ *Refines node idx until its leaves hold at most NF_LEAF_CAPACITY points,
+ *appending the leaves that hold targets to leaves in depth-first order.
+ *------------------------------------------------------------------------
+ */
+static void Refine(std::vector<TreeNode>& nodes, int idx, int depth,
+        const PointSet* psrc, const PointSet* ptar, int* src_order,
+        int* tar_order, int* src_tmp, int* tar_tmp,
+        std::vector<int>& leaves){
+
+    TreeNode* node = &nodes[idx];
+    BoundingBox(psrc, src_order, node->src_first, node->src_last, node->sbox);
+    BoundingBox(ptar, tar_order, node->tar_first, node->tar_last, node->tbox);
+    node->child = -1;
+
+    int npoints = node->src_last - node->src_first
+            + node->tar_last - node->tar_first;
+    if(npoints <= NF_LEAF_CAPACITY || depth == NF_MAX_DEPTH) {
+        if(node->tar_last > node->tar_first)
+            leaves.push_back(idx);
+        return;
+    }
+
+    double mx = 0.5*(node->x0 + node->x1);
+    double my = 0.5*(node->y0 + node->y1);
+    int ssplit[5], tsplit[5];
+    SplitQuadrants(psrc, src_order, src_tmp, node->src_first, node->src_last,
+            mx, my, ssplit);
+    SplitQuadrants(ptar, tar_order, tar_tmp, node->tar_first, node->tar_last,
+            mx, my, tsplit);
+
+    int child = static_cast<int>(nodes.size());
+    for(int q = 0;q<4;q++) {
+        TreeNode c;
+        c.x0 = (q & 1) ? mx : nodes[idx].x0;
+        c.x1 = (q & 1) ? nodes[idx].x1 : mx;
+        c.y0 = (q & 2) ? my : nodes[idx].y0;
+        c.y1 = (q & 2) ? nodes[idx].y1 : my;
+        c.src_first = ssplit[q];
+        c.src_last = ssplit[q+1];
+        c.tar_first = tsplit[q];
+        c.tar_last = tsplit[q+1];
+        nodes.push_back(c);
+    }
+    nodes[idx].child = child;
+
+    for(int q = 0;q<4;q++)
+        Refine(nodes, child+q, depth+1, psrc, ptar, src_order, tar_order,
+                src_tmp, tar_tmp, leaves);
+}
+
+/*------------------------------------------------------------------------
+ *Adds the parts of the tree below root that are within the cutoff of the
+ *targets in tbox, shifted by (shift_x,shift_y), to the interaction list.
+ *Nodes that are entirely within the cutoff are added as a whole.
+ *------------------------------------------------------------------------
+ */
+static void CollectRanges(const std::vector<TreeNode>& nodes, int root,
+        const double* tbox, double shift_x, double shift_y, double cutoffsq,
+        std::vector<SourceRange>& ranges){
+
+    //Guard against rounding when skipping the cutoff test.
+    double inner_sq = cutoffsq*(1-1e-12);
+
+    //The shifted targets.
+    double t0 = tbox[0] - shift_x, t2 = tbox[2] - shift_x;
+    double t1 = tbox[1] - shift_y, t3 = tbox[3] - shift_y;
+
+    int stack[4*NF_MAX_DEPTH+4];
+    int top = 0;
+    stack[top++] = root;
+
+    while(top > 0) {
+        const TreeNode* node = &nodes[stack[--top]];
+        if(node->src_last == node->src_first)
+            continue;
+
+        const double* s = node->sbox;
+        double dx = fmax(0, fmax(s[0] - t2, t0 - s[2]));
+        double dy = fmax(0, fmax(s[1] - t3, t1 - s[3]));
+        if(dx*dx + dy*dy >= cutoffsq)
+            continue;
+
+        double Dx = fmax(t2 - s[0], s[2] - t0);
+        double Dy = fmax(t3 - s[1], s[3] - t1);
+        int inside = (Dx*Dx + Dy*Dy < inner_sq);
+
+        if(inside || node->child < 0) {
+            SourceRange r;
+            r.first = node->src_first;
+            r.last = node->src_last;
+            r.shift_x = shift_x;
+            r.shift_y = shift_y;
+            r.check_cutoff = !inside;
+            ranges.push_back(r);
+        }else{
+            for(int q = 3;q>=0;q--)
+                stack[top++] = node->child + q;
+        }
+    }
+}
+
+static void BuildUniform(const BoxGrid* grid, const int* box_offsets_src,
+        const int* nsources_in_box, const int* box_offsets_tar,
+        const int* ntargets_in_box, NearField* nf){
+
+    int num_boxes = grid->nside_x*grid->nside_y;
+
+    int num_groups = 0;
+    for(int b = 0;b<num_boxes;b++)
+        if(ntargets_in_box[b] > 0)
+            num_groups++;
+
+    nf->num_groups = num_groups;
+    nf->group_offsets = NearFieldArray<int>(num_groups+1, nf->persistent);
+    nf->range_offsets = NearFieldArray<int>(num_groups+1, nf->persistent);
+    nf->ranges = NearFieldArray<SourceRange>(9*num_groups+1,
+            nf->persistent);
+
+    int g = 0, nr = 0;
+    for(int b = 0;b<num_boxes;b++) {
+        if(ntargets_in_box[b] == 0)
+            continue;
+
+        nf->group_offsets[g] = box_offsets_tar[b];
+        nf->range_offsets[g] = nr;
+
+        //The box self-interactions. The diagonal of a box is longer than
+        //the cutoff, so the pairs are tested as for the neighbours.
+        if(nsources_in_box[b] > 0) {
+            SourceRange* r = &nf->ranges[nr++];
+            r->first = box_offsets_src[b];
+            r->last = box_offsets_src[b] + nsources_in_box[b];
+            r->shift_x = r->shift_y = 0;
+            r->check_cutoff = 1;
+        }
+
+        //On a uniform periodic grid, each box has eight neighbors. FF
+        for(int j = 0;j<8;j++) {
+            double shift_x, shift_y;
+            int source_box = Neighbour(grid, b, j, &shift_x, &shift_y);
+
+            if(nsources_in_box[source_box] == 0)
+                continue;
+
+            SourceRange* r = &nf->ranges[nr++];
+            r->first = box_offsets_src[source_box];
+            r->last = box_offsets_src[source_box] + nsources_in_box[source_box];
+            r->shift_x = shift_x;
+            r->shift_y = shift_y;
+            r->check_cutoff = 1;
+        }
+        g++;
+    }
+
+    nf->group_offsets[num_groups] = box_offsets_tar[num_boxes];
+    nf->range_offsets[num_groups] = nr;
+}
+
+static void BuildAdaptive(const PointSet* psrc, const PointSet* ptar,
+        int Nsrc, int Ntar, const BoxGrid* grid, const int* box_offsets_src,
+        const int* nsources_in_box, const int* box_offsets_tar,
+        const int* ntargets_in_box, NearField* nf){
+
+    int nside_x = grid->nside_x;
+    int num_boxes = grid->nside_x*grid->nside_y;
+    double hx = grid->Lx/grid->nside_x;
+    double hy = grid->Ly/grid->nside_y;
+
+    std::vector<TreeNode> nodes;
+    std::vector<int> leaves;
+    ScratchBuffer<int> src_tmp(Nsrc+1);
+    ScratchBuffer<int> tar_tmp(Ntar+1);
+
+    //The boxes of the uniform grid are the roots of the trees.
+    nodes.resize(num_boxes);
+    for(int b = 0;b<num_boxes;b++) {
+        nodes[b].x0 = -grid->Lx/2 + hx*(grid->at[b]%nside_x);
+        nodes[b].x1 = nodes[b].x0 + hx;
+        nodes[b].y0 = -grid->Ly/2 + hy*(grid->at[b]/nside_x);
+        nodes[b].y1 = nodes[b].y0 + hy;
+        nodes[b].src_first = box_offsets_src[b];
+        nodes[b].src_last = box_offsets_src[b] + nsources_in_box[b];
+        nodes[b].tar_first = box_offsets_tar[b];
+        nodes[b].tar_last = box_offsets_tar[b] + ntargets_in_box[b];
+    }
+
+    for(int b = 0;b<num_boxes;b++)
+        Refine(nodes, b, 0, psrc, ptar, nf->src_order, nf->tar_order,
+                src_tmp, tar_tmp, leaves);
+
+    src_tmp.Free();
+    tar_tmp.Free();
+
+    //The interaction list of each leaf, searched for in the box of the
+    //leaf and the eight neighbouring boxes.
+    int num_groups = static_cast<int>(leaves.size());
+    std::vector<SourceRange> ranges;
+    nf->num_groups = num_groups;
+    nf->group_offsets = NearFieldArray<int>(num_groups+1, nf->persistent);
+    nf->range_offsets = NearFieldArray<int>(num_groups+1, nf->persistent);
+
+    int b = 0;
+    for(int g = 0;g<num_groups;g++) {
+        const TreeNode* leaf = &nodes[leaves[g]];
+        while(box_offsets_tar[b] + ntargets_in_box[b] <= leaf->tar_first)
+            b++;
+
+        nf->group_offsets[g] = leaf->tar_first;
+        nf->range_offsets[g] = static_cast<int>(ranges.size());
+
+        CollectRanges(nodes, b, leaf->tbox, 0, 0, nf->cutoffsq, ranges);
+        for(int j = 0;j<8;j++) {
+            double shift_x, shift_y;
+            int source_box = Neighbour(grid, b, j, &shift_x, &shift_y);
+
+            CollectRanges(nodes, source_box, leaf->tbox, shift_x, shift_y,
+                    nf->cutoffsq, ranges);
+        }
+    }
+
+    nf->group_offsets[num_groups] = Ntar;
+    nf->range_offsets[num_groups] = static_cast<int>(ranges.size());
+
+    nf->ranges = NearFieldArray<SourceRange>(ranges.size()+1,
+            nf->persistent);
+    if(!ranges.empty())
+        memcpy(nf->ranges, &ranges[0], ranges.size()*sizeof(SourceRange));
+}
+
+//Bins the sources. The sorted sources, which a near field built from src
+//may take over, are persistent if persistent is set. If an allocation
+//fails, what has been allocated is freed before the exception is passed
+//on.
+static void BuildSources(const PointSet* psrc, double* dens, int ndens,
+        int Nsrc,
+        int nside_x, int nside_y, double Lx, double Ly, int persistent,
+        NearFieldSources* src){
+
+    int num_boxes = nside_x*nside_y;
+
+    memset(src, 0, sizeof(NearFieldSources));
+    src->num_sources = Nsrc;
+    src->ndens = ndens;
+    src->nside_x = nside_x;
+    src->nside_y = nside_y;
+    src->Lx = Lx;
+    src->Ly = Ly;
+    src->psrc = *psrc;
+    src->dens = dens;
+    src->persistent = persistent;
+
+    try {
+        //Boxes along a Hilbert curve, so that neighbouring boxes and their
+        //points are mostly close in memory.
+        src->rank = ScratchArray<int>(num_boxes);
+        src->at = ScratchArray<int>(num_boxes);
+        HilbertBoxOrder(nside_x, nside_y, src->rank);
+        for(int b = 0;b<num_boxes;b++)
+            src->at[src->rank[b]] = b;
+
+        //Sources and densities in sorted order. The extra element keeps the
+        //allocations non-empty when there are no sources.
+        src->src_order = NearFieldArray<int>(Nsrc+1, persistent);
+        src->box_offsets_src = ScratchArray<int>(num_boxes+1);
+        src->nsources_in_box = ScratchArray<int>(num_boxes);
+        src->psrc_a = NearFieldArray<double>(2*Nsrc+1, persistent);
+        src->dens_a = NearFieldArray<double>(ndens*Nsrc+1, persistent);
+
+        AssignPoints(psrc, Lx, Ly, Nsrc, nside_x, nside_y, src->src_order,
+                src->box_offsets_src, src->nsources_in_box, dens, ndens,
+                src->psrc_a, src->dens_a, src->rank);
+    } catch(...) {
+        FreeNearFieldSources(src);
+        throw;
+    }
+}
+
+void BuildNearFieldSources(const PointSet* psrc, double* dens, int ndens,
+        int Nsrc, int nside_x, int nside_y, double Lx, double Ly,
+        NearFieldSources* src){
+
+    BuildSources(psrc, dens, ndens, Nsrc, nside_x, nside_y, Lx, Ly, 0, src);
+}
+
+void FreeNearFieldSources(NearFieldSources* src){
+
+    ScratchFree(src->rank);
+    ScratchFree(src->at);
+    FreeNearFieldArray(src->src_order, src->persistent);
+    ScratchFree(src->box_offsets_src);
+    ScratchFree(src->nsources_in_box);
+    FreeNearFieldArray(src->psrc_a, src->persistent);
+    FreeNearFieldArray(src->dens_a, src->persistent);
+}
+
+//1 if the uniform grid has far more candidate pairs than it would have if
+//the points were spread evenly over the boxes.
+static int IsClustered(const NearFieldSources* src, const BoxGrid* grid,
+        const int* ntargets_in_box, int Ntar){
+
+    int num_boxes = src->nside_x*src->nside_y;
+    const int* nsources_in_box = src->nsources_in_box;
+
+    double pairs = 0;
+    for(int b = 0;b<num_boxes;b++) {
+        int nsrc = nsources_in_box[b];
+        for(int j = 0;j<8;j++) {
+            double shift_x, shift_y;
+            nsrc += nsources_in_box[Neighbour(grid, b, j, &shift_x, &shift_y)];
+        }
+        pairs += static_cast<double>(ntargets_in_box[b])*nsrc;
+    }
+    double even_pairs = 9.0*src->num_sources*Ntar/num_boxes;
+
+    return pairs > 2*even_pairs;
+}
+
+int ChooseNearFieldMode(const NearFieldSources* src, const PointSet* ptar,
+        int Ntar){
+
+    int num_boxes = src->nside_x*src->nside_y;
+
+    BoxGrid grid;
+    grid.nside_x = src->nside_x;
+    grid.nside_y = src->nside_y;
+    grid.Lx = src->Lx;
+    grid.Ly = src->Ly;
+    grid.rank = src->rank;
+    grid.at = src->at;
+
+    //Targets per box, numbered along the Hilbert curve as the sources.
+    ScratchBuffer<int> ntargets_in_box(num_boxes);
+    memset(ntargets_in_box, 0, num_boxes*sizeof(int));
+    for(int j = 0;j<Ntar;j++)
+        ntargets_in_box[src->rank[BoxOf(ptar->x[ptar->stride*j],
+                ptar->y[ptar->stride*j], src->Lx,
+                src->Ly, src->nside_x, src->nside_y)]]++;
+
+    int clustered = IsClustered(src, &grid, ntargets_in_box, Ntar);
+
+    return clustered ? NF_ADAPTIVE : NF_UNIFORM;
+}
+
+static void BuildTargets(const NearFieldSources* src, const PointSet* ptar,
+        int Ntar, int mode, NearField* nf){
+
+    int nside_x = src->nside_x;
+    int nside_y = src->nside_y;
+    int num_boxes = nside_x*nside_y;
+    int Nsrc = src->num_sources;
+    int ndens = src->ndens;
+    const int* nsources_in_box = src->nsources_in_box;
+
+    //Cut off radius squared, the area of a box.
+    nf->cutoffsq = src->Lx*src->Ly/nside_x/nside_y;
+
+    BoxGrid grid;
+    grid.nside_x = nside_x;
+    grid.nside_y = nside_y;
+    grid.Lx = src->Lx;
+    grid.Ly = src->Ly;
+    grid.rank = src->rank;
+    grid.at = src->at;
+
+    //Assigns particles to boxes on the current grid. FF
+    nf->persistent = src->persistent;
+    nf->tar_order = NearFieldArray<int>(Ntar+1, nf->persistent);
+    nf->ptar_a = NearFieldArray<double>(2*Ntar+1, nf->persistent);
+    ScratchBuffer<int> box_offsets_tar(num_boxes+1);
+    ScratchBuffer<int> ntargets_in_box(num_boxes);
+    AssignPoints(ptar, src->Lx, src->Ly, Ntar, nside_x, nside_y,
+            nf->tar_order, box_offsets_tar, ntargets_in_box, NULL, 0,
+            nf->ptar_a, NULL, src->rank);
+
+    if(mode == NF_AUTO)
+        nf->adaptive = IsClustered(src, &grid, ntargets_in_box, Ntar);
+    else
+        nf->adaptive = (mode == NF_ADAPTIVE);
+
+    if(nf->adaptive) {
+        //The tree reorders the sources within the boxes, which depends on
+        //the targets, so the near field gets its own copy of them.
+        nf->owns_sources = 1;
+        nf->src_order = NearFieldArray<int>(Nsrc+1, nf->persistent);
+        memcpy(nf->src_order, src->src_order, Nsrc*sizeof(int));
+        nf->psrc_a = NearFieldArray<double>(2*Nsrc+1, nf->persistent);
+        nf->dens_a = NearFieldArray<double>(ndens*Nsrc+1, nf->persistent);
+
+        BuildAdaptive(&src->psrc, ptar, Nsrc, Ntar, &grid,
+                src->box_offsets_src, nsources_in_box, box_offsets_tar,
+                ntargets_in_box, nf);
+
+        const PointSet* psrc = &src->psrc;
+        const double* dens = src->dens;
+#pragma omp parallel for
+        for(int j = 0;j<Nsrc;j++) {
+            nf->psrc_a[2*j] = psrc->x[psrc->stride*nf->src_order[j]];
+            nf->psrc_a[2*j+1] = psrc->y[psrc->stride*nf->src_order[j]];
+            for(int c = 0;c<ndens;c++)
+                nf->dens_a[ndens*j+c] = dens[ndens*nf->src_order[j]+c];
+        }
+
+#pragma omp parallel for
+        for(int j = 0;j<Ntar;j++) {
+            nf->ptar_a[2*j] = ptar->x[ptar->stride*nf->tar_order[j]];
+            nf->ptar_a[2*j+1] = ptar->y[ptar->stride*nf->tar_order[j]];
+        }
+    }else{
+        //The sorted sources are shared with src.
+        nf->owns_sources = 0;
+        nf->src_order = src->src_order;
+        nf->psrc_a = src->psrc_a;
+        nf->dens_a = src->dens_a;
+
+        BuildUniform(&grid, src->box_offsets_src, nsources_in_box,
+                box_offsets_tar, ntargets_in_box, nf);
+    }
+}
+
+//BuildTargets() on a zeroed near field, which is freed again if it fails.
+void BuildNearFieldTargets(const NearFieldSources* src, const PointSet* ptar,
+        int Ntar, int mode, NearField* nf){
+
+    memset(nf, 0, sizeof(NearField));
+    try {
+        BuildTargets(src, ptar, Ntar, mode, nf);
+    } catch(...) {
+        FreeNearField(nf);
+        throw;
+    }
+}
+
+void BuildNearField(double* psrc, double* ptar, double* dens, int ndens,
+        int Nsrc, int Ntar, int nside_x, int nside_y, double Lx, double Ly,
+        int persistent, NearField* nf){
+
+    PointSet src_points = InterleavedPoints(psrc);
+    PointSet tar_points = InterleavedPoints(ptar);
+
+    NearFieldSources src;
+    BuildSources(&src_points, dens, ndens, Nsrc, nside_x, nside_y, Lx, Ly,
+            persistent, &src);
+    ScratchGuard<NearFieldSources, FreeNearFieldSources> free_src(&src);
+    BuildNearFieldTargets(&src, &tar_points, Ntar, NF_AUTO, nf);
+
+    //Take over the sorted sources if they are shared.
+    if(!nf->owns_sources) {
+        nf->owns_sources = 1;
+        src.src_order = NULL;
+        src.psrc_a = NULL;
+        src.dens_a = NULL;
+    }
+}
+
+void FreeNearField(NearField* nf){
+
+    FreeNearFieldArray(nf->group_offsets, nf->persistent);
+    FreeNearFieldArray(nf->range_offsets, nf->persistent);
+    FreeNearFieldArray(nf->ranges, nf->persistent);
+    FreeNearFieldArray(nf->tar_order, nf->persistent);
+    FreeNearFieldArray(nf->ptar_a, nf->persistent);
+    if(nf->owns_sources) {
+        FreeNearFieldArray(nf->src_order, nf->persistent);
+        FreeNearFieldArray(nf->psrc_a, nf->persistent);
+        FreeNearFieldArray(nf->dens_a, nf->persistent);
+    }
+}
+
+double NearFieldMemory(const NearField* nf, int Nsrc, int Ntar, int ndens){
+
+    double ints = 2.0*(nf->num_groups+1) + Ntar;
+    double doubles = 2.0*Ntar;
+    if(nf->owns_sources) {
+        ints += Nsrc;
+        doubles += (2.0+ndens)*Nsrc;
+    }
+
+    return ints*sizeof(int) + doubles*sizeof(double)
+            + static_cast<double>(nf->range_offsets[nf->num_groups])*sizeof(SourceRange);
+}
+
+double NearFieldSourcesMemory(const NearFieldSources* src){
+
+    double num_boxes = static_cast<double>(src->nside_x)*src->nside_y;
+    return (4*num_boxes + src->num_sources)*sizeof(int)
+            + (2.0+src->ndens)*src->num_sources*sizeof(double);
+}
+
+//1 if point order[j] of p is in the same box as the sorted point j of p_a
+//for all n points.
+static int SameBoxes(const double* p, const double* p_a, const int* order,
+        int n, int nside_x, int nside_y, double Lx, double Ly){
+
+    int moved = 0;
+#pragma omp parallel for reduction(|:moved)
+    for(int j = 0;j<n;j++) {
+        int k = order[j];
+        moved |= BoxOf(p[2*k], p[2*k+1], Lx, Ly, nside_x, nside_y) !=
+                BoxOf(p_a[2*j], p_a[2*j+1], Lx, Ly, nside_x, nside_y);
+    }
+    return !moved;
+}
+
+int MoveNearField(NearField* nf, const double* psrc, const double* ptar,
+        int Nsrc, int Ntar, int nside_x, int nside_y, double Lx, double Ly){
+
+    if(nf->adaptive)
+        return 0;
+    if(!SameBoxes(psrc, nf->psrc_a, nf->src_order, Nsrc, nside_x, nside_y,
+            Lx, Ly))
+        return 0;
+    if(!SameBoxes(ptar, nf->ptar_a, nf->tar_order, Ntar, nside_x, nside_y,
+            Lx, Ly))
+        return 0;
+
+#pragma omp parallel for
+    for(int j = 0;j<Nsrc;j++) {
+        nf->psrc_a[2*j] = psrc[2*nf->src_order[j]];
+        nf->psrc_a[2*j+1] = psrc[2*nf->src_order[j]+1];
+    }
+#pragma omp parallel for
+    for(int j = 0;j<Ntar;j++) {
+        nf->ptar_a[2*j] = ptar[2*nf->tar_order[j]];
+        nf->ptar_a[2*j+1] = ptar[2*nf->tar_order[j]+1];
+    }
+    return 1;
+}
@@ -0,0 +1,173 @@
+#ifndef NEAR_FIELD
+#define NEAR_FIELD
+
+#include "ewald_tools.h"
+
+#include <math.h>
+#include <string.h>
+
+//Maximum number of sources and targets in a leaf of the adaptive tree.
+#define NF_LEAF_CAPACITY 64
+
+//Maximum depth of the tree below a box of the uniform grid. Only reached
+//for (nearly) coincident points.
+#define NF_MAX_DEPTH 20
+
+//The structure of a near field: chosen from the distribution of the
+//points, the uniform grid or the adaptive tree. Both give the same pairs,
+//those within the cutoff, so the choice only affects the speed.
+#define NF_AUTO -1
+#define NF_UNIFORM 0
+#define NF_ADAPTIVE 1
+
+/*------------------------------------------------------------------------
+ *A contiguous range of sorted sources in the interaction list of a target
+ *group. The targets are shifted by (shift_x,shift_y) to account for the
+ *periodicity. If check_cutoff is 0 all pairs are known to be within the
+ *cutoff and the test can be skipped.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int first;
+    int last;
+    double shift_x;
+    double shift_y;
+    int check_cutoff;
+} SourceRange;
+
+/*------------------------------------------------------------------------
+ *Near-field structure of the real-space sum. Sources and targets are
+ *sorted so that each target group (a box of the uniform grid or a leaf of
+ *the adaptive tree) is contiguous, and each group has a list of source
+ *ranges it interacts with. The sorted point j is point src_order[j]
+ *(tar_order[j]) of the input, and psrc_a, ptar_a and dens_a hold the
+ *coordinates and the ndens density values per source in sorted order.
+ *
+ *Target group g holds the sorted targets group_offsets[g] to
+ *group_offsets[g+1]-1, and its interaction list is
+ *ranges[range_offsets[g]] to ranges[range_offsets[g+1]-1]. Unless
+ *owns_sources is set, src_order, psrc_a and dens_a belong to the
+ *NearFieldSources the near field was built from. The arrays come from
+ *the scratch arena, or from the heap if persistent is set.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int num_groups;
+    int* group_offsets;
+    int* range_offsets;
+    SourceRange* ranges;
+    int* src_order;
+    int* tar_order;
+    double* psrc_a;
+    double* ptar_a;
+    double* dens_a;
+    double cutoffsq;
+    int adaptive;
+    int owns_sources;
+    int persistent;
+} NearField;
+
+/*------------------------------------------------------------------------
+ *The source side of the near field: the sources binned on the uniform
+ *grid, with the boxes numbered along a Hilbert curve (rank[box_y*nside_x+
+ *box_x] is the number of a box and at[b] the row-major index of box b).
+ *It is built once and kept while the targets are processed in chunks.
+ *psrc and dens are the inputs, which must stay valid. A near field built
+ *from it is persistent if it is.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int num_sources;
+    int ndens;
+    int nside_x;
+    int nside_y;
+    double Lx;
+    double Ly;
+    int* rank;
+    int* at;
+    int* src_order;
+    int* box_offsets_src;
+    int* nsources_in_box;
+    PointSet psrc;
+    double* dens;
+    double* psrc_a;
+    double* dens_a;
+    int persistent;
+} NearFieldSources;
+
+void BuildNearFieldSources(const PointSet* psrc, double* dens, int ndens,
+        int Nsrc, int nside_x, int nside_y, double Lx, double Ly,
+        NearFieldSources* src);
+
+void FreeNearFieldSources(NearFieldSources* src);
+
+//Builds the near field of the targets ptar with the sources of src, with
+//the structure mode (NF_AUTO, NF_UNIFORM or NF_ADAPTIVE). On the uniform
+//grid the sorted sources are shared with src, while the adaptive tree
+//reorders a copy of them.
+void BuildNearFieldTargets(const NearFieldSources* src,
+        const PointSet* ptar, int Ntar, int mode, NearField* nf);
+
+//The structure NF_AUTO picks for the targets ptar and the sources of src,
+//NF_UNIFORM or NF_ADAPTIVE. Targets summed in chunks use the choice for
+//all of them, so that every chunk has the same structure.
+int ChooseNearFieldMode(const NearFieldSources* src, const PointSet* ptar,
+        int Ntar);
+
+/*------------------------------------------------------------------------
+ *Builds the near-field structure for the cutoff sqrt(Lx*Ly/nside_x/nside_y).
+ *For evenly spread points the uniform nside_x x nside_y grid is used, with
+ *the box itself and its eight neighbours in the interaction list. When the
+ *points are clustered, so that the grid would give far more candidate
+ *pairs than for evenly spread points, each box is refined as a quadtree
+ *with at most NF_LEAF_CAPACITY points per leaf, and the interaction lists
+ *only hold the tree nodes that are within the cutoff of the leaf. Either
+ *way only the pairs within the cutoff are summed.
+ *
+ *A near field kept between calls, as by a plan, is built persistent, so
+ *that it is allocated on the heap and does not hold on to the scratch
+ *arena (see scratch_arena.h). If an allocation fails, the partly built
+ *near field is freed and std::bad_alloc is thrown.
+ *------------------------------------------------------------------------
+ */
+void BuildNearField(double* psrc, double* ptar, double* dens, int ndens,
+        int Nsrc, int Ntar, int nside_x, int nside_y, double Lx, double Ly,
+        int persistent, NearField* nf);
+
+void FreeNearField(NearField* nf);
+
+//The memory in bytes held by a near field of Nsrc sources with ndens
+//density values each and Ntar targets. Sources shared with a
+//NearFieldSources are not counted.
+double NearFieldMemory(const NearField* nf, int Nsrc, int Ntar, int ndens);
+
+double NearFieldSourcesMemory(const NearFieldSources* src);
+
+/*------------------------------------------------------------------------
+ *Box of the uniform nside_x x nside_y grid holding the point (x,y), as in
+ *AssignPoints(). The number is row-major, not along the Hilbert curve.
+ *------------------------------------------------------------------------
+ */
+static inline int BoxOf(double x, double y, double Lx, double Ly,
+        int nside_x, int nside_y){
+
+    int box_x = static_cast<int>(nside_x*(x/Lx+0.5));
+    int box_y = static_cast<int>(nside_y*(y/Ly+0.5));
+    box_x = box_x < 0 ? 0 : (box_x >= nside_x ? nside_x-1 : box_x);
+    box_y = box_y < 0 ? 0 : (box_y >= nside_y ? nside_y-1 : box_y);
+    return box_y*nside_x + box_x;
+}
+
+/*------------------------------------------------------------------------
+ *Moves the points of a near field made by BuildNearField() to psrc and
+ *ptar (in input order). On the uniform grid the groups and interaction
+ *lists only depend on the boxes of the points, so if every point stays in
+ *its box the sorted coordinates are replaced and 1 is returned. Otherwise,
+ *and always for the adaptive tree, nothing is changed and 0 is returned,
+ *and the near field must be built anew.
+ *------------------------------------------------------------------------
+ */
+int MoveNearField(NearField* nf, const double* psrc, const double* ptar,
+        int Nsrc, int Ntar, int nside_x, int nside_y, double Lx, double Ly);
+
+#endif
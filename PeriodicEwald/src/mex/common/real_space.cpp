@@ -0,0 +1,2025 @@
+#include "real_space.h"
+#include "ewald_tools.h"
+#include "near_field.h"
+#include "scratch_arena.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <stdlib.h>
+#ifndef MATLAB_MEX_FILE
+#include <stdexcept>
+#endif
+
+//In a mex file the arrays of an operator come from mxMalloc, so that a
+//Matlab struct can take them over, and errors go to Matlab. Elsewhere they
+//come from malloc and errors are thrown.
+#ifdef MATLAB_MEX_FILE
+#define OperatorMalloc mxMalloc
+#define OperatorCalloc mxCalloc
+#define OperatorFree mxFree
+
+static void ReportError(const char* msg){
+    mexErrMsgTxt(msg);
+}
+#else
+#define OperatorMalloc malloc
+#define OperatorCalloc calloc
+#define OperatorFree free
+
+static void ReportError(const char* msg){
+    throw std::invalid_argument(msg);
+}
+#endif
+
+//Pairs with r^2 below this fraction of the cutoff squared are evaluated in
+//double also in mixed precision.
+#define RS_MIXED_NEAR 1e-6
+
+//Sources per batch in the vectorised stresslet velocity loops.
+#define RS_SIMD_BATCH 64
+
+//On x86-64 Linux the vectorised loops are compiled for AVX-512, AVX2 and
+//the baseline instruction set, and the best one is picked at load time.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define RS_SIMD_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define RS_SIMD_CLONES
+#endif
+
+static const char* quantity_names[RS_NUM_QUANTITIES] = {
+    "velocity", "pressure", "gradient", "stress", "vorticity", "pressure_grad"
+};
+
+static const int quantity_components[RS_NUM_QUANTITIES] = {2, 1, 4, 4, 1, 2};
+
+//Normalisation of each quantity, applied when the result is written out.
+static const double slp_scaling[RS_NUM_QUANTITIES] = {
+    1/(4*pi), 1/(2*pi), 1/(4*pi), 1/(4*pi), 1/(2*pi), 1/(2*pi)
+};
+static const double dlp_scaling[RS_NUM_QUANTITIES] = {
+    1/(4*pi), 1/(2*pi), 1/(4*pi), 1, 1/pi, 1/(2*pi)
+};
+
+//Various series expansion coefficients for the computation of E1. The
+//numerator and denominator coefficients are interleaved.
+static const double PQ0[8] = {
+    -17.70313744792479226930481672752649,-2.03222164752550948918496942496859,
+    -9.56230625623594754358691716333851,24.24775264986217493401454703416675,
+    -0.99999982131078080094255255971802,34.82867640350680460414878325536847,
+    -0.00000000083503088648841284312372,11.56228921223568129050818242831156
+};
+
+static const double PQ1[22] = {
+    -1185.45720315201027667L,-0.776491285282330997549L,
+    -14751.4895786128450662L,1229.20784182403048905L,
+    -54844.4587226402067411L,18455.4124737722049515L,
+    -86273.1567711649528784L,86722.3403467334749201L,
+    -66598.2652345418633509L,180329.498380501819718L,
+    -27182.6254466733970467L,192104.047790227984431L,
+    -6046.8250112711035463L,113057.05869159631492L,
+    -724.581482791462469795L,38129.5594484818471461L,
+    -43.3058660811817946037L,7417.37624454689546708L,
+    -0.999999999999998811143L,809.193214954550328455L,
+    -0.121013190657725568138e-18L,45.3058660811801465927L
+};
+static const double Y = 0.66373538970947265625L;
+
+static const double PQ2[12] = {
+    -0.000111507792921197858394L,-0.528611029520217142048e-6L,
+    -0.00399167106081113256961L,0.000131049900798434683324L,
+    -0.0368031736257943745142L,0.00427347600017103698101L,
+    -0.245088216639761496153L,0.056770677104207528384L,
+    0.0320913665303559189999L,0.37091387659397013215L,
+    0.0865197248079397976498L,1L,
+};
+
+/*------------------------------------------------------------------------
+ *The exponential integral E1(x) by Padé approximants. e = exp(-x) is
+ *passed in since the kernels need it anyway. Real is the precision of the
+ *pair evaluation, see ChoosePrecision().
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+static inline Real ExpInt(Real x, Real e){
+
+    if(x >= 16) {
+        //Far field: 8-term Padé-approximant in 1/x
+        Real recip = 1/x;
+        Real p = PQ0[0], q = PQ0[1];
+        for(int k = 2;k<8;k+=2) {
+            p = recip*p + Real(PQ0[k]);
+            q = recip*q + Real(PQ0[k+1]);
+        }
+        return e*(recip+p/(q + x));
+    }else if(x > 1) {
+        //Mid field: 22-term Padé-approximant in 1/x
+        Real recip = 1/x;
+        Real p = PQ1[0], q = PQ1[1];
+        for(int k = 2;k<22;k+=2) {
+            p = recip*p + Real(PQ1[k]);
+            q = recip*q + Real(PQ1[k+1]);
+        }
+        return e*(recip+p/(q + x));
+    }else{
+        //Near field: 12-term Padé-approximant in x
+        Real p = PQ2[0], q = PQ2[1];
+        for(int k = 2;k<12;k+=2) {
+            p = x*p + Real(PQ2[k]);
+            q = x*q + Real(PQ2[k+1]);
+        }
+        return p/q + x - std::log(x) - Real(Y);
+    }
+}
+
+int ChoosePrecision(double tol, int kernel, int q){
+    if(kernel != DLP_KERNEL || q != RS_VELOCITY)
+        return RS_DOUBLE;
+    return (tol >= RS_MIXED_PRECISION_TOL) ? RS_MIXED : RS_DOUBLE;
+}
+
+int QuantityComponents(int q){
+    return quantity_components[q];
+}
+
+int QuantityIndex(const char* name){
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+        if(strcmp(name, quantity_names[q]) == 0)
+            return q;
+    return -1;
+}
+
+/*------------------------------------------------------------------------
+ *Contribution of one source to one target for the Stokeslet. (r1,r2) is
+ *the target minus the source, fk the density at the source and acc the
+ *accumulators of the target, with quantity q starting at offset[q]. The
+ *pair is evaluated in precision Real and added to the double accumulators.
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+static inline void SLPPair(Real r1, Real r2, Real rSq, const double* fk, Real xi2,
+        const int* offset, double* acc){
+
+    Real f1 = fk[0];
+    Real f2 = fk[1];
+
+    //Terms shared by all quantities.
+    Real e2 = std::exp(-xi2*rSq);
+    Real irSq = 1/rSq;
+    Real rdotf = r1*f1 + r2*f2;
+
+    if(offset[RS_VELOCITY] >= 0) {
+        double* u = acc + offset[RS_VELOCITY];
+        Real a = Real(0.5)*ExpInt(xi2*rSq, e2) - e2;
+        Real b = e2*rdotf*irSq;
+        u[0] += a*f1 + b*r1;
+        u[1] += a*f2 + b*r2;
+    }
+
+    if(offset[RS_PRESSURE] >= 0)
+        acc[offset[RS_PRESSURE]] += rdotf*e2*irSq;
+
+    if(offset[RS_GRADIENT] >= 0) {
+        double* T = acc + offset[RS_GRADIENT];
+        Real c = 2*rdotf*(xi2 + irSq)*irSq;
+        T[0] += e2*(2*xi2*r1*f1 + rdotf*irSq - r1*r1*c);
+        T[1] += e2*(2*xi2*r1*f2 + (-r1*f2 + r2*f1)*irSq - r1*r2*c);
+        T[2] += e2*(2*xi2*r2*f1 + (r1*f2 - r2*f1)*irSq - r1*r2*c);
+        T[3] += e2*(2*xi2*r2*f2 + rdotf*irSq - r2*r2*c);
+    }
+
+    if(offset[RS_STRESS] >= 0) {
+        double* T = acc + offset[RS_STRESS];
+        Real d = 4*rdotf*irSq*irSq*(1+xi2*rSq);
+        Real offdiag = e2*(2*xi2*(r2*f1+r1*f2) - r1*r2*d);
+        T[0] += e2*(2*xi2*(rdotf+2*r1*f1) - r1*r1*d);
+        T[1] += offdiag;
+        T[2] += offdiag;
+        T[3] += e2*(2*xi2*(rdotf+2*r2*f2) - r2*r2*d);
+    }
+
+    if(offset[RS_VORTICITY] >= 0)
+        acc[offset[RS_VORTICITY]] += e2*(irSq-xi2)*(f1*r2 - f2*r1);
+
+    if(offset[RS_PRESSURE_GRAD] >= 0) {
+        double* pg = acc + offset[RS_PRESSURE_GRAD];
+        pg[0] -= e2*((f1 - 2*xi2*rdotf*r1)*irSq - 2*rdotf*r1*irSq*irSq);
+        pg[1] -= e2*((f2 - 2*xi2*rdotf*r2)*irSq - 2*rdotf*r2*irSq*irSq);
+    }
+}
+
+/*------------------------------------------------------------------------
+ *Contribution of one source to one target for the stresslet. dk holds
+ *(f1,f2,n1,n2) at the source, otherwise as SLPPair.
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+static inline void DLPPair(Real r1, Real r2, Real rSq, const double* dk, Real xi2,
+        const int* offset, double* acc){
+
+    Real f1 = dk[0];
+    Real f2 = dk[1];
+    Real n1 = dk[2];
+    Real n2 = dk[3];
+
+    //Terms shared by all quantities.
+    Real e2 = std::exp(-xi2*rSq);
+    Real irSq = 1/rSq;
+    Real rdotf = r1*f1 + r2*f2;
+    Real rdotn = r1*n1 + r2*n2;
+    Real fdotn = f1*n1 + f2*n2;
+    Real rfrn = rdotf*rdotn;
+
+    if(offset[RS_VELOCITY] >= 0) {
+        double* u = acc + offset[RS_VELOCITY];
+        Real prefac = 2*xi2;
+        Real facb = -4*(1+xi2*rSq)*irSq*irSq;
+
+        //The symmetric part of f x n is all that contributes.
+        Real S11 = f1*n1;
+        Real S12 = f1*n2 + f2*n1;
+        Real S22 = f2*n2;
+
+        Real T111 = r1*r1*r1*facb + prefac*3*r1;
+        Real T112 = r1*r1*r2*facb + prefac*r2;
+        Real T122 = r1*r2*r2*facb + prefac*r1;
+        Real T222 = r2*r2*r2*facb + prefac*3*r2;
+
+        u[0] += e2*(T111*S11 + T112*S12 + T122*S22);
+        u[1] += e2*(T112*S11 + T122*S12 + T222*S22);
+    }
+
+    if(offset[RS_PRESSURE] >= 0)
+        acc[offset[RS_PRESSURE]] -= e2*((fdotn - 2*xi2*rfrn)*irSq
+                - 2*rfrn*irSq*irSq);
+
+    if(offset[RS_GRADIENT] >= 0 || offset[RS_STRESS] >= 0) {
+        Real A = rfrn*(8*xi2*xi2*irSq + 16*xi2*irSq*irSq
+                + 16*irSq*irSq*irSq);
+        Real B = (1+xi2*rSq)*irSq*irSq;
+
+        if(offset[RS_GRADIENT] >= 0) {
+            double* T = acc + offset[RS_GRADIENT];
+            T[0] += e2*(r1*r1*A - 4*B*(rfrn + r1*f1*rdotn + r1*n1*rdotf)
+                    +2*xi2*(2*f1*n1+fdotn-2*xi2*r1*(f1*rdotn+n1*rdotf+r1*fdotn)));
+            T[1] += e2*(r1*r2*A - 4*B*(r2*f1*rdotn + r2*n1*rdotf)
+                    +2*xi2*(f1*n2+n1*f2-2*xi2*r1*(f2*rdotn+n2*rdotf+r2*fdotn)));
+            T[2] += e2*(r1*r2*A - 4*B*(r1*f2*rdotn + r1*n2*rdotf)
+                    +2*xi2*(f2*n1+f1*n2-2*xi2*r2*(f1*rdotn+n1*rdotf+r1*fdotn)));
+            T[3] += e2*(r2*r2*A - 4*B*(rfrn + r2*f2*rdotn + r2*n2*rdotf)
+                    +2*xi2*(2*f2*n2+fdotn-2*xi2*r2*(f2*rdotn+n2*rdotf+r2*fdotn)));
+        }
+
+        if(offset[RS_STRESS] >= 0) {
+            double* T = acc + offset[RS_STRESS];
+            Real mu = 1;
+            Real p = ((fdotn-2*xi2*rfrn)*irSq - 2*rfrn*irSq*irSq)/(2*Real(pi));
+            Real c = 2*mu/(4*Real(pi));
+            Real offdiag = c*e2*(r1*r2*A
+                    -2*B*(f1*r2*rdotn+n1*r2*rdotf+r1*f2*rdotn+r1*n2*rdotf)
+                    +2*xi2*(n1*f2+f1*n2-xi2*(2*r1*r2*fdotn+r1*f2*rdotn
+                    +r1*n2*rdotf+f1*r2*rdotn+n1*r2*rdotf)));
+
+            T[0] += e2*(p + c*(r1*r1*A
+                    -4*B*(f1*r1*rdotn+n1*r1*rdotf+rfrn)
+                    +2*xi2*(fdotn+2*n1*f1-2*xi2*(r1*r1*fdotn+r1*f1*rdotn+r1*n1*rdotf))));
+            T[1] += offdiag;
+            T[2] += offdiag;
+            T[3] += e2*(p + c*(r2*r2*A
+                    -4*B*(f2*r2*rdotn+n2*r2*rdotf+rfrn)
+                    +2*xi2*(fdotn+2*n2*f2-2*xi2*(r2*r2*fdotn+r2*f2*rdotn+r2*n2*rdotf))));
+        }
+    }
+
+    //The vorticity kernel is too singular to be evaluated close to the
+    //source, points this close are treated as coinciding.
+    if(offset[RS_VORTICITY] >= 0 && rSq >= 1e-13) {
+        Real rdot = r1*(n2*rdotf+f2*rdotn) - r2*(n1*rdotf+f1*rdotn);
+        Real ndot = n1*(r2*rdotf) - n2*(r1*rdotf);
+        Real fdot = f1*(r2*rdotn) - f2*(r1*rdotn);
+        acc[offset[RS_VORTICITY]] += e2*((1+xi2*rSq)*rdot*irSq*irSq
+                + xi2*xi2*(ndot+fdot));
+    }
+
+    if(offset[RS_PRESSURE_GRAD] >= 0) {
+        double* pg = acc + offset[RS_PRESSURE_GRAD];
+        pg[0] += e2*(2*xi2*(r1*fdotn+f1*rdotn+n1*rdotf-2*xi2*r1*rfrn)*irSq
+                +2*(r1*fdotn+f1*rdotn+n1*rdotf-4*xi2*r1*rfrn)*irSq*irSq
+                -8*r1*rfrn*irSq*irSq*irSq);
+        pg[1] += e2*(2*xi2*(r2*fdotn+f2*rdotn+n2*rdotf-2*xi2*r2*rfrn)*irSq
+                +2*(r2*fdotn+f2*rdotn+n2*rdotf-4*xi2*r2*rfrn)*irSq*irSq
+                -8*r2*rfrn*irSq*irSq*irSq);
+    }
+}
+
+/*------------------------------------------------------------------------
+ *A work item of the real-space loop: the sorted targets first..last-1 of
+ *a target group, with the estimated number of pairs they take part in.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int group;
+    int first;
+    int last;
+    double cost;
+} WorkItem;
+
+//Compares the costs to within a factor of two, so that a stable sort keeps
+//items of similar cost in group order.
+static bool CostlierThan(const WorkItem& a, const WorkItem& b){
+    int ea, eb;
+    frexp(a.cost, &ea);
+    frexp(b.cost, &eb);
+    return ea > eb;
+}
+
+/*------------------------------------------------------------------------
+ *Splits the loop over the target groups into work items sorted by
+ *decreasing estimated cost, rounded to powers of two. The cost of a group
+ *grows quadratically with the number of points around it, so for
+ *clustered points a few groups dominate. Groups costing more than a
+ *fraction of the average work per thread are split into target chunks so
+ *that no single item can hold back the whole loop. Returns the number of
+ *items. The items are taken from the scratch arena with ScratchArray and
+ *are freed by the caller with FreeWorkList(), which calls ScratchFree.
+ *------------------------------------------------------------------------
+ */
+static int BuildWorkList(const NearField* nf, WorkItem** items,
+        double* total_cost){
+
+    ScratchBuffer<double> group_cost(nf->num_groups+1);
+
+    *total_cost = 0;
+    for(int g = 0;g<nf->num_groups;g++) {
+        int nsrc = 0;
+        for(int r = nf->range_offsets[g];r<nf->range_offsets[g+1];r++)
+            nsrc += nf->ranges[r].last - nf->ranges[r].first;
+        int ntar = nf->group_offsets[g+1] - nf->group_offsets[g];
+        group_cost[g] = static_cast<double>(ntar)*nsrc;
+        *total_cost += group_cost[g];
+    }
+
+    //Items are kept below an eighth of the average work per thread. The
+    //lower bound stops the overhead of the dynamic schedule from mattering
+    //for small problems.
+    double max_cost = *total_cost/(8*omp_get_max_threads());
+    if(max_cost < 4096)
+        max_cost = 4096;
+
+    int nitems = 0;
+    for(int g = 0;g<nf->num_groups;g++) {
+        int ntar = nf->group_offsets[g+1] - nf->group_offsets[g];
+        int nchunks = static_cast<int>(ceil(group_cost[g]/max_cost));
+        if(nchunks < 1)
+            nchunks = 1;
+        if(nchunks > ntar)
+            nchunks = ntar;
+        nitems += nchunks;
+    }
+
+    *items = ScratchArray<WorkItem>(nitems > 0 ? nitems : 1);
+
+    int w = 0;
+    for(int g = 0;g<nf->num_groups;g++) {
+        int ntar = nf->group_offsets[g+1] - nf->group_offsets[g];
+        int nchunks = static_cast<int>(ceil(group_cost[g]/max_cost));
+        if(nchunks < 1)
+            nchunks = 1;
+        if(nchunks > ntar)
+            nchunks = ntar;
+
+        for(int c = 0;c<nchunks;c++,w++) {
+            (*items)[w].group = g;
+            (*items)[w].first = nf->group_offsets[g] + (c*ntar)/nchunks;
+            (*items)[w].last = nf->group_offsets[g] + ((c+1)*ntar)/nchunks;
+            (*items)[w].cost = group_cost[g]*((*items)[w].last-(*items)[w].first)/ntar;
+        }
+    }
+
+    //Largest first, so that the dynamic schedule ends with small items.
+    //Within a cost class the groups stay in the order of the box numbering,
+    //so consecutive items mostly share sources.
+    std::stable_sort(*items, *items + nitems, CostlierThan);
+
+    return nitems;
+}
+
+static void FreeWorkList(WorkItem* items){
+    ScratchFree(items);
+}
+
+/*------------------------------------------------------------------------
+ *Kernel traits of the real-space engine: the number of density values per
+ *source, the pair function, the term for coinciding points (if has_self)
+ *and the unit densities for assembling an operator.
+ *------------------------------------------------------------------------
+ */
+struct SLPKernel {
+    enum { ndens = 2, has_self = 1 };
+
+    template <typename Real>
+    static inline void Pair(Real r1, Real r2, Real rSq, const double* dk,
+            Real xi2, const int* offset, double* acc){
+        SLPPair<Real>(r1, r2, rSq, dk, xi2, offset, acc);
+    }
+
+    static inline void Self(double self, const double* dk, const int* offset,
+            double* acc){
+        if(offset[RS_VELOCITY] >= 0) {
+            acc[offset[RS_VELOCITY]] += self*dk[0];
+            acc[offset[RS_VELOCITY]+1] += self*dk[1];
+        }
+    }
+
+    //Density of unit component c, for the columns of an operator.
+    static inline void UnitDensity(int c, const double* n, int k, double* dk){
+        dk[0] = (c == 0);
+        dk[1] = (c == 1);
+    }
+};
+
+struct DLPKernel {
+    enum { ndens = 4, has_self = 0 };
+
+    template <typename Real>
+    static inline void Pair(Real r1, Real r2, Real rSq, const double* dk,
+            Real xi2, const int* offset, double* acc){
+        DLPPair<Real>(r1, r2, rSq, dk, xi2, offset, acc);
+    }
+
+    static inline void Self(double self, const double* dk, const int* offset,
+            double* acc){
+    }
+
+    static inline void UnitDensity(int c, const double* n, int k, double* dk){
+        dk[0] = (c == 0);
+        dk[1] = (c == 1);
+        dk[2] = n[2*k];
+        dk[3] = n[2*k+1];
+    }
+};
+
+/*------------------------------------------------------------------------
+ *The velocity of alpha*SLP(f) + beta*DLP(g,n), for the combined sums of
+ *second-kind integral equations. dk holds (alpha*f1, alpha*f2) and the
+ *symmetric part (S11, S12, S22) of beta*g x n, so one pass over the pairs
+ *and one exponential per pair give both potentials. The two velocity
+ *scalings are equal, so they are applied together at the end.
+ *------------------------------------------------------------------------
+ */
+struct CombinedKernel {
+    enum { ndens = 5, has_self = 1 };
+
+    template <typename Real>
+    static inline void Pair(Real r1, Real r2, Real rSq, const double* dk,
+            Real xi2, const int* offset, double* acc){
+
+        Real f1 = dk[0];
+        Real f2 = dk[1];
+        Real S11 = dk[2];
+        Real S12 = dk[3];
+        Real S22 = dk[4];
+
+        Real e2 = std::exp(-xi2*rSq);
+        Real irSq = 1/rSq;
+
+        //The Stokeslet, as in SLPPair.
+        Real a = Real(0.5)*ExpInt(xi2*rSq, e2) - e2;
+        Real b = e2*(r1*f1 + r2*f2)*irSq;
+
+        //The stresslet, as in DLPPair.
+        Real prefac = 2*xi2;
+        Real facb = -4*(1+xi2*rSq)*irSq*irSq;
+        Real T111 = r1*r1*r1*facb + prefac*3*r1;
+        Real T112 = r1*r1*r2*facb + prefac*r2;
+        Real T122 = r1*r2*r2*facb + prefac*r1;
+        Real T222 = r2*r2*r2*facb + prefac*3*r2;
+
+        double* u = acc + offset[RS_VELOCITY];
+        u[0] += a*f1 + b*r1 + e2*(T111*S11 + T112*S12 + T122*S22);
+        u[1] += a*f2 + b*r2 + e2*(T112*S11 + T122*S12 + T222*S22);
+    }
+
+    //The stresslet has no self-interaction.
+    static inline void Self(double self, const double* dk, const int* offset,
+            double* acc){
+        acc[offset[RS_VELOCITY]] += self*dk[0];
+        acc[offset[RS_VELOCITY]+1] += self*dk[1];
+    }
+};
+
+//Number of components of quantity q, usable at compile time.
+static inline int FixedComponents(int q){
+    return (q == RS_GRADIENT || q == RS_STRESS) ? 4 :
+            (q == RS_PRESSURE || q == RS_VORTICITY) ? 1 : 2;
+}
+
+//Adds the pair (r1,r2) within the cutoff with the source density dk to
+//acc_j. Coinciding points get the self term, and pairs closer than
+//sqrt(near_sq) are evaluated in double, the others in precision Real.
+template <class Kernel, typename Real>
+static inline void AddPair(double r1, double r2, double rSq,
+        const double* dk, double xi2, Real xi2_r, double self,
+        double near_sq, const int* offset, double* acc_j){
+
+    if(rSq < 1e-15) {
+        Kernel::Self(self, dk, offset, acc_j);
+        return;
+    }
+
+    //Nearly coinciding points would overflow in single precision.
+    if(rSq < near_sq)
+        Kernel::template Pair<double>(r1, r2, rSq, dk, xi2, offset, acc_j);
+    else
+        Kernel::template Pair<Real>(r1, r2, rSq, dk, xi2_r, offset, acc_j);
+}
+
+/*------------------------------------------------------------------------
+ *Adds the contributions of the sources in range to the sorted targets
+ *first..last-1. The differences r and the cutoff test are always in
+ *double, so that no accuracy is lost for nearby points far from the
+ *origin, while the kernels are evaluated in precision Real. Pairs closer
+ *than sqrt(near_sq) are always evaluated in double.
+ *
+ *Q is the only quantity evaluated, in which case the layout of the
+ *accumulators is known at compile time and the tests on the offsets in
+ *the pair functions fold away. For Q = RS_NUM_QUANTITIES the layout is
+ *given by offset and ncomp at run time, as for the fused sums. Returns
+ *the number of pairs within the cutoff.
+ *------------------------------------------------------------------------
+ */
+template <class Kernel, int Q, typename Real>
+static long long RangeSum(const SourceRange* range, int first, int last,
+        const double* ptar_a, const double* psrc_a, const double* dens_a,
+        double xi2, double self, double cutoffsq, double near_sq,
+        const int* offset_rt, int ncomp_rt, double* acc){
+
+    int offset[RS_NUM_QUANTITIES];
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+        offset[q] = (Q == RS_NUM_QUANTITIES) ? offset_rt[q] : (q == Q ? 0 : -1);
+    const int ncomp = (Q == RS_NUM_QUANTITIES) ? ncomp_rt : FixedComponents(Q);
+
+    Real xi2_r = static_cast<Real>(xi2);
+    long long accepted = 0;
+
+    for(int j=first;j<last;j++) {
+        double* acc_j = acc + ncomp*j;
+        double xt = ptar_a[2*j] - range->shift_x;
+        double yt = ptar_a[2*j+1] - range->shift_y;
+
+        for(int k=range->first;k<range->last;k++) {
+            double r1 = xt - psrc_a[2*k];
+            double r2 = yt - psrc_a[2*k+1];
+            double rSq = r1*r1+r2*r2;
+            const double* dk = dens_a + Kernel::ndens*k;
+
+            //Check if the points are within the cutoff. FF
+            if(range->check_cutoff && rSq >= cutoffsq)
+                continue;
+            accepted++;
+
+            AddPair<Kernel, Real>(r1, r2, rSq, dk, xi2, xi2_r, self, near_sq,
+                    offset, acc_j);
+        }
+    }
+    return accepted;
+}
+
+//The first entry of the exclusion list that leaves out source s for
+//target t, both in input order, or -1 if none does.
+static inline int ExclusionEntry(const ExclusionList* excl, int t, int s){
+    for(int e = excl->offsets[t];e<excl->offsets[t+1];e++)
+        if(s >= excl->ranges[2*e] && s < excl->ranges[2*e+1])
+            return e;
+    return -1;
+}
+
+/*------------------------------------------------------------------------
+ *RangeSum for the single sorted target j, which is target t of the input,
+ *leaving out the sources the exclusion list excludes for it. src_order
+ *maps the sorted sources to the input. The layout of the accumulators is
+ *given at run time, and the excluded pairs are neither evaluated nor
+ *counted.
+ *------------------------------------------------------------------------
+ */
+template <class Kernel, typename Real>
+static long long ExcludingRangeSum(const SourceRange* range, int j, int t,
+        const ExclusionList* excl, const int* src_order,
+        const double* ptar_a, const double* psrc_a, const double* dens_a,
+        double xi2, double self, double cutoffsq, double near_sq,
+        const int* offset, int ncomp, double* acc){
+
+    Real xi2_r = static_cast<Real>(xi2);
+    double* acc_j = acc + ncomp*j;
+    double xt = ptar_a[2*j] - range->shift_x;
+    double yt = ptar_a[2*j+1] - range->shift_y;
+    long long accepted = 0;
+
+    for(int k=range->first;k<range->last;k++) {
+        double r1 = xt - psrc_a[2*k];
+        double r2 = yt - psrc_a[2*k+1];
+        double rSq = r1*r1+r2*r2;
+
+        if((range->check_cutoff && rSq >= cutoffsq) ||
+                ExclusionEntry(excl, t, src_order[k]) >= 0)
+            continue;
+        accepted++;
+
+        AddPair<Kernel, Real>(r1, r2, rSq, dens_a + Kernel::ndens*k, xi2,
+                xi2_r, self, near_sq, offset, acc_j);
+    }
+    return accepted;
+}
+
+/*------------------------------------------------------------------------
+ *exp(x) for -708 <= x <= 0 without branches, so that it vectorises. x is
+ *split as k*log(2) + r with |r| <= log(2)/2, exp(r) is a degree 13 Taylor
+ *polynomial (truncation error below 1e-17) and 2^k is put together in the
+ *exponent bits.
+ *------------------------------------------------------------------------
+ */
+static inline double ExpNeg(double x){
+
+    const double log2e = 1.4426950408889634074;
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+    const double shifter = 6755399441055744.0; //1.5*2^52
+
+    //t holds k = round(x/log(2)) in its low mantissa bits.
+    double t = x*log2e + shifter;
+    double k = t - shifter;
+    double r = (x - k*ln2_hi) - k*ln2_lo;
+
+    double p = 1.0/6227020800;
+    p = p*r + 1.0/479001600;
+    p = p*r + 1.0/39916800;
+    p = p*r + 1.0/3628800;
+    p = p*r + 1.0/362880;
+    p = p*r + 1.0/40320;
+    p = p*r + 1.0/5040;
+    p = p*r + 1.0/720;
+    p = p*r + 1.0/120;
+    p = p*r + 1.0/24;
+    p = p*r + 1.0/6;
+    p = p*r + 0.5;
+    p = p*r + 1;
+    p = p*r + 1;
+
+    uint64_t bits;
+    memcpy(&bits, &t, sizeof(double));
+    bits = (bits + 1023) << 52;
+    double scale;
+    memcpy(&scale, &bits, sizeof(double));
+
+    return p*scale;
+}
+
+//ExpNeg in single precision, for -87 <= x <= 0, with a degree 7
+//polynomial (truncation error below 1e-8).
+static inline float ExpNeg(float x){
+
+    const float log2e = 1.44269504f;
+    const float ln2_hi = 0.693145752f;
+    const float ln2_lo = 1.42860677e-6f;
+    const float shifter = 12582912.0f; //1.5*2^23
+
+    float t = x*log2e + shifter;
+    float k = t - shifter;
+    float r = (x - k*ln2_hi) - k*ln2_lo;
+
+    float p = 1.0f/5040;
+    p = p*r + 1.0f/720;
+    p = p*r + 1.0f/120;
+    p = p*r + 1.0f/24;
+    p = p*r + 1.0f/6;
+    p = p*r + 0.5f;
+    p = p*r + 1;
+    p = p*r + 1;
+
+    uint32_t bits;
+    memcpy(&bits, &t, sizeof(float));
+    bits = (bits + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(float));
+
+    return p*scale;
+}
+
+//The unsigned integer with the bits of Real.
+template <typename Real> struct Bits;
+template <> struct Bits<double> { typedef uint64_t Type; };
+template <> struct Bits<float> { typedef uint32_t Type; };
+
+//1 if x is negative and 0 otherwise. Comparisons of floating point
+//numbers are not if-converted under -ftrapping-math, so the sign bit is
+//used.
+template <typename Real>
+static inline typename Bits<Real>::Type Negative(Real x){
+    typename Bits<Real>::Type bits;
+    memcpy(&bits, &x, sizeof(Real));
+    return bits >> (8*sizeof(Real)-1);
+}
+
+//1 if keep is 1 and 0 if it is 0, put together in the bits.
+template <typename Real>
+static inline Real Mask(typename Bits<Real>::Type keep){
+    Real one = 1, mask;
+    typename Bits<Real>::Type bits;
+    memcpy(&bits, &one, sizeof(Real));
+    bits &= 0 - keep;
+    memcpy(&mask, &bits, sizeof(Real));
+    return mask;
+}
+
+//The largest number of precision Real that is not above x.
+template <typename Real>
+static inline Real RoundDown(double x){
+    Real y = static_cast<Real>(x);
+    return (y > x) ? std::nextafter(y, Real(0)) : y;
+}
+
+/*------------------------------------------------------------------------
+ *Stresslet velocity at the target (xt,yt) from a batch of n sources, held
+ *as structure of arrays with the symmetric part of f x n in s11, s12 and
+ *s22. As in RangeSum, the differences and the cutoff test are in double
+ *and the kernel is evaluated in precision Real. Each pair needs a single
+ *reciprocal, and the tests are masks rather than branches:
+ *
+ *  - pairs within the cutoff, rSq < csq, are counted, coinciding ones
+ *    included, as RangeSum counts them,
+ *  - pairs with near_sq <= rSq < esq are evaluated, where esq <= csq is
+ *    also below the range of ExpNeg, beyond which the exponential is
+ *    below the smallest normal number and the pair adds nothing,
+ *  - pairs with rSq < near_sq, not coinciding, are counted in near, to
+ *    be evaluated in double by the caller.
+ *
+ *The last two tests are on rSq in precision Real, so that the loop runs
+ *as many lanes as it can, and esq is rounded down so that every pair
+ *evaluated is within the cutoff. The unscaled result is added to u, and
+ *the number of pairs within the cutoff is returned.
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+RS_SIMD_CLONES
+static int DLPVelocityBatch(double xt, double yt, const double* x,
+        const double* y, const Real* s11, const Real* s12, const Real* s22,
+        int n, double xi2, double csq, Real esq, Real near_sq, double* u,
+        int* near){
+
+    typedef typename Bits<Real>::Type Flag;
+    double u1 = 0, u2 = 0;
+    Real xi2_r = static_cast<Real>(xi2);
+    Real prefac = 2*xi2_r;
+    uint64_t kept = 0;
+    Flag close = 0;
+
+#pragma omp simd reduction(+:u1,u2,kept,close)
+    for(int i = 0;i<n;i++) {
+        double r1 = xt - x[i];
+        double r2 = yt - y[i];
+        double rSq = r1*r1+r2*r2;
+        kept += Negative(rSq - csq);
+
+        Real p1 = static_cast<Real>(r1);
+        Real p2 = static_cast<Real>(r2);
+        Real pSq = static_cast<Real>(rSq);
+        Flag apart = Negative(Real(1e-15) - pSq);
+        Flag below = Negative(pSq - near_sq);
+        close += apart & below;
+
+        //m is 1 for the evaluated pairs and 0 otherwise.
+        Real m = Mask<Real>(Negative(pSq - esq) & apart & (1 - below));
+        pSq = pSq*m + (1-m);
+        Real irSq = 1/pSq;
+        Real e2 = m*ExpNeg(-xi2_r*pSq*m);
+        Real facb = -4*(1+xi2_r*pSq)*irSq*irSq;
+
+        Real T111 = p1*p1*p1*facb + prefac*3*p1;
+        Real T112 = p1*p1*p2*facb + prefac*p2;
+        Real T122 = p1*p2*p2*facb + prefac*p1;
+        Real T222 = p2*p2*p2*facb + prefac*3*p2;
+
+        u1 += e2*(T111*s11[i] + T112*s12[i] + T122*s22[i]);
+        u2 += e2*(T112*s11[i] + T122*s12[i] + T222*s22[i]);
+    }
+
+    u[0] += u1;
+    u[1] += u2;
+    *near = static_cast<int>(close);
+    return static_cast<int>(kept);
+}
+
+/*------------------------------------------------------------------------
+ *RangeSum for the stresslet velocity alone, the most common stresslet
+ *sum. The sources are copied in batches into structure of arrays, which
+ *is amortised over the targets of the item. In mixed precision the few
+ *pairs closer than sqrt(near_sq) are evaluated in double afterwards.
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+static long long DLPVelocityRangeSum(const SourceRange* range, int first,
+        int last, const double* ptar_a, const double* psrc_a,
+        const double* dens_a, double xi2, double cutoffsq, double near_sq,
+        double* acc){
+
+    const int offset[RS_NUM_QUANTITIES] = {0, -1, -1, -1, -1, -1};
+    double x[RS_SIMD_BATCH], y[RS_SIMD_BATCH];
+    Real s11[RS_SIMD_BATCH], s12[RS_SIMD_BATCH], s22[RS_SIMD_BATCH];
+    double csq = range->check_cutoff ? cutoffsq : DBL_MAX;
+    Real esq = RoundDown<Real>(std::min(csq,
+            -std::log(std::numeric_limits<Real>::min())/xi2));
+    Real near_r = static_cast<Real>(near_sq);
+    long long accepted = 0;
+
+    for(int k0 = range->first;k0<range->last;k0 += RS_SIMD_BATCH) {
+        int n = std::min(RS_SIMD_BATCH, range->last-k0);
+
+        for(int i = 0;i<n;i++) {
+            const double* dk = dens_a + 4*(k0+i);
+            Real f1 = dk[0], f2 = dk[1], n1 = dk[2], n2 = dk[3];
+            x[i] = psrc_a[2*(k0+i)];
+            y[i] = psrc_a[2*(k0+i)+1];
+            s11[i] = f1*n1;
+            s12[i] = f1*n2 + f2*n1;
+            s22[i] = f2*n2;
+        }
+
+        for(int j=first;j<last;j++) {
+            double xt = ptar_a[2*j] - range->shift_x;
+            double yt = ptar_a[2*j+1] - range->shift_y;
+            int near;
+            accepted += DLPVelocityBatch<Real>(xt, yt, x, y, s11, s12, s22,
+                    n, xi2, csq, esq, near_r, acc + 2*j, &near);
+            if(near == 0)
+                continue;
+
+            //The pairs the batch counted in near, by the same tests.
+            for(int i = 0;i<n;i++) {
+                double r1 = xt - x[i];
+                double r2 = yt - y[i];
+                double rSq = r1*r1+r2*r2;
+                Real pSq = static_cast<Real>(rSq);
+                if(pSq > Real(1e-15) && pSq < near_r)
+                    DLPPair<double>(r1, r2, rSq, dens_a + 4*(k0+i), xi2,
+                            offset, acc + 2*j);
+            }
+        }
+    }
+    return accepted;
+}
+
+template <>
+long long RangeSum<DLPKernel, RS_VELOCITY, double>(const SourceRange* range,
+        int first, int last, const double* ptar_a, const double* psrc_a,
+        const double* dens_a, double xi2, double self, double cutoffsq,
+        double near_sq, const int* offset_rt, int ncomp_rt, double* acc){
+    return DLPVelocityRangeSum<double>(range, first, last, ptar_a, psrc_a,
+            dens_a, xi2, cutoffsq, near_sq, acc);
+}
+
+template <>
+long long RangeSum<DLPKernel, RS_VELOCITY, float>(const SourceRange* range,
+        int first, int last, const double* ptar_a, const double* psrc_a,
+        const double* dens_a, double xi2, double self, double cutoffsq,
+        double near_sq, const int* offset_rt, int ncomp_rt, double* acc){
+    return DLPVelocityRangeSum<float>(range, first, last, ptar_a, psrc_a,
+            dens_a, xi2, cutoffsq, near_sq, acc);
+}
+
+typedef long long (*RangeSumFunction)(const SourceRange*, int, int, const double*,
+        const double*, const double*, double, double, double, double,
+        const int*, int, double*);
+
+typedef long long (*ExcludingSumFunction)(const SourceRange*, int, int,
+        const ExclusionList*, const int*, const double*, const double*,
+        const double*, double, double, double, double, const int*, int,
+        double*);
+
+//The instance of RangeSum for a kernel, the precision and the single
+//quantity q, or several quantities if q is RS_NUM_QUANTITIES.
+template <class Kernel, typename Real>
+static RangeSumFunction SelectRangeSum(int q){
+    switch(q) {
+        case RS_VELOCITY: return RangeSum<Kernel, RS_VELOCITY, Real>;
+        case RS_PRESSURE: return RangeSum<Kernel, RS_PRESSURE, Real>;
+        case RS_GRADIENT: return RangeSum<Kernel, RS_GRADIENT, Real>;
+        case RS_STRESS: return RangeSum<Kernel, RS_STRESS, Real>;
+        case RS_VORTICITY: return RangeSum<Kernel, RS_VORTICITY, Real>;
+        case RS_PRESSURE_GRAD: return RangeSum<Kernel, RS_PRESSURE_GRAD, Real>;
+        default: return RangeSum<Kernel, RS_NUM_QUANTITIES, Real>;
+    }
+}
+
+/*------------------------------------------------------------------------
+ *Contribution of the excluded pairs of target j (in input order) to acc,
+ *in double precision, from the images the near-field traversal would
+ *have visited: those of a source within the cutoff among the nine
+ *nearest. The sum itself leaves these pairs out, see ExcludingRangeSum,
+ *so this is only needed for the skipped output. A source in several
+ *entries of the target is counted once, as it is left out once.
+ *------------------------------------------------------------------------
+ */
+template <class Kernel>
+static void ExcludedPairs(const ExclusionList* excl, int j,
+        const PointSet* psrc, const PointSet* ptar, const double* dens,
+        double xi2, double self, double cutoffsq, double Lx, double Ly,
+        const int* offset, double* acc){
+
+    double xt = ptar->x[ptar->stride*j];
+    double yt = ptar->y[ptar->stride*j];
+    for(int e = excl->offsets[j];e<excl->offsets[j+1];e++) {
+        for(int k = excl->ranges[2*e];k<excl->ranges[2*e+1];k++) {
+            if(ExclusionEntry(excl, j, k) != e)
+                continue;
+
+            const double* dk = dens + Kernel::ndens*k;
+            double xs = psrc->x[psrc->stride*k];
+            double ys = psrc->y[psrc->stride*k];
+
+            for(int ix = -1;ix<=1;ix++) {
+                for(int iy = -1;iy<=1;iy++) {
+                    double r1 = xt - xs + ix*Lx;
+                    double r2 = yt - ys + iy*Ly;
+                    double rSq = r1*r1+r2*r2;
+
+                    if(rSq >= cutoffsq)
+                        continue;
+
+                    if(rSq < 1e-15)
+                        Kernel::Self(self, dk, offset, acc);
+                    else
+                        Kernel::template Pair<double>(r1, r2, rSq, dk, xi2,
+                                offset, acc);
+                }
+            }
+        }
+    }
+}
+
+/*------------------------------------------------------------------------
+ *Number of targets per chunk so that the working memory of a real-space
+ *sum stays below max_memory (no limit if it is 0 or less). The estimate
+ *covers the arrays that grow with the number of points or boxes: the
+ *resident sources (and the copy the adaptive tree makes of them), the
+ *boxes, and per target its coordinates, order, accumulators (twice if
+ *skip, for the skipped pairs) and work items. The interaction lists of
+ *the adaptive tree are not included. A chunk has at least
+ *RS_MIN_TARGET_CHUNK targets.
+ *------------------------------------------------------------------------
+ */
+static int TargetChunkSize(int Nsrc, int ndens, int Ntar, int ncomp,
+        int skip, int num_boxes, double max_memory){
+
+    if(max_memory <= 0)
+        return Ntar;
+
+    double per_source = sizeof(int) + (2+ndens)*sizeof(double);
+    double fixed = 2*per_source*Nsrc
+            + static_cast<double>(num_boxes)*(6*sizeof(int)
+                    + omp_get_max_threads()*sizeof(int)
+                    + 9*sizeof(SourceRange) + sizeof(WorkItem)
+                    + sizeof(double));
+    double per_target = 2*sizeof(double) + 4*sizeof(int)
+            + (skip ? 2 : 1)*ncomp*sizeof(double) + sizeof(WorkItem)
+            + sizeof(double);
+
+    double chunk = floor((max_memory - fixed)/per_target);
+    if(chunk >= Ntar)
+        return Ntar;
+    return static_cast<int>(std::max(chunk, (double) RS_MIN_TARGET_CHUNK));
+}
+
+/*------------------------------------------------------------------------
+ *What a real-space sum needs besides the points: the layout of the
+ *accumulators (the requested quantities next to each other, so each
+ *target has one contiguous block of ncomp values), the instances of
+ *RangeSum and ExcludingRangeSum and the constants of the kernel. busy
+ *holds the time each thread spent in the loops, to measure the load
+ *balance, and counters the scratch-memory counters at the start of the
+ *sum.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int kernel;
+    int precision;
+    int offset[RS_NUM_QUANTITIES];
+    int ncomp;
+    RangeSumFunction range_sum;
+    ExcludingSumFunction excluding_sum;
+    const double* scaling;
+    double xi2;
+    double self;
+    double cutoffsq;
+    double near_sq;
+    int max_threads;
+    double* busy;
+    ScratchCounters counters;
+} SumSetup;
+
+//Sets up the sum for the quantities in output. Returns the number of
+//accumulated components, and if it is 0 nothing has been allocated.
+static int SetUpSum(int kernel, int precision, double xi, double cutoffsq,
+        double** output, SumSetup* sum){
+
+    int nq = 0, single = RS_NUM_QUANTITIES;
+    sum->ncomp = 0;
+    sum->busy = NULL;
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++) {
+        sum->offset[q] = -1;
+        if(output[q] != NULL) {
+            sum->offset[q] = sum->ncomp;
+            sum->ncomp += quantity_components[q];
+            single = q;
+            nq++;
+        }
+    }
+    if(nq > 1)
+        single = RS_NUM_QUANTITIES;
+    if(sum->ncomp == 0)
+        return 0;
+
+    sum->kernel = kernel;
+    sum->precision = precision;
+    sum->cutoffsq = cutoffsq;
+    sum->xi2 = xi*xi;
+
+    //The Stokeslet self-interaction with the singular part removed.
+    sum->self = -1.288607832450766155 - log(xi);
+
+    //Near pairs are evaluated in double also in mixed precision.
+    sum->near_sq = (precision == RS_MIXED) ? RS_MIXED_NEAR*cutoffsq : 0;
+    if(kernel == SLP_KERNEL)
+        sum->range_sum = (precision == RS_MIXED) ? SelectRangeSum<SLPKernel, float>(single)
+                : SelectRangeSum<SLPKernel, double>(single);
+    else if(kernel == COMBINED_KERNEL)
+        sum->range_sum = (precision == RS_MIXED) ? RangeSum<CombinedKernel, RS_VELOCITY, float>
+                : RangeSum<CombinedKernel, RS_VELOCITY, double>;
+    else
+        sum->range_sum = (precision == RS_MIXED) ? SelectRangeSum<DLPKernel, float>(single)
+                : SelectRangeSum<DLPKernel, double>(single);
+    if(kernel == SLP_KERNEL)
+        sum->excluding_sum = (precision == RS_MIXED) ? ExcludingRangeSum<SLPKernel, float>
+                : ExcludingRangeSum<SLPKernel, double>;
+    else if(kernel == COMBINED_KERNEL)
+        sum->excluding_sum = (precision == RS_MIXED) ? ExcludingRangeSum<CombinedKernel, float>
+                : ExcludingRangeSum<CombinedKernel, double>;
+    else
+        sum->excluding_sum = (precision == RS_MIXED) ? ExcludingRangeSum<DLPKernel, float>
+                : ExcludingRangeSum<DLPKernel, double>;
+    sum->scaling = (kernel == DLP_KERNEL) ? dlp_scaling : slp_scaling;
+
+    ReadScratchCounters(&sum->counters);
+    sum->max_threads = omp_get_max_threads();
+    sum->busy = ScratchArray<double>(sum->max_threads);
+    for(int t = 0;t<sum->max_threads;t++)
+        sum->busy[t] = -1;
+    return sum->ncomp;
+}
+
+//Frees what SetUpSum() allocated.
+static void FreeSumSetup(SumSetup* sum){
+    ScratchFree(sum->busy);
+}
+
+//Accumulates the pairs of the near field to acc (ncomp values per sorted
+//target, zeroed by the caller). If excl is not NULL its pairs are left
+//out, where the targets of the near field are those of the input from
+//first_target on.
+static void TraverseNearField(const SumSetup* sum, const NearField* nf,
+        const ExclusionList* excl, int first_target, double* acc,
+        RealSpaceStats* stats){
+
+    WorkItem* items;
+    double total_cost;
+    int nitems = BuildWorkList(nf, &items, &total_cost);
+    ScratchGuard<WorkItem, FreeWorkList> free_items(items);
+
+    const double* psrc_a = nf->psrc_a;
+    const double* ptar_a = nf->ptar_a;
+    const double* dens_a = nf->dens_a;
+    RangeSumFunction range_sum = sum->range_sum;
+    long long accepted = 0;
+
+#pragma omp parallel
+    {
+        double start = omp_get_wtime();
+
+#pragma omp for schedule(dynamic,1) reduction(+:accepted) nowait
+        for(int w = 0;w<nitems;w++) {
+            int g = items[w].group;
+            int first = items[w].first;
+            int last = items[w].last;
+
+            for(int r = nf->range_offsets[g];r<nf->range_offsets[g+1];r++) {
+                const SourceRange* range = &nf->ranges[r];
+                if(excl == NULL) {
+                    accepted += range_sum(range, first, last, ptar_a, psrc_a,
+                            dens_a, sum->xi2, sum->self, sum->cutoffsq,
+                            sum->near_sq, sum->offset, sum->ncomp, acc);
+                    continue;
+                }
+
+                //The runs of targets without exclusions go to range_sum,
+                //the targets with exclusions one by one to excluding_sum.
+                for(int j = first;j<last;) {
+                    int end = j, t = 0;
+                    for(;end<last;end++) {
+                        t = first_target + nf->tar_order[end];
+                        if(excl->offsets[t+1] > excl->offsets[t])
+                            break;
+                    }
+                    if(end > j)
+                        accepted += range_sum(range, j, end, ptar_a, psrc_a,
+                                dens_a, sum->xi2, sum->self, sum->cutoffsq,
+                                sum->near_sq, sum->offset, sum->ncomp, acc);
+                    if(end < last)
+                        accepted += sum->excluding_sum(range, end, t, excl,
+                                nf->src_order, ptar_a, psrc_a, dens_a,
+                                sum->xi2, sum->self, sum->cutoffsq,
+                                sum->near_sq, sum->offset, sum->ncomp, acc);
+                    j = end+1;
+                }
+            }
+        }
+
+        int t = omp_get_thread_num();
+        sum->busy[t] = std::max(sum->busy[t], 0.0) + omp_get_wtime() - start;
+    }
+
+    if(stats != NULL) {
+        stats->num_work_items += nitems;
+        stats->candidate_pairs += total_cost;
+        stats->accepted_pairs += accepted;
+        stats->adaptive |= nf->adaptive;
+        stats->num_groups += nf->num_groups;
+        stats->num_chunks++;
+    }
+}
+
+//Writes the scaled results of the n sorted targets in acc to output, in
+//the original target order.
+static void WriteOutput(const SumSetup* sum, const NearField* nf, int n,
+        const double* acc, double** output){
+
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++) {
+        if(output[q] == NULL)
+            continue;
+
+        int nc = quantity_components[q];
+        int off = sum->offset[q];
+        for(int j = 0;j<n;j++)
+            for(int c = 0;c<nc;c++)
+                output[q][nc*nf->tar_order[j]+c] =
+                        acc[sum->ncomp*j+off+c]*sum->scaling[q];
+    }
+}
+
+//Fills in the load balance and the scratch-memory counters of the
+//statistics.
+static void FinishSum(SumSetup* sum, int chunk, RealSpaceStats* stats){
+
+    if(stats != NULL) {
+        double max_busy = 0, sum_busy = 0;
+        int nthreads = 0;
+        for(int t = 0;t<sum->max_threads;t++) {
+            if(sum->busy[t] < 0)
+                continue;
+            nthreads++;
+            sum_busy += sum->busy[t];
+            if(sum->busy[t] > max_busy)
+                max_busy = sum->busy[t];
+        }
+
+        stats->num_threads = nthreads;
+        stats->imbalance = sum_busy > 0 ? max_busy*nthreads/sum_busy : 1;
+        stats->precision = sum->precision;
+        stats->chunk_size = chunk;
+
+        ScratchCounters now;
+        ReadScratchCounters(&now);
+        stats->allocations = now.allocations - sum->counters.allocations;
+        stats->heap_allocations = now.heap_allocations
+                - sum->counters.heap_allocations;
+        stats->page_faults = now.page_faults - sum->counters.page_faults;
+    }
+}
+
+/*------------------------------------------------------------------------
+ *The near-field traversal shared by the SLP and DLP real-space sums. dens
+ *holds ndens density values per source (f for the SLP, f and n for the
+ *DLP). The sources are binned once, and the targets are processed in
+ *chunks that keep the working memory below opt->max_memory: each chunk is
+ *binned, traversed and written out before the next, all with the
+ *structure of the near field chosen for the whole set of targets. If
+ *opt->excl is not NULL its pairs are left out of the traversal, and
+ *evaluated on their own only for opt->skipped, see RealSpaceOptions.
+ *------------------------------------------------------------------------
+ */
+static void RealSpaceSum(int kernel, const PointSet* psrc,
+        const PointSet* ptar, double* dens, int ndens, int Nsrc, int Ntar,
+        double xi, int nside_x, int nside_y, double Lx, double Ly,
+        const RealSpaceOptions* opt, double** output, RealSpaceStats* stats){
+
+    RealSpaceStats scratch;
+    if(stats == NULL)
+        stats = &scratch;
+    memset(stats, 0, sizeof(RealSpaceStats));
+    double clock = omp_get_wtime();
+
+    //Same as the cutoff of the near field.
+    double cutoffsq = Lx*Ly/nside_x/nside_y;
+
+    const ExclusionList* excl = opt->excl;
+    double** skipped = opt->skipped;
+    if(excl != NULL && excl->num_targets != Ntar)
+        ReportError("The exclusion list does not match the number of targets.");
+
+    //Whether the excluded contributions are wanted.
+    int skip = 0;
+    for(int q = 0;q<RS_NUM_QUANTITIES && excl != NULL && skipped != NULL;q++)
+        if(output[q] != NULL && skipped[q] != NULL)
+            skip = 1;
+
+    SumSetup sum;
+    int ncomp = (Ntar > 0) ? SetUpSum(kernel, opt->precision, xi, cutoffsq,
+            output, &sum) : 0;
+    if(ncomp == 0)
+        return;
+    ScratchGuard<SumSetup, FreeSumSetup> free_sum(&sum);
+
+    int chunk = TargetChunkSize(Nsrc, ndens, Ntar, ncomp, skip,
+            nside_x*nside_y, opt->max_memory);
+
+    NearFieldSources src;
+    BuildNearFieldSources(psrc, dens, ndens, Nsrc, nside_x, nside_y, Lx, Ly,
+            &src);
+    ScratchGuard<NearFieldSources, FreeNearFieldSources> free_src(&src);
+
+    ScratchBuffer<double> acc(ncomp*chunk);
+    ScratchBuffer<double> excl_acc(skip ? ncomp*chunk : 0);
+    double fixed_memory = NearFieldSourcesMemory(&src)
+            + (skip ? 2.0 : 1.0)*ncomp*chunk*sizeof(double);
+
+    //The structure of the near field is chosen from all the targets, not
+    //from each chunk on its own.
+    int mode = opt->near_field;
+    if(mode == NF_AUTO && chunk < Ntar)
+        mode = ChooseNearFieldMode(&src, ptar, Ntar);
+
+    for(int first = 0;first<Ntar;first += chunk) {
+        int nchunk = std::min(chunk, Ntar-first);
+
+        NearField nf;
+        PointSet chunk_tar = OffsetPoints(ptar, first);
+        BuildNearFieldTargets(&src, &chunk_tar, nchunk, mode, &nf);
+        ScratchGuard<NearField, FreeNearField> free_nf(&nf);
+        stats->memory = std::max(stats->memory, fixed_memory
+                + NearFieldMemory(&nf, Nsrc, nchunk, ndens));
+        LapTime(&stats->assign_time, &clock);
+
+        memset(acc, 0, ncomp*nchunk*sizeof(double));
+        TraverseNearField(&sum, &nf, excl, first, acc, stats);
+
+        //The excluded pairs, in the original target order.
+        if(skip) {
+            memset(excl_acc, 0, ncomp*nchunk*sizeof(double));
+
+#pragma omp parallel for schedule(dynamic,64)
+            for(int j = first;j<first+nchunk;j++) {
+                if(kernel == SLP_KERNEL)
+                    ExcludedPairs<SLPKernel>(excl, j, psrc, ptar, dens,
+                            sum.xi2, sum.self, cutoffsq, Lx, Ly, sum.offset,
+                            excl_acc + ncomp*(j-first));
+                else if(kernel == COMBINED_KERNEL)
+                    ExcludedPairs<CombinedKernel>(excl, j, psrc, ptar, dens,
+                            sum.xi2, sum.self, cutoffsq, Lx, Ly, sum.offset,
+                            excl_acc + ncomp*(j-first));
+                else
+                    ExcludedPairs<DLPKernel>(excl, j, psrc, ptar, dens,
+                            sum.xi2, sum.self, cutoffsq, Lx, Ly, sum.offset,
+                            excl_acc + ncomp*(j-first));
+            }
+        }
+        LapTime(&stats->pairs_time, &clock);
+
+        //Write the scaled results of the chunk back in the original target
+        //order.
+        double* out[RS_NUM_QUANTITIES];
+        for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+            out[q] = (output[q] != NULL) ?
+                    output[q] + quantity_components[q]*first : NULL;
+        WriteOutput(&sum, &nf, nchunk, acc, out);
+
+        for(int q = 0;q<RS_NUM_QUANTITIES && skip;q++) {
+            if(output[q] == NULL || skipped[q] == NULL)
+                continue;
+
+            int nc = quantity_components[q];
+            double* skip_q = skipped[q] + nc*first;
+            for(int j = 0;j<nchunk;j++)
+                for(int c = 0;c<nc;c++)
+                    skip_q[nc*j+c] =
+                            excl_acc[ncomp*j+sum.offset[q]+c]*sum.scaling[q];
+        }
+
+        LapTime(&stats->copy_out_time, &clock);
+    }
+
+    FinishSum(&sum, chunk, stats);
+}
+
+void RealSpaceSumNearField(int kernel, NearField* nf, double* f, double* n,
+        int Nsrc, int Ntar, double xi, int precision, double** output,
+        RealSpaceStats* stats){
+
+    RealSpaceStats scratch;
+    if(stats == NULL)
+        stats = &scratch;
+    memset(stats, 0, sizeof(RealSpaceStats));
+    double clock = omp_get_wtime();
+
+    SumSetup sum;
+    int ncomp = (Ntar > 0) ? SetUpSum(kernel, precision, xi, nf->cutoffsq,
+            output, &sum) : 0;
+    if(ncomp == 0)
+        return;
+    ScratchGuard<SumSetup, FreeSumSetup> free_sum(&sum);
+
+    //Gather the density into the sorted order of the sources.
+    int ndens = (kernel == SLP_KERNEL) ? 2 : 4;
+    double* dens_a = nf->dens_a;
+    const int* src_order = nf->src_order;
+#pragma omp parallel for schedule(static)
+    for(int i = 0;i<Nsrc;i++) {
+        int k = src_order[i];
+        dens_a[ndens*i] = f[2*k];
+        dens_a[ndens*i+1] = f[2*k+1];
+        if(ndens == 4) {
+            dens_a[ndens*i+2] = n[2*k];
+            dens_a[ndens*i+3] = n[2*k+1];
+        }
+    }
+
+    LapTime(&stats->copy_in_time, &clock);
+
+    ScratchBuffer<double> acc(ncomp*Ntar);
+    memset(acc, 0, ncomp*Ntar*sizeof(double));
+    stats->memory = NearFieldMemory(nf, Nsrc, Ntar, ndens)
+            + ncomp*static_cast<double>(Ntar)*sizeof(double);
+
+    TraverseNearField(&sum, nf, NULL, 0, acc, stats);
+    LapTime(&stats->pairs_time, &clock);
+    WriteOutput(&sum, nf, Ntar, acc, output);
+    LapTime(&stats->copy_out_time, &clock);
+    FinishSum(&sum, Ntar, stats);
+}
+
+//Options of a plain real-space sum: no exclusions and no memory limit.
+static RealSpaceOptions PlainOptions(int precision){
+
+    RealSpaceOptions opt;
+    opt.precision = precision;
+    opt.excl = NULL;
+    opt.skipped = NULL;
+    opt.max_memory = 0;
+    opt.near_field = NF_AUTO;
+    return opt;
+}
+
+void StokesSLPRealSpace(const PointSet* psrc, const PointSet* ptar, double* f,
+        int Nsrc, int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, int precision, double** output, RealSpaceStats* stats){
+
+    RealSpaceOptions opt = PlainOptions(precision);
+    RealSpaceSum(SLP_KERNEL, psrc, ptar, f, 2, Nsrc, Ntar, xi, nside_x,
+            nside_y, Lx, Ly, &opt, output, stats);
+}
+
+void StokesSLPRealSpaceEx(const PointSet* psrc, const PointSet* ptar,
+        double* f, int Nsrc, int Ntar, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, const RealSpaceOptions* opt, double** output,
+        RealSpaceStats* stats){
+
+    RealSpaceSum(SLP_KERNEL, psrc, ptar, f, 2, Nsrc, Ntar, xi, nside_x,
+            nside_y, Lx, Ly, opt, output, stats);
+}
+
+/*------------------------------------------------------------------------
+ *The Stokeslet velocity for ncomp/2 densities on the same sources, held
+ *next to each other in dens_a (ncomp values per source), as are the
+ *velocities of a target in acc. The coefficients of a pair are computed
+ *once and applied to every density. Otherwise as RangeSum.
+ *------------------------------------------------------------------------
+ */
+template <typename Real>
+static long long SLPBlockRangeSum(const SourceRange* range, int first, int last,
+        const double* ptar_a, const double* psrc_a, const double* dens_a,
+        double xi2, double self, double cutoffsq, double near_sq,
+        const int* offset, int ncomp, double* acc){
+
+    int nrhs = ncomp/2;
+    Real xi2_r = static_cast<Real>(xi2);
+    long long accepted = 0;
+
+    for(int j=first;j<last;j++) {
+        double* acc_j = acc + ncomp*j;
+        double xt = ptar_a[2*j] - range->shift_x;
+        double yt = ptar_a[2*j+1] - range->shift_y;
+
+        for(int k=range->first;k<range->last;k++) {
+            double r1 = xt - psrc_a[2*k];
+            double r2 = yt - psrc_a[2*k+1];
+            double rSq = r1*r1+r2*r2;
+            const double* dk = dens_a + ncomp*k;
+
+            if(range->check_cutoff && rSq >= cutoffsq)
+                continue;
+            accepted++;
+
+            if(rSq < 1e-15) {
+                for(int c = 0;c<ncomp;c++)
+                    acc_j[c] += self*dk[c];
+                continue;
+            }
+
+            //The velocity is a*f + b*(r.f)*r for every density, see
+            //SLPPair.
+            if(rSq < near_sq) {
+                double e2 = std::exp(-xi2*rSq);
+                double a = 0.5*ExpInt(xi2*rSq, e2) - e2;
+                double b = e2/rSq;
+                for(int r = 0;r<nrhs;r++) {
+                    double rdotf = (r1*dk[2*r] + r2*dk[2*r+1])*b;
+                    acc_j[2*r] += a*dk[2*r] + rdotf*r1;
+                    acc_j[2*r+1] += a*dk[2*r+1] + rdotf*r2;
+                }
+            } else {
+                Real r1_r = static_cast<Real>(r1);
+                Real r2_r = static_cast<Real>(r2);
+                Real rSq_r = static_cast<Real>(rSq);
+                Real e2 = std::exp(-xi2_r*rSq_r);
+                Real a = Real(0.5)*ExpInt(xi2_r*rSq_r, e2) - e2;
+                Real b = e2/rSq_r;
+                for(int r = 0;r<nrhs;r++) {
+                    Real f1 = static_cast<Real>(dk[2*r]);
+                    Real f2 = static_cast<Real>(dk[2*r+1]);
+                    Real rdotf = (r1_r*f1 + r2_r*f2)*b;
+                    acc_j[2*r] += a*f1 + rdotf*r1_r;
+                    acc_j[2*r+1] += a*f2 + rdotf*r2_r;
+                }
+            }
+        }
+    }
+    return accepted;
+}
+
+void StokesSLPRealSpaceBlock(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, int nrhs, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, int precision, double* u,
+        RealSpaceStats* stats){
+
+    RealSpaceStats scratch;
+    if(stats == NULL)
+        stats = &scratch;
+    memset(stats, 0, sizeof(RealSpaceStats));
+    double clock = omp_get_wtime();
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u;
+
+    SumSetup sum;
+    double cutoffsq = Lx*Ly/nside_x/nside_y;
+    if(Ntar == 0 || nrhs == 0 || SetUpSum(SLP_KERNEL, precision, xi,
+            cutoffsq, output, &sum) == 0)
+        return;
+    ScratchGuard<SumSetup, FreeSumSetup> free_sum(&sum);
+
+    //All densities of a source next to each other.
+    int ncomp = 2*nrhs;
+    sum.ncomp = ncomp;
+    sum.range_sum = (precision == RS_MIXED) ? SLPBlockRangeSum<float>
+            : SLPBlockRangeSum<double>;
+
+    ScratchBuffer<double> dens(ncomp*Nsrc+1);
+#pragma omp parallel for schedule(static)
+    for(int k = 0;k<Nsrc;k++)
+        for(int r = 0;r<nrhs;r++) {
+            dens[ncomp*k+2*r] = f[2*Nsrc*r+2*k];
+            dens[ncomp*k+2*r+1] = f[2*Nsrc*r+2*k+1];
+        }
+    LapTime(&stats->copy_in_time, &clock);
+
+    NearField nf;
+    BuildNearField(psrc, ptar, dens, ncomp, Nsrc, Ntar, nside_x, nside_y,
+            Lx, Ly, 0, &nf);
+    ScratchGuard<NearField, FreeNearField> free_nf(&nf);
+    dens.Free();
+    LapTime(&stats->assign_time, &clock);
+
+    ScratchBuffer<double> acc(ncomp*Ntar);
+    memset(acc, 0, ncomp*Ntar*sizeof(double));
+    stats->memory = NearFieldMemory(&nf, Nsrc, Ntar, ncomp)
+            + ncomp*static_cast<double>(Ntar)*sizeof(double);
+    TraverseNearField(&sum, &nf, NULL, 0, acc, stats);
+    LapTime(&stats->pairs_time, &clock);
+
+    //One 2 x Ntar page per density, in the original target order.
+    double scaling = sum.scaling[RS_VELOCITY];
+#pragma omp parallel for schedule(static)
+    for(int j = 0;j<Ntar;j++) {
+        int t = nf.tar_order[j];
+        for(int r = 0;r<nrhs;r++) {
+            u[2*Ntar*r+2*t] = acc[ncomp*j+2*r]*scaling;
+            u[2*Ntar*r+2*t+1] = acc[ncomp*j+2*r+1]*scaling;
+        }
+    }
+    LapTime(&stats->copy_out_time, &clock);
+
+    FinishSum(&sum, Ntar, stats);
+}
+
+//Interleaves f and n to fn (4*Nsrc values), so that the density of a
+//source is contiguous.
+static void InterleaveDensity(const double* f, const double* n, int Nsrc,
+        double* fn){
+
+    for(int j = 0;j<Nsrc;j++) {
+        fn[4*j] = f[2*j];
+        fn[4*j+1] = f[2*j+1];
+        fn[4*j+2] = n[2*j];
+        fn[4*j+3] = n[2*j+1];
+    }
+}
+
+void StokesDLPRealSpace(const PointSet* psrc, const PointSet* ptar, double* f,
+        double* n, int Nsrc, int Ntar, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, int precision, double** output,
+        RealSpaceStats* stats){
+
+    ScratchBuffer<double> fn(4*Nsrc+1);
+    InterleaveDensity(f, n, Nsrc, fn);
+
+    RealSpaceOptions opt = PlainOptions(precision);
+    RealSpaceSum(DLP_KERNEL, psrc, ptar, fn, 4, Nsrc, Ntar, xi, nside_x,
+            nside_y, Lx, Ly, &opt, output, stats);
+}
+
+void StokesDLPRealSpaceEx(const PointSet* psrc, const PointSet* ptar,
+        double* f, double* n, int Nsrc, int Ntar, double xi, int nside_x,
+        int nside_y, double Lx, double Ly, const RealSpaceOptions* opt,
+        double** output, RealSpaceStats* stats){
+
+    ScratchBuffer<double> fn(4*Nsrc+1);
+    InterleaveDensity(f, n, Nsrc, fn);
+
+    RealSpaceSum(DLP_KERNEL, psrc, ptar, fn, 4, Nsrc, Ntar, xi, nside_x,
+            nside_y, Lx, Ly, opt, output, stats);
+}
+
+void StokesCombinedRealSpace(double* psrc, double* ptar, double* f,
+        double* g, double* n, double alpha, double beta, int Nsrc,
+        int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, const RealSpaceOptions* opt, double* u,
+        RealSpaceStats* stats){
+
+    //The weighted densities of CombinedKernel.
+    ScratchBuffer<double> dens(5*Nsrc+1);
+    for(int k = 0;k<Nsrc;k++) {
+        dens[5*k] = alpha*f[2*k];
+        dens[5*k+1] = alpha*f[2*k+1];
+        dens[5*k+2] = beta*g[2*k]*n[2*k];
+        dens[5*k+3] = beta*(g[2*k]*n[2*k+1] + g[2*k+1]*n[2*k]);
+        dens[5*k+4] = beta*g[2*k+1]*n[2*k+1];
+    }
+
+    double* output[RS_NUM_QUANTITIES] = {NULL};
+    output[RS_VELOCITY] = u;
+    PointSet src = InterleavedPoints(psrc);
+    PointSet tar = InterleavedPoints(ptar);
+    RealSpaceSum(COMBINED_KERNEL, &src, &tar, dens, 5, Nsrc, Ntar, xi,
+            nside_x, nside_y, Lx, Ly, opt, output, stats);
+}
+
+/*------------------------------------------------------------------------
+ *Incremental update shared by the SLP and DLP. dens holds ndens values per
+ *source as in RealSpaceSum, with f first, and dens_old the old values of
+ *the changed sources. The changed sources enter a real-space sum twice,
+ *at the new positions with the new density and at the old positions with
+ *f negated, which gives the change of the result at every target. Only
+ *the boxes around the changed sources have any pairs. The changed
+ *targets are then summed over all sources and overwritten. Either sum
+ *may choose another near-field structure than the full sums did, which
+ *is exact since both structures sum the same pairs.
+ *------------------------------------------------------------------------
+ */
+static void RealSpaceUpdate(int kernel, double* psrc, double* ptar,
+        double* dens, int ndens, int Nsrc, int Ntar, const int* changed_src,
+        int nchanged_src, double* psrc_old, double* dens_old,
+        const int* changed_tar, int nchanged_tar, double xi, int nside_x,
+        int nside_y, double Lx, double Ly, int precision, double** output){
+
+    RealSpaceOptions opt = PlainOptions(precision);
+    int ncomp = 0;
+    for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+        if(output[q] != NULL)
+            ncomp += quantity_components[q];
+
+    //The changes of the requested quantities, one after the other.
+    ScratchBuffer<double> delta_all(ncomp*Ntar+1);
+    double* delta[RS_NUM_QUANTITIES] = {NULL};
+    for(int q = 0, offset = 0;q<RS_NUM_QUANTITIES;q++) {
+        if(output[q] != NULL) {
+            delta[q] = delta_all + offset;
+            offset += quantity_components[q]*Ntar;
+        }
+    }
+
+    if(nchanged_src > 0) {
+        int m = nchanged_src;
+        ScratchBuffer<double> psrc_d(4*m);
+        ScratchBuffer<double> dens_d(2*ndens*m);
+
+        for(int i = 0;i<m;i++) {
+            int k = changed_src[i];
+            psrc_d[2*i] = psrc[2*k];
+            psrc_d[2*i+1] = psrc[2*k+1];
+            psrc_d[2*(m+i)] = psrc_old[2*i];
+            psrc_d[2*(m+i)+1] = psrc_old[2*i+1];
+            for(int c = 0;c<ndens;c++) {
+                dens_d[ndens*i+c] = dens[ndens*k+c];
+                dens_d[ndens*(m+i)+c] = (c < 2 ? -1 : 1)*dens_old[ndens*i+c];
+            }
+        }
+
+        PointSet src = InterleavedPoints(psrc_d);
+        PointSet tar = InterleavedPoints(ptar);
+        RealSpaceSum(kernel, &src, &tar, dens_d, ndens, 2*m, Ntar, xi,
+                nside_x, nside_y, Lx, Ly, &opt, delta, NULL);
+
+        for(int q = 0;q<RS_NUM_QUANTITIES;q++)
+            if(output[q] != NULL)
+                for(int j = 0;j<quantity_components[q]*Ntar;j++)
+                    output[q][j] += delta[q][j];
+    }
+
+    if(nchanged_tar > 0) {
+        ScratchBuffer<double> ptar_c(2*nchanged_tar);
+        for(int i = 0;i<nchanged_tar;i++) {
+            ptar_c[2*i] = ptar[2*changed_tar[i]];
+            ptar_c[2*i+1] = ptar[2*changed_tar[i]+1];
+        }
+
+        PointSet src = InterleavedPoints(psrc);
+        PointSet tar = InterleavedPoints(ptar_c);
+        RealSpaceSum(kernel, &src, &tar, dens, ndens, Nsrc, nchanged_tar,
+                xi, nside_x, nside_y, Lx, Ly, &opt, delta, NULL);
+
+        for(int q = 0;q<RS_NUM_QUANTITIES;q++) {
+            if(output[q] == NULL)
+                continue;
+            int nc = quantity_components[q];
+            for(int i = 0;i<nchanged_tar;i++)
+                for(int c = 0;c<nc;c++)
+                    output[q][nc*changed_tar[i]+c] = delta[q][nc*i+c];
+        }
+    }
+}
+
+void StokesSLPRealSpaceUpdate(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, const int* changed_src, int nchanged_src,
+        double* psrc_old, double* f_old, const int* changed_tar,
+        int nchanged_tar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, int precision, double** output){
+
+    RealSpaceUpdate(SLP_KERNEL, psrc, ptar, f, 2, Nsrc, Ntar, changed_src,
+            nchanged_src, psrc_old, f_old, changed_tar, nchanged_tar, xi,
+            nside_x, nside_y, Lx, Ly, precision, output);
+}
+
+void StokesDLPRealSpaceUpdate(double* psrc, double* ptar, double* f,
+        double* n, int Nsrc, int Ntar, const int* changed_src,
+        int nchanged_src, double* psrc_old, double* f_old, double* n_old,
+        const int* changed_tar, int nchanged_tar, double xi, int nside_x,
+        int nside_y, double Lx, double Ly, int precision, double** output){
+
+    //Interleave f and n as in StokesDLPRealSpace, for the old values too.
+    ScratchBuffer<double> fn(4*Nsrc+1);
+    InterleaveDensity(f, n, Nsrc, fn);
+
+    ScratchBuffer<double> fn_old(4*nchanged_src+1);
+    InterleaveDensity(f_old, n_old, nchanged_src, fn_old);
+
+    RealSpaceUpdate(DLP_KERNEL, psrc, ptar, fn, 4, Nsrc, Ntar, changed_src,
+            nchanged_src, psrc_old, fn_old, changed_tar, nchanged_tar, xi,
+            nside_x, nside_y, Lx, Ly, precision, output);
+}
+
+/*------------------------------------------------------------------------
+ *Blocks of the velocity operator between the sorted target j and the
+ *sources in range, written to cols and blocks. The two columns of a block
+ *are evaluated by the pair kernel with unit densities, for the stresslet
+ *together with the normals n_a of the sources. If cols is NULL the blocks
+ *are only counted. Returns the number of blocks.
+ *------------------------------------------------------------------------
+ */
+template <class Kernel>
+static int RangeBlocks(const SourceRange* range, int j,
+        const double* ptar_a, const double* psrc_a, const double* n_a,
+        double xi2, double self, double cutoffsq, double scaling,
+        const int* src_order, int* cols, double* blocks){
+
+    static const int offset[RS_NUM_QUANTITIES] = {0, -1, -1, -1, -1, -1};
+
+    double xt = ptar_a[2*j] - range->shift_x;
+    double yt = ptar_a[2*j+1] - range->shift_y;
+    int nb = 0;
+
+    for(int k=range->first;k<range->last;k++) {
+        double r1 = xt - psrc_a[2*k];
+        double r2 = yt - psrc_a[2*k+1];
+        double rSq = r1*r1+r2*r2;
+
+        if(range->check_cutoff && rSq >= cutoffsq)
+            continue;
+        if(rSq < 1e-15 && !Kernel::has_self)
+            continue;
+
+        if(cols != NULL) {
+            double* B = blocks + 4*nb;
+            cols[nb] = src_order[k];
+
+            for(int c = 0;c<2;c++) {
+                double dk[4];
+                double u[2] = {0, 0};
+                Kernel::UnitDensity(c, n_a, k, dk);
+                if(rSq < 1e-15)
+                    Kernel::Self(self, dk, offset, u);
+                else
+                    Kernel::template Pair<double>(r1, r2, rSq, dk, xi2,
+                            offset, u);
+                B[c] = u[0]*scaling;
+                B[2+c] = u[1]*scaling;
+            }
+        }
+        nb++;
+    }
+
+    return nb;
+}
+
+typedef int (*RangeBlocksFunction)(const SourceRange*, int, const double*,
+        const double*, const double*, double, double, double, double,
+        const int*, int*, double*);
+
+/*------------------------------------------------------------------------
+ *Assembles the velocity operator, see StokesSLPRealSpaceOperator(). The
+ *near field is traversed twice, first to count the blocks of each target
+ *and then to fill them in. n holds the normals for the stresslet and is
+ *NULL for the Stokeslet.
+ *------------------------------------------------------------------------
+ */
+static int AssembleOperator(int kernel, double* psrc, double* ptar,
+        double* n, int Nsrc, int Ntar, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, double max_memory, RealSpaceOperator* op){
+
+    memset(op, 0, sizeof(RealSpaceOperator));
+    op->kernel = kernel;
+    op->num_sources = Nsrc;
+    op->num_targets = Ntar;
+    op->xi = xi;
+    op->nside_x = nside_x;
+    op->nside_y = nside_y;
+    op->Lx = Lx;
+    op->Ly = Ly;
+    op->memory = (Ntar+1.0)*sizeof(int);
+
+    if(Ntar == 0) {
+        op->row_offsets = (int*) OperatorCalloc(1, sizeof(int));
+        op->cols = (int*) OperatorMalloc(sizeof(int));
+        op->blocks = (double*) OperatorMalloc(sizeof(double));
+        return 1;
+    }
+
+    NearField nf;
+    BuildNearField(psrc, ptar, n, (n != NULL) ? 2 : 0, Nsrc, Ntar, nside_x,
+            nside_y, Lx, Ly, 0, &nf);
+    ScratchGuard<NearField, FreeNearField> free_nf(&nf);
+
+    WorkItem* items;
+    double total_cost;
+    int nitems = BuildWorkList(&nf, &items, &total_cost);
+    ScratchGuard<WorkItem, FreeWorkList> free_items(items);
+
+    double cutoffsq = nf.cutoffsq;
+    double xi2 = xi*xi;
+    double self = -1.288607832450766155 - log(xi);
+    double scaling = (kernel == SLP_KERNEL) ? slp_scaling[RS_VELOCITY]
+            : dlp_scaling[RS_VELOCITY];
+    RangeBlocksFunction range_blocks = (kernel == SLP_KERNEL)
+            ? RangeBlocks<SLPKernel> : RangeBlocks<DLPKernel>;
+
+    //Number of blocks of each target, in input order.
+    ScratchBuffer<int> count(Ntar);
+
+#pragma omp parallel for schedule(dynamic,1)
+    for(int w = 0;w<nitems;w++) {
+        int g = items[w].group;
+        for(int j = items[w].first;j<items[w].last;j++) {
+            int nb = 0;
+            for(int r = nf.range_offsets[g];r<nf.range_offsets[g+1];r++)
+                nb += range_blocks(&nf.ranges[r], j, nf.ptar_a,
+                        nf.psrc_a, nf.dens_a, xi2, self, cutoffsq, scaling,
+                        nf.src_order, NULL, NULL);
+            count[nf.tar_order[j]] = nb;
+        }
+    }
+
+    double num_blocks = 0;
+    for(int j = 0;j<Ntar;j++)
+        num_blocks += count[j];
+    op->memory += num_blocks*(4*sizeof(double)+sizeof(int));
+
+    int assembled = (op->memory <= max_memory && num_blocks < INT_MAX);
+    if(assembled) {
+        op->num_blocks = static_cast<int>(num_blocks);
+        op->row_offsets = (int*) OperatorMalloc((Ntar+1)*sizeof(int));
+        op->cols = (int*) OperatorMalloc((op->num_blocks+1)*sizeof(int));
+        op->blocks = (double*) OperatorMalloc((4*num_blocks+1)*sizeof(double));
+
+        op->row_offsets[0] = 0;
+        for(int j = 0;j<Ntar;j++)
+            op->row_offsets[j+1] = op->row_offsets[j] + count[j];
+
+#pragma omp parallel for schedule(dynamic,1)
+        for(int w = 0;w<nitems;w++) {
+            int g = items[w].group;
+            for(int j = items[w].first;j<items[w].last;j++) {
+                int pos = op->row_offsets[nf.tar_order[j]];
+                for(int r = nf.range_offsets[g];r<nf.range_offsets[g+1];r++)
+                    pos += range_blocks(&nf.ranges[r], j, nf.ptar_a,
+                            nf.psrc_a, nf.dens_a, xi2, self, cutoffsq,
+                            scaling, nf.src_order, op->cols + pos,
+                            op->blocks + 4*static_cast<long>(pos));
+            }
+        }
+    }
+
+    return assembled;
+}
+
+int StokesSLPRealSpaceOperator(double* psrc, double* ptar, int Nsrc,
+        int Ntar, double xi, int nside_x, int nside_y, double Lx, double Ly,
+        double max_memory, RealSpaceOperator* op){
+
+    return AssembleOperator(SLP_KERNEL, psrc, ptar, NULL, Nsrc, Ntar, xi,
+            nside_x, nside_y, Lx, Ly, max_memory, op);
+}
+
+int StokesDLPRealSpaceOperator(double* psrc, double* ptar, double* n,
+        int Nsrc, int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, double max_memory, RealSpaceOperator* op){
+
+    return AssembleOperator(DLP_KERNEL, psrc, ptar, n, Nsrc, Ntar, xi,
+            nside_x, nside_y, Lx, Ly, max_memory, op);
+}
+
+void ApplyRealSpaceOperator(const RealSpaceOperator* op, const double* f,
+        double* u){
+
+#pragma omp parallel for schedule(dynamic,256)
+    for(int j = 0;j<op->num_targets;j++) {
+        double u1 = 0, u2 = 0;
+        for(int b = op->row_offsets[j];b<op->row_offsets[j+1];b++) {
+            const double* B = op->blocks + 4*static_cast<long>(b);
+            const double* fk = f + 2*op->cols[b];
+            u1 += B[0]*fk[0] + B[1]*fk[1];
+            u2 += B[2]*fk[0] + B[3]*fk[1];
+        }
+        u[2*j] = u1;
+        u[2*j+1] = u2;
+    }
+}
+
+void FreeRealSpaceOperator(RealSpaceOperator* op){
+    OperatorFree(op->row_offsets);
+    OperatorFree(op->cols);
+    OperatorFree(op->blocks);
+    op->row_offsets = NULL;
+    op->cols = NULL;
+    op->blocks = NULL;
+}
+
+#ifdef MATLAB_MEX_FILE
+//An int32 column vector holding data allocated with mxMalloc, or empty.
+static mxArray* AdoptInt32(int* data, int n){
+
+    mxArray* a = mxCreateNumericMatrix(0, 0, mxINT32_CLASS, mxREAL);
+    if(data != NULL) {
+        mxSetData(a, data);
+        mxSetM(a, n);
+        mxSetN(a, 1);
+    }
+    return a;
+}
+
+mxArray* RealSpaceOperatorToStruct(RealSpaceOperator* op){
+
+    static const char* fields[13] = {"kernel", "num_sources", "num_targets",
+            "xi", "nside_x", "nside_y", "Lx", "Ly", "memory", "assembled",
+            "row_offsets", "cols", "blocks"};
+    mxArray* s = mxCreateStructMatrix(1, 1, 13, fields);
+
+    int assembled = (op->blocks != NULL);
+
+    mxSetField(s, 0, "kernel",
+            mxCreateString(op->kernel == SLP_KERNEL ? "slp" : "dlp"));
+    mxSetField(s, 0, "num_sources", mxCreateDoubleScalar(op->num_sources));
+    mxSetField(s, 0, "num_targets", mxCreateDoubleScalar(op->num_targets));
+    mxSetField(s, 0, "xi", mxCreateDoubleScalar(op->xi));
+    mxSetField(s, 0, "nside_x", mxCreateDoubleScalar(op->nside_x));
+    mxSetField(s, 0, "nside_y", mxCreateDoubleScalar(op->nside_y));
+    mxSetField(s, 0, "Lx", mxCreateDoubleScalar(op->Lx));
+    mxSetField(s, 0, "Ly", mxCreateDoubleScalar(op->Ly));
+    mxSetField(s, 0, "memory", mxCreateDoubleScalar(op->memory));
+    mxSetField(s, 0, "assembled", mxCreateDoubleScalar(assembled));
+    mxSetField(s, 0, "row_offsets",
+            AdoptInt32(op->row_offsets, op->num_targets+1));
+    mxSetField(s, 0, "cols", AdoptInt32(op->cols, op->num_blocks));
+
+    mxArray* blocks = mxCreateDoubleMatrix(0, 0, mxREAL);
+    if(assembled) {
+        mxSetData(blocks, op->blocks);
+        mxSetM(blocks, 4);
+        mxSetN(blocks, op->num_blocks);
+    }
+    mxSetField(s, 0, "blocks", blocks);
+
+    //The arrays now belong to the struct.
+    op->row_offsets = NULL;
+    op->cols = NULL;
+    op->blocks = NULL;
+
+    return s;
+}
+
+void RealSpaceOperatorFromStruct(const mxArray* s, RealSpaceOperator* op){
+
+    if(!mxIsStruct(s))
+        mexErrMsgTxt("The real-space operator must be a struct.");
+
+    static const char* fields[8] = {"kernel", "num_sources", "num_targets",
+            "xi", "nside_x", "nside_y", "Lx", "Ly"};
+    for(int k = 0;k<8;k++)
+        if(mxGetField(s, 0, fields[k]) == NULL)
+            mexErrMsgTxt("Not a real-space operator.");
+
+    const mxArray* assembled = mxGetField(s, 0, "assembled");
+    const mxArray* row_offsets = mxGetField(s, 0, "row_offsets");
+    const mxArray* cols = mxGetField(s, 0, "cols");
+    const mxArray* blocks = mxGetField(s, 0, "blocks");
+    if(assembled == NULL || mxGetScalar(assembled) == 0 || row_offsets == NULL
+            || cols == NULL || blocks == NULL)
+        mexErrMsgTxt("The real-space operator has not been assembled.");
+
+    char* kernel = mxArrayToString(mxGetField(s, 0, "kernel"));
+    op->kernel = (strcmp(kernel, "slp") == 0) ? SLP_KERNEL : DLP_KERNEL;
+    mxFree(kernel);
+
+    op->num_sources = static_cast<int>(mxGetScalar(mxGetField(s, 0, "num_sources")));
+    op->num_targets = static_cast<int>(mxGetScalar(mxGetField(s, 0, "num_targets")));
+    op->xi = mxGetScalar(mxGetField(s, 0, "xi"));
+    op->nside_x = static_cast<int>(mxGetScalar(mxGetField(s, 0, "nside_x")));
+    op->nside_y = static_cast<int>(mxGetScalar(mxGetField(s, 0, "nside_y")));
+    op->Lx = mxGetScalar(mxGetField(s, 0, "Lx"));
+    op->Ly = mxGetScalar(mxGetField(s, 0, "Ly"));
+    op->memory = mxGetScalar(mxGetField(s, 0, "memory"));
+
+    if(mxGetClassID(row_offsets) != mxINT32_CLASS
+            || mxGetClassID(cols) != mxINT32_CLASS || !mxIsDouble(blocks)
+            || static_cast<int>(mxGetNumberOfElements(row_offsets)) != op->num_targets+1)
+        mexErrMsgTxt("The real-space operator is corrupt.");
+
+    op->num_blocks = static_cast<int>(mxGetNumberOfElements(cols));
+    op->row_offsets = (int*) mxGetData(row_offsets);
+    op->cols = (int*) mxGetData(cols);
+    op->blocks = mxGetPr(blocks);
+
+    if(op->num_sources < 0 || op->num_targets < 0
+            || op->row_offsets[0] != 0
+            || op->row_offsets[op->num_targets] != op->num_blocks
+            || static_cast<long>(mxGetNumberOfElements(blocks)) != 4L*op->num_blocks)
+        mexErrMsgTxt("The real-space operator is corrupt.");
+
+    //The apply reads blocks and densities through these without checks.
+    for(int j = 0;j<op->num_targets;j++)
+        if(op->row_offsets[j] > op->row_offsets[j+1])
+            mexErrMsgTxt("The real-space operator is corrupt.");
+    for(int b = 0;b<op->num_blocks;b++)
+        if(op->cols[b] < 0 || op->cols[b] >= op->num_sources)
+            mexErrMsgTxt("The real-space operator is corrupt.");
+}
+#endif
@@ -0,0 +1,362 @@
+#ifndef REAL_SPACE
+#define REAL_SPACE
+
+#include <math.h>
+#include <string.h>
+#include <omp.h>
+#ifdef MATLAB_MEX_FILE
+#include "mex.h"
+#endif
+#include "near_field.h"
+
+/*------------------------------------------------------------------------
+ *Quantities that the fused real-space engine can evaluate. Any subset can
+ *be requested at once, in which case all of them are computed in a single
+ *traversal of the boxes and the terms they have in common (r, r^2,
+ *exp(-xi^2 r^2) and E1) are evaluated once per pair.
+ *------------------------------------------------------------------------
+ */
+enum RealSpaceQuantity {
+    RS_VELOCITY,
+    RS_PRESSURE,
+    RS_GRADIENT,
+    RS_STRESS,
+    RS_VORTICITY,
+    RS_PRESSURE_GRAD,
+    RS_NUM_QUANTITIES
+};
+
+//Number of output rows of quantity q, e.g. 2 for the velocity.
+int QuantityComponents(int q);
+
+//Translates a quantity name ("velocity", "pressure", "gradient", "stress",
+//"vorticity" or "pressure_grad") into a RealSpaceQuantity, -1 if unknown.
+int QuantityIndex(const char* name);
+
+/*------------------------------------------------------------------------
+ *Precision of the pair evaluation. With RS_MIXED the kernels are evaluated
+ *in single precision, while the distances, the cutoff test and the sums
+ *over the sources stay in double, as do pairs that nearly coincide. Each
+ *pair then has a relative error of a few units of single-precision
+ *roundoff (2^-24 = 6e-8), mostly from exp and E1. For all quantities the
+ *error has been measured to stay below 1e-6 times the largest value of the
+ *result, so mixed precision can be used when the requested tolerance is
+ *at least RS_MIXED_PRECISION_TOL, which leaves a factor ten margin.
+ *
+ *Only the stresslet velocity alone has a vectorised single-precision
+ *loop, which runs more lanes than the double one. The other sums call
+ *the same pair functions with float instead of double, which changes the
+ *precision but saves little time, so ChoosePrecision() keeps them in
+ *double.
+ *------------------------------------------------------------------------
+ */
+enum RealSpacePrecision {
+    RS_DOUBLE,
+    RS_MIXED
+};
+
+#define RS_MIXED_PRECISION_TOL 1e-5
+
+//The precision to use for the error tolerance tol, when kernel sums the
+//single quantity q, or several quantities if q is RS_NUM_QUANTITIES.
+//Mixed precision is only chosen for the stresslet velocity alone.
+int ChoosePrecision(double tol, int kernel, int q);
+
+//The functions that read or make Matlab arrays are only compiled into mex
+//files (MATLAB_MEX_FILE), from real_space_mx.cpp. The sums themselves do
+//not depend on Matlab and are also built into the standalone library, see
+//lib/fasttools2d.h.
+#ifdef MATLAB_MEX_FILE
+//Reads a cell array of quantity names into a list of RealSpaceQuantity,
+//keeping the order in which they were given. Returns the number of names.
+int ParseQuantities(const mxArray* list, int* quantities);
+
+//Reads a vector of distinct 1-based indices between 1 and n into 0-based
+//indices, allocated with mxMalloc. Returns the number of indices.
+int ParseIndices(const mxArray* list, int n, int** indices);
+#endif
+
+/*------------------------------------------------------------------------
+ *Source-target pairs to leave out of a real-space sum, e.g. the panels
+ *near a target whose contribution is instead computed by special
+ *quadrature. The list is in CSR form: the entries of target j (in input
+ *order) are offsets[j] to offsets[j+1]-1, and entry e excludes the
+ *sources ranges[2*e] to ranges[2*e+1]-1. The indices are 0-based.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int num_targets;
+    int num_entries;
+    int* offsets;
+    int* ranges;
+} ExclusionList;
+
+#ifdef MATLAB_MEX_FILE
+//The points of a Matlab argument, either a 2 x n matrix or a cell {x, y}
+//of two vectors of n coordinates each, e.g. the columns the wrappers
+//hold. Neither is copied, so a must outlive p. name is the argument in
+//the error message. Returns n.
+int ParsePoints(const mxArray* a, const char* name, PointSet* p);
+
+//Reads an exclusion list for Ntar targets and Nsrc sources from Matlab.
+//ptr is a vector of Ntar+1 1-based offsets into the columns of src, which
+//is a 2 x nnz matrix of 1-based source ranges [first; last], last
+//included. The arrays are allocated with mxMalloc.
+void ParseExclusions(const mxArray* ptr, const mxArray* src, int Ntar,
+        int Nsrc, ExclusionList* excl);
+
+void FreeExclusionList(ExclusionList* excl);
+#endif
+
+/*------------------------------------------------------------------------
+ *Statistics of one real-space evaluation. The target groups of the near
+ *field (see near_field.h) are split into work items of (group, range of
+ *targets), whose cost is the number of candidate pairs: the targets times
+ *the sources in the interaction list. accepted_pairs counts the pairs
+ *within the cutoff that were evaluated. The imbalance is the longest
+ *time a thread spent on the loop divided by the mean, so 1 means perfect
+ *balance. adaptive is 1 if the quadtree was used instead of the uniform
+ *grid. The targets are processed in num_chunks chunks of chunk_size, see
+ *RealSpaceOptions, and the counts are summed over the chunks.
+ *
+ *The wall times in seconds of the phases are: assign_time for binning the
+ *points and building the near field, copy_in_time for gathering the
+ *densities into the sorted order (when the points are binned in the same
+ *call this is part of the binning), pairs_time for the sum over the pairs
+ *and the excluded pairs, and copy_out_time for scaling the results and
+ *writing them in the original target order. memory is the largest memory
+ *in bytes the sum held at one time: the near field and the accumulators.
+ *allocations counts the scratch allocations of the sum, heap_allocations
+ *those that did not fit the scratch arena, and page_faults the page
+ *faults of the process during the sum, see scratch_arena.h.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int num_work_items;
+    int num_threads;
+    double candidate_pairs;
+    double accepted_pairs;
+    double imbalance;
+    int adaptive;
+    int num_groups;
+    int precision;
+    int num_chunks;
+    int chunk_size;
+    double assign_time;
+    double copy_in_time;
+    double pairs_time;
+    double copy_out_time;
+    double memory;
+    double allocations;
+    double heap_allocations;
+    double page_faults;
+} RealSpaceStats;
+
+#ifdef MATLAB_MEX_FILE
+//Converts the statistics to a Matlab struct.
+mxArray* RealSpaceStatsToStruct(const RealSpaceStats* stats);
+#endif
+
+/*------------------------------------------------------------------------
+ *Real-space part of the Ewald sum for the Stokeslet (SLP) and the
+ *stresslet (DLP). The points are read in place, either from 2 x n
+ *matrices or from separate x and y vectors, see PointSet and
+ *ParsePoints(). Quantity q is evaluated if output[q] is not NULL, in
+ *which case it must point to a QuantityComponents(q) x Ntar array. The
+ *scaled result is written to it in the original target order. precision
+ *is RS_DOUBLE or RS_MIXED, see ChoosePrecision(). stats may be NULL.
+ *------------------------------------------------------------------------
+ */
+void StokesSLPRealSpace(const PointSet* psrc, const PointSet* ptar, double* f,
+        int Nsrc, int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, int precision, double** output, RealSpaceStats* stats);
+
+void StokesDLPRealSpace(const PointSet* psrc, const PointSet* ptar, double* f,
+        double* n, int Nsrc, int Ntar, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, int precision, double** output,
+        RealSpaceStats* stats);
+
+//Smallest number of targets per chunk of a memory-limited real-space sum.
+#define RS_MIN_TARGET_CHUNK 1024
+
+/*------------------------------------------------------------------------
+ *Options of StokesSLPRealSpaceEx and StokesDLPRealSpaceEx.
+ *
+ *precision is RS_DOUBLE or RS_MIXED, see ChoosePrecision().
+ *
+ *excl, if not NULL, lists pairs to leave out of the sum. The pairs loop
+ *skips them, so they leave nothing behind in mixed precision either, and
+ *the targets without exclusions are summed as usual. If skipped and
+ *skipped[q] are not NULL (same layout as output[q]) the contributions of
+ *the excluded pairs, from exactly the periodic images the sum would have
+ *visited, are evaluated in double precision and written to it.
+ *
+ *max_memory, if positive, bounds the working memory in bytes. The sources
+ *are binned once and the targets are binned and summed in chunks small
+ *enough to fit, so the temporaries grow with the chunk rather than with
+ *Ntar. A chunk has at least RS_MIN_TARGET_CHUNK targets, so the bound
+ *is exceeded if the sources alone do not fit.
+ *
+ *near_field is the structure of the near field, NF_AUTO to choose it from
+ *the points or NF_UNIFORM or NF_ADAPTIVE to force it. Both sum the same
+ *pairs, so the results agree to roundoff.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int precision;
+    const ExclusionList* excl;
+    double** skipped;
+    double max_memory;
+    int near_field;
+} RealSpaceOptions;
+
+//As StokesSLPRealSpace and StokesDLPRealSpace, with the options in opt.
+//Given a valid exclusion list they make no calls to the Matlab API, so
+//they can run on a thread other than Matlab's, see RunConcurrently().
+void StokesSLPRealSpaceEx(const PointSet* psrc, const PointSet* ptar,
+        double* f, int Nsrc, int Ntar, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, const RealSpaceOptions* opt, double** output,
+        RealSpaceStats* stats);
+
+void StokesDLPRealSpaceEx(const PointSet* psrc, const PointSet* ptar,
+        double* f, double* n, int Nsrc, int Ntar, double xi, int nside_x,
+        int nside_y, double Lx, double Ly, const RealSpaceOptions* opt,
+        double** output, RealSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *The real-space velocity of the Stokeslet for nrhs densities on the same
+ *points, e.g. the block vectors of block GMRES. f holds one 2 x Nsrc page
+ *per density and the velocities are written to u, one 2 x Ntar page per
+ *density. The points are binned once and each pair is evaluated once for
+ *all densities. It makes no calls to the Matlab API.
+ *------------------------------------------------------------------------
+ */
+void StokesSLPRealSpaceBlock(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, int nrhs, double xi, int nside_x, int nside_y,
+        double Lx, double Ly, int precision, double* u,
+        RealSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *The real-space velocity of alpha*SLP(f) + beta*DLP(g,n), for operators
+ *such as 1/2*I + D + S of second-kind integral equations. f, g and n are
+ *2 x Nsrc and u is 2 x Ntar. Both potentials come from a single pass over
+ *the near field, which evaluates the exponential of each pair once. The
+ *options are as for StokesSLPRealSpaceEx, and it makes no calls to the
+ *Matlab API either.
+ *------------------------------------------------------------------------
+ */
+void StokesCombinedRealSpace(double* psrc, double* ptar, double* f,
+        double* g, double* n, double alpha, double beta, int Nsrc,
+        int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, const RealSpaceOptions* opt, double* u,
+        RealSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *The real-space sum over a near field that has already been built, e.g.
+ *kept by an EwaldPlan over many evaluations with new densities. nf must
+ *come from BuildNearField() with ndens 2 (SLP_KERNEL) or 4 (DLP_KERNEL)
+ *values per source. The densities f and, for the stresslet, the normals n
+ *(2 x Nsrc, input order) are copied into nf->dens_a in the sorted order,
+ *and the quantities in output are evaluated as for StokesSLPRealSpace.
+ *------------------------------------------------------------------------
+ */
+void RealSpaceSumNearField(int kernel, NearField* nf, double* f, double* n,
+        int Nsrc, int Ntar, double xi, int precision, double** output,
+        RealSpaceStats* stats);
+
+/*------------------------------------------------------------------------
+ *Updates the real-space result in output (as for StokesSLPRealSpace) after
+ *the nchanged_src sources in changed_src moved or changed density, and the
+ *nchanged_tar targets in changed_tar moved. psrc, ptar and f hold the new
+ *values, and psrc_old and f_old (2 x nchanged_src) the old values of the
+ *changed sources. The old contributions of the changed sources are
+ *subtracted and the new ones added, and the changed targets are evaluated
+ *anew. Apart from binning the points, the cost is proportional to the
+ *number of changed points times the number of points near them. The
+ *indices are 0-based.
+ *------------------------------------------------------------------------
+ */
+void StokesSLPRealSpaceUpdate(double* psrc, double* ptar, double* f,
+        int Nsrc, int Ntar, const int* changed_src, int nchanged_src,
+        double* psrc_old, double* f_old, const int* changed_tar,
+        int nchanged_tar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, int precision, double** output);
+
+//As StokesSLPRealSpaceUpdate, with n_old the old normals of the changed
+//sources.
+void StokesDLPRealSpaceUpdate(double* psrc, double* ptar, double* f,
+        double* n, int Nsrc, int Ntar, const int* changed_src,
+        int nchanged_src, double* psrc_old, double* f_old, double* n_old,
+        const int* changed_tar, int nchanged_tar, double xi, int nside_x,
+        int nside_y, double Lx, double Ly, int precision, double** output);
+
+#define SLP_KERNEL 0
+#define DLP_KERNEL 1
+#define COMBINED_KERNEL 2
+
+//Default limit on the memory footprint of an assembled operator (1 GiB).
+#define RS_OPERATOR_MAX_MEMORY 1073741824.0
+
+/*------------------------------------------------------------------------
+ *The real-space velocity as a linear operator on the density, for sources
+ *and targets that stay fixed over many evaluations, e.g. the iterations
+ *of an iterative solver. It is stored as a sparse matrix of 2x2 blocks in
+ *CSR format: the blocks of target j (in input order) are row_offsets[j]
+ *to row_offsets[j+1]-1, block b couples the target to source cols[b], and
+ *blocks[4*b..4*b+3] holds it row by row with the scaling included. The
+ *stresslet operator includes the normals and acts on f. kernel is
+ *SLP_KERNEL or DLP_KERNEL, and xi, nside_x, nside_y, Lx and Ly are the
+ *parameters it was assembled for. memory is the footprint in bytes.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    int kernel;
+    int num_sources;
+    int num_targets;
+    int num_blocks;
+    double xi;
+    int nside_x;
+    int nside_y;
+    double Lx;
+    double Ly;
+    double memory;
+    int* row_offsets;
+    int* cols;
+    double* blocks;
+} RealSpaceOperator;
+
+/*------------------------------------------------------------------------
+ *Assembles the real-space velocity operator. The blocks are counted
+ *first, and if the footprint would exceed max_memory nothing is allocated
+ *and 0 is returned, with op->memory set to the footprint the operator
+ *would have had. The velocity must then be evaluated on the fly instead.
+ *Otherwise 1 is returned and the arrays are allocated, in a mex file with
+ *mxMalloc so that RealSpaceOperatorToStruct() can take them over.
+ *------------------------------------------------------------------------
+ */
+int StokesSLPRealSpaceOperator(double* psrc, double* ptar, int Nsrc,
+        int Ntar, double xi, int nside_x, int nside_y, double Lx, double Ly,
+        double max_memory, RealSpaceOperator* op);
+
+int StokesDLPRealSpaceOperator(double* psrc, double* ptar, double* n,
+        int Nsrc, int Ntar, double xi, int nside_x, int nside_y, double Lx,
+        double Ly, double max_memory, RealSpaceOperator* op);
+
+//Applies the operator to the 2 x num_sources density f, giving the
+//2 x num_targets velocity u. The rows are split over the threads.
+void ApplyRealSpaceOperator(const RealSpaceOperator* op, const double* f,
+        double* u);
+
+//Frees the arrays of an assembled operator.
+void FreeRealSpaceOperator(RealSpaceOperator* op);
+
+#ifdef MATLAB_MEX_FILE
+//Converts the operator to a Matlab struct, which takes over its arrays.
+mxArray* RealSpaceOperatorToStruct(RealSpaceOperator* op);
+
+//Reads an operator from a struct made by RealSpaceOperatorToStruct(). The
+//arrays point into the struct and must not be freed.
+void RealSpaceOperatorFromStruct(const mxArray* s, RealSpaceOperator* op);
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+#include "real_space.h"
+
+#include <cstdio>
+
+/*------------------------------------------------------------------------
+ *The parts of the real-space interface that read or make Matlab arrays.
+ *They are compiled into the mex files, which get the sums themselves from
+ *lib/fasttools2d built with -O3, see real_space.h. The operator structs
+ *stay in real_space.cpp, since they take over arrays allocated there.
+ *------------------------------------------------------------------------
+ */
+
+int ParseQuantities(const mxArray* list, int* quantities){
+
+    if(mxIsChar(list)) {
+        char* name = mxArrayToString(list);
+        quantities[0] = QuantityIndex(name);
+        mxFree(name);
+        if(quantities[0] < 0)
+            mexErrMsgTxt("Unknown real-space quantity.");
+        return 1;
+    }
+
+    if(!mxIsCell(list))
+        mexErrMsgTxt("quantities must be a string or a cell array of strings.");
+
+    int nq = static_cast<int>(mxGetNumberOfElements(list));
+    if(nq < 1 || nq > RS_NUM_QUANTITIES)
+        mexErrMsgTxt("Between one and six quantities can be requested.");
+
+    for(int j = 0;j<nq;j++) {
+        const mxArray* cell = mxGetCell(list, j);
+        if(cell == NULL || !mxIsChar(cell))
+            mexErrMsgTxt("quantities must be a string or a cell array of strings.");
+
+        char* name = mxArrayToString(cell);
+        quantities[j] = QuantityIndex(name);
+        mxFree(name);
+
+        if(quantities[j] < 0)
+            mexErrMsgTxt("Unknown real-space quantity.");
+        for(int k = 0;k<j;k++)
+            if(quantities[k] == quantities[j])
+                mexErrMsgTxt("Each quantity can only be requested once.");
+    }
+
+    return nq;
+}
+
+int ParseIndices(const mxArray* list, int n, int** indices){
+
+    if(!mxIsDouble(list) || mxIsComplex(list))
+        mexErrMsgTxt("Indices must be a real double vector.");
+
+    int m = static_cast<int>(mxGetNumberOfElements(list));
+    double* idx = mxGetPr(list);
+    char* seen = (char*) mxCalloc(n+1, sizeof(char));
+
+    *indices = (int*) mxMalloc((m+1)*sizeof(int));
+    for(int i = 0;i<m;i++) {
+        int k = static_cast<int>(idx[i]);
+        if(k != idx[i] || k < 1 || k > n)
+            mexErrMsgTxt("Indices must be integers between 1 and the number of points.");
+        if(seen[k])
+            mexErrMsgTxt("Each index can only be given once.");
+        seen[k] = 1;
+        (*indices)[i] = k-1;
+    }
+
+    mxFree(seen);
+    return m;
+}
+
+int ParsePoints(const mxArray* a, const char* name, PointSet* p){
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s must be a 2xn matrix or a cell {x, y} "
+            "of two real double vectors of the same length.", name);
+
+    if(!mxIsCell(a)) {
+        if(mxGetM(a) != 2 || !mxIsDouble(a) || mxIsComplex(a))
+            mexErrMsgTxt(msg);
+        *p = InterleavedPoints(mxGetPr(a));
+        return static_cast<int>(mxGetN(a));
+    }
+
+    const mxArray* x = (mxGetNumberOfElements(a) == 2) ? mxGetCell(a, 0)
+            : NULL;
+    const mxArray* y = (x != NULL) ? mxGetCell(a, 1) : NULL;
+    if(x == NULL || y == NULL || !mxIsDouble(x) || mxIsComplex(x) ||
+            !mxIsDouble(y) || mxIsComplex(y) ||
+            mxGetNumberOfElements(x) != mxGetNumberOfElements(y))
+        mexErrMsgTxt(msg);
+
+    p->x = mxGetPr(x);
+    p->y = mxGetPr(y);
+    p->stride = 1;
+    return static_cast<int>(mxGetNumberOfElements(x));
+}
+
+void ParseExclusions(const mxArray* ptr, const mxArray* src, int Ntar,
+        int Nsrc, ExclusionList* excl){
+
+    if(!mxIsDouble(ptr) || mxIsComplex(ptr) || !mxIsDouble(src) ||
+            mxIsComplex(src))
+        mexErrMsgTxt("The exclusion list must be real double arrays.");
+    if(static_cast<int>(mxGetNumberOfElements(ptr)) != Ntar+1)
+        mexErrMsgTxt("The exclusion offsets must have one more element than the number of targets.");
+
+    int nnz = static_cast<int>(mxGetN(src));
+    if(mxGetNumberOfElements(src) > 0 && mxGetM(src) != 2)
+        mexErrMsgTxt("The excluded source ranges must be a 2xn matrix.");
+    if(mxGetNumberOfElements(src) == 0)
+        nnz = 0;
+
+    double* p = mxGetPr(ptr);
+    double* r = mxGetPr(src);
+
+    excl->num_targets = Ntar;
+    excl->num_entries = nnz;
+    excl->offsets = (int*) mxMalloc((Ntar+1)*sizeof(int));
+    excl->ranges = (int*) mxMalloc((2*nnz+1)*sizeof(int));
+
+    for(int j = 0;j<=Ntar;j++) {
+        int o = static_cast<int>(p[j]);
+        if(o != p[j] || (j == 0 && o != 1) || (j == Ntar && o != nnz+1) ||
+                (j > 0 && o < excl->offsets[j-1]+1))
+            mexErrMsgTxt("The exclusion offsets must be nondecreasing, from 1 to the number of ranges plus one.");
+        excl->offsets[j] = o-1;
+    }
+
+    for(int e = 0;e<nnz;e++) {
+        int first = static_cast<int>(r[2*e]);
+        int last = static_cast<int>(r[2*e+1]);
+        if(first != r[2*e] || last != r[2*e+1] || first < 1 ||
+                last < first || last > Nsrc)
+            mexErrMsgTxt("The excluded source ranges must be integers with 1 <= first <= last <= the number of sources.");
+        excl->ranges[2*e] = first-1;
+        excl->ranges[2*e+1] = last;
+    }
+}
+
+void FreeExclusionList(ExclusionList* excl){
+    mxFree(excl->offsets);
+    mxFree(excl->ranges);
+}
+
+mxArray* RealSpaceStatsToStruct(const RealSpaceStats* stats){
+
+    static const char* fields[18] = {"num_work_items", "num_threads",
+            "candidate_pairs", "accepted_pairs", "imbalance", "adaptive",
+            "num_groups", "mixed_precision", "num_chunks", "chunk_size",
+            "assign_time", "copy_in_time", "pairs_time", "copy_out_time",
+            "memory", "allocations", "heap_allocations", "page_faults"};
+    mxArray* s = mxCreateStructMatrix(1, 1, 18, fields);
+
+    mxSetField(s, 0, "num_work_items", mxCreateDoubleScalar(stats->num_work_items));
+    mxSetField(s, 0, "num_threads", mxCreateDoubleScalar(stats->num_threads));
+    mxSetField(s, 0, "candidate_pairs", mxCreateDoubleScalar(stats->candidate_pairs));
+    mxSetField(s, 0, "accepted_pairs", mxCreateDoubleScalar(stats->accepted_pairs));
+    mxSetField(s, 0, "imbalance", mxCreateDoubleScalar(stats->imbalance));
+    mxSetField(s, 0, "adaptive", mxCreateDoubleScalar(stats->adaptive));
+    mxSetField(s, 0, "num_groups", mxCreateDoubleScalar(stats->num_groups));
+    mxSetField(s, 0, "mixed_precision",
+            mxCreateDoubleScalar(stats->precision == RS_MIXED));
+    mxSetField(s, 0, "num_chunks", mxCreateDoubleScalar(stats->num_chunks));
+    mxSetField(s, 0, "chunk_size", mxCreateDoubleScalar(stats->chunk_size));
+    mxSetField(s, 0, "assign_time", mxCreateDoubleScalar(stats->assign_time));
+    mxSetField(s, 0, "copy_in_time", mxCreateDoubleScalar(stats->copy_in_time));
+    mxSetField(s, 0, "pairs_time", mxCreateDoubleScalar(stats->pairs_time));
+    mxSetField(s, 0, "copy_out_time", mxCreateDoubleScalar(stats->copy_out_time));
+    mxSetField(s, 0, "memory", mxCreateDoubleScalar(stats->memory));
+    mxSetField(s, 0, "allocations", mxCreateDoubleScalar(stats->allocations));
+    mxSetField(s, 0, "heap_allocations",
+            mxCreateDoubleScalar(stats->heap_allocations));
+    mxSetField(s, 0, "page_faults", mxCreateDoubleScalar(stats->page_faults));
+
+    return s;
+}
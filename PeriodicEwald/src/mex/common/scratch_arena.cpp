@@ -0,0 +1,165 @@
+#include "scratch_arena.h"
+
+#include <algorithm>
+#include <mm_malloc.h>
+#include <new>
+#include <omp.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/*------------------------------------------------------------------------
+ *Every allocation is preceded by a header of SA_ALIGNMENT bytes, which
+ *keeps the memory after it aligned. size is the number of bytes taken,
+ *header included, and below the offset of the header of the allocation
+ *under it in the block (or -1).
+ *------------------------------------------------------------------------
+ */
+typedef union {
+    struct {
+        size_t size;
+        ptrdiff_t below;
+        int in_block;
+        int freed;
+    } h;
+    char pad[SA_ALIGNMENT];
+} AllocationHeader;
+
+/*------------------------------------------------------------------------
+ *The block is capacity bytes, of which top are taken, and the topmost
+ *allocation starts at last. heap_bytes are held on the heap, and
+ *high_water is the largest top + heap_bytes so far, the size the block
+ *needs to hold everything, including the gaps left by allocations freed
+ *out of order. The block lives as long as the mex file or the program.
+ *It is only freed at the end if nothing is held in it, since a static
+ *object may free its scratch memory later, and the lock is kept for the
+ *same reason.
+ *------------------------------------------------------------------------
+ */
+struct ScratchArena {
+    char* block;
+    size_t capacity;
+    size_t top;
+    ptrdiff_t last;
+    size_t heap_bytes;
+    size_t high_water;
+    double allocations;
+    double heap_allocations;
+    omp_lock_t lock;
+
+    ScratchArena() : block(NULL), capacity(0), top(0), last(-1), heap_bytes(0),
+            high_water(0), allocations(0), heap_allocations(0){
+        omp_init_lock(&lock);
+    }
+    ~ScratchArena(){
+        if(top == 0) {
+            _mm_free(block);
+            block = NULL;
+            capacity = 0;
+        }
+    }
+};
+
+static ScratchArena arena;
+
+void* ScratchAlloc(size_t bytes){
+
+    size_t size = sizeof(AllocationHeader)
+            + (bytes + SA_ALIGNMENT - 1)/SA_ALIGNMENT*SA_ALIGNMENT;
+    AllocationHeader* header = NULL;
+    char* old_block = NULL;
+
+    omp_set_lock(&arena.lock);
+    arena.allocations++;
+
+    //Grow to the high-water mark while nothing is held in the block. If
+    //that fails the old block is kept.
+    if(arena.top == 0 && arena.high_water > arena.capacity) {
+        char* block = static_cast<char*>(_mm_malloc(arena.high_water,
+                SA_ALIGNMENT));
+        if(block != NULL) {
+            old_block = arena.block;
+            arena.block = block;
+            arena.capacity = arena.high_water;
+            arena.heap_allocations++;
+        }
+    }
+
+    if(arena.top + size <= arena.capacity) {
+        header = reinterpret_cast<AllocationHeader*>(arena.block + arena.top);
+        header->h.size = size;
+        header->h.below = arena.last;
+        header->h.in_block = 1;
+        header->h.freed = 0;
+        arena.last = static_cast<ptrdiff_t>(arena.top);
+        arena.top += size;
+    } else {
+        arena.heap_bytes += size;
+        arena.heap_allocations++;
+    }
+    arena.high_water = std::max(arena.high_water,
+            arena.top + arena.heap_bytes);
+    omp_unset_lock(&arena.lock);
+
+    _mm_free(old_block);
+
+    if(header == NULL) {
+        header = static_cast<AllocationHeader*>(_mm_malloc(size,
+                SA_ALIGNMENT));
+        if(header == NULL) {
+            omp_set_lock(&arena.lock);
+            arena.heap_bytes -= size;
+            omp_unset_lock(&arena.lock);
+            throw std::bad_alloc();
+        }
+        header->h.size = size;
+        header->h.below = -1;
+        header->h.in_block = 0;
+        header->h.freed = 0;
+    }
+    return header + 1;
+}
+
+void ScratchFree(void* p){
+
+    if(p == NULL)
+        return;
+
+    AllocationHeader* header = static_cast<AllocationHeader*>(p) - 1;
+    if(!header->h.in_block) {
+        omp_set_lock(&arena.lock);
+        arena.heap_bytes -= header->h.size;
+        omp_unset_lock(&arena.lock);
+        _mm_free(header);
+        return;
+    }
+
+    //Release the top of the block down to the first allocation in use.
+    omp_set_lock(&arena.lock);
+    header->h.freed = 1;
+    while(arena.last >= 0) {
+        AllocationHeader* top = reinterpret_cast<AllocationHeader*>(
+                arena.block + arena.last);
+        if(!top->h.freed)
+            break;
+        arena.top = static_cast<size_t>(arena.last);
+        arena.last = top->h.below;
+    }
+    omp_unset_lock(&arena.lock);
+}
+
+void ReadScratchCounters(ScratchCounters* counters){
+
+    omp_set_lock(&arena.lock);
+    counters->allocations = arena.allocations;
+    counters->heap_allocations = arena.heap_allocations;
+    omp_unset_lock(&arena.lock);
+
+    counters->page_faults = 0;
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        counters->page_faults = static_cast<double>(usage.ru_minflt)
+                + usage.ru_majflt;
+#endif
+}
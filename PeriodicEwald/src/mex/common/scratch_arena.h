@@ -0,0 +1,100 @@
+#ifndef SCRATCH_ARENA
+#define SCRATCH_ARENA
+
+#include <stddef.h>
+
+//Alignment in bytes of all scratch memory, a cache line.
+#define SA_ALIGNMENT 64
+
+/*------------------------------------------------------------------------
+ *Scratch memory of the sums: the sorted points, the box offsets, the
+ *accumulators and the locks of the spreading. It is drawn from one
+ *persistent, SA_ALIGNMENT-aligned block that is kept between the calls
+ *of a mex file (and freed when it is cleared), so that repeated calls do
+ *not allocate, and the pages of the block are touched once instead of
+ *being faulted in again by every call.
+ *
+ *Allocations are taken from the top of the block and are released when
+ *they and everything above them are freed, so memory freed in any order
+ *is reused. An allocation that does not fit goes to the heap, and the
+ *next time the block is empty it grows to the high-water mark, the size
+ *that would have held everything. Memory kept across calls, such as the
+ *near field of a plan, would pin the block until it is freed, so it
+ *comes from the heap instead. ScratchAlloc and ScratchFree take a lock,
+ *so they are safe to call from the concurrent real-space and k-space
+ *sums, but are not meant for the parallel loops.
+ *------------------------------------------------------------------------
+ */
+void* ScratchAlloc(size_t bytes);
+
+//Frees memory from ScratchAlloc. p can be NULL.
+void ScratchFree(void* p);
+
+//n elements of type T from ScratchAlloc.
+template <typename T>
+inline T* ScratchArray(size_t n){
+    return static_cast<T*>(ScratchAlloc(n*sizeof(T)));
+}
+
+/*------------------------------------------------------------------------
+ *ScratchArray<T>(n) that is freed when it goes out of scope, also when an
+ *exception (std::bad_alloc from ScratchAlloc, or a failed FFT, see
+ *MatlabTransform()) leaves the function, so that an error does not leave
+ *memory held in the block. It converts to T*, and Free() releases it
+ *early.
+ *------------------------------------------------------------------------
+ */
+template <typename T>
+class ScratchBuffer {
+public:
+    explicit ScratchBuffer(size_t n) : p(ScratchArray<T>(n)) {}
+    ~ScratchBuffer(){ ScratchFree(p); }
+
+    operator T*() const { return p; }
+
+    void Free(){
+        ScratchFree(p);
+        p = NULL;
+    }
+
+private:
+    ScratchBuffer(const ScratchBuffer&);
+    ScratchBuffer& operator=(const ScratchBuffer&);
+
+    T* p;
+};
+
+//Calls Free(object) when it goes out of scope, for structs that hold
+//scratch memory, such as a NearField. The struct must be zeroed before it
+//is built, so that a partly built one can be freed.
+template <typename T, void (*Free)(T*)>
+class ScratchGuard {
+public:
+    explicit ScratchGuard(T* object) : object(object) {}
+    ~ScratchGuard(){ Free(object); }
+
+private:
+    ScratchGuard(const ScratchGuard&);
+    ScratchGuard& operator=(const ScratchGuard&);
+
+    T* object;
+};
+
+/*------------------------------------------------------------------------
+ *Counters for the statistics of the sums, read before and after a sum:
+ *the number of scratch allocations, those of them that went to the heap
+ *(including the growth of the block), and the page faults of the process
+ *(minor and major, 0 where getrusage is not available). The counters
+ *cover the whole process, so when the real-space and k-space sums run
+ *concurrently the difference over one of them includes the other.
+ *------------------------------------------------------------------------
+ */
+typedef struct {
+    double allocations;
+    double heap_allocations;
+    double page_faults;
+} ScratchCounters;
+
+void ReadScratchCounters(ScratchCounters* counters);
+
+#endif
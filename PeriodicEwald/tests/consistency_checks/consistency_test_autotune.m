@@ -0,0 +1,55 @@
+% This is a test script to check that the parameters chosen by the
+% autotuner (ewald_autotune) give the same velocity as the default
+% parameters to within the tolerance. The chosen parameters and the
+% predicted times are written out by the verbose Ewald sums.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 5000;
+Ntar = 5000;
+
+Lx = 1;
+Ly = 2;
+
+% Two components of the density function
+f1 = rand(Nsrc,1);
+f2 = rand(Nsrc,1);
+
+% Two components of normal vector
+t = 2*pi*rand(Nsrc,1);
+n1 = cos(t);
+n2 = sin(t);
+
+% Source and target locations, inside the reference cell
+xsrc = Lx*rand(Nsrc,1) - Lx/2;
+ysrc = Ly*rand(Nsrc,1) - Ly/2;
+xtar = Lx*rand(Ntar,1) - Lx/2;
+ytar = Ly*rand(Ntar,1) - Ly/2;
+
+% measure the cost model once, so that it is not part of the timings
+ewald_cost_model('slp', true);
+ewald_cost_model('dlp', true);
+
+for tol = [1e-6 1e-10 1e-14]
+    fprintf("*********************************************************\n");
+    fprintf('Checking autotuned parameters for tolerance %.0e...\n', tol);
+    fprintf("*********************************************************\n");
+    
+    [u1, u2] = StokesSLP_ewald_2p(xsrc,ysrc,xtar,ytar,f1,f2,Lx,Ly,'tol',tol);
+    [u1_tuned, u2_tuned] = StokesSLP_ewald_2p(xsrc,ysrc,xtar,ytar,f1,f2,...
+                Lx,Ly,'tol',tol,'autotune',true,'verbose',true);
+    fprintf('SLP, MAXIMUM RELATIVE DIFFERENCE: %.5e\n',...
+                max(abs([u1_tuned - u1; u2_tuned - u2]))/max(abs([u1; u2])));
+    
+    [u1, u2] = StokesDLP_ewald_2p(xsrc,ysrc,xtar,ytar,n1,n2,f1,f2,Lx,Ly,...
+                'tol',tol);
+    [u1_tuned, u2_tuned] = StokesDLP_ewald_2p(xsrc,ysrc,xtar,ytar,n1,n2,...
+                f1,f2,Lx,Ly,'tol',tol,'autotune',true,'verbose',true);
+    fprintf('DLP, MAXIMUM RELATIVE DIFFERENCE: %.5e\n',...
+                max(abs([u1_tuned - u1; u2_tuned - u2]))/max(abs([u1; u2])));
+end
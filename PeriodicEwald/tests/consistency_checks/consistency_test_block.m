@@ -0,0 +1,77 @@
+% This is a test script to check that the block evaluation of the
+% single-layer potential for several densities on the same points
+% (mex_stokes_slp_ewald_block) agrees with evaluating each density on its
+% own, and to compare the time per density.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 4000;
+Ntar = 3000;
+k = 8;
+
+Lx = 1;
+Ly = 1;
+
+% k densities of two components each
+f = 10*rand(2,Nsrc,k);
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+fprintf("*********************************************************\n");
+fprintf('Checking block Ewald sums for %d densities...\n', k);
+fprintf("*********************************************************\n");
+
+tic
+[ur_block, uk_block] = mex_stokes_slp_ewald_block(psrc,ptar,f,xi,...
+            nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+time_block = toc;
+
+ur = zeros(2,Ntar,k);
+uk = zeros(2,Ntar,k);
+tic
+for r = 1:k
+    [ur(:,:,r), uk(:,:,r)] = mex_stokes_slp_ewald(psrc,ptar,f(:,:,r),xi,...
+                nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+end
+time_separate = toc;
+
+fprintf('MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier)\n',...
+                max(abs(ur_block(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(uk_block(:) - uk(:)))/max(abs(uk(:))));
+fprintf('TIME PER DENSITY: %.3g s (block), %.3g s (separate)\n',...
+                time_block/k, time_separate/k);
+
+%% Through StokesSLP_ewald_2p, with the densities as columns
+f1 = squeeze(f(1,:,:));
+f2 = squeeze(f(2,:,:));
+[u1_block, u2_block] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',...
+                ptar(1,:)',ptar(2,:)',f1,f2,Lx,Ly,'tol',1e-10);
+
+err = 0;
+for r = 1:k
+    [u1, u2] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                ptar(2,:)',f1(:,r),f2(:,r),Lx,Ly,'tol',1e-10);
+    err = max(err, max(abs([u1_block(:,r) - u1; u2_block(:,r) - u2]))/...
+                max(abs([u1; u2])));
+end
+
+% the block evaluation uses the parameters of the largest density, which
+% are at least as accurate as those of each density
+fprintf('EWALD SUM, MAXIMUM RELATIVE ERROR: %.5e (tol 1e-10)\n', err);
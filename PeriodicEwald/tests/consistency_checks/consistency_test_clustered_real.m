@@ -0,0 +1,69 @@
+% This is a test script to check the real-space sums for strongly clustered
+% points, for which the uniform box grid is refined into a quadtree. The
+% mex functions are compared to the direct real-space sums, with xi large
+% enough that the truncation error of the mex functions is negligible.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+N = 400;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f1 = 10*rand(N,1);
+f2 = 10*rand(N,1);
+
+% Two components of normal vector
+n1 = rand(N,1);
+n2 = sqrt(1 - n1.^2);
+
+% Sources on a small circle, targets on and around it
+t = 2*pi*((1:N)' + 0.3*rand(N,1))/N;
+xsrc = 0.1*cos(t) + 0.2;
+ysrc = 0.1*sin(t) - 0.1;
+
+xtar = (0.1 + 0.02*rand(N,1)).*cos(t) + 0.2;
+ytar = (0.1 + 0.02*rand(N,1)).*sin(t) - 0.1;
+
+psrc = [xsrc'; ysrc'];
+ptar = [xtar'; ytar'];
+f = [f1'; f2'];
+n = [n1'; n2'];
+
+% Real space parameters, exp(-xi^2*rc^2) is far below machine precision
+nside_x = 6;
+nside_y = 6;
+xi = 80;
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking clustered real space sum for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[ur, rstats] = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+ur_direct = stokes_slp_real_ds(xsrc, ysrc, xtar, ytar, f1, f2, Lx, Ly, xi);
+
+fprintf('ADAPTIVE: %d, LEAVES WITH TARGETS: %d\n', rstats.adaptive,...
+                rstats.num_groups);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_direct(:)))/max(abs(ur_direct(:))));
+
+%% Double-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking clustered real space sum for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[ur, rstats] = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+ur_direct = stokes_dlp_real_ds(xsrc, ysrc, xtar, ytar, n1, n2,...
+                f1, f2, Lx, Ly, xi);
+
+fprintf('ADAPTIVE: %d, LEAVES WITH TARGETS: %d\n', rstats.adaptive,...
+                rstats.num_groups);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_direct(:)))/max(abs(ur_direct(:))));
@@ -0,0 +1,84 @@
+% This is a test script to check that the combined operator
+% alpha*SLP(f) + beta*DLP(g,n) + gamma*f (mex_stokes_combined_ewald,
+% StokesCombined_ewald_2p) agrees with evaluating the two potentials
+% separately and adding them, and to compare the times.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+N = 4000;
+
+Lx = 1;
+Ly = 1;
+
+% Densities of the Stokeslet and the stresslet
+f = 10*rand(2,N);
+g = 10*rand(2,N);
+
+% Two components of normal vector
+t = 2*pi*rand(1,N);
+n = [cos(t); sin(t)];
+
+% The targets are the sources, for the identity term
+p = [Lx*rand(1,N); Ly*rand(1,N)] - [Lx; Ly]/2;
+
+alpha = 1;
+beta = 1;
+gamma = 0.5;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+fprintf("*********************************************************\n");
+fprintf('Checking the combined SLP and DLP operator...\n');
+fprintf("*********************************************************\n");
+
+tic
+[u, ur, uk] = mex_stokes_combined_ewald(p,p,f,g,n,alpha,beta,gamma,xi,...
+            nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+time_combined = toc;
+
+tic
+[ur_slp, uk_slp] = mex_stokes_slp_ewald(p,p,f,xi,nside_x,nside_y,eta,...
+            Mx,My,Lx,Ly,w,P,0);
+[ur_dlp, uk_dlp] = mex_stokes_dlp_ewald(p,p,g,n,xi,nside_x,nside_y,eta,...
+            Mx,My,Lx,Ly,w,P,0);
+time_separate = toc;
+
+ur_ref = alpha*ur_slp + beta*ur_dlp;
+uk_ref = alpha*uk_slp + beta*uk_dlp;
+u_ref = ur_ref + uk_ref + gamma*f;
+
+fprintf('MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier), %.5e (total)\n',...
+                max(abs(ur(:) - ur_ref(:)))/max(abs(ur_ref(:))),...
+                max(abs(uk(:) - uk_ref(:)))/max(abs(uk_ref(:))),...
+                max(abs(u(:) - u_ref(:)))/max(abs(u_ref(:))));
+fprintf('TIME: %.3g s (combined), %.3g s (separate)\n',...
+                time_combined, time_separate);
+
+%% Through StokesCombined_ewald_2p, against the two wrappers
+tol = 1e-10;
+[u1, u2] = StokesCombined_ewald_2p(p(1,:)',p(2,:)',p(1,:)',p(2,:)',...
+                f(1,:)',f(2,:)',g(1,:)',g(2,:)',n(1,:)',n(2,:)',alpha,...
+                beta,gamma,Lx,Ly,'tol',tol);
+[u1_slp, u2_slp] = StokesSLP_ewald_2p(p(1,:)',p(2,:)',p(1,:)',p(2,:)',...
+                f(1,:)',f(2,:)',Lx,Ly,'tol',tol);
+[u1_dlp, u2_dlp] = StokesDLP_ewald_2p(p(1,:)',p(2,:)',p(1,:)',p(2,:)',...
+                n(1,:)',n(2,:)',g(1,:)',g(2,:)',Lx,Ly,'tol',tol);
+u1_ref = alpha*u1_slp + beta*u1_dlp + gamma*f(1,:)';
+u2_ref = alpha*u2_slp + beta*u2_dlp + gamma*f(2,:)';
+
+fprintf('EWALD SUM, MAXIMUM RELATIVE ERROR: %.5e (tol %.0e)\n',...
+                max(abs([u1 - u1_ref; u2 - u2_ref]))/max(abs([u1_ref; u2_ref])),...
+                tol);
@@ -0,0 +1,76 @@
+% This is a test script to check that evaluating the real and Fourier
+% sums at the same time (mex_stokes_slp_ewald, mex_stokes_dlp_ewald) gives
+% the same result as evaluating them one after the other.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 2000;
+Ntar = 1500;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking concurrent Ewald sums for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+uk = mex_stokes_slp_kspace(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P);
+[ur_conc, uk_conc, stats] = mex_stokes_slp_ewald(psrc,ptar,f,xi,nside_x,...
+            nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+
+fprintf('THREADS: %d (real), %d (Fourier), CONCURRENT: %d\n',...
+                stats.real_threads, stats.kspace_threads, stats.concurrent);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier)\n',...
+                max(abs(ur_conc(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(uk_conc(:) - uk(:)))/max(abs(uk(:))));
+
+[u1, u2] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly,'concurrent',false);
+[u1_conc, u2_conc] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',...
+                ptar(1,:)',ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly);
+fprintf('EWALD SUM, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs([u1_conc - u1; u2_conc - u2]))/max(abs([u1; u2])));
+
+%% Double-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking concurrent Ewald sums for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+uk = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,My,Lx,Ly,w,P);
+[ur_conc, uk_conc, stats] = mex_stokes_dlp_ewald(psrc,ptar,f,n,xi,...
+            nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+
+fprintf('THREADS: %d (real), %d (Fourier), CONCURRENT: %d\n',...
+                stats.real_threads, stats.kspace_threads, stats.concurrent);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier)\n',...
+                max(abs(ur_conc(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(uk_conc(:) - uk(:)))/max(abs(uk(:))));
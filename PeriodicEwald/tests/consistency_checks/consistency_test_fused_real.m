@@ -0,0 +1,82 @@
+% This is a test script to check that the fused real-space sums give the
+% same result as the separate real-space mex functions, for any subset of
+% the quantities and in any order.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 200;
+Ntar = 150;
+
+Lx = 1;
+Ly = 2;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+n1 = rand(1,Nsrc);
+n = [n1; sqrt(1 - n1.^2)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Real space parameters
+xi = 10;
+nside_x = 4;
+nside_y = 8;
+
+quantities = {'velocity', 'pressure', 'gradient', 'stress', 'vorticity',...
+                'pressure_grad'};
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking fused real space sum for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+out = cell(1, length(quantities));
+[out{:}] = mex_stokes_slp_real_fused(psrc,ptar,f,xi,nside_x,nside_y,...
+                Lx,Ly,quantities);
+
+for j = 1:length(quantities)
+    if strcmp(quantities{j}, 'velocity')
+        name = 'mex_stokes_slp_real';
+    else
+        name = ['mex_stokes_slp_', quantities{j}, '_real'];
+    end
+    ref = feval(name,psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+
+    fprintf('%s, MAXIMUM RELATIVE ERROR: %.5e\n', quantities{j},...
+                max(abs(ref(:) - out{j}(:)))/max(abs(ref(:))));
+end
+
+% a subset in a different order
+[sr, ur] = mex_stokes_slp_real_fused(psrc,ptar,f,xi,nside_x,nside_y,...
+                Lx,Ly,{'stress', 'velocity'});
+fprintf('subset, MAXIMUM ERROR: %.5e\n',...
+    max([max(abs(sr(:) - out{4}(:))), max(abs(ur(:) - out{1}(:)))]));
+
+%% Double-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking fused real space sum for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[out{:}] = mex_stokes_dlp_real_fused(psrc,ptar,f,n,xi,nside_x,nside_y,...
+                Lx,Ly,quantities);
+
+for j = 1:length(quantities)
+    if strcmp(quantities{j}, 'velocity')
+        name = 'mex_stokes_dlp_real';
+    else
+        name = ['mex_stokes_dlp_', quantities{j}, '_real'];
+    end
+    ref = feval(name,psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+
+    fprintf('%s, MAXIMUM RELATIVE ERROR: %.5e\n', quantities{j},...
+                max(abs(ref(:) - out{j}(:)))/max(abs(ref(:))));
+end
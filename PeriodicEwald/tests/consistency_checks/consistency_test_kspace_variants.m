@@ -0,0 +1,89 @@
+% This is a test script to check that the variants of the Fourier sums
+% (see kspace_variants.h) agree with each other, that 'measure' picks one
+% of them and remembers it for calls of the same size, and that an
+% EwaldPlan made with 'measure' keeps the fastest variant.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 4000;
+Ntar = 3000;
+
+Lx = 1;
+Ly = 1;
+
+f = 10*rand(2,Nsrc);
+n = randn(2,Nsrc);
+n = n./sqrt(sum(n.^2,1));
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+fprintf("*********************************************************\n");
+fprintf('Checking the variants of the Fourier sums...\n');
+fprintf("*********************************************************\n");
+
+%% Gradient and stress of the Stokeslet
+kspace = {@mex_stokes_slp_gradient_kspace, @mex_stokes_slp_stress_kspace};
+names = {'GRADIENT', 'STRESS'};
+variants = {'two_spreads', 'one_spread', 'batched'};
+
+for j = 1:2
+    uk = kspace{j}(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P);
+    for v = 1:length(variants)
+        tic
+        uk_v = kspace{j}(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P,variants{v});
+        fprintf('%s, %s: MAXIMUM RELATIVE ERROR %.5e, TIME %.3g s\n',...
+                    names{j}, upper(variants{v}),...
+                    max(abs(uk_v(:) - uk(:)))/max(abs(uk(:))), toc);
+    end
+
+    % the first call times each variant, the second reuses the choice
+    [uk_v, variant, times] = kspace{j}(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,...
+                P,'measure');
+    fprintf('%s, MEASURE: %s (times %s s), MAXIMUM RELATIVE ERROR %.5e\n',...
+                names{j}, variant, num2str(times,'%.3g '),...
+                max(abs(uk_v(:) - uk(:)))/max(abs(uk(:))));
+    [~, variant_again, times] = kspace{j}(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,...
+                w,P,'measure');
+    fprintf('%s, MEASURE AGAIN: %s (remembered: %d)\n', names{j},...
+                variant_again, strcmp(variant, variant_again) && all(times < 0));
+end
+
+%% Velocity, through plans
+kernels = {'slp', 'dlp'};
+normals = {[], n};
+for j = 1:2
+    plan = EwaldPlan(kernels{j},psrc,ptar,normals{j},xi,nside_x,nside_y,...
+                eta,Mx,My,Lx,Ly,w,P,0);
+    [ur, uk] = execute(plan, f);
+    for variant = {'batched', 'measure'}
+        plan_v = EwaldPlan(kernels{j},psrc,ptar,normals{j},xi,nside_x,...
+                    nside_y,eta,Mx,My,Lx,Ly,w,P,0,variant{1});
+        err = 0;
+        for r = 1:2
+            [ur_v, uk_v] = execute(plan_v, f);
+            err = max(err, max(abs([ur_v(:) - ur(:); uk_v(:) - uk(:)]))/...
+                        max(abs(ur(:) + uk(:))));
+        end
+        s = info(plan_v);
+        fprintf('PLAN %s, %s: %s (times %s s), MAXIMUM RELATIVE ERROR %.5e\n',...
+                    upper(kernels{j}), upper(variant{1}), s.kspace_variant,...
+                    num2str(s.kspace_times,'%.3g '), err);
+    end
+end
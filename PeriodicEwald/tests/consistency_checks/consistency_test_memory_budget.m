@@ -0,0 +1,119 @@
+% This is a test script to check the memory budget of the Fourier sums.
+% The streamed variants, which hold the fewest grids, should agree with
+% the default variants, the 'budget' command of
+% mex_stokes_ewald_parameters should choose a coarser grid of boxes and a
+% smaller Fourier grid that still meet the tolerance, and the Ewald sums
+% should meet the tolerance within the budget.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 4000;
+Ntar = 3000;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+P = 24;
+Mx = 128;
+My = 128;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+%% Streamed variants
+fprintf("*********************************************************\n");
+fprintf('Checking the streamed Fourier sums...\n');
+fprintf("*********************************************************\n");
+
+[uk, stats] = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,My,Lx,Ly,w,P);
+[uk_stream, stats_stream] = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,...
+            Mx,My,Lx,Ly,w,P,'streamed');
+fprintf('DLP VELOCITY: %.5e, GRID MEMORY %.3g MB (default %.3g MB)\n',...
+                max(abs(uk_stream(:) - uk(:)))/max(abs(uk(:))),...
+                stats_stream.kspace_memory/1e6, stats.kspace_memory/1e6);
+
+% a budget below the default grids makes 'estimate' stream
+[uk_budget, ~, variant] = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,...
+            My,Lx,Ly,w,P,'estimate',stats_stream.kspace_memory);
+fprintf('DLP VELOCITY WITHIN %.3g MB: %s, %.5e\n',...
+                stats_stream.kspace_memory/1e6, variant,...
+                max(abs(uk_budget(:) - uk(:)))/max(abs(uk(:))));
+
+[gk, ~, ~, stats] = mex_stokes_slp_gradient_kspace(psrc,ptar,xi,eta,f,...
+            Mx,My,Lx,Ly,w,P);
+[gk_stream, ~, ~, stats_stream] = mex_stokes_slp_gradient_kspace(psrc,...
+            ptar,xi,eta,f,Mx,My,Lx,Ly,w,P,'streamed');
+fprintf('SLP GRADIENT: %.5e, GRID MEMORY %.3g MB (default %.3g MB)\n',...
+                max(abs(gk_stream(:) - gk(:)))/max(abs(gk(:))),...
+                stats_stream.kspace_memory/1e6, stats.kspace_memory/1e6);
+
+[sk, ~, ~, stats] = mex_stokes_slp_stress_kspace(psrc,ptar,xi,eta,f,...
+            Mx,My,Lx,Ly,w,P);
+[sk_stream, ~, ~, stats_stream] = mex_stokes_slp_stress_kspace(psrc,...
+            ptar,xi,eta,f,Mx,My,Lx,Ly,w,P,'streamed');
+fprintf('SLP STRESS: %.5e, GRID MEMORY %.3g MB (default %.3g MB)\n',...
+                max(abs(sk_stream(:) - sk(:)))/max(abs(sk(:))),...
+                stats_stream.kspace_memory/1e6, stats.kspace_memory/1e6);
+
+%% Parameters within a budget
+fprintf("*********************************************************\n");
+fprintf('Checking the parameters within a memory budget...\n');
+fprintf("*********************************************************\n");
+
+tol = 1e-10;
+Q = sum(f(:).^2) + 1;
+par = mex_stokes_ewald_parameters('parameters','dlp',0,Q,Nsrc+Ntar,...
+            24*log2(Nsrc+Ntar),0,Lx,Ly,tol);
+for max_memory = [0 par.Mx*par.My*8*[4 1]]
+    fit = mex_stokes_ewald_parameters('budget','dlp',0,Q,par.nside_x,...
+                par.nside_y,par.P,Lx,Ly,tol,max_memory);
+    fprintf(['BUDGET %.3g MB: %d x %d boxes, xi %.3f, Mx %d, GRID MEMORY ',...
+                '%.3g MB, MEETS TOL %d\n'], max_memory/1e6, fit.nside_x,...
+                fit.nside_y, fit.xi, fit.Mx, fit.kspace_memory/1e6,...
+                fit.meets_tol);
+end
+
+%% Ewald sums within a budget
+fprintf("*********************************************************\n");
+fprintf('Checking the Ewald sums within a memory budget...\n');
+fprintf("*********************************************************\n");
+
+% a budget of one grid of the default parameters
+max_memory = par.Mx*par.My*8;
+for kernel = {'slp', 'dlp'}
+    if strcmp(kernel{1}, 'slp')
+        [u1_ref, u2_ref] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',...
+                    ptar(1,:)',ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly,'tol',1e-14);
+        [u1, u2] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                    ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly,'tol',tol,...
+                    'max_memory',max_memory,'verbose',true);
+    else
+        [u1_ref, u2_ref] = StokesDLP_ewald_2p(psrc(1,:)',psrc(2,:)',...
+                    ptar(1,:)',ptar(2,:)',n(1,:)',n(2,:)',f(1,:)',...
+                    f(2,:)',Lx,Ly,'tol',1e-14);
+        [u1, u2] = StokesDLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                    ptar(2,:)',n(1,:)',n(2,:)',f(1,:)',f(2,:)',Lx,Ly,...
+                    'tol',tol,'max_memory',max_memory,'verbose',true);
+    end
+    fprintf('%s WITHIN %.3g MB, MAXIMUM RELATIVE ERROR: %.5e (tol %.0e)\n',...
+                upper(kernel{1}), max_memory/1e6,...
+                max(abs([u1 - u1_ref; u2 - u2_ref]))/max(abs([u1_ref; u2_ref])),...
+                tol);
+end
@@ -0,0 +1,58 @@
+% This is a test script to check the native error estimates of
+% mex_stokes_ewald_parameters. The xi and kinf it returns should meet the
+% tolerance, and be the smallest values that do, for both potentials and
+% all numbers of derivatives, and the parameters of the 'parameters'
+% command should agree with those computed from its xi and kinf.
+
+close all
+clearvars
+clc
+
+initewald
+
+Q = 2001;
+Lx = 1;
+Ly = 2;
+
+% the estimates, C*x^a*exp(-b*x^2) with the x-dependent parts of
+% ewald_parameters.h
+real_est = {@(x,rc,d) sqrt(Q*pi/(4*Lx*Ly*x))*exp(-x^2*rc^2)*(2*x^2*rc)^d,...
+            @(x,rc,d) exp(-x^2*rc^2)*x*rc*sqrt(2*pi*Q/(Lx*Ly))*(2*x^2*rc)^d};
+kspace_est = {@(k,xi,d) sqrt(4*Q*pi/(Lx^5*k))*exp(-k^2/(4*xi^2))*k^d,...
+              @(k,xi,d) sqrt(8*Q*pi*k/Lx^5)*exp(-k^2/(4*xi^2))*k^d};
+kernels = {'slp', 'dlp'};
+
+for j = 1:2
+    for d = 0:2
+        for tol = [1e-6 1e-10 1e-14]
+            rc = Lx/16;
+            xi = mex_stokes_ewald_parameters('xi',kernels{j},d,Q,Lx,Ly,rc,tol);
+            kinf = mex_stokes_ewald_parameters('kinf',kernels{j},d,Q,Lx,Lx,...
+                        xi,tol);
+
+            % the estimates at the returned values, relative to tol, just
+            % beyond them and just before them
+            err_xi = [real_est{j}(xi*1.001,rc,d), real_est{j}(xi*0.999,rc,d)]/tol;
+            k = 2*pi*kinf/Lx;
+            err_k = [kspace_est{j}(k+2*pi/Lx,xi,d), kspace_est{j}(k-2*pi/Lx,xi,d)]/tol;
+            fprintf('%s, %d DERIVATIVES, TOL %.0e: xi %.4f (%.3f, %.3f), kinf %d (%.3f, %.3f)\n',...
+                        upper(kernels{j}), d, tol, xi, err_xi, kinf, err_k);
+        end
+    end
+end
+
+%% All parameters at once
+npts = 20000;
+Nb = 200;
+tol = 1e-8;
+par = mex_stokes_ewald_parameters('parameters','dlp',1,Q,npts,Nb,0,Lx,Ly,tol);
+[A,B] = rat(Lx/Ly);
+a = ceil(sqrt(npts/(Nb*A*B)));
+xi = mex_stokes_ewald_parameters('xi','dlp',1,Q,Lx,Ly,Lx/(a*A),tol);
+kinf = mex_stokes_ewald_parameters('kinf','dlp',1,Q,Lx,Lx,xi,tol);
+fprintf('PARAMETERS, GRID: %d x %d (expected %d x %d)\n', par.nside_x,...
+            par.nside_y, a*A, a*B);
+fprintf('PARAMETERS, XI: %.6f (expected %.6f), KINF: %d (expected %d)\n',...
+            par.xi, xi, par.kinf, kinf);
+fprintf('PARAMETERS, FOURIER GRID: %d x %d (expected %d x %d), P: %d\n',...
+            par.Mx, par.My, A*min(2*kinf,10000), B*min(2*kinf,10000), par.P);
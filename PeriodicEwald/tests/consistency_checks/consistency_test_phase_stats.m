@@ -0,0 +1,111 @@
+% This is a test script to check the statistics of the Ewald sums
+% (mex_stokes_slp_ewald, mex_stokes_dlp_ewald, mex_stokes_slp_kspace and
+% EwaldPlan): the times of the phases of the real space and Fourier sums,
+% the candidate and accepted pairs, the peak memory, and the scratch
+% allocations and page faults. The phase times should add up to the times
+% of the parts, no more pairs can be accepted than were tested, and once
+% the scratch arena has grown, repeated calls should not allocate from the
+% heap.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 4000;
+Ntar = 3000;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+real_phases = {'assign_time','copy_in_time','pairs_time','copy_out_time'};
+kspace_phases = {'spread_time','fft_time','filter_time','ifft_time',...
+                'gather_time'};
+phase_sum = @(s, names) sum(cellfun(@(c) s.(c), names));
+
+%% Single- and double-layer potential
+for kernel = ["slp", "dlp"]
+    fprintf("*********************************************************\n");
+    fprintf('Checking the phase statistics of the %s Ewald sums...\n', kernel);
+    fprintf("*********************************************************\n");
+
+    % The first calls grow the scratch arena
+    for iter = 1:3
+        if kernel == "slp"
+            [~, ~, stats] = mex_stokes_slp_ewald(psrc,ptar,f,xi,nside_x,...
+                        nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+        else
+            [~, ~, stats] = mex_stokes_dlp_ewald(psrc,ptar,f,n,xi,nside_x,...
+                        nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+        end
+    end
+
+    fprintf('REAL SPACE: assign %.4f, copy in %.4f, pairs %.4f, copy out %.4f (part %.4f)\n',...
+                stats.assign_time, stats.copy_in_time, stats.pairs_time,...
+                stats.copy_out_time, stats.real_time);
+    fprintf('FOURIER: spread %.4f, fft %.4f, filter %.4f, ifft %.4f, gather %.4f (part %.4f)\n',...
+                stats.spread_time, stats.fft_time, stats.filter_time,...
+                stats.ifft_time, stats.gather_time, stats.kspace_time);
+    fprintf('PAIRS: %d candidate, %d accepted (%.1f%%)\n',...
+                stats.candidate_pairs, stats.accepted_pairs,...
+                100*stats.accepted_pairs/stats.candidate_pairs);
+    fprintf('MEMORY: %.2f MB (real), %.2f MB (Fourier), %.2f MB (peak)\n',...
+                stats.memory/2^20, stats.kspace_memory/2^20,...
+                stats.peak_memory/2^20);
+    fprintf('UNACCOUNTED TIME: %.4f (real), %.4f (Fourier)\n',...
+                stats.real_time - phase_sum(stats, real_phases),...
+                stats.kspace_time - phase_sum(stats, kspace_phases));
+    fprintf('SCRATCH: %d allocations, %d from the heap, %d page faults (real), %d, %d, %d (Fourier)\n',...
+                stats.allocations, stats.heap_allocations,...
+                stats.page_faults, stats.kspace_allocations,...
+                stats.kspace_heap_allocations, stats.kspace_page_faults);
+    assert(stats.accepted_pairs <= stats.candidate_pairs);
+    assert(stats.accepted_pairs > 0);
+    assert(stats.allocations > 0 && stats.kspace_allocations > 0);
+    assert(stats.heap_allocations == 0 && stats.kspace_heap_allocations == 0);
+end
+
+%% Fourier sum alone and plan
+fprintf("*********************************************************\n");
+fprintf('Checking the phase statistics of the Fourier sum and plans...\n');
+fprintf("*********************************************************\n");
+
+tic
+[~, kstats] = mex_stokes_slp_kspace(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P);
+time = toc;
+fprintf('FOURIER SUM: %.4f in phases, %.4f in total, %d grids\n',...
+                phase_sum(kstats, kspace_phases), time, kstats.num_grids);
+
+plan = EwaldPlan('slp',psrc,ptar,[],xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+for iter = 1:2
+    [~, ~, stats] = execute(plan, f);
+    fprintf('PLAN, EXECUTION %d: copy in %.4f, pairs %.4f, copy out %.4f, spread %.4f, fft %.4f\n',...
+                iter, stats.copy_in_time, stats.pairs_time,...
+                stats.copy_out_time, stats.spread_time, stats.fft_time);
+    % The binning is done when the plan is made
+    assert(stats.assign_time == 0);
+    assert(stats.accepted_pairs <= stats.candidate_pairs);
+end
@@ -0,0 +1,107 @@
+% This is a test script to check that an EwaldPlan gives the same result
+% as evaluating the Ewald sums anew, for a new density and after the points
+% have moved, both by so little that the plan is kept and by so much that
+% its real-space part is rebuilt.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 2000;
+Ntar = 1500;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Ewald parameters
+xi = 30;
+nside_x = 8;
+nside_y = 8;
+P = 24;
+Mx = 64;
+My = 64;
+w = P*Lx/Mx/2;
+eta = (2*xi*w/(0.95*sqrt(pi*P)))^2;
+
+% small and large moves of the points, kept inside the reference cell
+small = 1e-9;
+large = 0.05;
+move_points = @(p, h) min(max(p + h*(rand(size(p)) - 0.5), -0.5), 0.5 - 1e-9);
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking Ewald plan for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+plan = EwaldPlan('slp',psrc,ptar,[],xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+for h = [0 small large]
+    psrc = move_points(psrc, h);
+    ptar = move_points(ptar, h);
+    f = 10*rand(2,Nsrc);
+    rebuilt = move(plan, psrc, ptar);
+    
+    ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+    uk = mex_stokes_slp_kspace(psrc,ptar,xi,eta,f,Mx,My,Lx,Ly,w,P);
+    [ur_plan, uk_plan] = execute(plan, f);
+    
+    fprintf('MOVE %.0e (REBUILT: %d), MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier)\n',...
+                h, rebuilt, max(abs(ur_plan(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(uk_plan(:) - uk(:)))/max(abs(uk(:))));
+end
+delete(plan);
+
+% a plan made by the Ewald sum gives the same velocity for the density it
+% was made with, and reuses its parameters for a new one
+[u1_ref, u2_ref] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly);
+[u1, u2, ~, ~, ~, ~, ~, plan] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',...
+                ptar(1,:)',ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly,'plan',true);
+fprintf('EWALD SUM MAKING PLAN, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs([u1 - u1_ref; u2 - u2_ref]))/max(abs([u1_ref; u2_ref])));
+
+f = 10*rand(2,Nsrc);
+s = info(plan);
+ur = mex_stokes_slp_real(psrc,ptar,f,s.xi,s.nside_x,s.nside_y,Lx,Ly);
+uk = mex_stokes_slp_kspace(psrc,ptar,s.xi,s.eta,f,s.Mx,s.My,Lx,Ly,s.w,s.P);
+[u1, u2] = StokesSLP_ewald_2p(psrc(1,:)',psrc(2,:)',ptar(1,:)',...
+                ptar(2,:)',f(1,:)',f(2,:)',Lx,Ly,'plan',plan);
+fprintf('EWALD SUM WITH PLAN, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs([u1; u2] - [ur(1,:)'+uk(1,:)'; ur(2,:)'+uk(2,:)']))/...
+                max(abs([u1; u2])));
+delete(plan);
+
+%% Double-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking Ewald plan for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+plan = EwaldPlan('dlp',psrc,ptar,n,xi,nside_x,nside_y,eta,Mx,My,Lx,Ly,w,P,0);
+for h = [0 small large]
+    psrc = move_points(psrc, h);
+    ptar = move_points(ptar, h);
+    f = 10*rand(2,Nsrc);
+    rebuilt = move(plan, psrc, ptar, n);
+    
+    ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+    uk = mex_stokes_dlp_kspace(psrc,ptar,xi,eta,f,n,Mx,My,Lx,Ly,w,P);
+    [ur_plan, uk_plan] = execute(plan, f);
+    
+    fprintf('MOVE %.0e (REBUILT: %d), MAXIMUM RELATIVE ERROR: %.5e (real), %.5e (Fourier)\n',...
+                h, rebuilt, max(abs(ur_plan(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(uk_plan(:) - uk(:)))/max(abs(uk(:))));
+end
+delete(plan);
@@ -0,0 +1,103 @@
+% This is a test script to check the exclusion lists of the real-space
+% sums, where given source-target pairs are left out and returned
+% separately, against the full sums and against sums where the excluded
+% sources have zero density.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 400;
+Ntar = 300;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell. The first
+% targets coincide with sources.
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+ptar(:,1:5) = psrc(:,1:5);
+
+% Real space parameters
+xi = 20;
+nside_x = 6;
+nside_y = 6;
+
+% Exclusion list in CSR form: target j leaves out the "panels" of ten
+% sources in columns excl_ptr(j) to excl_ptr(j+1)-1 of excl_src
+panel_size = 10;
+npanels = Nsrc/panel_size;
+excl_ptr = zeros(Ntar+1,1);
+excl_ptr(1) = 1;
+excl_src = zeros(2,0);
+for j = 1:Ntar
+    panels = randperm(npanels, randi([0 2]));
+    if j <= 5
+        panels = ceil(j/panel_size);
+    end
+    excl_src = [excl_src, [(panels-1)*panel_size+1; panels*panel_size]];
+    excl_ptr(j+1) = excl_ptr(j) + length(panels);
+end
+
+% Targets checked against a sum with the excluded densities set to zero
+check_idx = [1:5, 10:50:Ntar];
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking real space exclusions for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+[ur_excl, ~, ur_skip] = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,...
+            nside_y,Lx,Ly,0,excl_ptr,excl_src);
+
+fprintf('SKIPPED PAIRS, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur_excl(:) + ur_skip(:) - ur(:)))/max(abs(ur(:))));
+
+err = 0;
+for j = check_idx
+    fz = f;
+    for e = excl_ptr(j):excl_ptr(j+1)-1
+        fz(:,excl_src(1,e):excl_src(2,e)) = 0;
+    end
+    urj = mex_stokes_slp_real(psrc,ptar(:,j),fz,xi,nside_x,nside_y,Lx,Ly);
+    err = max(err, max(abs(urj - ur_excl(:,j))));
+end
+fprintf('ZERO DENSITY, MAXIMUM RELATIVE ERROR: %.5e\n', err/max(abs(ur(:))));
+
+%% Double-layer potential, several quantities
+fprintf("*********************************************************\n");
+fprintf('Checking real space exclusions for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[ur, gr] = mex_stokes_dlp_real_fused(psrc,ptar,f,n,xi,nside_x,nside_y,...
+            Lx,Ly,{'velocity','gradient'});
+[ur_excl, gr_excl, ~, ur_skip, gr_skip] = mex_stokes_dlp_real_fused(psrc,...
+            ptar,f,n,xi,nside_x,nside_y,Lx,Ly,{'velocity','gradient'},0,...
+            excl_ptr,excl_src);
+
+fprintf('SKIPPED PAIRS, MAXIMUM RELATIVE ERROR: %.5e (velocity), %.5e (gradient)\n',...
+                max(abs(ur_excl(:) + ur_skip(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(gr_excl(:) + gr_skip(:) - gr(:)))/max(abs(gr(:))));
+
+err = 0;
+for j = check_idx
+    fz = f;
+    for e = excl_ptr(j):excl_ptr(j+1)-1
+        fz(:,excl_src(1,e):excl_src(2,e)) = 0;
+    end
+    urj = mex_stokes_dlp_real(psrc,ptar(:,j),fz,n,xi,nside_x,nside_y,Lx,Ly);
+    err = max(err, max(abs(urj - ur_excl(:,j))));
+end
+fprintf('ZERO DENSITY, MAXIMUM RELATIVE ERROR: %.5e\n', err/max(abs(ur(:))));
@@ -0,0 +1,89 @@
+% This is a test script to check that the precomputed real-space operators
+% give the same result as the real-space mex functions, and that the Ewald
+% functions give the same velocity when the operator is reused for a new
+% density, as in an iterative solver.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 300;
+Ntar = 200;
+
+Lx = 1;
+Ly = 2;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+n1 = rand(1,Nsrc);
+n = [n1; sqrt(1 - n1.^2)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Real space parameters
+xi = 10;
+nside_x = 4;
+nside_y = 8;
+
+%% Operators against the mex functions
+fprintf("*********************************************************\n");
+fprintf('Checking precomputed real space operators...\n');
+fprintf("*********************************************************\n");
+
+op = mex_stokes_slp_real_operator(psrc,ptar,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+ur_op = mex_stokes_real_operator_apply(op,f);
+
+fprintf('SINGLE-LAYER, MEMORY: %3.3g MB, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                op.memory/2^20, max(abs(ur(:) - ur_op(:)))/max(abs(ur(:))));
+
+op = mex_stokes_dlp_real_operator(psrc,ptar,n,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+ur_op = mex_stokes_real_operator_apply(op,f);
+
+fprintf('DOUBLE-LAYER, MEMORY: %3.3g MB, MAXIMUM RELATIVE ERROR: %.5e\n',...
+                op.memory/2^20, max(abs(ur(:) - ur_op(:)))/max(abs(ur(:))));
+
+% An operator larger than the memory limit is not assembled
+op = mex_stokes_slp_real_operator(psrc,ptar,xi,nside_x,nside_y,Lx,Ly,1e3);
+fprintf('ASSEMBLED WITH 1 KB LIMIT: %d (needs %3.3g MB)\n', op.assembled,...
+                op.memory/2^20);
+
+%% Reuse in the Ewald functions
+fprintf("*********************************************************\n");
+fprintf('Checking reuse of the operators in the Ewald sums...\n');
+fprintf("*********************************************************\n");
+
+f2 = 10*rand(2,Nsrc);
+
+[~, ~, ~, ~, xi, rop] = StokesSLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', f(1,:)', f(2,:)', Lx, Ly,...
+            'real_op', true);
+[u1_op, u2_op] = StokesSLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', f2(1,:)', f2(2,:)', Lx, Ly,...
+            'real_op', rop);
+[u1, u2] = StokesSLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', f2(1,:)', f2(2,:)', Lx, Ly);
+
+fprintf('SINGLE-LAYER, MAXIMUM RELATIVE DIFFERENCE: %.5e\n',...
+            max(abs([u1; u2] - [u1_op; u2_op]))/max(abs([u1; u2])));
+
+[~, ~, ~, ~, ~, rop] = StokesDLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', n(1,:)', n(2,:)', f(1,:)', f(2,:)',...
+            Lx, Ly, 'real_op', true);
+[u1_op, u2_op] = StokesDLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', n(1,:)', n(2,:)', f2(1,:)', f2(2,:)',...
+            Lx, Ly, 'real_op', rop);
+[u1, u2] = StokesDLP_ewald_2p(psrc(1,:)', psrc(2,:)',...
+            ptar(1,:)', ptar(2,:)', n(1,:)', n(2,:)', f2(1,:)', f2(2,:)',...
+            Lx, Ly);
+
+fprintf('DOUBLE-LAYER, MAXIMUM RELATIVE DIFFERENCE: %.5e\n',...
+            max(abs([u1; u2] - [u1_op; u2_op]))/max(abs([u1; u2])));
@@ -0,0 +1,71 @@
+% This is a test script to check that the real-space sums give the same
+% result when the points are given as cells {x, y} of coordinate vectors,
+% which are read in place, as when they are given as 2 x n matrices.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 400;
+Ntar = 300;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target coordinates as separate column vectors, inside the
+% reference cell
+xsrc = Lx*rand(Nsrc,1) - Lx/2;
+ysrc = Ly*rand(Nsrc,1) - Ly/2;
+xtar = Lx*rand(Ntar,1) - Lx/2;
+ytar = Ly*rand(Ntar,1) - Ly/2;
+
+psrc = [xsrc'; ysrc'];
+ptar = [xtar'; ytar'];
+
+% Real space parameters
+xi = 20;
+nside_x = 6;
+nside_y = 6;
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking separate coordinates for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+ur_xy = mex_stokes_slp_real({xsrc,ysrc},{xtar,ytar},f,xi,nside_x,...
+            nside_y,Lx,Ly);
+fprintf('VELOCITY, MAXIMUM DIFFERENCE: %.5e\n', max(abs(ur(:) - ur_xy(:))));
+
+pr = mex_stokes_slp_pressure_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+pr_xy = mex_stokes_slp_pressure_real({xsrc,ysrc},{xtar,ytar},f,xi,...
+            nside_x,nside_y,Lx,Ly);
+fprintf('PRESSURE, MAXIMUM DIFFERENCE: %.5e\n', max(abs(pr(:) - pr_xy(:))));
+
+% The targets summed in chunks
+ur_xy = mex_stokes_slp_real({xsrc,ysrc},{xtar,ytar},f,xi,nside_x,...
+            nside_y,Lx,Ly,0,[],[],1e4);
+fprintf('VELOCITY IN CHUNKS, MAXIMUM DIFFERENCE: %.5e\n',...
+            max(abs(ur(:) - ur_xy(:))));
+
+%% Double-layer potential, several quantities
+fprintf("*********************************************************\n");
+fprintf('Checking separate coordinates for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[ur, sr] = mex_stokes_dlp_real_fused(psrc,ptar,f,n,xi,nside_x,nside_y,...
+            Lx,Ly,{'velocity','stress'});
+[ur_xy, sr_xy] = mex_stokes_dlp_real_fused({xsrc,ysrc},{xtar,ytar},f,n,...
+            xi,nside_x,nside_y,Lx,Ly,{'velocity','stress'});
+fprintf('MAXIMUM DIFFERENCE: %.5e (velocity), %.5e (stress)\n',...
+            max(abs(ur(:) - ur_xy(:))), max(abs(sr(:) - sr_xy(:))));
@@ -0,0 +1,84 @@
+% This is a test script to check that the real-space sums give the same
+% result when a memory limit makes them process the targets in chunks,
+% with and without exclusion lists.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 4000;
+Ntar = 5000;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Real space parameters
+xi = 40;
+nside_x = 12;
+nside_y = 12;
+
+% Small enough that the targets are split into chunks of the smallest size
+max_memory = 1e5;
+
+% Exclusion list that leaves out up to two ranges of sources per target
+excl_ptr = zeros(Ntar+1,1);
+excl_ptr(1) = 1;
+excl_src = zeros(2,0);
+for j = 1:Ntar
+    first = randi(Nsrc-20, 1, randi([0 2]));
+    excl_src = [excl_src, [first; first+randi(20,size(first))-1]];
+    excl_ptr(j+1) = excl_ptr(j) + length(first);
+end
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking chunked real space sums for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+[ur_chunk, stats] = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,...
+            Lx,Ly,0,[],[],max_memory);
+
+fprintf('TARGET CHUNKS: %d\n', stats.num_chunks);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur_chunk(:) - ur(:)))/max(abs(ur(:))));
+
+[ur_excl, ~, ur_skip] = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,...
+            nside_y,Lx,Ly,0,excl_ptr,excl_src);
+[ur_chunk, ~, ur_skip_chunk] = mex_stokes_slp_real(psrc,ptar,f,xi,...
+            nside_x,nside_y,Lx,Ly,0,excl_ptr,excl_src,max_memory);
+
+fprintf('EXCLUSIONS, MAXIMUM RELATIVE ERROR: %.5e (sum), %.5e (skipped)\n',...
+                max(abs(ur_chunk(:) - ur_excl(:)))/max(abs(ur(:))),...
+                max(abs(ur_skip_chunk(:) - ur_skip(:)))/max(abs(ur(:))));
+
+%% Double-layer potential, several quantities
+fprintf("*********************************************************\n");
+fprintf('Checking chunked real space sums for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+[ur, pr, gr] = mex_stokes_dlp_real_fused(psrc,ptar,f,n,xi,nside_x,...
+            nside_y,Lx,Ly,{'velocity','pressure','gradient'});
+[ur_chunk, pr_chunk, gr_chunk, stats] = mex_stokes_dlp_real_fused(psrc,...
+            ptar,f,n,xi,nside_x,nside_y,Lx,Ly,...
+            {'velocity','pressure','gradient'},0,[],[],max_memory);
+
+fprintf('TARGET CHUNKS: %d\n', stats.num_chunks);
+fprintf('MAXIMUM RELATIVE ERROR: %.5e (velocity), %.5e (pressure), %.5e (gradient)\n',...
+                max(abs(ur_chunk(:) - ur(:)))/max(abs(ur(:))),...
+                max(abs(pr_chunk(:) - pr(:)))/max(abs(pr(:))),...
+                max(abs(gr_chunk(:) - gr(:)))/max(abs(gr(:))));
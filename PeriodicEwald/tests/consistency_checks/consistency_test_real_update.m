@@ -0,0 +1,118 @@
+% This is a test script to check the incremental real-space update, where
+% a subset of the sources and targets moves and the sources change
+% density, against evaluating the real-space sums anew.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 400;
+Ntar = 300;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f = 10*rand(2,Nsrc);
+
+% Two components of normal vector
+t = 2*pi*rand(1,Nsrc);
+n = [cos(t); sin(t)];
+
+% Source and target locations, inside the reference cell
+psrc = [Lx*rand(1,Nsrc); Ly*rand(1,Nsrc)] - [Lx; Ly]/2;
+ptar = [Lx*rand(1,Ntar); Ly*rand(1,Ntar)] - [Lx; Ly]/2;
+
+% Real space parameters
+xi = 20;
+nside_x = 6;
+nside_y = 6;
+
+% The changed sources and targets
+src_idx = 1:4:Nsrc;
+tar_idx = 2:7:Ntar;
+
+% Move them a little, keeping them inside the reference cell
+psrc_new = psrc;
+psrc_new(:,src_idx) = psrc(:,src_idx) + 0.02*randn(2,length(src_idx));
+psrc_new = mod(psrc_new + [Lx; Ly]/2, [Lx; Ly]) - [Lx; Ly]/2;
+ptar_new = ptar;
+ptar_new(:,tar_idx) = ptar(:,tar_idx) + 0.02*randn(2,length(tar_idx));
+ptar_new = mod(ptar_new + [Lx; Ly]/2, [Lx; Ly]) - [Lx; Ly]/2;
+
+f_new = f;
+f_new(:,src_idx) = f(:,src_idx) + rand(2,length(src_idx));
+
+t(src_idx) = t(src_idx) + 0.1;
+n_new = [cos(t); sin(t)];
+
+%% Single-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking real space update for single-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_slp_real_update(psrc_new,ptar_new,f_new,ur,src_idx,...
+            psrc(:,src_idx),f(:,src_idx),tar_idx,xi,nside_x,nside_y,Lx,Ly);
+ur_new = mex_stokes_slp_real(psrc_new,ptar_new,f_new,xi,nside_x,nside_y,...
+            Lx,Ly);
+
+fprintf('MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_new(:)))/max(abs(ur_new(:))));
+
+%% Double-layer potential
+fprintf("*********************************************************\n");
+fprintf('Checking real space update for double-layer potential...\n');
+fprintf("*********************************************************\n");
+
+ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_dlp_real_update(psrc_new,ptar_new,f_new,n_new,ur,...
+            src_idx,psrc(:,src_idx),f(:,src_idx),n(:,src_idx),tar_idx,...
+            xi,nside_x,nside_y,Lx,Ly);
+ur_new = mex_stokes_dlp_real(psrc_new,ptar_new,f_new,n_new,xi,...
+            nside_x,nside_y,Lx,Ly);
+
+fprintf('MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_new(:)))/max(abs(ur_new(:))));
+
+%% Clustered points
+% The unchanged sources and the targets are clustered, while the changed
+% sources are spread over the cell. The full sums then use the adaptive
+% tree and the update the uniform grid, which must sum the same pairs.
+fprintf("*********************************************************\n");
+fprintf('Checking real space update for clustered points...\n');
+fprintf("*********************************************************\n");
+
+psrc = 0.2*rand(2,Nsrc) + 0.1;
+psrc(:,src_idx) = [Lx*rand(1,length(src_idx));...
+                   Ly*rand(1,length(src_idx))] - [Lx; Ly]/2;
+ptar = 0.2*rand(2,Ntar) + 0.1;
+
+psrc_new = psrc;
+psrc_new(:,src_idx) = psrc(:,src_idx) + 0.02*randn(2,length(src_idx));
+psrc_new = mod(psrc_new + [Lx; Ly]/2, [Lx; Ly]) - [Lx; Ly]/2;
+ptar_new = ptar;
+ptar_new(:,tar_idx) = ptar(:,tar_idx) + 0.02*randn(2,length(tar_idx));
+
+[ur, rstats] = mex_stokes_slp_real(psrc,ptar,f,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_slp_real_update(psrc_new,ptar_new,f_new,ur,src_idx,...
+            psrc(:,src_idx),f(:,src_idx),tar_idx,xi,nside_x,nside_y,Lx,Ly);
+ur_new = mex_stokes_slp_real(psrc_new,ptar_new,f_new,xi,nside_x,nside_y,...
+            Lx,Ly);
+
+fprintf('ADAPTIVE: %d\n', rstats.adaptive);
+fprintf('SLP MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_new(:)))/max(abs(ur_new(:))));
+
+ur = mex_stokes_dlp_real(psrc,ptar,f,n,xi,nside_x,nside_y,Lx,Ly);
+ur = mex_stokes_dlp_real_update(psrc_new,ptar_new,f_new,n_new,ur,...
+            src_idx,psrc(:,src_idx),f(:,src_idx),n(:,src_idx),tar_idx,...
+            xi,nside_x,nside_y,Lx,Ly);
+ur_new = mex_stokes_dlp_real(psrc_new,ptar_new,f_new,n_new,xi,...
+            nside_x,nside_y,Lx,Ly);
+
+fprintf('DLP MAXIMUM RELATIVE ERROR: %.5e\n',...
+                max(abs(ur(:) - ur_new(:)))/max(abs(ur_new(:))));
@@ -0,0 +1,87 @@
+% This is a test script to check that the parameters chosen from the
+% tolerance meet it for every quantity. P and the grids are chosen from
+% tol by the per-quantity error estimates of the Ewald sums, and each
+% quantity is compared with the same quantity computed at tol = 1e-14.
+% The relative differences should be of the order of the tolerance.
+
+close all
+clearvars
+clc
+
+initewald
+
+%% Set up data
+Nsrc = 2000;
+Ntar = 2000;
+
+Lx = 1;
+Ly = 1;
+
+% Two components of the density function
+f1 = rand(Nsrc,1);
+f2 = rand(Nsrc,1);
+
+% Two components of normal vector
+t = 2*pi*rand(Nsrc,1);
+n1 = cos(t);
+n2 = sin(t);
+
+% Target direction vector for the gradients
+b1 = ones(Ntar,1)/sqrt(2);
+b2 = ones(Ntar,1)/sqrt(2);
+
+% Source and target locations, inside the reference cell
+xsrc = Lx*rand(Nsrc,1) - Lx/2;
+ysrc = Ly*rand(Nsrc,1) - Ly/2;
+xtar = Lx*rand(Ntar,1) - Lx/2;
+ytar = Ly*rand(Ntar,1) - Ly/2;
+
+% the quantities, as functions of the optional arguments, and the number
+% of their outputs that make up the quantity
+slp = {'velocity', @(varargin) StokesSLP_ewald_2p(xsrc,ysrc,xtar,ytar,...
+                        f1,f2,Lx,Ly,varargin{:}), 2;
+       'gradient', @(varargin) StokesSLP_gradient_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,f1,f2,b1,b2,Lx,Ly,varargin{:}), 2;
+       'pressure', @(varargin) StokesSLP_pressure_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,f1,f2,Lx,Ly,varargin{:}), 1;
+       'pressure gradient', @(varargin) StokesSLP_pressure_grad_ewald_2p(...
+                        xsrc,ysrc,xtar,ytar,f1,f2,Lx,Ly,varargin{:}), 1;
+       'stress', @(varargin) StokesSLP_stress_ewald_2p(xsrc,ysrc,xtar,...
+                        ytar,f1,f2,b1,b2,Lx,Ly,varargin{:}), 2;
+       'vorticity', @(varargin) StokesSLP_vorticity_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,f1,f2,Lx,Ly,varargin{:}), 1};
+dlp = {'velocity', @(varargin) StokesDLP_ewald_2p(xsrc,ysrc,xtar,ytar,...
+                        n1,n2,f1,f2,Lx,Ly,varargin{:}), 2;
+       'gradient', @(varargin) StokesDLP_gradient_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,n1,n2,f1,f2,b1,b2,Lx,Ly,varargin{:}), 2;
+       'pressure', @(varargin) StokesDLP_pressure_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,n1,n2,f1,f2,Lx,Ly,varargin{:}), 1;
+       'pressure gradient', @(varargin) StokesDLP_pressure_grad_ewald_2p(...
+                        xsrc,ysrc,xtar,ytar,n1,n2,f1,f2,Lx,Ly,varargin{:}), 1;
+       'stress', @(varargin) StokesDLP_stress_ewald_2p(xsrc,ysrc,xtar,...
+                        ytar,n1,n2,f1,f2,b1,b2,Lx,Ly,varargin{:}), 2;
+       'vorticity', @(varargin) StokesDLP_vorticity_ewald_2p(xsrc,ysrc,...
+                        xtar,ytar,n1,n2,f1,f2,Lx,Ly,varargin{:}), 1};
+kernels = {'SLP', slp; 'DLP', dlp};
+
+for tol = [1e-6 1e-10]
+    fprintf("*********************************************************\n");
+    fprintf('Checking parameters chosen for tolerance %.0e...\n', tol);
+    fprintf("*********************************************************\n");
+
+    for j = 1:size(kernels,1)
+        quantities = kernels{j,2};
+        for q = 1:size(quantities,1)
+            evaluate = quantities{q,2};
+            ref = cell(1, quantities{q,3});
+            [ref{:}] = evaluate('tol', 1e-14);
+            out = cell(1, quantities{q,3});
+            [out{:}] = evaluate('tol', tol);
+            ref = [ref{:}];
+            out = [out{:}];
+            fprintf('%s %s, MAXIMUM RELATIVE DIFFERENCE: %.5e\n',...
+                        kernels{j,1}, upper(quantities{q,1}),...
+                        max(abs(out(:) - ref(:)))/max(abs(ref(:))));
+        end
+    end
+end
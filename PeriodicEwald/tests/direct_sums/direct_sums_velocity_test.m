@@ -90,3 +90,30 @@ uk_direct = stokes_dlp_kspace_ds(xsrc, ysrc, xtar, ytar, n1, n2,...
                         f1, f2, Lx, Ly, xi, kinf);
  
 fprintf('MAXIMUM ERROR: %.5e\n',max(max(abs(uk_direct - uk_ewald))));
+
+%% Check mixed-precision real sums
+fprintf("*********************************************************\n");
+fprintf('TESTING MIXED-PRECISION REAL SUMS\n');
+fprintf("*********************************************************\n");
+
+% Loose tolerance, for which the real-space pairs of the double layer are
+% evaluated in single precision. The single layer stays in double.
+tol_mixed = 1e-5;
+
+[~,~, ur_ewald, ~, xi] = StokesSLP_ewald_2p(xsrc, ysrc, ...
+    xtar, ytar, f1, f2, Lx, Ly, 'verbose', 1, 'tol', tol_mixed);
+
+ur_direct = stokes_slp_real_ds(xsrc, ysrc, xtar, ytar,...
+                        f1, f2, Lx, Ly, xi);
+ 
+fprintf('SINGLE-LAYER, MAXIMUM ERROR: %.5e (tol %.1e)\n',...
+                max(max(abs(ur_direct - ur_ewald))), tol_mixed);
+
+[~,~, ur_ewald, ~, xi] = StokesDLP_ewald_2p(xsrc, ysrc, ...
+    xtar, ytar, n1, n2, f1, f2, Lx, Ly, 'verbose', 1, 'tol', tol_mixed);
+
+ur_direct = stokes_dlp_real_ds(xsrc, ysrc, xtar, ytar, n1, n2,...
+                        f1, f2, Lx, Ly, xi);
+ 
+fprintf('DOUBLE-LAYER, MAXIMUM ERROR: %.5e (tol %.1e)\n',...
+                max(max(abs(ur_direct - ur_ewald))), tol_mixed);